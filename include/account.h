@@ -27,6 +27,13 @@ struct kline_ {
   char *reason;
   char *setby;
 
+  match_pattern_t *user_match;
+  match_pattern_t *host_match;
+
+  unsigned long seq;
+  mowgli_node_t index_node;
+  mowgli_node_t cidr_node;
+
   unsigned long number;
   long duration;
   time_t settime;
@@ -39,6 +46,10 @@ struct xline_ {
   char *reason;
   char *setby;
 
+  match_pattern_t *realname_match;
+  unsigned long seq;
+  mowgli_node_t index_node;
+
   unsigned int number;
   long duration;
   time_t settime;
@@ -51,6 +62,10 @@ struct qline_ {
   char *reason;
   char *setby;
 
+  match_pattern_t *mask_match;
+  unsigned long seq;
+  mowgli_node_t index_node;
+
   unsigned int number;
   long duration;
   time_t settime;
@@ -162,6 +177,8 @@ struct mychan_
 
   channel_t *chan;
   mowgli_list_t chanacs;
+  mowgli_patricia_t *chanacs_entities;	/* account id -> list of chanacs_t */
+  mowgli_list_t chanacs_masks;		/* hostmask, group and exttarget chanacs */
   time_t registered;
   time_t used;
 
@@ -205,11 +222,13 @@ struct chanacs_
 	myentity_t *entity;
 	mychan_t *mychan;
 	char     *host;
+	match_pattern_t *host_match;
 	unsigned int  level;
 	time_t    tmodified;
 
 	mowgli_node_t    cnode;
 	mowgli_node_t    unode;
+	mowgli_node_t    inode;
 
 	stringref setter;
 };
@@ -368,7 +387,13 @@ typedef struct {
 E bool backend_loaded;
 
 /* dbhandler.c */
-E void (*db_save)(void *arg);
+typedef enum {
+	DB_SAVE_BLOCKING,	/* write now, in this process */
+	DB_SAVE_BG_REGULAR,	/* may write in a child; skipped while one is running */
+	DB_SAVE_BG_IMPORTANT	/* may write in a child; waits for a running one first */
+} db_save_strategy_t;
+
+E void (*db_save)(void *arg, db_save_strategy_t strategy);
 E void (*db_load)(const char *arg);
 
 /* function.c */
@@ -415,10 +440,12 @@ E void init_accounts(void);
 
 E myuser_t *myuser_add(const char *name, const char *pass, const char *email, unsigned int flags);
 E myuser_t *myuser_add_id(const char *id, const char *name, const char *pass, const char *email, unsigned int flags);
+E void myuser_commit(myuser_t *mu);
 E void myuser_delete(myuser_t *mu);
 //inline myuser_t *myuser_find(const char *name);
 E void myuser_rename(myuser_t *mu, const char *name);
 E void myuser_set_email(myuser_t *mu, const char *newemail);
+E void myuser_set_flags(myuser_t *mu, unsigned int set, unsigned int clear);
 E myuser_t *myuser_find_ext(const char *name);
 E void myuser_notice(const char *from, myuser_t *target, const char *fmt, ...) PRINTFLIKE(3, 4);
 
@@ -464,6 +491,7 @@ E chanacs_t *chanacs_find_host_by_user(mychan_t *mychan, user_t *u, unsigned int
 E chanacs_t *chanacs_find_by_mask(mychan_t *mychan, const char *mask, unsigned int level);
 E bool chanacs_user_has_flag(mychan_t *mychan, user_t *u, unsigned int level);
 E unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u);
+E void chanacs_user_flags_invalidate(void);
 //inline bool chanacs_source_has_flag(mychan_t *mychan, sourceinfo_t *si, unsigned int level);
 E unsigned int chanacs_source_flags(mychan_t *mychan, sourceinfo_t *si);
 
@@ -477,6 +505,16 @@ E bool chanacs_modify_simple(chanacs_t *ca, unsigned int addflags, unsigned int
 E bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsigned int *addflags, unsigned int *removeflags, unsigned int restrictflags, myentity_t *setter);
 E bool chanacs_change_simple(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsigned int addflags, unsigned int removeflags, myentity_t *setter);
 
+/* registered objects whose metadata is kept in the database */
+typedef enum {
+	MYOBJECT_NONE,
+	MYOBJECT_MYUSER,
+	MYOBJECT_MYCHAN,
+	MYOBJECT_CHANACS
+} myobject_type_t;
+
+E myobject_type_t myobject_type(void *target);
+
 E void expire_check(void *arg);
 /* Check the database for (version) problems common to all backends */
 E void db_check(void);
@@ -41,6 +41,7 @@
 #include "tools.h"
 #include "confprocess.h"
 #include "global.h"
+#include "profile.h"
 #include "flags.h"
 #include "phandler.h"
 #include "commandtree.h"
@@ -48,10 +49,12 @@
 #include "services.h"
 #include "users.h"
 #include "sourceinfo.h"
+#include "scan.h"
 #include "taint.h"
 #include "database_backend.h"
 #include "entity.h"
 #include "uid.h"
+#include "journal.h"
 
 #include "inline/account.h"
 #include "inline/channels.h"
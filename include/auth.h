@@ -12,9 +12,26 @@
 E void set_password(myuser_t *mu, const char *newpassword);
 E bool verify_password(myuser_t *mu, const char *password);
 
+typedef struct verify_request_ verify_request_t;
+typedef void (*verify_password_cb_t)(myuser_t *mu, bool verified, void *priv);
+
+E verify_request_t *verify_password_async(myuser_t *mu, const char *password, verify_password_cb_t cb, void *priv);
+E void verify_password_cancel(verify_request_t *req);
+
 E bool auth_module_loaded;
 E bool (*auth_user_custom)(myuser_t *mu, const char *password);
 
+/*
+ * An auth module may also check passwords without blocking: it returns a
+ * handle and later calls cb from the event loop, never from within
+ * auth_user_custom_async() itself, unless auth_user_custom_cancel() is
+ * called first.  Returning NULL makes the caller use auth_user_custom.
+ */
+typedef void (*auth_user_cb_t)(bool verified, void *priv);
+
+E void *(*auth_user_custom_async)(myuser_t *mu, const char *password, auth_user_cb_t cb, void *priv);
+E void (*auth_user_custom_cancel)(void *handle);
+
 #endif
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -46,6 +46,9 @@ struct chanuser_
   unsigned int modes;
   mowgli_node_t unode;
   mowgli_node_t cnode;
+
+  unsigned int acs_flags;	/* cached chanacs_user_flags() */
+  unsigned int acs_generation;
 };
 
 struct chanban_
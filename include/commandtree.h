@@ -21,6 +21,7 @@ struct commandentry_ {
 		const char *path;
 		void (*func)(sourceinfo_t *, const char *subcmd);
 	} help;
+	profile_entry_t *prof;
 };
 
 /* commandtree.c */
@@ -47,6 +47,8 @@ struct connection_
 	time_t last_recv;
 
 	size_t sendq_limit;
+	size_t sendq_len;
+	unsigned int sendq_batch;
 
 	sockaddr_any_t saddr;
 	socklen_t saddr_size;
@@ -77,6 +79,7 @@ struct connection_
 #define CF_NONEWLINE  0x00000080
 #define CF_SEND_EOF   0x00000100 /* shutdown(2) write end if sendq empty */
 #define CF_SEND_DEAD  0x00000200 /* write end shut down */
+#define CF_RECVQ_INPLACE 0x00000400 /* recvq is one buffer, lines are read in place */
 
 #define CF_IS_UPLINK(x) ((x)->flags & CF_UPLINK)
 #define CF_IS_DCC(x) ((x)->flags & (CF_DCCOUT | CF_DCCIN))
@@ -19,13 +19,30 @@ typedef struct {
 	const char *(*salt)(void);
 	bool (*needs_param_upgrade)(const char *user_pass_string);
 
+	/* optional; like crypt, but writes into buf and may be called from
+	 * the crypt worker threads.
+	 */
+	const char *(*crypt_r)(const char *key, const char *salt, char *buf, size_t buflen);
+
+	/* optional; turns a hash of another scheme into one of this scheme,
+	 * without knowing the password. salt is as returned by salt(). Must
+	 * be reentrant as well.
+	 */
+	const char *(*wrap)(const char *hash, const char *salt, char *buf, size_t buflen);
+
 	mowgli_node_t node;
 } crypt_impl_t;
 
+typedef struct crypt_request_ crypt_request_t;
+typedef void (*crypt_verify_cb_t)(const crypt_impl_t *ci, void *priv);
+
 E void crypt_register(crypt_impl_t *impl);
 E void crypt_unregister(crypt_impl_t *impl);
 E const crypt_impl_t *crypt_verify_password(const char *user_input, const char *pass);
+E const crypt_impl_t *crypt_verify_password_r(const char *user_input, const char *pass, char *buf, size_t buflen, bool *skipped);
 E const crypt_impl_t *crypt_get_default_provider(void);
+E crypt_request_t *crypt_verify_password_async(const char *user_input, const char *pass, crypt_verify_cb_t cb, void *priv);
+E void crypt_request_cancel(crypt_request_t *req);
 
 #endif
 
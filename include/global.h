@@ -80,6 +80,14 @@ struct ConfOption
   unsigned int kline_time;          /* default expire for klines  */
   unsigned int clone_time;          /* default expire for clone exemptions */
   unsigned int commit_interval;     /* interval between commits   */
+  bool db_save_fork;                /* write commits from a child? */
+  bool db_journal;                  /* journal changes between commits? */
+
+  unsigned int log_queue_size;      /* lines queued for the log writer */
+  bool log_queue_block;             /* wait for room instead of dropping? */
+  unsigned int crypt_threads;       /* threads verifying passwords */
+  unsigned int scan_threads;        /* threads scanning snapshots */
+  unsigned int profile_sample;      /* time one in this many hooks/commands */
 
   bool silent;               /* stop sending WALLOPS?      */
   bool join_chans;           /* join registered channels?  */
@@ -138,10 +146,24 @@ struct cnt
   unsigned int node;
   unsigned int bin;
   unsigned int bout;
+  unsigned int sendq_flush;
+  unsigned int sendq_syscall;
+  unsigned int sendq_bytes;
+  unsigned int chanacs_cache_hit;
+  unsigned int chanacs_cache_miss;
+  unsigned int log_queued;
+  unsigned int log_dropped;
   unsigned int uplink;
   unsigned int operclass;
   unsigned int myuser_access;
   unsigned int myuser_name;
+  unsigned int metadata;
+  unsigned int metadata_tree;
+  unsigned int metadata_bytes;
+  unsigned int strshare;
+  unsigned int strshare_refs;
+  unsigned int strshare_bytes;
+  unsigned int strshare_saved;
 };
 
 E struct cnt cnt;
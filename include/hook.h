@@ -9,11 +9,12 @@
 #define HOOK_H
 
 typedef struct hook_ hook_t;
+typedef struct hook_vec_ hook_vec_t;
 typedef void (*hookfn_t)(void *data);
 
 struct hook_ {
 	stringref name;
-	mowgli_list_t hooks;
+	hook_vec_t *vec;
 };
 
 E hook_t *hook_add_event(const char *);
@@ -22,6 +23,15 @@ E void hook_del_hook(const char *, hookfn_t);
 E void hook_add_hook(const char *, hookfn_t);
 E void hook_add_hook_first(const char *, hookfn_t);
 E void hook_call_event(const char *, void *);
+E void hook_call(hook_t *, void *);
+
+/* looks the hook up on the first call from each call site only */
+#define HOOK_CALL(name, dptr) do {					\
+	static hook_t *hook_handle_;					\
+	if (hook_handle_ == NULL)					\
+		hook_handle_ = hook_add_event(name);			\
+	hook_call(hook_handle_, (dptr));				\
+} while (0)
 
 E void hook_stop(void);
 E void hook_continue(void *newptr);
@@ -29,6 +29,12 @@ struct httpddata
 	bool correct_content_type;
 	bool expect_100_continue;
 	bool sent_reply;
+
+	/* set by a handler which replies later on, through httpd_reply_done();
+	 * cancel_reply is called if the connection goes away before that.
+	 */
+	bool reply_pending;
+	void (*cancel_reply)(connection_t *cptr);
 };
 
 #endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Append-only journal of database changes between full commits.
+ *
+ */
+
+#ifndef ATHEME_JOURNAL_H
+#define ATHEME_JOURNAL_H
+
+E void journal_init(void);
+E void journal_shutdown(void);
+E void journal_rotate(void);
+E void journal_commit(void);
+
+E void journal_myuser(myuser_t *mu);
+E void journal_myuser_delete(myuser_t *mu);
+E void journal_mynick(mynick_t *mn);
+E void journal_mynick_delete(mynick_t *mn);
+E void journal_mychan(mychan_t *mc);
+E void journal_mychan_delete(mychan_t *mc);
+E void journal_chanacs(chanacs_t *ca);
+E void journal_chanacs_delete(chanacs_t *ca);
+E void journal_metadata(void *target, const char *name, const char *value);
+E void journal_kline(kline_t *k);
+E void journal_kline_delete(kline_t *k);
+E void journal_xline(xline_t *x);
+E void journal_xline_delete(xline_t *x);
+E void journal_qline(qline_t *q);
+E void journal_qline_delete(qline_t *q);
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
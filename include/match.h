@@ -13,6 +13,8 @@
 /* cidr.c */
 E int match_ips(const char *mask, const char *address);
 E int match_cidr(const char *mask, const char *address);
+E int ip_parse(const char *s, unsigned char *addr);
+E int cidr_parse(const char *s, unsigned char *addr, int *cidrlen);
 
 /* match.c */
 #define MATCH_RFC1459   0
@@ -53,6 +55,12 @@ E void strcasecanon(char *);
 E void noopcanon(char *);
 
 E int match(const char *, const char *);
+
+typedef struct match_pattern_ match_pattern_t;
+
+E match_pattern_t *match_compile(const char *mask);
+E void match_pattern_free(match_pattern_t *mp);
+E int match_pattern(match_pattern_t *mp, const char *name);
 E char *collapse(char *);
 
 /* regex_create() flags */
@@ -67,6 +75,16 @@ E char *regex_extract(char *pattern, char **pend, int *pflags);
 E bool regex_match(atheme_regex_t *preg, char *string);
 E bool regex_destroy(atheme_regex_t *preg);
 
+/* regexset.c */
+typedef struct atheme_regex_set_ atheme_regex_set_t;
+typedef struct regex_set_entry_ regex_set_entry_t;
+
+E atheme_regex_set_t *regex_set_create(void);
+E void regex_set_destroy(atheme_regex_set_t *set);
+E regex_set_entry_t *regex_set_add(atheme_regex_set_t *set, const char *pattern, int flags, atheme_regex_t *re, void *data);
+E void regex_set_delete(atheme_regex_set_t *set, regex_set_entry_t *e);
+E void **regex_set_match(atheme_regex_set_t *set, char *string, unsigned int *count);
+
 #endif
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -34,14 +34,14 @@ while read hook type; do
 		continue
 		;;
 	*:void)
-		echo "#define hook_call_$hook() hook_call_event(\"$hook\", NULL)"
+		echo "#define hook_call_$hook() HOOK_CALL(\"$hook\", NULL)"
 		# Still require a dummy void * function parameter here.
 		echo "#define hook_add_$hook(f) hook_add_hook(\"$hook\", f)"
 		echo "#define hook_add_first_$hook(f) hook_add_hook_first(\"$hook\", f)"
 		echo "#define hook_del_$hook(f) hook_del_hook(\"$hook\", f)"
 		;;
 	*)
-		echo "#define hook_call_$hook(x) hook_call_event(\"$hook\", ENSURE_TYPE(x, $type))"
+		echo "#define hook_call_$hook(x) HOOK_CALL(\"$hook\", ENSURE_TYPE(x, $type))"
 		echo "#define hook_add_$hook(f) hook_add_hook(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
 		echo "#define hook_add_first_$hook(f) hook_add_hook_first(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
 		echo "#define hook_del_$hook(f) hook_del_hook(\"$hook\", (void (*)(void *))ENSURE_TYPE(f, void (*)($type)))"
@@ -100,6 +100,8 @@ typedef struct {
 E void _modinit(module_t *m);
 E void _moddeinit(module_unload_intent_t intent);
 
+E module_t *modtarget;
+
 E void modules_init(void);
 E module_t *module_load(const char *filespec);
 E void module_load_dir(const char *dirspec);
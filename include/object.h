@@ -9,19 +9,41 @@
 #ifndef ATHEME_OBJECT_H
 #define ATHEME_OBJECT_H
 
+/*
+ * Metadata keys are interned in a registry and identified by an atom.
+ * Modules register the keys they use once and compare entries by atom;
+ * the string API interns keys on the fly.  0 is never a valid atom.
+ */
+typedef unsigned int metadata_atom_t;
+
+#define METADATA_ATOM_NONE	0
+
 struct metadata_ {
-	stringref name;
+	stringref name;			/* owned by the key registry */
 	char *value;
+	metadata_atom_t atom;
 };
 
 typedef struct metadata_ metadata_t;
 
 typedef void (*destructor_t)(void *);
 
+/*
+ * Most objects carry only a handful of metadata entries, so they are kept
+ * in a small array searched linearly.  Once an object has more than
+ * METADATA_INLINE_MAX entries the array is replaced by a patricia tree.
+ */
+#define METADATA_INLINE_MAX	8
+
 typedef struct {
 	int refcount;
+	unsigned short metadata_count;	/* entries in metadata.vec */
+	bool metadata_promoted;		/* metadata.tree is in use */
 	destructor_t destructor;
-	mowgli_patricia_t *metadata;
+	union {
+		metadata_t **vec;
+		mowgli_patricia_t *tree;
+	} metadata;
 	mowgli_patricia_t *privatedata;
 #ifdef OBJECT_DEBUG
 	mowgli_node_t dnode;
@@ -40,6 +62,33 @@ E metadata_t *metadata_add(void *target, const char *name, const char *value);
 E void metadata_delete(void *target, const char *name);
 E metadata_t *metadata_find(void *target, const char *name);
 E void metadata_delete_all(void *target);
+E unsigned int metadata_count(void *target);
+
+E metadata_atom_t metadata_atom_register(const char *name);
+E void metadata_atom_unregister(metadata_atom_t atom);
+E metadata_atom_t metadata_atom_find(const char *name);
+E const char *metadata_atom_name(metadata_atom_t atom);
+E metadata_atom_t metadata_atom_max(void);
+
+E metadata_t *metadata_add_atom(void *target, metadata_atom_t atom, const char *value);
+E void metadata_delete_atom(void *target, metadata_atom_t atom);
+E metadata_t *metadata_find_atom(void *target, metadata_atom_t atom);
+
+typedef struct {
+	object_t *obj;
+	unsigned int pos;
+	metadata_t *cur;
+	mowgli_patricia_t *tree;
+	mowgli_patricia_iteration_state_t tstate;
+} metadata_iteration_state_t;
+
+E void metadata_foreach_start(void *target, metadata_iteration_state_t *state);
+E metadata_t *metadata_foreach_cur(metadata_iteration_state_t *state);
+E void metadata_foreach_next(metadata_iteration_state_t *state);
+
+/* the current entry may be deleted while iterating */
+#define METADATA_FOREACH(md, state, target) \
+	for (metadata_foreach_start((target), (state)); ((md) = metadata_foreach_cur((state))) != NULL; metadata_foreach_next((state)))
 
 E void *privatedata_get(void *target, const char *key);
 E void privatedata_set(void *target, const char *key, void *data);
@@ -61,6 +61,10 @@ struct operclass_ {
   char *privs; /* priv1 priv2 priv3... */
   int flags;
   mowgli_node_t node;
+
+  /* privs compiled by operclass_add(), indexed by interned priv id */
+  unsigned int *privset;
+  unsigned int privset_words;
 };
 
 #define OPERCLASS_NEEDOPER	0x1 /* only give privs to IRCops */
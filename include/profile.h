@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Latency profiling of hook handlers and commands.
+ *
+ */
+
+#ifndef ATHEME_PROFILE_H
+#define ATHEME_PROFILE_H
+
+#define PROFILE_HOOK		0x1
+#define PROFILE_COMMAND		0x2
+
+/* bucket 0 counts calls under 1us, bucket i those under 2^i us */
+#define PROFILE_BUCKETS		20
+
+typedef struct profile_entry_ profile_entry_t;
+
+struct profile_entry_ {
+	unsigned int kind;
+	char *name;		/* hook or command name */
+	char *module;		/* module that added the handler or command */
+
+	unsigned long long calls;
+	unsigned long long timed;	/* calls that were sampled */
+	unsigned long long total_ns;	/* time spent in the sampled calls */
+	unsigned long long max_ns;
+	unsigned int hist[PROFILE_BUCKETS];
+};
+
+E int profile_countdown;
+
+E profile_entry_t *profile_entry_get(unsigned int kind, const char *name);
+E unsigned long long profile_now(void);
+E void profile_record(profile_entry_t *p, unsigned long long start);
+E void profile_reset(void);
+E unsigned int profile_top(unsigned int kinds, bool by_module, profile_entry_t *out, unsigned int count);
+E double profile_estimate_ns(const profile_entry_t *p);
+E unsigned int profile_percentile_us(const profile_entry_t *p, unsigned int pct);
+
+/*
+ * Counts a call and, if general::profile_sample picks it, returns the
+ * time it starts at; profile_stop() then records how long it took.
+ */
+static inline unsigned long long profile_start(profile_entry_t *p)
+{
+	if (config_options.profile_sample == 0 || p == NULL)
+		return 0;
+
+	p->calls++;
+
+	if (--profile_countdown > 0)
+		return 0;
+
+	profile_countdown = config_options.profile_sample;
+
+	return profile_now();
+}
+
+static inline void profile_stop(profile_entry_t *p, unsigned long long start)
+{
+	if (start != 0)
+		profile_record(p, start);
+}
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -29,6 +29,12 @@ struct sasl_session_ {
 
   char *host;
   char *ip;
+
+  mowgli_node_t node;		/* in sessions */
+  mowgli_node_t wheel_node;	/* in the expiry wheel slot for deadline */
+  int wheel_slot;		/* -1 if not in the wheel */
+  time_t deadline;		/* expires unless there is progress by then */
+  struct timeval started;
 };
 
 struct sasl_message_ {
@@ -56,14 +62,18 @@ typedef struct {
 typedef struct {
 	void (*mech_register) (struct sasl_mechanism_ *mech);
 	void (*mech_unregister) (struct sasl_mechanism_ *mech);
+	void (*mech_complete) (struct sasl_session_ *sptr, int rc);
 } sasl_mech_register_func_t;
 
 #define ASASL_FAIL 0 /* client supplied invalid credentials / screwed up their formatting */
 #define ASASL_MORE 1 /* everything looks good so far, but we're not done yet */
 #define ASASL_DONE 2 /* client successfully authenticated */
+#define ASASL_PENDING 3 /* result will be passed to mech_complete later */
 
-#define ASASL_MARKED_FOR_DELETION   1 /* see delete_stale() in saslserv/main.c */
+#define ASASL_MARKED_FOR_DELETION   1 /* unused, sessions expire by deadline */
 #define ASASL_NEED_LOG              2 /* user auth success needs to be logged still */
+#define ASASL_OUTCOME_SEEN          4 /* handshake outcome has been counted */
+#define ASASL_VERIFYING             8 /* waiting for the mechanism to complete a step */
 
 #endif
 
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Scans over snapshots of the user and channel tables.
+ *
+ */
+
+#ifndef ATHEME_SCAN_H
+#define ATHEME_SCAN_H
+
+/* scan_add_user() and scan_add_users() flags */
+#define SCAN_USER_CHANNELS	0x1	/* fill in scan_row_t.channels */
+
+typedef struct scan_ scan_t;
+typedef struct scan_row_ scan_row_t;
+
+/*
+ * Decides whether a row matches. Runs in worker threads, so it may only
+ * look at the row and at data that nothing changes while the scan runs;
+ * regex_match(), match(), match_ips() and irccasecmp() are fine.
+ */
+typedef bool (*scan_pred_t)(const scan_row_t *row, void *priv);
+
+/*
+ * Called in the main thread once the scan is over. scan->si is NULL if
+ * whoever asked for the scan has gone, and scan->cancelled is set if it
+ * was cut short; either way, this is where priv gets freed.
+ */
+typedef void (*scan_done_cb_t)(scan_t *scan, void *priv);
+
+/* copies of the data at the time the row was added; unused fields are NULL */
+struct scan_row_ {
+	const char *name;	/* nick, channel name or scan_add() name */
+	const char *user;
+	const char *host;
+	const char *ip;
+	const char *gecos;
+	const char *server;
+	const char *mask;	/* "nick!user@host gecos" */
+	const char *topic;
+	const char **channels;	/* the user's channels, NULL-terminated */
+	unsigned int count;	/* channel members or scan_add() count */
+};
+
+struct scan_ {
+	sourceinfo_t *si;
+	bool cancelled;
+
+	scan_row_t *rows;
+	unsigned int nrows;
+
+	scan_row_t **matches;	/* in the order the rows were added */
+	unsigned int nmatches;
+
+	/* the rest belongs to scan.c */
+	mowgli_node_t node;
+	mowgli_list_t *list;
+	scan_pred_t pred;
+	scan_done_cb_t done;
+	void *priv;
+	unsigned int maxrows;
+	unsigned char *hit;
+	unsigned int nchunks;
+	unsigned int next;	/* chunks handed out */
+	unsigned int busy;	/* chunks being scanned */
+	unsigned int left;	/* chunks not finished */
+	struct scan_block_ *blocks;
+};
+
+E scan_t *scan_create(sourceinfo_t *si, scan_pred_t pred, scan_done_cb_t done, void *priv);
+E void scan_add(scan_t *scan, const char *name, unsigned int count);
+E void scan_add_user(scan_t *scan, user_t *u, unsigned int flags);
+E void scan_add_users(scan_t *scan, unsigned int flags);
+E void scan_add_channel(scan_t *scan, channel_t *c);
+E void scan_add_channels(scan_t *scan);
+E void scan_start(scan_t *scan);
+E void scan_cancel(scan_t *scan);
+E void scan_forget(scan_done_cb_t done);
+
+#endif
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -60,6 +60,8 @@ struct logfile_ {
 
 	log_write_func_t write_func;
 	log_type_t log_type;
+
+	unsigned int log_dropped;	/* lines lost to a full log queue since the last notice */
 };
 
 E char *log_path; /* contains path to default log. */
@@ -110,6 +112,9 @@ E void log_shutdown(void);
 E bool log_debug_enabled(void);
 E void log_master_set_mask(unsigned int mask);
 E logfile_t *logfile_find_mask(unsigned int log_mask);
+E void log_queue_start(void);
+E void log_queue_stop(void);
+E void log_queue_flush(void);
 E void slog(unsigned int level, const char *fmt, ...) PRINTFLIKE(2, 3);
 E void logcommand(sourceinfo_t *si, int level, const char *fmt, ...) PRINTFLIKE(3, 4);
 E void logcommand_user(service_t *svs, user_t *source, int level, const char *fmt, ...) PRINTFLIKE(4, 5);
@@ -69,6 +69,11 @@ typedef struct {
 	const char *comment;
 } hook_user_delete_t;
 
+typedef struct {
+	user_t *u;		/* User who asked. */
+	char req;		/* The STATS letter. */
+} hook_stats_t;
+
 /* function.c */
 E bool is_ircop(user_t *user);
 E bool is_admin(user_t *user);
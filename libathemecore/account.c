@@ -94,10 +94,13 @@ void init_accounts(void)
  * Side Effects:
  *      - the created account is added to the accounts DTree,
  *        this may be undesirable for a factory.
+ *      - myuser_add hook is called
  *
  * Caveats:
  *      - if nicksvs.no_nick_ownership is not enabled, the caller is
  *        responsible for adding a nick with the same name
+ *      - new registrations must be passed to myuser_commit() once the
+ *        caller has filled them in, or they are not journaled
  */
 
 myuser_t *myuser_add(const char *name, const char *pass, const char *email, unsigned int flags)
@@ -171,9 +174,42 @@ myuser_t *myuser_add_id(const char *id, const char *name, const char *pass, cons
 
 	cnt.myuser++;
 
+	hook_call_myuser_add(mu);
+
 	return mu;
 }
 
+/*
+ * myuser_commit(myuser_t *mu)
+ *
+ * Records a newly registered account in the journal.  Registration paths
+ * call this once they have finished filling the account in, and before
+ * adding nicks or anything else that refers to it.
+ *
+ * Inputs:
+ *      - account to record
+ *
+ * Outputs:
+ *      - nothing
+ *
+ * Side Effects:
+ *      - the account and the metadata it already carries are journaled
+ */
+void myuser_commit(myuser_t *mu)
+{
+	metadata_iteration_state_t state;
+	metadata_t *md;
+
+	return_if_fail(mu != NULL);
+
+	journal_myuser(mu);
+
+	/* myuser_add() may already have set some, before the account
+	 * itself was in the journal */
+	METADATA_FOREACH(md, &state, mu)
+		journal_metadata(mu, md->name, md->value);
+}
+
 /*
  * myuser_delete(myuser_t *mu)
  *
@@ -206,6 +242,8 @@ void myuser_delete(myuser_t *mu)
 
 	myuser_name_remember(entity(mu)->name, mu);
 
+	journal_myuser_delete(mu);
+
 	hook_call_myuser_delete(mu);
 
 	/* log them out */
@@ -215,6 +253,7 @@ void myuser_delete(myuser_t *mu)
 		if (!authservice_loaded || !ircd_on_logout(u, entity(mu)->name))
 		{
 			u->myuser = NULL;
+			chanacs_user_flags_invalidate();
 			mowgli_node_delete(n, &mu->logins);
 			mowgli_node_free(n);
 		}
@@ -389,6 +428,8 @@ void myuser_rename(myuser_t *mu, const char *name)
 		}
 	}
 
+	journal_myuser(mu);
+
 	data.mu = mu;
 	data.oldname = nb;
 	hook_call_user_rename(&data);
@@ -408,6 +449,7 @@ void myuser_rename(myuser_t *mu, const char *name)
  *
  * Side Effects:
  *      - email address is changed
+ *      - myuser_email_change hook is called
  */
 void myuser_set_email(myuser_t *mu, const char *newemail)
 {
@@ -419,6 +461,41 @@ void myuser_set_email(myuser_t *mu, const char *newemail)
 
 	mu->email = strshare_get(newemail);
 	mu->email_canonical = canonicalize_email(newemail);
+
+	journal_myuser(mu);
+
+	hook_call_myuser_email_change(mu);
+}
+
+/*
+ * myuser_set_flags(myuser_t *mu, unsigned int set, unsigned int clear)
+ *
+ * Changes the flags of an account.
+ *
+ * Inputs:
+ *      - account to change
+ *      - MU_* flags to set
+ *      - MU_* flags to clear
+ *
+ * Outputs:
+ *      - nothing
+ *
+ * Side Effects:
+ *      - the account is journaled if its flags changed
+ */
+void myuser_set_flags(myuser_t *mu, unsigned int set, unsigned int clear)
+{
+	unsigned int flags;
+
+	return_if_fail(mu != NULL);
+
+	flags = (mu->flags & ~clear) | set;
+	if (flags == mu->flags)
+		return;
+
+	mu->flags = flags;
+
+	journal_myuser(mu);
 }
 
 /*
@@ -697,6 +774,8 @@ mynick_t *mynick_add(myuser_t *mu, const char *name)
 
 	myuser_name_restore(mn->nick, mu);
 
+	journal_mynick(mn);
+
 	cnt.mynick++;
 
 	return mn;
@@ -725,9 +804,13 @@ void mynick_delete(mynick_t *mn)
 
 	myuser_name_remember(mn->nick, mn->owner);
 
+	journal_mynick_delete(mn);
+
 	mowgli_patricia_delete(nicklist, mn->nick);
 	mowgli_node_delete(&mn->node, &mn->owner->nicks);
 
+	metadata_delete_all(mn);
+
 	mowgli_heap_free(mynick_heap, mn);
 
 	cnt.mynick--;
@@ -866,7 +949,7 @@ void myuser_name_restore(const char *name, myuser_t *mu)
 {
 	myuser_name_t *mun;
 	metadata_t *md, *md2;
-	mowgli_patricia_iteration_state_t state;
+	metadata_iteration_state_t state;
 	char *copy;
 
 	mun = myuser_name_find(name);
@@ -889,24 +972,21 @@ void myuser_name_restore(const char *name, myuser_t *mu)
 				md2->value, entity(mu)->name, name);
 	}
 
-	if (object(mun)->metadata)
+	METADATA_FOREACH(md, &state, mun)
 	{
-		MOWGLI_PATRICIA_FOREACH(md, &state, object(mun)->metadata)
+		/* prefer current metadata to saved */
+		if (!metadata_find(mu, md->name))
 		{
-			/* prefer current metadata to saved */
-			if (!metadata_find(mu, md->name))
+			if (strcmp(md->name, "private:mark:reason") ||
+					!strncmp(md->value, "(restored) ", 11))
+				metadata_add(mu, md->name, md->value);
+			else
 			{
-				if (strcmp(md->name, "private:mark:reason") ||
-						!strncmp(md->value, "(restored) ", 11))
-					metadata_add(mu, md->name, md->value);
-				else
-				{
-					copy = smalloc(strlen(md->value) + 12);
-					memcpy(copy, "(restored) ", 11);
-					strcpy(copy + 11, md->value);
-					metadata_add(mu, md->name, copy);
-					free(copy);
-				}
+				copy = smalloc(strlen(md->value) + 12);
+				memcpy(copy, "(restored) ", 11);
+				strcpy(copy + 11, md->value);
+				metadata_add(mu, md->name, copy);
+				free(copy);
 			}
 		}
 	}
@@ -971,6 +1051,8 @@ static void mychan_delete(mychan_t *mc)
 	if (!(runflags & RF_STARTING))
 		slog(LG_DEBUG, "mychan_delete(): %s", mc->name);
 
+	journal_mychan_delete(mc);
+
 	if (mc->chan != NULL)
 		mc->chan->mychan = NULL;
 
@@ -978,6 +1060,9 @@ static void mychan_delete(mychan_t *mc)
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, mc->chanacs.head)
 		object_unref(n->data);
 
+	if (mc->chanacs_entities != NULL)
+		mowgli_patricia_destroy(mc->chanacs_entities, NULL, NULL);
+
 	metadata_delete_all(mc);
 
 	mowgli_patricia_delete(mclist, mc->name);
@@ -1011,6 +1096,8 @@ mychan_t *mychan_add(char *name)
 
 	mowgli_patricia_add(mclist, mc->name, mc);
 
+	journal_mychan(mc);
+
 	cnt.mychan++;
 
 	return mc;
@@ -1342,6 +1429,77 @@ const char *mychan_get_sts_mlock(mychan_t *mc)
  * C H A N A C S *
  *****************/
 
+/*
+ * Account entries are found through mychan->chanacs_entities, keyed by
+ * account id.  Everything else needs a match against the user or entity
+ * being looked up, and is kept on mychan->chanacs_masks in list order.
+ */
+static inline bool chanacs_is_literal(chanacs_t *ca)
+{
+	return ca->entity != NULL && isuser(ca->entity);
+}
+
+static void chanacs_index_add(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+	mowgli_list_t *l;
+
+	if (!chanacs_is_literal(ca))
+	{
+		mowgli_node_add(ca, &ca->inode, &mc->chanacs_masks);
+		return;
+	}
+
+	if (mc->chanacs_entities == NULL)
+		mc->chanacs_entities = mowgli_patricia_create(noopcanon);
+
+	if ((l = mowgli_patricia_retrieve(mc->chanacs_entities, ca->entity->id)) == NULL)
+	{
+		l = mowgli_list_create();
+		mowgli_patricia_add(mc->chanacs_entities, ca->entity->id, l);
+	}
+
+	mowgli_node_add(ca, &ca->inode, l);
+}
+
+static void chanacs_index_delete(chanacs_t *ca)
+{
+	mychan_t *mc = ca->mychan;
+	mowgli_list_t *l;
+
+	if (!chanacs_is_literal(ca))
+	{
+		mowgli_node_delete(&ca->inode, &mc->chanacs_masks);
+		return;
+	}
+
+	l = mc->chanacs_entities != NULL ? mowgli_patricia_retrieve(mc->chanacs_entities, ca->entity->id) : NULL;
+	return_if_fail(l != NULL);
+
+	mowgli_node_delete(&ca->inode, l);
+
+	if (MOWGLI_LIST_LENGTH(l) == 0)
+	{
+		mowgli_patricia_delete(mc->chanacs_entities, ca->entity->id);
+		mowgli_list_free(l);
+	}
+
+	if (mowgli_patricia_size(mc->chanacs_entities) == 0)
+	{
+		mowgli_patricia_destroy(mc->chanacs_entities, NULL, NULL);
+		mc->chanacs_entities = NULL;
+	}
+}
+
+/* the entries naming this account directly, or NULL for other entities */
+static mowgli_list_t *chanacs_index_find(mychan_t *mc, myentity_t *mt)
+{
+	if (mc->chanacs_entities == NULL || !isuser(mt))
+		return NULL;
+
+	return mowgli_patricia_retrieve(mc->chanacs_entities, mt->id);
+}
+
 /* private destructor for chanacs_t */
 static void chanacs_delete(chanacs_t *ca)
 {
@@ -1352,6 +1510,11 @@ static void chanacs_delete(chanacs_t *ca)
 		slog(LG_DEBUG, "chanacs_delete(): %s -> %s [%s]", ca->mychan->name,
 			ca->entity != NULL ? entity(ca->entity)->name : ca->host,
 			ca->entity != NULL ? "entity" : "hostmask");
+
+	journal_chanacs_delete(ca);
+
+	chanacs_index_delete(ca);
+	chanacs_user_flags_invalidate();
 	mowgli_node_delete(&ca->cnode, &ca->mychan->chanacs);
 
 	if (ca->entity != NULL)
@@ -1369,6 +1532,7 @@ static void chanacs_delete(chanacs_t *ca)
 
 	if (ca->host != NULL)
 		free(ca->host);
+	match_pattern_free(ca->host_match);
 
 	mowgli_heap_free(chanacs_heap, ca);
 
@@ -1413,13 +1577,18 @@ chanacs_t *chanacs_add(mychan_t *mychan, myentity_t *mt, unsigned int level, tim
 	ca->mychan = mychan;
 	ca->entity = isdynamic(mt) ? object_ref(mt) : mt;
 	ca->host = NULL;
+	ca->host_match = NULL;
 	ca->level = level & ca_all;
 	ca->tmodified = ts;
 	ca->setter = setter != NULL ? strshare_ref(setter->name) : NULL;
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
+	chanacs_index_add(ca);
+	chanacs_user_flags_invalidate();
 	mowgli_node_add(ca, &ca->unode, &mt->chanacs);
 
+	journal_chanacs(ca);
+
 	cnt.chanacs++;
 
 	return ca;
@@ -1463,11 +1632,16 @@ chanacs_t *chanacs_add_host(mychan_t *mychan, const char *host, unsigned int lev
 	ca->mychan = mychan;
 	ca->entity = NULL;
 	ca->host = sstrdup(host);
+	ca->host_match = match_compile(host);
 	ca->level = level & ca_all;
 	ca->tmodified = ts;
 	ca->setter = setter != NULL ? strshare_ref(setter->name) : NULL;
 
 	mowgli_node_add(ca, &ca->cnode, &mychan->chanacs);
+	chanacs_index_add(ca);
+	chanacs_user_flags_invalidate();
+
+	journal_chanacs(ca);
 
 	cnt.chanacs++;
 
@@ -1484,7 +1658,8 @@ chanacs_t *chanacs_find(mychan_t *mychan, myentity_t *mt, unsigned int level)
 	if ((ca = chanacs_find_literal(mychan, mt, level)) != NULL)
 		return ca;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	/* account entries only match their own account, which was checked above */
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
@@ -1508,13 +1683,18 @@ chanacs_t *chanacs_find(mychan_t *mychan, myentity_t *mt, unsigned int level)
 
 unsigned int chanacs_entity_flags(mychan_t *mychan, myentity_t *mt)
 {
+	mowgli_list_t *l;
 	mowgli_node_t *n;
 	chanacs_t *ca;
 	unsigned int result = 0;
 
 	return_val_if_fail(mychan != NULL && mt != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if ((l = chanacs_index_find(mychan, mt)) != NULL)
+		MOWGLI_ITER_FOREACH(n, l->head)
+			result |= ((chanacs_t *)n->data)->level;
+
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		entity_chanacs_validation_vtable_t *vt;
 
@@ -1539,12 +1719,18 @@ unsigned int chanacs_entity_flags(mychan_t *mychan, myentity_t *mt)
 
 chanacs_t *chanacs_find_literal(mychan_t *mychan, myentity_t *mt, unsigned int level)
 {
+	mowgli_list_t *l;
 	mowgli_node_t *n;
 	chanacs_t *ca;
 
 	return_val_if_fail(mychan != NULL && mt != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	if (!isuser(mt))
+		l = &mychan->chanacs_masks;
+	else if ((l = chanacs_index_find(mychan, mt)) == NULL)
+		return NULL;
+
+	MOWGLI_ITER_FOREACH(n, l->head)
 	{
 		ca = (chanacs_t *)n->data;
 
@@ -1567,16 +1753,16 @@ chanacs_t *chanacs_find_host(mychan_t *mychan, const char *host, unsigned int le
 
 	return_val_if_fail(mychan != NULL && host != NULL, NULL);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		ca = (chanacs_t *)n->data;
 
 		if (level != 0x0)
 		{
-			if ((ca->entity == NULL) && (!match(ca->host, host)) && ((ca->level & level) == level))
+			if ((ca->entity == NULL) && (!match_pattern(ca->host_match, host)) && ((ca->level & level) == level))
 				return ca;
 		}
-		else if ((ca->entity == NULL) && (!match(ca->host, host)))
+		else if ((ca->entity == NULL) && (!match_pattern(ca->host_match, host)))
 			return ca;
 	}
 
@@ -1591,11 +1777,11 @@ unsigned int chanacs_host_flags(mychan_t *mychan, const char *host)
 
 	return_val_if_fail(mychan != NULL && host != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		ca = (chanacs_t *)n->data;
 
-		if (ca->entity == NULL && !match(ca->host, host))
+		if (ca->entity == NULL && !match_pattern(ca->host_match, host))
 			result |= ca->level;
 	}
 
@@ -1610,7 +1796,7 @@ chanacs_t *chanacs_find_host_literal(mychan_t *mychan, const char *host, unsigne
 	if ((!mychan) || (!host))
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		ca = (chanacs_t *)n->data;
 
@@ -1633,7 +1819,7 @@ chanacs_t *chanacs_find_host_by_user(mychan_t *mychan, user_t *u, unsigned int l
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_masks.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		if ((ca->level & level) == level)
@@ -1651,7 +1837,7 @@ static unsigned int chanacs_host_flags_by_user(mychan_t *mychan, user_t *u)
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
-	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
+	for (n = next_matching_host_chanacs(mychan, u, mychan->chanacs_masks.head); n != NULL; n = next_matching_host_chanacs(mychan, u, n->next))
 	{
 		ca = n->data;
 		result |= ca->level;
@@ -1708,7 +1894,7 @@ static unsigned int chanacs_entity_flags_by_user(mychan_t *mychan, user_t *u)
 	return_val_if_fail(mychan != NULL, 0);
 	return_val_if_fail(u != NULL, 0);
 
-	MOWGLI_ITER_FOREACH(n, mychan->chanacs.head)
+	MOWGLI_ITER_FOREACH(n, mychan->chanacs_masks.head)
 	{
 		chanacs_t *ca = n->data;
 		myentity_t *mt;
@@ -1729,13 +1915,46 @@ static unsigned int chanacs_entity_flags_by_user(mychan_t *mychan, user_t *u)
 	return result;
 }
 
+/*
+ * chanacs_user_flags() results are cached on the chanuser, since the join
+ * hooks ask for them several times in a row.  Anything that may change
+ * them -- access list changes, logins and logouts, nick, host, oper and
+ * channel membership changes (for exttargets), and every line read from
+ * the uplink -- moves the generation on and so drops all cached results.
+ */
+static unsigned int chanacs_generation = 1;
+
+void chanacs_user_flags_invalidate(void)
+{
+	/* 0 never matches, so fresh chanusers start out stale */
+	if (++chanacs_generation == 0)
+		chanacs_generation = 1;
+}
+
 unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u)
 {
+	static unsigned int depth = 0;
 	myentity_t *mt;
-	unsigned int result = 0;
+	chanuser_t *cu = NULL;
+	unsigned int result = 0, generation = chanacs_generation;
 
 	return_val_if_fail(mychan != NULL && u != NULL, 0);
 
+	/* nested lookups through $chanacs may be cut short by its recursion
+	 * limit, so only the outermost result is cached */
+	if (depth == 0 && mychan->chan != NULL && (cu = chanuser_find(mychan->chan, u)) != NULL)
+	{
+		if (cu->acs_generation == generation)
+		{
+			cnt.chanacs_cache_hit++;
+			return cu->acs_flags;
+		}
+
+		cnt.chanacs_cache_miss++;
+	}
+
+	depth++;
+
 	mt = entity(u->myuser);
 	if (mt != NULL)
 		result |= chanacs_entity_flags(mychan, mt);
@@ -1750,6 +1969,14 @@ unsigned int chanacs_user_flags(mychan_t *mychan, user_t *u)
 
 	result |= chanacs_host_flags_by_user(mychan, u);
 
+	depth--;
+
+	if (cu != NULL)
+	{
+		cu->acs_flags = result;
+		cu->acs_generation = generation;
+	}
+
 	slog(LG_DEBUG, "chanacs_user_flags(%s, %s): return %s", mychan->name, u->nick, bitmask_to_flags(result));
 
 	return result;
@@ -1828,8 +2055,11 @@ bool chanacs_modify(chanacs_t *ca, unsigned int *addflags, unsigned int *removef
 	if (~restrictflags & ca->level)
 		return false;
 	ca->level = (ca->level | *addflags) & ~*removeflags;
+	chanacs_user_flags_invalidate();
 	ca->tmodified = CURRTIME;
 
+	journal_chanacs(ca);
+
 	return true;
 }
 
@@ -1891,9 +2121,12 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 			if (~restrictflags & ca->level)
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
+			chanacs_user_flags_invalidate();
 			ca->tmodified = CURRTIME;
 			if (ca->level == 0)
 				object_unref(ca);
+			else
+				journal_chanacs(ca);
 		}
 	}
 	else /* hostmask != NULL */
@@ -1927,9 +2160,12 @@ bool chanacs_change(mychan_t *mychan, myentity_t *mt, const char *hostmask, unsi
 			if (~restrictflags & ca->level)
 				return false;
 			ca->level = (ca->level | *addflags) & ~*removeflags;
+			chanacs_user_flags_invalidate();
 			ca->tmodified = CURRTIME;
 			if (ca->level == 0)
 				object_unref(ca);
+			else
+				journal_chanacs(ca);
 		}
 	}
 	return true;
@@ -1945,6 +2181,39 @@ bool chanacs_change_simple(mychan_t *mychan, myentity_t *mt, const char *hostmas
 	return chanacs_change(mychan, mt, hostmask, &a, &r, ca_all, setter);
 }
 
+/*
+ * myobject_type(void *target)
+ *
+ * Tells which kind of registered object an object is, by its destructor.
+ *
+ * Inputs:
+ *       - an object
+ *
+ * Outputs:
+ *       - the kind of object, or MYOBJECT_NONE if it is not an account,
+ *         channel registration or channel access entry
+ *
+ * Side Effects:
+ *       - none
+ */
+myobject_type_t myobject_type(void *target)
+{
+	destructor_t des;
+
+	return_val_if_fail(target != NULL, MYOBJECT_NONE);
+
+	des = object(target)->destructor;
+
+	if (des == (destructor_t) myuser_delete)
+		return MYOBJECT_MYUSER;
+	else if (des == (destructor_t) mychan_delete)
+		return MYOBJECT_MYCHAN;
+	else if (des == (destructor_t) chanacs_delete)
+		return MYOBJECT_CHANACS;
+
+	return MYOBJECT_NONE;
+}
+
 static int expire_myuser_cb(myentity_t *mt, void *unused)
 {
 	hook_expiry_req_t req;
@@ -61,9 +61,14 @@ bool strict_mode = true;
 bool offline_mode = false;
 bool permissive_mode = false;
 
-void (*db_save) (void *arg) = NULL;
+void (*db_save) (void *arg, db_save_strategy_t strategy) = NULL;
 void (*db_load) (const char *name) = NULL;
 
+static void db_save_periodic(void *unused)
+{
+	db_save(NULL, DB_SAVE_BG_REGULAR);
+}
+
 /* *INDENT-OFF* */
 static void print_help(void)
 {
@@ -385,6 +390,9 @@ int atheme_main(int argc, char *argv[])
 	}
 	db_check();
 
+	/* and whatever changed after it was last written */
+	journal_init();
+
 #ifdef HAVE_GETPID
 	/* write pid */
 	if ((pid_file = fopen(pidfilename, "w")))
@@ -411,12 +419,15 @@ int atheme_main(int argc, char *argv[])
 	/* no longer starting */
 	runflags &= ~RF_STARTING;
 
+	/* write log files from a separate thread from now on */
+	log_queue_start();
+
 	/* we probably have a few open already... */
 	me.maxfd = 3;
 
 	/* DB commit interval is configurable */
 	if (db_save && !readonly)
-		mowgli_timer_add(base_eventloop, "db_save", db_save, NULL, config_options.commit_interval);
+		mowgli_timer_add(base_eventloop, "db_save", db_save_periodic, NULL, config_options.commit_interval);
 
 	/* check expires every hour */
 	mowgli_timer_add(base_eventloop, "expire_check", expire_check, NULL, 3600);
@@ -439,7 +450,9 @@ int atheme_main(int argc, char *argv[])
 	hook_call_shutdown();
 
 	if (db_save && !readonly)
-		db_save(NULL);
+		db_save(NULL, DB_SAVE_BLOCKING);
+
+	journal_shutdown();
 
 	remove(pidfilename);
 	errno = 0;
@@ -449,6 +462,8 @@ int atheme_main(int argc, char *argv[])
 
 	me.connected = false;
 
+	log_queue_stop();
+
 	/* should we restart? */
 	if (runflags & RF_RESTART)
 	{
@@ -25,6 +25,8 @@
 
 bool auth_module_loaded = false;
 bool (*auth_user_custom)(myuser_t *mu, const char *password);
+void *(*auth_user_custom_async)(myuser_t *mu, const char *password, auth_user_cb_t cb, void *priv);
+void (*auth_user_custom_cancel)(void *handle);
 
 void set_password(myuser_t *mu, const char *newpassword)
 {
@@ -42,6 +44,31 @@ void set_password(myuser_t *mu, const char *newpassword)
 		mu->flags &= ~MU_CRYPTPASS;			/* just in case */
 		mowgli_strlcpy(mu->pass, newpassword, PASSLEN);
 	}
+
+	journal_myuser(mu);
+}
+
+static void verify_password_upgrade(myuser_t *mu, const char *password, const crypt_impl_t *ci)
+{
+	const crypt_impl_t *ci_default;
+
+	if (ci == (ci_default = crypt_get_default_provider()))
+	{
+		if (ci->needs_param_upgrade != NULL && ci->needs_param_upgrade(mu->pass))
+		{
+			slog(LG_INFO, "verify_password(): transitioning to newer parameters for crypt scheme '%s' for account '%s'",
+			              ci->id, entity(mu)->name);
+
+			mowgli_strlcpy(mu->pass, ci->crypt(password, ci->salt()), PASSLEN);
+		}
+	}
+	else
+	{
+		slog(LG_INFO, "verify_password(): transitioning from crypt scheme '%s' to '%s' for account '%s'",
+			      ci->id, ci_default->id, entity(mu)->name);
+
+		mowgli_strlcpy(mu->pass, ci_default->crypt(password, ci_default->salt()), PASSLEN);
+	}
 }
 
 bool verify_password(myuser_t *mu, const char *password)
@@ -55,29 +82,13 @@ bool verify_password(myuser_t *mu, const char *password)
 	if (mu->flags & MU_CRYPTPASS)
 		if (crypto_module_loaded)
 		{
-			const crypt_impl_t *ci, *ci_default;
+			const crypt_impl_t *ci;
 
 			ci = crypt_verify_password(password, mu->pass);
 			if (ci == NULL)
 				return false;
 
-			if (ci == (ci_default = crypt_get_default_provider()))
-			{
-				if (ci->needs_param_upgrade != NULL && ci->needs_param_upgrade(mu->pass))
-				{
-					slog(LG_INFO, "verify_password(): transitioning to newer parameters for crypt scheme '%s' for account '%s'",
-					              ci->id, entity(mu)->name);
-
-					mowgli_strlcpy(mu->pass, ci->crypt(password, ci->salt()), PASSLEN);
-				}
-			}
-			else
-			{
-				slog(LG_INFO, "verify_password(): transitioning from crypt scheme '%s' to '%s' for account '%s'",
-					      ci->id, ci_default->id, entity(mu)->name);
-
-				mowgli_strlcpy(mu->pass, ci_default->crypt(password, ci_default->salt()), PASSLEN);
-			}
+			verify_password_upgrade(mu, password, ci);
 
 			return true;
 		}
@@ -94,3 +105,142 @@ bool verify_password(myuser_t *mu, const char *password)
 		return (strcmp(mu->pass, password) == 0);
 }
 
+/*
+ * The account is remembered by its entity ID, so that it may be dropped
+ * while its password is being checked; the callback then gets NULL.
+ */
+struct verify_request_ {
+	char *uid;
+	char *password;
+	char *pass;			/* mu->pass when the check started */
+
+	crypt_request_t *creq;
+	void *areq;			/* auth module handle */
+	mowgli_eventloop_timer_t *timer;
+	bool verified;
+
+	verify_password_cb_t cb;
+	void *priv;
+};
+
+static void verify_request_free(verify_request_t *req)
+{
+	explicit_bzero(req->password, strlen(req->password));
+	free(req->password);
+	free(req->pass);
+	free(req->uid);
+	free(req);
+}
+
+static void verify_password_deferred(void *arg)
+{
+	verify_request_t *req = arg;
+	myuser_t *mu = req->uid != NULL ? myuser_find_uid(req->uid) : NULL;
+
+	req->timer = NULL;
+	req->cb(mu, mu != NULL && req->verified, req->priv);
+	verify_request_free(req);
+}
+
+static void verify_password_crypted(const crypt_impl_t *ci, void *priv)
+{
+	verify_request_t *req = priv;
+	myuser_t *mu = myuser_find_uid(req->uid);
+	bool verified = false;
+
+	req->creq = NULL;
+
+	/* a password changed meanwhile is not the one we checked */
+	if (mu != NULL && ci != NULL && !strcmp(mu->pass, req->pass))
+	{
+		verify_password_upgrade(mu, req->password, ci);
+		verified = true;
+	}
+
+	req->cb(mu, verified, req->priv);
+	verify_request_free(req);
+}
+
+static void verify_password_custom(bool verified, void *priv)
+{
+	verify_request_t *req = priv;
+	myuser_t *mu = myuser_find_uid(req->uid);
+
+	req->areq = NULL;
+	req->cb(mu, mu != NULL && verified, req->priv);
+	verify_request_free(req);
+}
+
+/*
+ * verify_password_async(myuser_t *mu, const char *password,
+ *                       verify_password_cb_t cb, void *priv)
+ *
+ * Checks a password like verify_password(), handing crypted passwords to
+ * the crypt workers and the rest to the auth module, if it can check
+ * them without blocking.
+ *
+ * Inputs:
+ *       - account and password to check
+ *       - callback and its data
+ *
+ * Outputs:
+ *       - a request handle for verify_password_cancel()
+ *
+ * Side Effects:
+ *       - cb is called exactly once from the event loop, never from
+ *         within this function, unless the request is cancelled first.
+ *         It is passed the account, or NULL if it was dropped meanwhile.
+ */
+verify_request_t *verify_password_async(myuser_t *mu, const char *password, verify_password_cb_t cb, void *priv)
+{
+	verify_request_t *req;
+
+	return_val_if_fail(cb != NULL, NULL);
+
+	req = scalloc(1, sizeof(verify_request_t));
+	req->uid = mu != NULL ? sstrdup(entity(mu)->id) : NULL;
+	req->password = sstrdup(password != NULL ? password : "");
+	req->cb = cb;
+	req->priv = priv;
+
+	if (mu != NULL && password != NULL && auth_module_loaded && auth_user_custom_async != NULL)
+	{
+		req->areq = auth_user_custom_async(mu, password, verify_password_custom, req);
+		if (req->areq != NULL)
+			return req;
+	}
+
+	if (mu != NULL && password != NULL && !(auth_module_loaded && auth_user_custom) &&
+			(mu->flags & MU_CRYPTPASS) && crypto_module_loaded)
+	{
+		req->pass = sstrdup(mu->pass);
+		req->creq = crypt_verify_password_async(password, mu->pass, verify_password_crypted, req);
+		if (req->creq != NULL)
+			return req;
+	}
+
+	req->verified = verify_password(mu, password);
+	req->timer = mowgli_timer_add_once(base_eventloop, "verify_password_deferred", verify_password_deferred, req, 0);
+
+	return req;
+}
+
+void verify_password_cancel(verify_request_t *req)
+{
+	return_if_fail(req != NULL);
+
+	if (req->creq != NULL)
+		crypt_request_cancel(req->creq);
+	if (req->areq != NULL && auth_user_custom_cancel != NULL)
+		auth_user_custom_cancel(req->areq);
+	if (req->timer != NULL)
+		mowgli_timer_destroy(base_eventloop, req->timer);
+
+	verify_request_free(req);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
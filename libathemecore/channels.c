@@ -408,6 +408,7 @@ chanuser_t *chanuser_add(channel_t *chan, const char *nick)
 	mowgli_node_add(cu, &cu->unode, &u->channels);
 
 	cnt.chanuser++;
+	chanacs_user_flags_invalidate();
 
 	hdata.cu = cu;
 	hook_call_channel_join(&hdata);
@@ -461,6 +462,7 @@ void chanuser_delete(channel_t *chan, user_t *user)
 
 	chan->nummembers--;
 	cnt.chanuser--;
+	chanacs_user_flags_invalidate();
 
 	if (is_internal_client(user))
 		chan->numsvcmembers--;
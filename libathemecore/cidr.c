@@ -296,6 +296,58 @@ int match_ips(const char *s1, const char *s2)
 		return 1;
 }
 
+/*
+ * Parses an address the way match_ips() parses its second argument.
+ * Returns the address length in bits (32 or 128), or 0 if it is not an
+ * address.  addr must have room for an IPv6 address.
+ */
+int ip_parse(const char *s, unsigned char *addr)
+{
+	char ip[HOSTLEN + 1];
+
+	return_val_if_fail(s != NULL, 0);
+
+	mowgli_strlcpy(ip, s, sizeof ip);
+
+	if (strchr(ip, ':'))
+		return inet_pton6(ip, addr) ? 128 : 0;
+
+	return inet_pton4(ip, addr) ? 32 : 0;
+}
+
+/*
+ * Parses a mask the way match_ips() parses its first argument.  Returns the
+ * address length in bits (32 or 128) and fills in addr and cidrlen if
+ * match_ips() can match addresses against it, 0 if it never can, and -1
+ * if the prefix length is negative and the answer is not that simple.
+ */
+int cidr_parse(const char *s, unsigned char *addr, int *cidrlen)
+{
+	char ipmask[BUFSIZE];
+	char *len;
+
+	return_val_if_fail(s != NULL, 0);
+
+	mowgli_strlcpy(ipmask, s, sizeof ipmask);
+
+	len = strrchr(ipmask, '/');
+	if (len == NULL)
+		return 0;
+
+	*len++ = '\0';
+
+	*cidrlen = atoi(len);
+	if (*cidrlen < 0)
+		return -1;
+	if (*cidrlen == 0)
+		return 0;
+
+	if (strchr(ipmask, ':'))
+		return *cidrlen <= 128 && inet_pton6(ipmask, addr) ? 128 : 0;
+
+	return *cidrlen <= 32 && inet_pton4(ipmask, addr) ? 32 : 0;
+}
+
 /* match_cidr()
  *
  * Input - mask n!u@i/c, address n!u@i
@@ -31,6 +31,9 @@ void command_add(command_t *cmd, mowgli_patricia_t *commandtree)
 	return_if_fail(cmd != NULL);
 	return_if_fail(commandtree != NULL);
 
+	if (cmd->prof == NULL)
+		cmd->prof = profile_entry_get(PROFILE_COMMAND, cmd->name);
+
 	mowgli_patricia_add(commandtree, cmd->name, cmd);
 }
 
@@ -86,6 +89,8 @@ static inline bool command_verify(service_t *svs, sourceinfo_t *si, command_t *c
 void command_exec(service_t *svs, sourceinfo_t *si, command_t *c, int parc, char *parv[])
 {
 	const char *cmdaccess;
+	profile_entry_t *prof;
+	unsigned long long start;
 
 	if (si->smu != NULL)
 		language_set_active(si->smu->language);
@@ -106,7 +111,13 @@ void command_exec(service_t *svs, sourceinfo_t *si, command_t *c, int parc, char
 			language_set_active(si->force_language);
 
 		si->command = c;
+
+		/* the command may unbind itself, so don't look at c afterwards */
+		prof = c->prof;
+		start = profile_start(prof);
 		c->cmd(si, parc, parv);
+		profile_stop(prof, start);
+
 		language_set_active(NULL);
 		return;
 	}
@@ -243,6 +243,13 @@ void init_newconf(void)
 	add_duration_conf_item("KLINE_TIME", &conf_gi_table, 0, &config_options.kline_time, "d", 0);
 	add_duration_conf_item("CLONE_TIME", &conf_gi_table, 0, &config_options.clone_time, "m", 0);
 	add_duration_conf_item("COMMIT_INTERVAL", &conf_gi_table, 0, &config_options.commit_interval, "m", 300);
+	add_bool_conf_item("DB_SAVE_FORK", &conf_gi_table, 0, &config_options.db_save_fork, false);
+	add_bool_conf_item("DB_JOURNAL", &conf_gi_table, CONF_NO_REHASH, &config_options.db_journal, false);
+	add_uint_conf_item("LOG_QUEUE_SIZE", &conf_gi_table, CONF_NO_REHASH, &config_options.log_queue_size, 0, 1048576, 1024);
+	add_bool_conf_item("LOG_QUEUE_BLOCK", &conf_gi_table, 0, &config_options.log_queue_block, false);
+	add_uint_conf_item("CRYPT_THREADS", &conf_gi_table, CONF_NO_REHASH, &config_options.crypt_threads, 0, 64, 2);
+	add_uint_conf_item("SCAN_THREADS", &conf_gi_table, CONF_NO_REHASH, &config_options.scan_threads, 0, 64, 2);
+	add_uint_conf_item("PROFILE_SAMPLE", &conf_gi_table, 0, &config_options.profile_sample, 0, 1000000, 0);
 	/* XXX: These options should probably move into operserv/clones eventually */
 	add_uint_conf_item("DEFAULT_CLONE_WARN", &conf_gi_table, 0, &config_options.default_clone_warn, 1, INT_MAX, 5);
 	add_uint_conf_item("DEFAULT_CLONE_ALLOWED", &conf_gi_table, 0, &config_options.default_clone_allowed, 1, INT_MAX, 5);
@@ -959,7 +966,8 @@ bool conf_check(void)
 		fix_global_template_flags();
 	}
 
-	if (config_options.commit_interval < 60 || config_options.commit_interval > 3600)
+	/* with a journal, an infrequent commit only makes startup slower */
+	if (config_options.commit_interval < 60 || config_options.commit_interval > (config_options.db_journal ? 86400 : 3600))
 	{
 		slog(LG_INFO, "conf_check(): invalid `commit_interval' set in %s; defaulting to 5 minutes", config_file);
 		config_options.commit_interval = 300;
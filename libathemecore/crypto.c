@@ -23,7 +23,13 @@
 
 #include "atheme.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 static mowgli_list_t crypt_impl_list = { NULL, NULL, 0 };
+
+static void crypt_requests_forget(const crypt_impl_t *impl);
 bool crypto_module_loaded = false;
 
 static const char *generic_crypt_string(const char *str, const char *salt)
@@ -113,6 +119,7 @@ void crypt_unregister(crypt_impl_t *impl)
 	return_if_fail(impl != NULL);
 
 	mowgli_node_delete(&impl->node, &crypt_impl_list);
+	crypt_requests_forget(impl);
 
 	crypto_module_loaded = MOWGLI_LIST_LENGTH(&crypt_impl_list) > 0 ? true : false;
 }
@@ -144,6 +151,433 @@ const crypt_impl_t *crypt_verify_password(const char *uinput, const char *pass)
 	return NULL;
 }
 
+/*
+ * crypt_verify_password_r is crypt_verify_password() for other threads:
+ * only schemes which provide crypt_r are tried, and *skipped is set if
+ * there were others. The list of schemes must not change meanwhile.
+ */
+const crypt_impl_t *crypt_verify_password_r(const char *uinput, const char *pass, char *buf, size_t buflen, bool *skipped)
+{
+	mowgli_node_t *n;
+	const char *cstr;
+
+	*skipped = false;
+
+	MOWGLI_ITER_FOREACH(n, crypt_impl_list.head)
+	{
+		crypt_impl_t *ci = n->data;
+
+		if (ci->crypt_r == NULL)
+		{
+			*skipped = true;
+			continue;
+		}
+
+		cstr = ci->crypt_r(uinput, pass, buf, buflen);
+		if (cstr != NULL && !strcmp(cstr, pass))
+			return ci;
+	}
+
+	if (!strcmp(uinput, pass))
+		return &fallback_crypt_impl;
+
+	return NULL;
+}
+
+/*
+ * Asynchronous verification.
+ *
+ * Schemes which provide crypt_r are tried by a pool of worker threads
+ * (general::crypt_threads), so that a slow hash does not hold up the event
+ * loop; the others are still tried in the main thread. Either way the
+ * result is handed back through a pipe watched by the event loop, so the
+ * callback never runs before crypt_verify_password_async() has returned.
+ *
+ * A request is on exactly one of the lists below, except while the main
+ * thread is trying it; the lists, and the request fields the workers
+ * write, are protected by crypt_pool.lock.
+ */
+struct crypt_request_ {
+	mowgli_node_t node;
+	mowgli_list_t *list;
+
+	char *key;
+	char *pass;
+
+	crypt_impl_t *impl;		/* scheme being tried by a worker */
+	const crypt_impl_t *result;	/* when finished */
+	bool matched;			/* impl matched */
+	bool finished;
+	bool cancelled;
+
+	crypt_verify_cb_t cb;
+	void *priv;
+
+	char buf[PASSLEN];
+};
+
+static mowgli_list_t crypt_queue = { NULL, NULL, 0 };		/* waiting for a worker */
+static mowgli_list_t crypt_running = { NULL, NULL, 0 };	/* being tried by a worker */
+static mowgli_list_t crypt_done = { NULL, NULL, 0 };		/* waiting for the main thread */
+
+static int crypt_pipe[2] = { -1, -1 };
+static mowgli_eventloop_pollable_t *crypt_pollable;
+
+#ifdef HAVE_PTHREAD
+static struct {
+	pthread_t *threads;
+	unsigned int nthreads;
+	bool started;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* main thread -> workers */
+	pthread_cond_t idle;	/* workers -> crypt_unregister() */
+} crypt_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+#define crypt_lock()	pthread_mutex_lock(&crypt_pool.lock)
+#define crypt_unlock()	pthread_mutex_unlock(&crypt_pool.lock)
+#else
+#define crypt_lock()	do { } while (0)
+#define crypt_unlock()	do { } while (0)
+#endif
+
+static void crypt_request_step(crypt_request_t *req, mowgli_node_t *n);
+
+static void crypt_request_move(crypt_request_t *req, mowgli_list_t *list)
+{
+	if (req->list != NULL)
+		mowgli_node_delete(&req->node, req->list);
+	if (list != NULL)
+		mowgli_node_add(req, &req->node, list);
+	req->list = list;
+}
+
+static void crypt_wakeup(void)
+{
+	/* if the pipe is full, the main thread has a wakeup pending anyway */
+	(void) write(crypt_pipe[1], "", 1);
+}
+
+static void crypt_request_free(crypt_request_t *req)
+{
+	explicit_bzero(req->key, strlen(req->key));
+	explicit_bzero(req->buf, sizeof req->buf);
+	free(req->key);
+	free(req->pass);
+	free(req);
+}
+
+static void crypt_done_read(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
+{
+	crypt_request_t *req;
+	char buf[64];
+
+	while (read(crypt_pipe[0], buf, sizeof buf) > 0)
+		;
+
+	/* callbacks may start or cancel other requests, so take them off
+	 * the list one at a time.
+	 */
+	for (;;)
+	{
+		crypt_lock();
+		if (crypt_done.head == NULL)
+		{
+			crypt_unlock();
+			break;
+		}
+		req = crypt_done.head->data;
+		crypt_request_move(req, NULL);
+		crypt_unlock();
+
+		if (req->cancelled)
+			crypt_request_free(req);
+		else if (req->finished)
+		{
+			req->cb(req->result, req->priv);
+			crypt_request_free(req);
+		}
+		else if (req->impl == NULL)
+			/* the scheme went away, start over */
+			crypt_request_step(req, crypt_impl_list.head);
+		else if (req->matched)
+		{
+			req->cb(req->impl, req->priv);
+			crypt_request_free(req);
+		}
+		else
+			crypt_request_step(req, req->impl->node.next);
+	}
+}
+
+static bool crypt_async_init(void)
+{
+	int i;
+
+	if (crypt_pollable != NULL)
+		return true;
+
+	if (pipe(crypt_pipe) < 0)
+	{
+		slog(LG_ERROR, "crypt_async_init(): pipe: %s", strerror(errno));
+		return false;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		fcntl(crypt_pipe[i], F_SETFL, fcntl(crypt_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+		fcntl(crypt_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	crypt_pollable = mowgli_pollable_create(base_eventloop, crypt_pipe[0], NULL);
+	mowgli_pollable_setselect(base_eventloop, crypt_pollable, MOWGLI_EVENTLOOP_IO_READ, crypt_done_read);
+
+	return true;
+}
+
+#ifdef HAVE_PTHREAD
+static void *crypt_worker(void *unused)
+{
+	crypt_request_t *req;
+	const char *cstr;
+
+	crypt_lock();
+
+	for (;;)
+	{
+		while (crypt_queue.head == NULL)
+			pthread_cond_wait(&crypt_pool.work, &crypt_pool.lock);
+
+		req = crypt_queue.head->data;
+		crypt_request_move(req, &crypt_running);
+		crypt_unlock();
+
+		cstr = req->impl->crypt_r(req->key, req->pass, req->buf, sizeof req->buf);
+
+		crypt_lock();
+		req->matched = cstr != NULL && !strcmp(cstr, req->pass);
+		crypt_request_move(req, &crypt_done);
+		pthread_cond_broadcast(&crypt_pool.idle);
+		crypt_wakeup();
+	}
+
+	return NULL;
+}
+
+/* the child of a fork has no workers; make sure the lock is not held by
+ * one of them when it is copied.
+ */
+static void crypt_atfork_prepare(void)
+{
+	crypt_lock();
+}
+
+static void crypt_atfork_parent(void)
+{
+	crypt_unlock();
+}
+
+static void crypt_atfork_child(void)
+{
+	crypt_pool.nthreads = 0;
+	crypt_unlock();
+}
+
+static void crypt_pool_start(void)
+{
+	sigset_t all, old;
+	unsigned int i;
+	int err = 0;
+
+	crypt_pool.started = true;
+
+	if (config_options.crypt_threads == 0)
+		return;
+
+	crypt_pool.threads = scalloc(config_options.crypt_threads, sizeof(pthread_t));
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < config_options.crypt_threads; i++)
+		if ((err = pthread_create(&crypt_pool.threads[i], NULL, crypt_worker, NULL)) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+		slog(LG_ERROR, "crypt_pool_start(): cannot start crypt worker %u, verifying passwords %s: %s", i + 1,
+				i > 0 ? "with fewer workers" : "in the main thread", strerror(err));
+
+	pthread_atfork(crypt_atfork_prepare, crypt_atfork_parent, crypt_atfork_child);
+
+	crypt_pool.nthreads = i;
+	slog(LG_DEBUG, "crypt_pool_start(): started %u crypt workers", i);
+}
+#endif
+
+static void crypt_request_finish(crypt_request_t *req, const crypt_impl_t *ci)
+{
+	req->impl = NULL;
+	req->result = ci;
+	req->finished = true;
+
+	crypt_lock();
+	crypt_request_move(req, &crypt_done);
+	crypt_unlock();
+
+	crypt_wakeup();
+}
+
+/* tries the schemes from n on, until one matches or is handed to a worker */
+static void crypt_request_step(crypt_request_t *req, mowgli_node_t *n)
+{
+	const char *cstr;
+
+	for (; n != NULL; n = n->next)
+	{
+		crypt_impl_t *ci = n->data;
+
+#ifdef HAVE_PTHREAD
+		if (ci->crypt_r != NULL && crypt_pool.nthreads > 0)
+		{
+			req->impl = ci;
+			req->matched = false;
+
+			crypt_lock();
+			crypt_request_move(req, &crypt_queue);
+			pthread_cond_signal(&crypt_pool.work);
+			crypt_unlock();
+			return;
+		}
+#endif
+
+		cstr = ci->crypt(req->key, req->pass);
+		if (cstr != NULL && !strcmp(cstr, req->pass))
+		{
+			crypt_request_finish(req, ci);
+			return;
+		}
+	}
+
+	cstr = fallback_crypt_impl.crypt(req->key, req->pass);
+	crypt_request_finish(req, !strcmp(cstr, req->pass) ? &fallback_crypt_impl : NULL);
+}
+
+/*
+ * crypt_verify_password_async is crypt_verify_password(), but calls
+ * cb with the matching scheme (or NULL) from the event loop later on,
+ * unless the request is cancelled first. Returns NULL, without calling
+ * cb, if it cannot be done.
+ */
+crypt_request_t *crypt_verify_password_async(const char *uinput, const char *pass, crypt_verify_cb_t cb, void *priv)
+{
+	crypt_request_t *req;
+
+	return_val_if_fail(uinput != NULL, NULL);
+	return_val_if_fail(pass != NULL, NULL);
+	return_val_if_fail(cb != NULL, NULL);
+
+	if (!crypt_async_init())
+		return NULL;
+
+#ifdef HAVE_PTHREAD
+	if (!crypt_pool.started)
+		crypt_pool_start();
+#endif
+
+	req = scalloc(1, sizeof(crypt_request_t));
+	req->key = sstrdup(uinput);
+	req->pass = sstrdup(pass);
+	req->cb = cb;
+	req->priv = priv;
+
+	crypt_request_step(req, crypt_impl_list.head);
+
+	return req;
+}
+
+/*
+ * crypt_request_cancel makes sure the callback of a pending request is
+ * not called.
+ */
+void crypt_request_cancel(crypt_request_t *req)
+{
+	return_if_fail(req != NULL);
+
+	crypt_lock();
+
+	/* a worker has it; it is freed when it comes back */
+	if (req->list == &crypt_running)
+	{
+		req->cancelled = true;
+		crypt_unlock();
+		return;
+	}
+
+	crypt_request_move(req, NULL);
+	crypt_unlock();
+
+	crypt_request_free(req);
+}
+
+/* sends requests using impl back to the start, and waits for the
+ * workers to finish with it.
+ */
+static void crypt_requests_forget(const crypt_impl_t *impl)
+{
+	mowgli_node_t *n, *tn;
+	crypt_request_t *req;
+	bool wakeup = false;
+
+	crypt_lock();
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, crypt_queue.head)
+	{
+		req = n->data;
+		if (req->impl != impl)
+			continue;
+
+		req->impl = NULL;
+		crypt_request_move(req, &crypt_done);
+		wakeup = true;
+	}
+
+#ifdef HAVE_PTHREAD
+	for (;;)
+	{
+		MOWGLI_ITER_FOREACH(n, crypt_running.head)
+			if (((crypt_request_t *) n->data)->impl == impl)
+				break;
+		if (n == NULL)
+			break;
+
+		pthread_cond_wait(&crypt_pool.idle, &crypt_pool.lock);
+	}
+#endif
+
+	MOWGLI_ITER_FOREACH(n, crypt_done.head)
+	{
+		req = n->data;
+		if (req->impl != impl && req->result != impl)
+			continue;
+
+		req->impl = NULL;
+		req->result = NULL;
+		req->matched = req->finished = false;
+		wakeup = true;
+	}
+
+	crypt_unlock();
+
+	if (wakeup)
+		crypt_wakeup();
+}
+
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
  * vim:ts=8
  * vim:sw=8
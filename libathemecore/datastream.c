@@ -24,12 +24,23 @@
 #include "atheme.h"
 #include "datastream.h"
 
-#define SENDQSIZE (4096 - 40)
+#define SENDQSIZE (16384 - 40)
 
 #ifdef MOWGLI_OS_WIN
 # define EWOULDBLOCK	WSAEWOULDBLOCK
 # define EALREADY	WSAEALREADY
 # define ENOBUFS	WSAENOBUFS
+
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+# define SENDQ_IOV	1
+#else
+# include <sys/uio.h>
+
+# define SENDQ_IOV	64
 #endif
 
 /* sendq struct */
@@ -40,98 +51,230 @@ struct sendq {
 	char buf[SENDQSIZE];
 };
 
-void sendq_add(connection_t * cptr, char *buf, size_t len)
+static struct sendq *sendq_chunk_add(mowgli_list_t *q)
 {
-	mowgli_node_t *n;
 	struct sendq *sq;
-	size_t l;
-	int pos = 0;
 
-	return_if_fail(cptr != NULL);
+	sq = smalloc(sizeof(struct sendq));
+	sq->firstused = sq->firstfree = 0;
+	mowgli_node_add(sq, &sq->node, q);
 
+	return sq;
+}
+
+/* drop a chunk that has been used up; the last one is kept for reuse */
+static void sendq_chunk_release(mowgli_list_t *q, struct sendq *sq)
+{
+	if (MOWGLI_LIST_LENGTH(q) > 1)
+	{
+		mowgli_node_delete(&sq->node, q);
+		free(sq);
+	}
+	else
+		sq->firstused = sq->firstfree = 0;
+}
+
+static bool sendq_check_dead(connection_t *cptr)
+{
 	if (cptr->flags & (CF_DEAD | CF_SEND_EOF))
 	{
 		slog(LG_DEBUG, "sendq_add(): attempted to send to fd %d which is already dead", cptr->fd);
-		return;
+		return true;
 	}
 
-	if (len == 0)
+	return false;
+}
+
+/* batches are only held to the limit once they are complete */
+static bool sendq_check_limit(connection_t *cptr)
+{
+	if (cptr->sendq_limit == 0 || cptr->sendq_batch > 0 || cptr->sendq_len <= cptr->sendq_limit)
+		return true;
+
+	slog(LG_INFO, "sendq_add(): sendq limit exceeded on connection %s[%d]",
+			cptr->name, cptr->fd);
+	cptr->flags |= CF_DEAD;
+
+	return false;
+}
+
+void sendq_add(connection_t * cptr, char *buf, size_t len)
+{
+	mowgli_node_t *n;
+	struct sendq *sq = NULL;
+	size_t l;
+
+	return_if_fail(cptr != NULL);
+
+	if (sendq_check_dead(cptr))
 		return;
 
-	if (cptr->sendq_limit != 0 &&
-			MOWGLI_LIST_LENGTH(&cptr->sendq) * SENDQSIZE + len > cptr->sendq_limit)
-	{
-		slog(LG_INFO, "sendq_add(): sendq limit exceeded on connection %s[%d]",
-				cptr->name, cptr->fd);
-		cptr->flags |= CF_DEAD;
+	if (len == 0)
 		return;
-	}
 
 	if (!sendq_nonempty(cptr))
 		connection_setselect_write(cptr, sendq_flush);
 
-	n = cptr->sendq.tail;
-	if (n != NULL)
-	{
+	if ((n = cptr->sendq.tail) != NULL)
 		sq = n->data;
-		l = SENDQSIZE - sq->firstfree;
-		if (l > len)
-			l = len;
-		memcpy(sq->buf + sq->firstfree, buf + pos, l);
-		sq->firstfree += l;
-		pos += l;
-		len -= l;
-	}
 
 	while (len > 0)
 	{
-		sq = smalloc(sizeof(struct sendq));
-		sq->firstused = sq->firstfree = 0;
-		mowgli_node_add(sq, &sq->node, &cptr->sendq);
+		if (sq == NULL || sq->firstfree == SENDQSIZE)
+			sq = sendq_chunk_add(&cptr->sendq);
+
 		l = SENDQSIZE - sq->firstfree;
 		if (l > len)
 			l = len;
-		memcpy(sq->buf + sq->firstfree, buf + pos, l);
+		memcpy(sq->buf + sq->firstfree, buf, l);
 		sq->firstfree += l;
-		pos += l;
+		cptr->sendq_len += l;
+		buf += l;
 		len -= l;
 	}
+
+	sendq_check_limit(cptr);
+}
+
+/*
+ * sendq_reserve()
+ *
+ * Returns room for up to len bytes at the end of the sendq, so that a line
+ * can be formatted in place; nothing is queued until sendq_commit() is
+ * called with the number of bytes actually used.  len may not exceed the
+ * size of a sendq chunk.
+ *
+ * Returns NULL if the connection is dead.
+ */
+char *sendq_reserve(connection_t *cptr, size_t len)
+{
+	mowgli_node_t *n;
+	struct sendq *sq = NULL;
+
+	return_val_if_fail(cptr != NULL, NULL);
+	return_val_if_fail(len <= SENDQSIZE, NULL);
+
+	if (sendq_check_dead(cptr))
+		return NULL;
+
+	if ((n = cptr->sendq.tail) != NULL)
+		sq = n->data;
+
+	if (sq == NULL || (size_t) (SENDQSIZE - sq->firstfree) < len)
+		sq = sendq_chunk_add(&cptr->sendq);
+
+	return sq->buf + sq->firstfree;
+}
+
+void sendq_commit(connection_t *cptr, size_t len)
+{
+	struct sendq *sq;
+
+	return_if_fail(cptr != NULL);
+	return_if_fail(cptr->sendq.tail != NULL);
+
+	if (len == 0)
+		return;
+
+	if (!sendq_nonempty(cptr))
+		connection_setselect_write(cptr, sendq_flush);
+
+	sq = cptr->sendq.tail->data;
+	sq->firstfree += len;
+	cptr->sendq_len += len;
+
+	sendq_check_limit(cptr);
+}
+
+/*
+ * sendq_batch_begin(), sendq_batch_end()
+ *
+ * Everything queued between these is written out together, with as few
+ * system calls as possible, when the outermost batch ends.  The sendq
+ * limit is only checked at that point, so a burst may exceed it briefly.
+ */
+void sendq_batch_begin(connection_t *cptr)
+{
+	return_if_fail(cptr != NULL);
+
+	cptr->sendq_batch++;
+}
+
+void sendq_batch_end(connection_t *cptr)
+{
+	return_if_fail(cptr != NULL);
+	return_if_fail(cptr->sendq_batch > 0);
+
+	if (--cptr->sendq_batch > 0)
+		return;
+
+	if (!sendq_check_limit(cptr))
+		return;
+
+	if (!(cptr->flags & (CF_CONNECTING | CF_DEAD)) && sendq_nonempty(cptr))
+		sendq_flush(cptr);
 }
 
 void sendq_add_eof(connection_t * cptr)
 {
 	return_if_fail(cptr != NULL);
 
-	if (cptr->flags & (CF_DEAD | CF_SEND_EOF))
-	{
-		slog(LG_DEBUG, "sendq_add(): attempted to send to fd %d which is already dead", cptr->fd);
+	if (sendq_check_dead(cptr))
 		return;
-	}
 	if (!sendq_nonempty(cptr))
 		connection_setselect_write(cptr, sendq_flush);
 	cptr->flags |= CF_SEND_EOF;
 }
 
+static ssize_t sendq_writev(connection_t *cptr, const struct iovec *iov, int iovcnt)
+{
+#ifndef MOWGLI_OS_WIN
+	return writev(cptr->fd, iov, iovcnt);
+#else
+	return send(cptr->fd, iov[0].iov_base, iov[0].iov_len, 0);
+#endif
+}
+
 void sendq_flush(connection_t * cptr)
 {
-        mowgli_node_t *n, *tn;
-        struct sendq *sq;
-        int l;
+	mowgli_node_t *n, *tn;
+	struct sendq *sq;
+	struct iovec iov[SENDQ_IOV];
+	int iovcnt;
+	size_t want, written;
+	ssize_t l;
 
 	return_if_fail(cptr != NULL);
 
-        MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->sendq.head)
-        {
-                sq = (struct sendq *)n->data;
+	cnt.sendq_flush++;
+
+	while (cptr->sendq_len > 0)
+	{
+		iovcnt = 0;
+		want = 0;
+
+		MOWGLI_ITER_FOREACH(n, cptr->sendq.head)
+		{
+			sq = (struct sendq *)n->data;
+
+			if (sq->firstused == sq->firstfree)
+				continue;
 
-                if (sq->firstused == sq->firstfree)
-                        break;
+			iov[iovcnt].iov_base = sq->buf + sq->firstused;
+			iov[iovcnt].iov_len = sq->firstfree - sq->firstused;
+			want += iov[iovcnt].iov_len;
 
-                if ((l = send(cptr->fd, sq->buf + sq->firstused, sq->firstfree - sq->firstused, 0)) == -1)
-                {
-                        int err = ioerrno();
+			if (++iovcnt == SENDQ_IOV)
+				break;
+		}
+
+		cnt.sendq_syscall++;
 
-                        if (!mowgli_eventloop_ignore_errno(err))
+		if ((l = sendq_writev(cptr, iov, iovcnt)) == -1)
+		{
+			int err = ioerrno();
+
+			if (!mowgli_eventloop_ignore_errno(err))
 			{
 				slog(LG_DEBUG, "sendq_flush(): write error %d (%s) on connection %s[%d]",
 						err, strerror(err),
@@ -139,24 +282,38 @@ void sendq_flush(connection_t * cptr)
 				cptr->flags |= CF_DEAD;
 			}
 
-                        return;
-                }
+			return;
+		}
+
+		written = l;
+		cnt.sendq_bytes += written;
+		cptr->sendq_len -= written;
+
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, cptr->sendq.head)
+		{
+			size_t used;
+
+			if (l == 0)
+				break;
+
+			sq = (struct sendq *)n->data;
+			used = sq->firstfree - sq->firstused;
 
-                sq->firstused += l;
-                if (sq->firstused == sq->firstfree)
-                {
-			if (MOWGLI_LIST_LENGTH(&cptr->sendq) > 1)
+			if ((size_t) l < used)
 			{
-                        	mowgli_node_delete(&sq->node, &cptr->sendq);
-                        	free(sq);
+				sq->firstused += l;
+				break;
 			}
-			else
-				/* keep one struct sendq */
-				sq->firstused = sq->firstfree = 0;
-                }
-                else
-                        return;
-        }
+
+			l -= used;
+			sendq_chunk_release(&cptr->sendq, sq);
+		}
+
+		/* the socket buffer is full, wait until it drains */
+		if (written < want)
+			return;
+	}
+
 	if (cptr->flags & CF_SEND_EOF)
 	{
 		/* shut down write end, kill entire connection
@@ -173,18 +330,11 @@ void sendq_flush(connection_t * cptr)
 
 bool sendq_nonempty(connection_t *cptr)
 {
-	mowgli_node_t *n;
-	struct sendq *sq;
-
 	if (cptr->flags & CF_SEND_DEAD)
 		return false;
 	if (cptr->flags & CF_SEND_EOF)
 		return true;
-	n = cptr->sendq.head;
-	if (n == NULL)
-		return false;
-	sq = n->data;
-	return sq->firstfree > sq->firstused;
+	return cptr->sendq_len > 0;
 }
 
 void sendq_set_limit(connection_t *cptr, size_t len)
@@ -192,6 +342,24 @@ void sendq_set_limit(connection_t *cptr, size_t len)
 	cptr->sendq_limit = len;
 }
 
+/* move a partial line left over from a read to the start of the buffer */
+static void recvq_compact(connection_t *cptr)
+{
+	struct sendq *sq;
+
+	if (cptr->recvq.head == NULL)
+		return;
+
+	sq = cptr->recvq.head->data;
+
+	if (sq->firstused == 0)
+		return;
+
+	memmove(sq->buf, sq->buf + sq->firstused, sq->firstfree - sq->firstused);
+	sq->firstfree -= sq->firstused;
+	sq->firstused = 0;
+}
+
 int recvq_length(connection_t *cptr)
 {
 	int l = 0;
@@ -238,9 +406,19 @@ void recvq_put(connection_t *cptr)
 	}
 	if (sq == NULL)
 	{
-		sq = smalloc(sizeof(struct sendq));
-		sq->firstused = sq->firstfree = 0;
-		mowgli_node_add(sq, &sq->node, &cptr->recvq);
+		/* lines are handed out in place, so they must not straddle
+		 * chunks; recvq_getline_inplace() never leaves a full line's
+		 * worth unconsumed, so this cannot happen with a handler.
+		 */
+		if (n != NULL && cptr->flags & CF_RECVQ_INPLACE)
+		{
+			slog(LG_INFO, "recvq_put(): recvq full on connection %s[%d]",
+					cptr->name, cptr->fd);
+			cptr->flags |= CF_DEAD;
+			return;
+		}
+
+		sq = sendq_chunk_add(&cptr->recvq);
 		l = SENDQSIZE;
 	}
 	errno = 0;
@@ -260,6 +438,9 @@ void recvq_put(connection_t *cptr)
 
 	if (cptr->recvq_handler)
 	{
+		/* send the replies to everything read in one go */
+		sendq_batch_begin(cptr);
+
 		l = recvq_length(cptr);
 		do /* call handler until it consumes nothing */
 		{
@@ -267,8 +448,12 @@ void recvq_put(connection_t *cptr)
 			ll = l;
 			l = recvq_length(cptr);
 		} while (ll != l && l != 0);
+
+		sendq_batch_end(cptr);
 	}
-	return;
+
+	if (cptr->flags & CF_RECVQ_INPLACE)
+		recvq_compact(cptr);
 }
 
 int recvq_get(connection_t *cptr, char *buf, size_t len)
@@ -368,6 +553,65 @@ int recvq_getline(connection_t *cptr, char *buf, size_t len)
 	return p - buf;
 }
 
+/*
+ * recvq_getline_inplace()
+ *
+ * Like recvq_getline(), for connections with CF_RECVQ_INPLACE: rather than
+ * copying the next line out, returns it as a slice of the receive buffer
+ * with the line ending replaced by a NUL, so that it can be tokenized where
+ * it is.  The line stays valid until the recvq handler returns.
+ *
+ * *count is set to the number of bytes consumed.  Like recvq_getline(), a
+ * line longer than len is cut short and CF_NONEWLINE is set until the rest
+ * of it has been read.
+ *
+ * Returns NULL if there is no complete line yet.
+ */
+char *recvq_getline_inplace(connection_t *cptr, size_t len, int *count)
+{
+	struct sendq *sq;
+	char *line, *newline;
+	size_t avail, l;
+
+	return_val_if_fail(cptr != NULL, NULL);
+	return_val_if_fail(cptr->flags & CF_RECVQ_INPLACE, NULL);
+	return_val_if_fail(len > 1, NULL);
+
+	if (cptr->recvq.head == NULL)
+		return NULL;
+
+	sq = cptr->recvq.head->data;
+	line = sq->buf + sq->firstused;
+	avail = sq->firstfree - sq->firstused;
+
+	if ((newline = memchr(line, '\n', avail < len ? avail : len)) != NULL)
+	{
+		cptr->flags &= ~CF_NONEWLINE;
+		l = newline - line + 1;
+
+		*newline = '\0';
+		if (newline > line && newline[-1] == '\r')
+			newline[-1] = '\0';
+	}
+	else if (avail >= len)
+	{
+		/* the byte after the cut belongs to the part of the line
+		 * that will be thrown away, so it can hold the NUL.
+		 */
+		cptr->flags |= CF_NONEWLINE;
+		l = len - 1;
+
+		line[l] = '\0';
+	}
+	else
+		return NULL;
+
+	sq->firstused += l;
+	*count = l;
+
+	return line;
+}
+
 void sendqrecvq_free(connection_t *cptr)
 {
 	mowgli_node_t *nptr, *nptr2;
@@ -388,6 +632,8 @@ void sendqrecvq_free(connection_t *cptr)
 		mowgli_node_delete(&sq->node, &cptr->sendq);
 		free(sq);
 	}
+
+	cptr->sendq_len = 0;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
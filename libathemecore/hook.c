@@ -26,32 +26,44 @@
 #include "internal.h"
 
 mowgli_patricia_t *hooks;
-static mowgli_heap_t *hook_heap, *hook_privfn_heap;
+static mowgli_heap_t *hook_heap;
 
+/*
+ * The handlers of a hook are kept in an array that is replaced, never
+ * modified, when handlers are added or removed.  A running hook_call()
+ * holds a reference to the array it started with, so handlers may come
+ * and go (modules may even be unloaded) while it runs.
+ */
 typedef struct {
-	hook_t *hook;
+	hookfn_t fn;
+	profile_entry_t *prof;
+} hook_fn_t;
+
+struct hook_vec_ {
+	unsigned int refcount;
+	unsigned int count;
+	hook_fn_t fns[];
+};
+
+typedef struct hook_run_ctx_ hook_run_ctx_t;
+
+struct hook_run_ctx_ {
+	hook_run_ctx_t *prev;
 	void *dptr;
-	mowgli_node_t node;
 	unsigned int flags;
-} hook_run_ctx_t;
-
-typedef struct {
-	hookfn_t hookfn;
-	mowgli_node_t node;
-} hook_privfn_ctx_t;
+};
 
 #define HF_RUN		0x1
 #define HF_STOP		0x2
 
-static mowgli_list_t hook_run_stack = { NULL, NULL, 0 };
+static hook_run_ctx_t *hook_run_stack = NULL;
 
 void hooks_init(void)
 {
 	hooks = mowgli_patricia_create(strcasecanon);
 	hook_heap = sharedheap_get(sizeof(hook_t));
-	hook_privfn_heap = sharedheap_get(sizeof(hook_privfn_ctx_t));
 
-	if (hook_heap == NULL || hook_privfn_heap == NULL || hooks == NULL)
+	if (hook_heap == NULL || hooks == NULL)
 	{
 		slog(LG_INFO, "hooks_init(): block allocator failed.");
 		exit(EXIT_SUCCESS);
@@ -63,6 +75,12 @@ static inline hook_t *hook_find(const char *name)
 	return mowgli_patricia_retrieve(hooks, name);
 }
 
+/*
+ * hook_add_event
+ *
+ * Looks up a hook, creating it if it does not exist yet.  Hooks are never
+ * freed, so the result may be cached, as the hook_call_* wrappers do.
+ */
 hook_t *hook_add_event(const char *name)
 {
 	hook_t *nh;
@@ -72,161 +90,205 @@ hook_t *hook_add_event(const char *name)
 
 	nh = mowgli_heap_alloc(hook_heap);
 	nh->name = strshare_get(name);
+	nh->vec = NULL;
 
 	mowgli_patricia_add(hooks, nh->name, nh);
 
 	return nh;
 }
 
-static inline void hook_destroy(hook_t *hook, hook_privfn_ctx_t *priv)
+static inline void hook_vec_unref(hook_vec_t *vec)
 {
-	mowgli_node_delete(&priv->node, &hook->hooks);
-	mowgli_heap_free(hook_privfn_heap, priv);
+	if (vec != NULL && --vec->refcount == 0)
+		free(vec);
 }
 
-void hook_del_event(const char *name)
+static inline bool hook_vec_contains(hook_vec_t *vec, hookfn_t handler)
 {
-	hook_t *h;
-	mowgli_node_t *n, *tn;
-
-	if ((h = hook_find(name)) == NULL)
-		return;
+	unsigned int i;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, h->hooks.head)
-		hook_destroy(h, n->data);
+	if (vec == NULL)
+		return false;
 
-	mowgli_patricia_delete(hooks, h->name);
-	strshare_unref(h->name);
+	for (i = 0; i < vec->count; i++)
+		if (vec->fns[i].fn == handler)
+			return true;
 
-	mowgli_heap_free(hook_heap, h);
+	return false;
 }
 
-void hook_del_hook(const char *event, hookfn_t handler)
+/* installs a new handler array, built from the old one by the caller */
+static void hook_set_vec(hook_t *hook, hook_vec_t *vec)
 {
-	mowgli_node_t *n, *n2;
-	hook_t *h;
+	hook_vec_t *old = hook->vec;
 
-	return_if_fail(event != NULL);
-	return_if_fail(handler != NULL);
-
-	h = hook_find(event);
-	if (h == NULL)
-		return;
-
-	MOWGLI_ITER_FOREACH_SAFE(n, n2, h->hooks.head)
+	if (vec != NULL && vec->count == 0)
 	{
-		hook_privfn_ctx_t *priv = n->data;
-
-		if (handler == priv->hookfn)
-			hook_destroy(h, n->data);
+		free(vec);
+		vec = NULL;
 	}
+
+	if (vec != NULL)
+		vec->refcount = 1;
+
+	hook->vec = vec;
+	hook_vec_unref(old);
 }
 
-static inline hook_privfn_ctx_t *hook_create_and_add(hook_t *hook, hookfn_t handler,
-	void (*addfn)(void *data, mowgli_node_t *node, mowgli_list_t *list))
+static hook_vec_t *hook_vec_alloc(unsigned int count)
 {
-	hook_privfn_ctx_t *priv;
+	hook_vec_t *vec;
 
-	return_val_if_fail(hook != NULL, NULL);
-	return_val_if_fail(handler != NULL, NULL);
-	return_val_if_fail(addfn != NULL, NULL);
+	vec = smalloc(sizeof(hook_vec_t) + count * sizeof(hook_fn_t));
+	vec->count = count;
 
-	priv = mowgli_heap_alloc(hook_privfn_heap);
-	priv->hookfn = handler;
+	return vec;
+}
+
+void hook_del_event(const char *name)
+{
+	hook_t *h;
 
-	addfn(priv, &priv->node, &hook->hooks);
+	if ((h = hook_find(name)) == NULL)
+		return;
 
-	return priv;
+	/* the hook itself stays, call sites may have cached it */
+	hook_set_vec(h, NULL);
 }
 
-void hook_add_hook(const char *event, hookfn_t handler)
+void hook_del_hook(const char *event, hookfn_t handler)
 {
 	hook_t *h;
-	hook_privfn_ctx_t *priv;
+	hook_vec_t *vec;
+	unsigned int i, j;
 
 	return_if_fail(event != NULL);
 	return_if_fail(handler != NULL);
 
 	h = hook_find(event);
-	if (h == NULL)
-		h = hook_add_event(event);
+	if (h == NULL || !hook_vec_contains(h->vec, handler))
+		return;
+
+	vec = hook_vec_alloc(h->vec->count);
 
-	hook_create_and_add(h, handler, mowgli_node_add);
+	for (i = j = 0; i < h->vec->count; i++)
+		if (h->vec->fns[i].fn != handler)
+			vec->fns[j++] = h->vec->fns[i];
+
+	vec->count = j;
+	hook_set_vec(h, vec);
 }
 
-void hook_add_hook_first(const char *event, hookfn_t handler)
+static void hook_add(const char *event, hookfn_t handler, bool first)
 {
 	hook_t *h;
+	hook_vec_t *vec;
+	unsigned int count;
 
 	return_if_fail(event != NULL);
 	return_if_fail(handler != NULL);
 
-	h = hook_find(event);
-	if (h == NULL)
-		h = hook_add_event(event);
+	h = hook_add_event(event);
+
+	count = h->vec != NULL ? h->vec->count : 0;
+	vec = hook_vec_alloc(count + 1);
+
+	if (count > 0)
+		memcpy(vec->fns + (first ? 1 : 0), h->vec->fns, count * sizeof(hook_fn_t));
+
+	vec->fns[first ? 0 : count].fn = handler;
+	vec->fns[first ? 0 : count].prof = profile_entry_get(PROFILE_HOOK, h->name);
 
-	hook_create_and_add(h, handler, mowgli_node_add_head);
+	hook_set_vec(h, vec);
 }
 
-void hook_call_event(const char *event, void *dptr)
+void hook_add_hook(const char *event, hookfn_t handler)
+{
+	hook_add(event, handler, false);
+}
+
+void hook_add_hook_first(const char *event, hookfn_t handler)
+{
+	hook_add(event, handler, true);
+}
+
+/*
+ * hook_call
+ *
+ * Runs the handlers of a hook.
+ *
+ * Inputs:
+ *      - the hook, as returned by hook_add_event()
+ *      - argument for the handlers
+ *
+ * Outputs:
+ *      - none
+ *
+ * Side Effects:
+ *      - handlers removed by an earlier handler of the same call are
+ *        skipped
+ */
+void hook_call(hook_t *hook, void *dptr)
 {
 	hook_run_ctx_t ctx;
-	mowgli_node_t *n, *tn;
-	void (*func)(void *data);
+	hook_vec_t *vec;
+	unsigned long long start;
+	unsigned int i;
 
-	return_if_fail(event != NULL);
+	return_if_fail(hook != NULL);
 
-	ctx.hook = hook_find(event);
-	if (ctx.hook == NULL)
+	if ((vec = hook->vec) == NULL)
 		return;
 
+	vec->refcount++;
+
 	ctx.dptr = dptr;
 	ctx.flags = HF_RUN;
+	ctx.prev = hook_run_stack;
+	hook_run_stack = &ctx;
 
-	mowgli_node_add_head(&ctx, &ctx.node, &hook_run_stack);
-
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, ctx.hook->hooks.head)
+	for (i = 0; i < vec->count; i++)
 	{
-		hook_privfn_ctx_t *priv = n->data;
+		if (vec != hook->vec && !hook_vec_contains(hook->vec, vec->fns[i].fn))
+			continue;
 
-		priv->hookfn(ctx.dptr);
+		start = profile_start(vec->fns[i].prof);
+		vec->fns[i].fn(ctx.dptr);
+		profile_stop(vec->fns[i].prof, start);
 		if (ctx.flags & HF_STOP)
-			goto out;
+			break;
 	}
 
-out:
-	mowgli_node_delete(&ctx.node, &hook_run_stack);
+	hook_run_stack = ctx.prev;
+
+	hook_vec_unref(vec);
 }
 
-static inline hook_run_ctx_t *hook_run_stack_highest(void)
+void hook_call_event(const char *event, void *dptr)
 {
-	if (hook_run_stack.head == NULL)
-		return NULL;
+	hook_t *h;
 
-	return hook_run_stack.head->data;
+	return_if_fail(event != NULL);
+
+	if ((h = hook_find(event)) != NULL)
+		hook_call(h, dptr);
 }
 
 void hook_stop(void)
 {
-	hook_run_ctx_t *ctx;
-
-	ctx = hook_run_stack_highest();
-	if (ctx == NULL)
+	if (hook_run_stack == NULL)
 		return;
 
-	ctx->flags |= HF_STOP;
+	hook_run_stack->flags |= HF_STOP;
 }
 
 void hook_continue(void *newptr)
 {
-	hook_run_ctx_t *ctx;
-
-	ctx = hook_run_stack_highest();
-	if (ctx == NULL)
+	if (hook_run_stack == NULL)
 		return;
 
-	ctx->dptr = newptr;
-	ctx->flags &= ~HF_STOP;
+	hook_run_stack->dptr = newptr;
+	hook_run_stack->flags &= ~HF_STOP;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
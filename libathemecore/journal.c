@@ -0,0 +1,875 @@
+/*
+ * atheme-services: A collection of minimalist IRC services
+ * journal.c: Append-only journal of database changes between full commits.
+ *
+ * Copyright (c) 2026 Atheme Development Group (http://atheme.org)
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+ * IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Changes to accounts, nicks, channel registrations, access lists,
+ * metadata and k/x/q-lines are appended to services.journal as they happen,
+ * one self-contained line per change, and the file is synced every few
+ * seconds.  Before a full commit the journal is moved aside to
+ * services.journal.old; once the commit has reached the disk that file
+ * is removed.  At startup both files are replayed on top of the database,
+ * oldest first.  Every record carries the complete new state of what it
+ * touches, so replaying a record twice is harmless.
+ */
+
+#include "atheme.h"
+
+#define JOURNAL_FILE		"services.journal"
+#define JOURNAL_OLD_FILE	"services.journal.old"
+
+#define JOURNAL_SYNC_INTERVAL	5
+#define JOURNAL_MAX_ARGS	7
+
+static int journal_fd = -1;
+static bool journal_dirty = false;
+static bool journal_active = false;
+static mowgli_eventloop_timer_t *journal_sync_timer = NULL;
+
+static void journal_path(char *buf, size_t len, const char *name)
+{
+	snprintf(buf, len, "%s/%s", datadir, name);
+}
+
+static bool journal_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0)
+	{
+		n = write(fd, buf, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static void journal_sync(void *unused)
+{
+	if (journal_fd < 0 || !journal_dirty)
+		return;
+
+	if (fsync(journal_fd) < 0)
+		slog(LG_ERROR, "journal_sync(): cannot sync %s: %s", JOURNAL_FILE, strerror(errno));
+
+	journal_dirty = false;
+}
+
+static void journal_open(void)
+{
+	char path[BUFSIZE];
+
+	journal_path(path, sizeof path, JOURNAL_FILE);
+
+	if ((journal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600)) < 0)
+	{
+		slog(LG_ERROR, "journal_open(): cannot open %s: %s", path, strerror(errno));
+		wallops(_("\2DATABASE ERROR\2: journal_open(): cannot open %s: %s"), path, strerror(errno));
+		return;
+	}
+
+	fcntl(journal_fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void journal_write(const char *fmt, ...) PRINTFLIKE(1, 2);
+
+static void journal_write(const char *fmt, ...)
+{
+	char buf[BUFSIZE * 4];
+	va_list ap;
+	int len;
+
+	if (journal_fd < 0)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof buf - 1, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || (size_t) len >= sizeof buf - 1)
+	{
+		slog(LG_ERROR, "journal_write(): record too long, change only saved at next commit: %.40s", buf);
+		return;
+	}
+
+	if (strpbrk(buf, "\r\n") != NULL)
+	{
+		slog(LG_ERROR, "journal_write(): record contains a line break, change only saved at next commit: %.40s", buf);
+		return;
+	}
+
+	buf[len++] = '\n';
+
+	if (!journal_write_all(journal_fd, buf, len))
+	{
+		slog(LG_ERROR, "journal_write(): cannot write %s: %s", JOURNAL_FILE, strerror(errno));
+		return;
+	}
+
+	journal_dirty = true;
+}
+
+/*
+ * R E P L A Y
+ */
+
+typedef struct {
+	const char *type;
+	unsigned int nargs;
+	void (*handler)(char **args);
+} journal_handler_t;
+
+static myentity_t *journal_find_setter(const char *name)
+{
+	return strcmp(name, "*") ? myentity_find(name) : NULL;
+}
+
+static chanacs_t *journal_find_chanacs(mychan_t *mc, const char *kind, const char *target)
+{
+	myentity_t *mt;
+
+	switch (*kind)
+	{
+		case 'E':
+			mt = myentity_find_uid(target);
+			break;
+		case 'X':
+			mt = myentity_find_ext(target);
+			break;
+		case 'H':
+			return chanacs_find_host_literal(mc, target, 0);
+		default:
+			return NULL;
+	}
+
+	return mt != NULL ? chanacs_find_literal(mc, mt, 0) : NULL;
+}
+
+static void journal_h_mu(char **args)
+{
+	myuser_t *mu;
+	const char *pass = strcmp(args[2], "*") ? args[2] : "";
+	unsigned int flags = strtoul(args[4], NULL, 10);
+
+	if ((mu = myuser_find_uid(args[0])) == NULL)
+	{
+		if ((mu = myuser_add_id(args[0], args[1], pass, args[3], flags)) == NULL)
+			return;
+
+		mu->registered = strtoul(args[5], NULL, 10);
+		return;
+	}
+
+	if (irccasecmp(entity(mu)->name, args[1]))
+		myuser_rename(mu, args[1]);
+
+	if (strcmp(mu->email, args[3]))
+		myuser_set_email(mu, args[3]);
+
+	mowgli_strlcpy(mu->pass, pass, sizeof mu->pass);
+	mu->flags = flags;
+}
+
+static void journal_h_mud(char **args)
+{
+	myuser_t *mu;
+
+	if ((mu = myuser_find_uid(args[0])) != NULL)
+		object_dispose(mu);
+}
+
+static void journal_h_mn(char **args)
+{
+	myuser_t *mu;
+	mynick_t *mn;
+
+	if ((mu = myuser_find_uid(args[0])) == NULL || mynick_find(args[1]) != NULL)
+		return;
+
+	mn = mynick_add(mu, args[1]);
+	mn->registered = strtoul(args[2], NULL, 10);
+}
+
+static void journal_h_mnd(char **args)
+{
+	mynick_t *mn;
+
+	if ((mn = mynick_find(args[0])) != NULL)
+		object_unref(mn);
+}
+
+static void journal_h_mc(char **args)
+{
+	mychan_t *mc;
+
+	if (mychan_find(args[0]) != NULL)
+		return;
+
+	mc = mychan_add(args[0]);
+	mc->registered = strtoul(args[1], NULL, 10);
+}
+
+static void journal_h_mcd(char **args)
+{
+	mychan_t *mc;
+
+	if ((mc = mychan_find(args[0])) != NULL)
+		object_unref(mc);
+}
+
+static void journal_h_ca(char **args)
+{
+	mychan_t *mc;
+	myentity_t *mt = NULL;
+	chanacs_t *ca;
+	unsigned int level = flags_to_bitmask(args[3], 0);
+	time_t ts = strtoul(args[4], NULL, 10);
+
+	if ((mc = mychan_find(args[0])) == NULL)
+		return;
+
+	if ((ca = journal_find_chanacs(mc, args[1], args[2])) != NULL)
+	{
+		ca->level = level & ca_all;
+		ca->tmodified = ts;
+		return;
+	}
+
+	if (*args[1] == 'H')
+	{
+		chanacs_add_host(mc, args[2], level, ts, journal_find_setter(args[5]));
+		return;
+	}
+
+	if (*args[1] == 'E')
+		mt = myentity_find_uid(args[2]);
+	else if (*args[1] == 'X')
+		mt = myentity_find_ext(args[2]);
+
+	if (mt != NULL)
+		chanacs_add(mc, mt, level, ts, journal_find_setter(args[5]));
+}
+
+static void journal_h_cad(char **args)
+{
+	mychan_t *mc;
+	chanacs_t *ca;
+
+	if ((mc = mychan_find(args[0])) == NULL)
+		return;
+
+	if ((ca = journal_find_chanacs(mc, args[1], args[2])) != NULL)
+		object_unref(ca);
+}
+
+static void journal_set_metadata(void *target, const char *name, const char *value)
+{
+	if (target == NULL)
+		return;
+
+	if (value != NULL)
+		metadata_add(target, name, value);
+	else
+		metadata_delete(target, name);
+}
+
+static void journal_h_mdu(char **args)
+{
+	journal_set_metadata(myuser_find_uid(args[0]), args[1], args[2]);
+}
+
+static void journal_h_mdc(char **args)
+{
+	journal_set_metadata(mychan_find(args[0]), args[1], args[2]);
+}
+
+static void journal_h_mda(char **args)
+{
+	mychan_t *mc;
+
+	if ((mc = mychan_find(args[0])) == NULL)
+		return;
+
+	journal_set_metadata(journal_find_chanacs(mc, args[1], args[2]), args[3], args[4]);
+}
+
+static void journal_h_kl(char **args)
+{
+	kline_t *k;
+	unsigned long id = strtoul(args[0], NULL, 10);
+
+	if (kline_find_num(id) != NULL)
+		return;
+
+	k = kline_add_with_id(args[1], args[2], args[6], strtol(args[3], NULL, 10), args[5], id);
+	k->settime = strtoul(args[4], NULL, 10);
+	k->expires = k->settime + k->duration;
+
+	if (id > me.kline_id)
+		me.kline_id = id;
+}
+
+static void journal_h_kld(char **args)
+{
+	kline_t *k;
+
+	if ((k = kline_find_num(strtoul(args[0], NULL, 10))) != NULL)
+		kline_delete(k);
+}
+
+/* the number is left to xline_add(), as when the database is loaded;
+ * the counter it comes from starts over in every process */
+static void journal_h_xl(char **args)
+{
+	xline_t *x;
+
+	if (xline_find(args[1]) != NULL)
+		return;
+
+	x = xline_add(args[1], args[5], strtol(args[2], NULL, 10), args[4]);
+	x->settime = strtoul(args[3], NULL, 10);
+	x->expires = x->settime + x->duration;
+}
+
+static void journal_h_xld(char **args)
+{
+	if (xline_find(args[0]) != NULL)
+		xline_delete(args[0]);
+}
+
+/* the number is left to qline_add(), see journal_h_xl() */
+static void journal_h_ql(char **args)
+{
+	qline_t *q;
+
+	if (qline_find(args[1]) != NULL)
+		return;
+
+	q = qline_add(args[1], args[5], strtol(args[2], NULL, 10), args[4]);
+	q->settime = strtoul(args[3], NULL, 10);
+	q->expires = q->settime + q->duration;
+}
+
+static void journal_h_qld(char **args)
+{
+	if (qline_find(args[0]) != NULL)
+		qline_delete(args[0]);
+}
+
+/* the last argument of each record runs to the end of the line */
+static const journal_handler_t journal_handlers[] = {
+	{ "MU",		6,	journal_h_mu },
+	{ "MUD",	1,	journal_h_mud },
+	{ "MN",		3,	journal_h_mn },
+	{ "MND",	1,	journal_h_mnd },
+	{ "MC",		2,	journal_h_mc },
+	{ "MCD",	1,	journal_h_mcd },
+	{ "CA",		6,	journal_h_ca },
+	{ "CAD",	3,	journal_h_cad },
+	{ "MDU",	3,	journal_h_mdu },
+	{ "MDUD",	2,	journal_h_mdu },
+	{ "MDC",	3,	journal_h_mdc },
+	{ "MDCD",	2,	journal_h_mdc },
+	{ "MDA",	5,	journal_h_mda },
+	{ "MDAD",	4,	journal_h_mda },
+	{ "KL",		7,	journal_h_kl },
+	{ "KLD",	1,	journal_h_kld },
+	{ "XL",		6,	journal_h_xl },
+	{ "XLD",	1,	journal_h_xld },
+	{ "QL",		6,	journal_h_ql },
+	{ "QLD",	1,	journal_h_qld },
+};
+
+static bool journal_replay_line(char *line)
+{
+	char *args[JOURNAL_MAX_ARGS + 1];
+	char *type, *p;
+	unsigned int i, j;
+
+	type = line;
+	if ((p = strchr(line, ' ')) != NULL)
+		*p++ = '\0';
+
+	for (i = 0; i < ARRAY_SIZE(journal_handlers); i++)
+	{
+		if (strcmp(journal_handlers[i].type, type))
+			continue;
+
+		memset(args, 0, sizeof args);
+
+		for (j = 0; j < journal_handlers[i].nargs; j++)
+		{
+			if (p == NULL)
+				return false;
+
+			args[j] = p;
+
+			if (j + 1 < journal_handlers[i].nargs && (p = strchr(p, ' ')) != NULL)
+				*p++ = '\0';
+		}
+
+		journal_handlers[i].handler(args);
+		return true;
+	}
+
+	return false;
+}
+
+static void journal_replay(const char *name)
+{
+	char path[BUFSIZE];
+	char buf[BUFSIZE * 4];
+	FILE *f;
+	char *p;
+	unsigned int line = 0, rows = 0;
+
+	journal_path(path, sizeof path, name);
+
+	if ((f = fopen(path, "r")) == NULL)
+	{
+		if (errno != ENOENT)
+		{
+			slog(LG_ERROR, "journal_replay(): cannot open %s: %s", path, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		return;
+	}
+
+	journal_active = true;
+
+	while (fgets(buf, sizeof buf, f) != NULL)
+	{
+		line++;
+
+		/* a record without its newline was cut short by a crash */
+		if ((p = strchr(buf, '\n')) == NULL)
+		{
+			slog(LG_INFO, "journal_replay(): %s line %u: incomplete record, ignoring it", path, line);
+			break;
+		}
+
+		*p = '\0';
+
+		if (journal_replay_line(buf))
+			rows++;
+		else
+			slog(LG_INFO, "journal_replay(): %s line %u: malformed record, ignoring it", path, line);
+	}
+
+	fclose(f);
+
+	slog(LG_INFO, "journal_replay(): replayed %u changes from %s", rows, path);
+}
+
+/*
+ * L I F E C Y C L E
+ */
+
+/*
+ * journal_init()
+ *
+ * Replays a journal left by an earlier run on top of the freshly loaded
+ * database, then starts journaling if db_journal is set.
+ *
+ * Inputs:
+ *      - none
+ *
+ * Outputs:
+ *      - none
+ *
+ * Side Effects:
+ *      - the database may be changed.
+ *      - the journal is opened for writing.
+ */
+void journal_init(void)
+{
+	journal_replay(JOURNAL_OLD_FILE);
+	journal_replay(JOURNAL_FILE);
+
+	if (!config_options.db_journal || readonly)
+		return;
+
+	journal_active = true;
+	journal_open();
+
+	journal_sync_timer = mowgli_timer_add(base_eventloop, "journal_sync", journal_sync, NULL, JOURNAL_SYNC_INTERVAL);
+}
+
+void journal_shutdown(void)
+{
+	if (journal_sync_timer != NULL)
+	{
+		mowgli_timer_destroy(base_eventloop, journal_sync_timer);
+		journal_sync_timer = NULL;
+	}
+
+	if (journal_fd < 0)
+		return;
+
+	journal_sync(NULL);
+	close(journal_fd);
+	journal_fd = -1;
+}
+
+/* appends one file to another, then removes the first */
+static bool journal_append_file(const char *from, const char *to)
+{
+	char buf[BUFSIZE * 4];
+	int in, out;
+	ssize_t n;
+	bool ok = true;
+
+	if ((in = open(from, O_RDONLY)) < 0)
+		return errno == ENOENT;
+
+	if ((out = open(to, O_WRONLY | O_CREAT | O_APPEND, 0600)) < 0)
+	{
+		close(in);
+		return false;
+	}
+
+	while (ok && (n = read(in, buf, sizeof buf)) != 0)
+	{
+		if (n < 0)
+		{
+			if (errno != EINTR)
+				ok = false;
+			continue;
+		}
+
+		ok = journal_write_all(out, buf, n);
+	}
+
+	if (ok && fsync(out) < 0)
+		ok = false;
+
+	close(in);
+	if (close(out) < 0)
+		ok = false;
+
+	if (ok)
+		unlink(from);
+
+	return ok;
+}
+
+/*
+ * journal_rotate()
+ *
+ * Moves the current journal aside before a full commit; everything in it
+ * will be part of the snapshot about to be written.
+ *
+ * Inputs:
+ *      - none
+ *
+ * Outputs:
+ *      - none
+ *
+ * Side Effects:
+ *      - the journal is moved to services.journal.old, or appended to it
+ *        if an earlier commit has not completed.
+ *      - a new, empty journal is opened.
+ */
+void journal_rotate(void)
+{
+	char path[BUFSIZE], oldpath[BUFSIZE];
+	struct stat sb;
+
+	if (!journal_active)
+		return;
+
+	if (journal_fd >= 0)
+	{
+		journal_sync(NULL);
+		close(journal_fd);
+		journal_fd = -1;
+	}
+
+	journal_path(path, sizeof path, JOURNAL_FILE);
+	journal_path(oldpath, sizeof oldpath, JOURNAL_OLD_FILE);
+
+	/* if the previous commit failed, its records are still needed */
+	if (stat(oldpath, &sb) < 0 && errno == ENOENT)
+	{
+		if (rename(path, oldpath) < 0 && errno != ENOENT)
+			slog(LG_ERROR, "journal_rotate(): cannot rename %s to %s: %s", path, oldpath, strerror(errno));
+	}
+	else if (!journal_append_file(path, oldpath))
+		slog(LG_ERROR, "journal_rotate(): cannot append %s to %s: %s", path, oldpath, strerror(errno));
+
+	if (config_options.db_journal && !readonly)
+		journal_open();
+}
+
+/*
+ * journal_commit()
+ *
+ * Drops the journal records covered by a full commit that has reached
+ * the disk.
+ *
+ * Inputs:
+ *      - none
+ *
+ * Outputs:
+ *      - none
+ *
+ * Side Effects:
+ *      - services.journal.old is removed.
+ */
+void journal_commit(void)
+{
+	char oldpath[BUFSIZE];
+
+	if (!journal_active)
+		return;
+
+	journal_path(oldpath, sizeof oldpath, JOURNAL_OLD_FILE);
+
+	if (unlink(oldpath) < 0 && errno != ENOENT)
+		slog(LG_ERROR, "journal_commit(): cannot remove %s: %s", oldpath, strerror(errno));
+
+	/* a journal replayed with db_journal off is not needed any more */
+	if (journal_fd < 0)
+		journal_active = false;
+}
+
+/*
+ * R E C O R D S
+ */
+
+static const char *journal_setter(chanacs_t *ca)
+{
+	return ca->setter != NULL ? ca->setter : "*";
+}
+
+/* writes the kind and target of a channel access entry */
+static bool journal_chanacs_target(chanacs_t *ca, char *buf, size_t len)
+{
+	if (ca->host != NULL)
+		snprintf(buf, len, "H %s", ca->host);
+	else if (isdynamic(ca->entity))
+		snprintf(buf, len, "X %s", ca->entity->name);
+	else if (*ca->entity->id != '\0')
+		snprintf(buf, len, "E %s", ca->entity->id);
+	else
+		return false;
+
+	return true;
+}
+
+void journal_myuser(myuser_t *mu)
+{
+	if (journal_fd < 0 || *entity(mu)->id == '\0')
+		return;
+
+	journal_write("MU %s %s %s %s %u %lu", entity(mu)->id, entity(mu)->name,
+			*mu->pass != '\0' ? mu->pass : "*", mu->email,
+			mu->flags, (unsigned long) mu->registered);
+}
+
+void journal_myuser_delete(myuser_t *mu)
+{
+	if (journal_fd < 0 || *entity(mu)->id == '\0')
+		return;
+
+	journal_write("MUD %s", entity(mu)->id);
+}
+
+void journal_mynick(mynick_t *mn)
+{
+	if (journal_fd < 0 || *entity(mn->owner)->id == '\0')
+		return;
+
+	journal_write("MN %s %s %lu", entity(mn->owner)->id, mn->nick, (unsigned long) mn->registered);
+}
+
+void journal_mynick_delete(mynick_t *mn)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("MND %s", mn->nick);
+}
+
+void journal_mychan(mychan_t *mc)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("MC %s %lu", mc->name, (unsigned long) mc->registered);
+}
+
+void journal_mychan_delete(mychan_t *mc)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("MCD %s", mc->name);
+}
+
+void journal_chanacs(chanacs_t *ca)
+{
+	char target[BUFSIZE];
+
+	/* entries are created empty and filled in by chanacs_modify() */
+	if (journal_fd < 0 || ca->level == 0)
+		return;
+
+	if (!journal_chanacs_target(ca, target, sizeof target))
+		return;
+
+	journal_write("CA %s %s %s %lu %s", ca->mychan->name, target,
+			bitmask_to_flags2(ca->level, 0), (unsigned long) ca->tmodified,
+			journal_setter(ca));
+}
+
+void journal_chanacs_delete(chanacs_t *ca)
+{
+	char target[BUFSIZE];
+
+	/* dropping the channel takes its access list along */
+	if (journal_fd < 0 || object(ca->mychan)->refcount == -1)
+		return;
+
+	if (!journal_chanacs_target(ca, target, sizeof target))
+		return;
+
+	journal_write("CAD %s %s", ca->mychan->name, target);
+}
+
+/*
+ * journal_metadata(void *target, const char *name, const char *value)
+ *
+ * Journals a metadata change on an account, channel registration or
+ * access entry; other objects' metadata is not saved.
+ *
+ * Inputs:
+ *      - object the metadata belongs to
+ *      - metadata key
+ *      - new value, or NULL if the key was deleted
+ *
+ * Outputs:
+ *      - none
+ *
+ * Side Effects:
+ *      - a record is appended to the journal.
+ */
+void journal_metadata(void *target, const char *name, const char *value)
+{
+	char key[BUFSIZE * 2], ctarget[BUFSIZE];
+	chanacs_t *ca;
+
+	/* objects being destroyed take their metadata along */
+	if (journal_fd < 0 || object(target)->refcount == -1)
+		return;
+
+	switch (myobject_type(target))
+	{
+		case MYOBJECT_MYUSER:
+			if (*entity(target)->id == '\0')
+				return;
+			snprintf(key, sizeof key, "MDU%s %s %s", value != NULL ? "" : "D", entity(target)->id, name);
+			break;
+		case MYOBJECT_MYCHAN:
+			snprintf(key, sizeof key, "MDC%s %s %s", value != NULL ? "" : "D", ((mychan_t *) target)->name, name);
+			break;
+		case MYOBJECT_CHANACS:
+			ca = target;
+			if (!journal_chanacs_target(ca, ctarget, sizeof ctarget))
+				return;
+			snprintf(key, sizeof key, "MDA%s %s %s %s", value != NULL ? "" : "D", ca->mychan->name, ctarget, name);
+			break;
+		default:
+			return;
+	}
+
+	if (value != NULL)
+		journal_write("%s %s", key, value);
+	else
+		journal_write("%s", key);
+}
+
+void journal_kline(kline_t *k)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("KL %lu %s %s %ld %lu %s %s", k->number, k->user, k->host,
+			k->duration, (unsigned long) k->settime, k->setby, k->reason);
+}
+
+void journal_kline_delete(kline_t *k)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("KLD %lu", k->number);
+}
+
+void journal_xline(xline_t *x)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("XL %u %s %ld %lu %s %s", x->number, x->realname,
+			x->duration, (unsigned long) x->settime, x->setby, x->reason);
+}
+
+void journal_xline_delete(xline_t *x)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("XLD %s", x->realname);
+}
+
+void journal_qline(qline_t *q)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("QL %u %s %ld %lu %s %s", q->number, q->mask,
+			q->duration, (unsigned long) q->settime, q->setby, q->reason);
+}
+
+void journal_qline_delete(qline_t *q)
+{
+	if (journal_fd < 0)
+		return;
+
+	journal_write("QLD %s", q->mask);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -23,11 +23,129 @@
 
 #include "atheme.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 static logfile_t *log_file;
 int log_force;
 
 static mowgli_list_t log_files = { NULL, NULL, 0 };
 
+/* union of the masks of all registered log streams, so that messages
+ * nobody wants are dropped before they are formatted.
+ */
+static unsigned int log_mask_all;
+
+#ifdef HAVE_PTHREAD
+/*
+ * File log streams are written by a separate thread, so that a slow disk
+ * does not hold up the event loop. Formatted lines are put into a ring
+ * which only the main thread appends to and only the writer thread takes
+ * from; the two indexes grow freely and are only ever advanced by their
+ * owner, so neither side needs the lock to pass a line. The lock and
+ * condition variables are only used to put the writer to sleep while the
+ * ring is empty, and the main thread while it is full and
+ * general::log_queue_block is set.
+ */
+typedef struct {
+	FILE *file;
+	size_t len;
+	char line[BUFSIZE + 64];
+} log_entry_t;
+
+static struct {
+	log_entry_t *ring;
+	unsigned int size;	/* power of two */
+	unsigned int head;	/* next entry to write, advanced by the writer */
+	unsigned int tail;	/* next free entry, advanced by the main thread */
+	bool sleeping;
+	bool stop;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;	/* main thread -> writer */
+	pthread_cond_t drained;	/* writer -> main thread */
+} log_queue;
+
+static bool log_queue_running = false;
+#endif
+
+static void logfile_update_mask(void)
+{
+	mowgli_node_t *n;
+
+	log_mask_all = 0;
+
+	MOWGLI_ITER_FOREACH(n, log_files.head)
+	{
+		logfile_t *lf = n->data;
+
+		log_mask_all |= lf->log_mask;
+	}
+}
+
+/*
+ * log_level_wanted(unsigned int level)
+ *
+ * Determines whether any log stream, or the terminal during startup,
+ * would take a message at the given level.
+ *
+ * Inputs:
+ *       - bitmask of log categories
+ *
+ * Outputs:
+ *       - whether the message needs to be formatted at all
+ *
+ * Side Effects:
+ *       - none
+ */
+static inline bool log_level_wanted(unsigned int level)
+{
+	unsigned int mask = log_mask_all;
+
+	if (log_force)
+		return true;
+
+	if (runflags & (RF_LIVE | RF_STARTING) && log_file == NULL)
+		mask |= LG_ERROR | LG_INFO;
+
+	return (level & mask) != 0;
+}
+
+/*
+ * log_timestamp(void)
+ *
+ * Returns the timestamp log lines are prefixed with. It is only
+ * reformatted when the second changes.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - "[YYYY-mm-dd HH:MM:SS]" for the current time
+ *
+ * Side Effects:
+ *       - none
+ */
+static const char *log_timestamp(void)
+{
+	static char datetime[64];
+	static time_t last = 0;
+	time_t t;
+	struct tm tm;
+
+	time(&t);
+	if (t != last || datetime[0] == '\0')
+	{
+		tm = *localtime(&t);
+		strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", &tm);
+		last = t;
+	}
+
+	return datetime;
+}
+
 /* private destructor function for logfile_t. */
 static void logfile_delete_file(void *vdata)
 {
@@ -35,6 +153,9 @@ static void logfile_delete_file(void *vdata)
 
 	logfile_unregister(lf);
 
+	/* lines for this file may still be queued */
+	log_queue_flush();
+
 	fclose(lf->log_file);
 	free(lf->log_path);
 	metadata_delete_all(lf);
@@ -169,10 +290,265 @@ logfile_strip_control_codes(const char *buf)
 	return outbuf;
 }
 
+#ifdef HAVE_PTHREAD
+static void *log_writer(void *unused)
+{
+	FILE *files[16];
+	unsigned int head, tail, nfiles, i;
+	bool stop;
+
+	for (;;)
+	{
+		head = log_queue.head;
+		tail = __atomic_load_n(&log_queue.tail, __ATOMIC_SEQ_CST);
+
+		if (head == tail)
+		{
+			pthread_mutex_lock(&log_queue.lock);
+			pthread_cond_broadcast(&log_queue.drained);
+
+			/* the main thread checks sleeping after advancing tail,
+			 * so one of us always sees the other.
+			 */
+			__atomic_store_n(&log_queue.sleeping, true, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&log_queue.tail, __ATOMIC_SEQ_CST) == head && !log_queue.stop)
+				pthread_cond_wait(&log_queue.wakeup, &log_queue.lock);
+			__atomic_store_n(&log_queue.sleeping, false, __ATOMIC_SEQ_CST);
+
+			stop = log_queue.stop && __atomic_load_n(&log_queue.tail, __ATOMIC_SEQ_CST) == head;
+			pthread_mutex_unlock(&log_queue.lock);
+
+			if (stop)
+				break;
+			continue;
+		}
+
+		/* write everything queued so far, then flush each file once */
+		nfiles = 0;
+		for (; head != tail; head++)
+		{
+			log_entry_t *e = &log_queue.ring[head & (log_queue.size - 1)];
+
+			fwrite(e->line, 1, e->len, e->file);
+
+			for (i = 0; i < nfiles && files[i] != e->file; i++)
+				;
+			if (i == nfiles)
+			{
+				if (nfiles == sizeof files / sizeof files[0])
+					fflush(files[--nfiles]);
+				files[nfiles++] = e->file;
+			}
+
+			/* the entry has been copied out, it may be reused */
+			__atomic_store_n(&log_queue.head, head + 1, __ATOMIC_RELEASE);
+		}
+
+		for (i = 0; i < nfiles; i++)
+			fflush(files[i]);
+
+		pthread_mutex_lock(&log_queue.lock);
+		pthread_cond_broadcast(&log_queue.drained);
+		pthread_mutex_unlock(&log_queue.lock);
+	}
+
+	return NULL;
+}
+
+static void log_queue_wake(void)
+{
+	pthread_mutex_lock(&log_queue.lock);
+	pthread_cond_signal(&log_queue.wakeup);
+	pthread_mutex_unlock(&log_queue.lock);
+}
+
+static bool log_queue_put(FILE *f, const char *line, size_t len)
+{
+	unsigned int tail = log_queue.tail;
+	log_entry_t *e;
+
+	if (tail - __atomic_load_n(&log_queue.head, __ATOMIC_ACQUIRE) == log_queue.size)
+	{
+		if (!config_options.log_queue_block)
+		{
+			cnt.log_dropped++;
+			return false;
+		}
+
+		pthread_mutex_lock(&log_queue.lock);
+		while (tail - __atomic_load_n(&log_queue.head, __ATOMIC_ACQUIRE) == log_queue.size)
+		{
+			pthread_cond_signal(&log_queue.wakeup);
+			pthread_cond_wait(&log_queue.drained, &log_queue.lock);
+		}
+		pthread_mutex_unlock(&log_queue.lock);
+	}
+
+	e = &log_queue.ring[tail & (log_queue.size - 1)];
+	e->file = f;
+	e->len = len;
+	memcpy(e->line, line, len);
+
+	__atomic_store_n(&log_queue.tail, tail + 1, __ATOMIC_SEQ_CST);
+	cnt.log_queued++;
+
+	if (__atomic_load_n(&log_queue.sleeping, __ATOMIC_SEQ_CST))
+		log_queue_wake();
+
+	return true;
+}
+
+/* make sure nothing is half-written when we fork, and that the child,
+ * which has no writer thread, writes its own lines directly.
+ */
+static void log_queue_atfork_prepare(void)
+{
+	log_queue_flush();
+}
+
+static void log_queue_atfork_child(void)
+{
+	log_queue_running = false;
+}
+#endif
+
+/*
+ * log_queue_start(void)
+ *
+ * Starts the thread writing file log streams, if general::log_queue_size
+ * is not 0. Until then, and if it cannot be started, files are written
+ * directly.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - a writer thread is created.
+ */
+void log_queue_start(void)
+{
+#ifdef HAVE_PTHREAD
+	static bool atfork = false;
+	sigset_t all, old;
+	int err;
+
+	if (log_queue_running || config_options.log_queue_size == 0)
+		return;
+
+	log_queue.size = 1;
+	while (log_queue.size < config_options.log_queue_size)
+		log_queue.size <<= 1;
+	log_queue.ring = smalloc(log_queue.size * sizeof(log_entry_t));
+	log_queue.head = log_queue.tail = 0;
+	log_queue.sleeping = log_queue.stop = false;
+
+	pthread_mutex_init(&log_queue.lock, NULL);
+	pthread_cond_init(&log_queue.wakeup, NULL);
+	pthread_cond_init(&log_queue.drained, NULL);
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	err = pthread_create(&log_queue.thread, NULL, log_writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+	{
+		pthread_cond_destroy(&log_queue.drained);
+		pthread_cond_destroy(&log_queue.wakeup);
+		pthread_mutex_destroy(&log_queue.lock);
+		free(log_queue.ring);
+		log_queue.ring = NULL;
+
+		slog(LG_ERROR, "log_queue_start(): cannot start the log writer, writing log files directly: %s", strerror(err));
+		return;
+	}
+
+	if (!atfork)
+	{
+		pthread_atfork(log_queue_atfork_prepare, NULL, log_queue_atfork_child);
+		atfork = true;
+	}
+
+	log_queue_running = true;
+#endif
+}
+
+/*
+ * log_queue_stop(void)
+ *
+ * Writes out everything still queued and stops the writer thread.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - file log streams are written directly from now on.
+ */
+void log_queue_stop(void)
+{
+#ifdef HAVE_PTHREAD
+	if (!log_queue_running)
+		return;
+
+	pthread_mutex_lock(&log_queue.lock);
+	log_queue.stop = true;
+	pthread_cond_signal(&log_queue.wakeup);
+	pthread_mutex_unlock(&log_queue.lock);
+
+	pthread_join(log_queue.thread, NULL);
+	log_queue_running = false;
+
+	pthread_cond_destroy(&log_queue.drained);
+	pthread_cond_destroy(&log_queue.wakeup);
+	pthread_mutex_destroy(&log_queue.lock);
+	free(log_queue.ring);
+	log_queue.ring = NULL;
+#endif
+}
+
+/*
+ * log_queue_flush(void)
+ *
+ * Waits until the writer thread has written and flushed every queued line.
+ *
+ * Inputs:
+ *       - none
+ *
+ * Outputs:
+ *       - none
+ *
+ * Side Effects:
+ *       - none
+ */
+void log_queue_flush(void)
+{
+#ifdef HAVE_PTHREAD
+	if (!log_queue_running)
+		return;
+
+	pthread_mutex_lock(&log_queue.lock);
+	while (__atomic_load_n(&log_queue.head, __ATOMIC_ACQUIRE) != log_queue.tail ||
+			!__atomic_load_n(&log_queue.sleeping, __ATOMIC_SEQ_CST))
+	{
+		pthread_cond_signal(&log_queue.wakeup);
+		pthread_cond_wait(&log_queue.drained, &log_queue.lock);
+	}
+	pthread_mutex_unlock(&log_queue.lock);
+#endif
+}
+
 /*
  * logfile_write(logfile_t *lf, const char *buf)
  *
- * Writes an I/O stream to a static file.
+ * Writes an I/O stream to a static file, or queues it for the writer
+ * thread.
  *
  * Inputs:
  *       - logfile_t representing the I/O stream.
@@ -186,19 +562,47 @@ logfile_strip_control_codes(const char *buf)
  */
 static void logfile_write(logfile_t *lf, const char *buf)
 {
-	char datetime[BUFSIZE];
-	time_t t;
-	struct tm tm;
+	char line[BUFSIZE + 64];
+	int len;
 
 	return_if_fail(lf != NULL);
 	return_if_fail(lf->log_file != NULL);
 	return_if_fail(buf != NULL);
 
-	time(&t);
-	tm = *localtime(&t);
-	strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", &tm);
+	len = snprintf(line, sizeof line, "%s %s\n", log_timestamp(), logfile_strip_control_codes(buf));
+	if (len < 0)
+		return;
+	if ((size_t) len >= sizeof line)
+	{
+		len = sizeof line - 1;
+		line[len - 1] = '\n';
+	}
+
+#ifdef HAVE_PTHREAD
+	if (log_queue_running)
+	{
+		if (lf->log_dropped != 0)
+		{
+			char note[BUFSIZE];
+			int notelen;
 
-	fprintf((FILE *) lf->log_file, "%s %s\n", datetime, logfile_strip_control_codes(buf));
+			notelen = snprintf(note, sizeof note, "%s %u log messages were dropped because the log queue was full\n",
+					log_timestamp(), lf->log_dropped);
+			if (!log_queue_put(lf->log_file, note, notelen))
+			{
+				lf->log_dropped++;
+				return;
+			}
+			lf->log_dropped = 0;
+		}
+
+		if (!log_queue_put(lf->log_file, line, len))
+			lf->log_dropped++;
+		return;
+	}
+#endif
+
+	fwrite(line, 1, len, (FILE *) lf->log_file);
 	fflush((FILE *) lf->log_file);
 }
 
@@ -311,6 +715,7 @@ static void logfile_write_snotices(logfile_t *lf, const char *buf)
 void logfile_register(logfile_t *lf)
 {
 	mowgli_node_add(lf, &lf->node, &log_files);
+	logfile_update_mask();
 }
 
 /*
@@ -330,6 +735,7 @@ void logfile_register(logfile_t *lf)
 void logfile_unregister(logfile_t *lf)
 {
 	mowgli_node_delete(&lf->node, &log_files);
+	logfile_update_mask();
 }
 
 /*
@@ -476,18 +882,7 @@ void log_shutdown(void)
  */
 bool log_debug_enabled(void)
 {
-	mowgli_node_t *n;
-	logfile_t *lf;
-
-	if (log_force)
-		return true;
-	MOWGLI_ITER_FOREACH(n, log_files.head)
-	{
-		lf = n->data;
-		if (lf->log_mask & (LG_DEBUG | LG_RAWDATA))
-			return true;
-	}
-	return false;
+	return log_force || (log_mask_all & (LG_DEBUG | LG_RAWDATA));
 }
 
 /*
@@ -510,6 +905,7 @@ void log_master_set_mask(unsigned int mask)
 	if (log_file == NULL)
 		return;
 	log_file->log_mask = mask;
+	logfile_update_mask();
 }
 
 /*
@@ -558,20 +954,13 @@ static void vslog_ext(log_type_t type, unsigned int level, const char *fmt,
 	static bool in_slog = false;
 	char buf[BUFSIZE];
 	mowgli_node_t *n;
-	char datetime[BUFSIZE];
-	time_t t;
-	struct tm tm;
 
-	if (in_slog)
+	if (in_slog || !log_level_wanted(level))
 		return;
 	in_slog = true;
 
 	vsnprintf(buf, BUFSIZE, fmt, args);
 
-	time(&t);
-	tm = *localtime(&t);
-	strftime(datetime, sizeof datetime, "[%Y-%m-%d %H:%M:%S]", &tm);
-
 	MOWGLI_ITER_FOREACH(n, log_files.head)
 	{
 		logfile_t *lf = (logfile_t *) n->data;
@@ -593,7 +982,7 @@ static void vslog_ext(log_type_t type, unsigned int level, const char *fmt,
 	if (type != LOG_INTERACTIVE && ((runflags & (RF_LIVE | RF_STARTING) &&
 		(log_file != NULL ? log_file->log_mask : LG_ERROR | LG_INFO) & level) ||
 		(runflags & RF_LIVE && log_force)))
-		fprintf(stderr, "%s %s\n", datetime, logfile_strip_control_codes(buf));
+		fprintf(stderr, "%s %s\n", log_timestamp(), logfile_strip_control_codes(buf));
 
 	in_slog = false;
 }
@@ -658,6 +1047,9 @@ void logcommand(sourceinfo_t *si, int level, const char *fmt, ...)
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!log_level_wanted(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -692,6 +1084,9 @@ void logcommand_user(service_t *svs, user_t *source, int level, const char *fmt,
 	char accountbuf[NICKLEN * 5]; /* entity name len is NICKLEN * 4, plus another for the ID */
 	bool showaccount;
 
+	if (!log_level_wanted(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -744,6 +1139,9 @@ void logcommand_external(service_t *svs, const char *type, connection_t *source,
 	va_list args;
 	char lbuf[BUFSIZE];
 
+	if (!log_level_wanted(level))
+		return;
+
 	va_start(args, fmt);
 	vsnprintf(lbuf, BUFSIZE, fmt, args);
 	va_end(args);
@@ -210,6 +210,232 @@ int match(const char *mask, const char *name)
 	return 1;
 }
 
+/*
+ * Compiled masks for match().
+ *
+ * Kline, qline, xline and hostmask chanacs entries are matched against
+ * every user that connects or joins, so their masks are taken apart once
+ * when the entry is created: the case-folded literal prefix, and for masks
+ * that only use '*', the folded literal segments between the stars.  A
+ * compiled mask gives exactly the same answer as match(mask, name); where
+ * it cannot prove that cheaply it asks match() itself.
+ *
+ * match() gives up after MAX_ITERATIONS steps and reports no match, and
+ * needs at most (strlen(name) + 2) * (strlen(mask) + 1) steps, so a
+ * "no match" from the segment scan is always final and a "match" is final
+ * whenever that bound fits.
+ */
+
+#define MATCH_PATTERN_ALL	0	/* only stars, matches everything */
+#define MATCH_PATTERN_LITERAL	1	/* no wildcards at all */
+#define MATCH_PATTERN_GLOB	2	/* literals and '*' only */
+#define MATCH_PATTERN_COMPLEX	3	/* anything else, left to match() */
+
+typedef struct {
+	size_t off;
+	size_t len;
+} match_segment_t;
+
+struct match_pattern_
+{
+	char *mask;
+	unsigned char *fold;
+	size_t len;
+	size_t prefixlen;
+	int type;
+	int mapping;
+
+	bool anchor_start, anchor_end;
+	unsigned int nseg;
+	match_segment_t *seg;
+};
+
+static unsigned char match_fold[256];
+static int match_fold_mapping = -1;
+
+static inline void match_fold_update(void)
+{
+	int c;
+
+	if (match_fold_mapping == match_mapping)
+		return;
+
+	for (c = 0; c < 256; c++)
+		match_fold[c] = ToLower(c);
+
+	match_fold_mapping = match_mapping;
+}
+
+static void match_pattern_fold(match_pattern_t *mp)
+{
+	size_t i;
+
+	match_fold_update();
+
+	for (i = 0; i < mp->len; i++)
+		mp->fold[i] = match_fold[(unsigned char)mp->mask[i]];
+
+	mp->mapping = match_mapping;
+}
+
+match_pattern_t *match_compile(const char *mask)
+{
+	match_pattern_t *mp;
+	size_t i, start;
+
+	return_val_if_fail(mask != NULL, NULL);
+
+	mp = smalloc(sizeof(match_pattern_t));
+	mp->mask = sstrdup(mask);
+	mp->len = strlen(mask);
+	mp->fold = smalloc(mp->len + 1);
+	mp->prefixlen = strcspn(mask, "*?&#%\\");
+
+	match_pattern_fold(mp);
+
+	if (mp->prefixlen == mp->len)
+		mp->type = MATCH_PATTERN_LITERAL;
+	else if (mask[strspn(mask, "*")] == '\0')
+		mp->type = MATCH_PATTERN_ALL;
+	else if (mask[strcspn(mask, "?&#%\\")] != '\0')
+		mp->type = MATCH_PATTERN_COMPLEX;
+	else
+	{
+		mp->type = MATCH_PATTERN_GLOB;
+		mp->anchor_start = mask[0] != '*';
+		mp->anchor_end = mask[mp->len - 1] != '*';
+		mp->seg = smalloc(sizeof(match_segment_t) * (mp->len / 2 + 1));
+
+		for (i = 0; i < mp->len; )
+		{
+			if (mask[i] == '*')
+			{
+				i++;
+				continue;
+			}
+
+			for (start = i; i < mp->len && mask[i] != '*'; i++)
+				;
+
+			mp->seg[mp->nseg].off = start;
+			mp->seg[mp->nseg].len = i - start;
+			mp->nseg++;
+		}
+	}
+
+	return mp;
+}
+
+void match_pattern_free(match_pattern_t *mp)
+{
+	if (mp == NULL)
+		return;
+
+	free(mp->seg);
+	free(mp->fold);
+	free(mp->mask);
+	free(mp);
+}
+
+static inline bool match_segment(const unsigned char *fold, const unsigned char *name, size_t len)
+{
+	while (len--)
+		if (match_fold[*name++] != *fold++)
+			return false;
+
+	return true;
+}
+
+static bool match_pattern_glob(const match_pattern_t *mp, const unsigned char *name, size_t namelen)
+{
+	const match_segment_t *seg = mp->seg, *last = mp->seg + mp->nseg;
+	size_t pos = 0, end = namelen;
+
+	if (mp->anchor_start)
+	{
+		if (seg->len > end || !match_segment(mp->fold + seg->off, name, seg->len))
+			return false;
+		pos = seg->len;
+		seg++;
+	}
+
+	if (mp->anchor_end)
+	{
+		last--;
+		if (last->len > end - pos || !match_segment(mp->fold + last->off, name + end - last->len, last->len))
+			return false;
+		end -= last->len;
+	}
+
+	/* the remaining segments float; taking the leftmost fit of each is enough */
+	for (; seg < last; seg++)
+	{
+		while (end - pos >= seg->len && !match_segment(mp->fold + seg->off, name + pos, seg->len))
+			pos++;
+		if (end - pos < seg->len)
+			return false;
+		pos += seg->len;
+	}
+
+	return true;
+}
+
+/*
+ * match_pattern(match_pattern_t *mp, const char *name)
+ *
+ * Matches a name against a mask compiled with match_compile().
+ *
+ * Inputs:
+ *       - compiled mask
+ *       - name to match
+ *
+ * Outputs:
+ *       - 0 if the name matches, 1 if not, exactly as match() would
+ *
+ * Side Effects:
+ *       - none
+ */
+int match_pattern(match_pattern_t *mp, const char *name)
+{
+	const unsigned char *n = (const unsigned char *)name;
+	size_t namelen;
+
+	if (mp == NULL || name == NULL)
+		return 1;
+
+	match_fold_update();
+	if (mp->mapping != match_mapping)
+		match_pattern_fold(mp);
+
+	switch (mp->type)
+	{
+	case MATCH_PATTERN_ALL:
+		return 0;
+
+	case MATCH_PATTERN_LITERAL:
+		namelen = strlen(name);
+		if (namelen != mp->len || !match_segment(mp->fold, n, namelen))
+			return 1;
+		/* a literal match takes match() one step per character */
+		if (namelen + 2 <= MAX_ITERATIONS)
+			return 0;
+		return match(mp->mask, name);
+
+	case MATCH_PATTERN_GLOB:
+		namelen = strlen(name);
+		if (namelen < mp->prefixlen || !match_pattern_glob(mp, n, namelen))
+			return 1;
+		if ((namelen + 2) * (mp->len + 1) <= MAX_ITERATIONS)
+			return 0;
+		return match(mp->mask, name);
+
+	default:
+		/* match() rejects a differing literal prefix before any wildcard */
+		if (!match_segment(mp->fold, n, mp->prefixlen))
+			return 1;
+		return match(mp->mask, name);
+	}
+}
 
 /*
 ** collapse a pattern string into minimal components.
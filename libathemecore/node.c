@@ -115,6 +115,294 @@ void remove_illegals()
 	}
 }
 
+/*************
+ * I N D E X *
+ *************/
+
+/*
+ * kline_find_user(), xline_find_user() and qline_find_user() run for every
+ * user introduced, so the lines are indexed rather than scanned.  Lines
+ * whose mask has no wildcards are kept in a tree keyed by the case-folded
+ * mask, klines whose host match_ips() can match are also kept in a radix
+ * tree per address family, and everything else stays on a residual list
+ * that is still scanned in order.  When several lines match, the earliest
+ * one on klnlist, xlnlist or qlnlist wins, as it did with the plain scan.
+ * The folded keys depend on the casemapping, so the trees are rebuilt when
+ * it changes.
+ */
+
+typedef struct {
+	mowgli_patricia_t *exact;
+	mowgli_list_t wild;
+} mask_index_t;
+
+typedef struct cidr_node_ cidr_node_t;
+
+struct cidr_node_ {
+	unsigned char addr[16];
+	int bits;
+	cidr_node_t *child[2];
+	mowgli_list_t klines;
+};
+
+static mask_index_t kline_index, xline_index, qline_index;
+static cidr_node_t *kline_cidr4, *kline_cidr6;
+static int index_mapping = -1;
+static unsigned long kline_seq, xline_seq, qline_seq;
+
+static void mask_index_canon(char *key)
+{
+	for (; *key != '\0'; key++)
+		*key = ToLower(*key);
+}
+
+/* short enough that match() always compares a literal mask to the end */
+static bool mask_index_literal(const char *mask)
+{
+	return *mask != '\0' && mask[strcspn(mask, "*?&#%\\")] == '\0' && strlen(mask) <= 500;
+}
+
+static void mask_index_add(mask_index_t *idx, const char *mask, bool exact, mowgli_node_t *n, void *data)
+{
+	mowgli_list_t *l;
+
+	if (!exact)
+	{
+		mowgli_node_add(data, n, &idx->wild);
+		return;
+	}
+
+	if (idx->exact == NULL)
+		idx->exact = mowgli_patricia_create(mask_index_canon);
+
+	if ((l = mowgli_patricia_retrieve(idx->exact, mask)) == NULL)
+	{
+		l = mowgli_list_create();
+		mowgli_patricia_add(idx->exact, mask, l);
+	}
+
+	mowgli_node_add(data, n, l);
+}
+
+static void mask_index_delete(mask_index_t *idx, const char *mask, bool exact, mowgli_node_t *n)
+{
+	mowgli_list_t *l;
+
+	if (!exact)
+	{
+		mowgli_node_delete(n, &idx->wild);
+		return;
+	}
+
+	l = mowgli_patricia_retrieve(idx->exact, mask);
+	return_if_fail(l != NULL);
+
+	mowgli_node_delete(n, l);
+
+	if (MOWGLI_LIST_LENGTH(l) == 0)
+	{
+		mowgli_patricia_delete(idx->exact, mask);
+		mowgli_list_free(l);
+	}
+}
+
+static mowgli_list_t *mask_index_find(mask_index_t *idx, const char *name)
+{
+	if (idx->exact == NULL || name == NULL || *name == '\0')
+		return NULL;
+
+	return mowgli_patricia_retrieve(idx->exact, name);
+}
+
+static void mask_index_free_cb(const char *key, void *data, void *privdata)
+{
+	mowgli_list_free(data);
+}
+
+static void mask_index_clear(mask_index_t *idx)
+{
+	if (idx->exact != NULL)
+		mowgli_patricia_destroy(idx->exact, mask_index_free_cb, NULL);
+
+	idx->exact = NULL;
+	memset(&idx->wild, 0, sizeof idx->wild);
+}
+
+static inline int cidr_bit(const unsigned char *addr, int bit)
+{
+	return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/* number of leading bits two addresses share, at most max */
+static int cidr_common(const unsigned char *a, const unsigned char *b, int max)
+{
+	int i;
+
+	for (i = 0; i < max; i += 8)
+	{
+		unsigned char diff = a[i >> 3] ^ b[i >> 3];
+
+		if (diff != 0)
+		{
+			while (!(diff & 0x80))
+			{
+				diff <<= 1;
+				i++;
+			}
+			return i < max ? i : max;
+		}
+	}
+
+	return max;
+}
+
+static cidr_node_t *cidr_node_create(const unsigned char *addr, int bits)
+{
+	cidr_node_t *node = smalloc(sizeof(cidr_node_t));
+
+	memcpy(node->addr, addr, sizeof node->addr);
+	node->bits = bits;
+
+	return node;
+}
+
+static cidr_node_t *cidr_insert(cidr_node_t **np, const unsigned char *addr, int len)
+{
+	cidr_node_t *node, *split;
+	int common;
+
+	while ((node = *np) != NULL)
+	{
+		common = cidr_common(node->addr, addr, node->bits < len ? node->bits : len);
+
+		if (common == node->bits)
+		{
+			if (node->bits == len)
+				return node;
+
+			np = &node->child[cidr_bit(addr, node->bits)];
+			continue;
+		}
+
+		/* the new prefix leaves this node's path at bit common */
+		split = cidr_node_create(addr, common);
+		split->child[cidr_bit(node->addr, common)] = node;
+		*np = split;
+
+		if (common == len)
+			return split;
+
+		np = &split->child[cidr_bit(addr, common)];
+	}
+
+	return *np = cidr_node_create(addr, len);
+}
+
+static void cidr_remove(cidr_node_t **np, const unsigned char *addr, int len, mowgli_node_t *n)
+{
+	cidr_node_t *node = *np;
+
+	return_if_fail(node != NULL);
+
+	if (node->bits == len)
+		mowgli_node_delete(n, &node->klines);
+	else
+		cidr_remove(&node->child[cidr_bit(addr, node->bits)], addr, len, n);
+
+	/* drop nodes that no longer hold klines or join two subtrees */
+	if (MOWGLI_LIST_LENGTH(&node->klines) == 0 && (node->child[0] == NULL || node->child[1] == NULL))
+	{
+		*np = node->child[0] != NULL ? node->child[0] : node->child[1];
+		free(node);
+	}
+}
+
+/*
+ * A kline is kept in the CIDR tree if match_ips() can match its host, and
+ * in the exact tree if its host is literal and match_ips() on it is
+ * predictable.  Returns the address length for the CIDR tree, or 0.
+ */
+static int kline_index_class(kline_t *k, unsigned char *addr, int *cidrlen, bool *exact)
+{
+	int bits = cidr_parse(k->host, addr, cidrlen);
+
+	*exact = bits >= 0 && mask_index_literal(k->host);
+
+	return bits > 0 ? bits : 0;
+}
+
+static void kline_index_add(kline_t *k)
+{
+	unsigned char addr[16];
+	cidr_node_t *node;
+	int bits, cidrlen;
+	bool exact;
+
+	bits = kline_index_class(k, addr, &cidrlen, &exact);
+
+	mask_index_add(&kline_index, k->host, exact, &k->index_node, k);
+
+	if (bits != 0)
+	{
+		node = cidr_insert(bits == 32 ? &kline_cidr4 : &kline_cidr6, addr, cidrlen);
+		mowgli_node_add(k, &k->cidr_node, &node->klines);
+	}
+}
+
+static void kline_index_delete(kline_t *k)
+{
+	unsigned char addr[16];
+	int bits, cidrlen;
+	bool exact;
+
+	bits = kline_index_class(k, addr, &cidrlen, &exact);
+
+	mask_index_delete(&kline_index, k->host, exact, &k->index_node);
+
+	if (bits != 0)
+		cidr_remove(bits == 32 ? &kline_cidr4 : &kline_cidr6, addr, cidrlen, &k->cidr_node);
+}
+
+/* rebuild the exact trees if the casemapping changed since they were built */
+static void index_check(void)
+{
+	unsigned char addr[16];
+	int cidrlen;
+	bool exact;
+	mowgli_node_t *n;
+
+	if (index_mapping == match_mapping)
+		return;
+
+	index_mapping = match_mapping;
+
+	mask_index_clear(&kline_index);
+	mask_index_clear(&xline_index);
+	mask_index_clear(&qline_index);
+
+	MOWGLI_ITER_FOREACH(n, klnlist.head)
+	{
+		kline_t *k = n->data;
+
+		kline_index_class(k, addr, &cidrlen, &exact);
+		mask_index_add(&kline_index, k->host, exact, &k->index_node, k);
+	}
+
+	MOWGLI_ITER_FOREACH(n, xlnlist.head)
+	{
+		xline_t *x = n->data;
+
+		mask_index_add(&xline_index, x->realname, mask_index_literal(x->realname), &x->index_node, x);
+	}
+
+	MOWGLI_ITER_FOREACH(n, qlnlist.head)
+	{
+		qline_t *q = n->data;
+
+		mask_index_add(&qline_index, q->mask, mask_index_literal(q->mask), &q->index_node, q);
+	}
+}
+
 /*************
  * K L I N E *
  *************/
@@ -126,21 +414,29 @@ kline_t *kline_add_with_id(const char *user, const char *host, const char *reaso
 
 	slog(LG_DEBUG, "kline_add(): %s@%s -> %s (%ld)", user, host, reason, duration);
 
+	index_check();
+
 	k = mowgli_heap_alloc(kline_heap);
 
 	mowgli_node_add(k, n, &klnlist);
 
 	k->user = sstrdup(user);
 	k->host = sstrdup(host);
+	k->user_match = match_compile(user);
+	k->host_match = match_compile(host);
 	k->reason = sstrdup(reason);
 	k->setby = sstrdup(setby);
 	k->duration = duration;
 	k->settime = CURRTIME;
 	k->expires = CURRTIME + duration;
 	k->number = id;
+	k->seq = ++kline_seq;
+
+	kline_index_add(k);
 
 	cnt.kline++;
 
+	journal_kline(k);
 
 	char treason[BUFSIZE];
 	snprintf(treason, sizeof(treason), "[#%lu] %s", k->number, k->reason);
@@ -171,14 +467,21 @@ void kline_delete(kline_t *k)
 
 	slog(LG_DEBUG, "kline_delete(): %s@%s -> %s", k->user, k->host, k->reason);
 
+	journal_kline_delete(k);
+
 	/* only unkline if ircd has not already removed this -- jilles */
 	if (me.connected && (k->duration == 0 || k->expires > CURRTIME))
 		unkline_sts("*", k->user, k->host);
 
+	index_check();
+	kline_index_delete(k);
+
 	n = mowgli_node_find(k, &klnlist);
 	mowgli_node_delete(n, &klnlist);
 	mowgli_node_free(n);
 
+	match_pattern_free(k->user_match);
+	match_pattern_free(k->host_match);
 	free(k->user);
 	free(k->host);
 	free(k->reason);
@@ -198,7 +501,7 @@ kline_t *kline_find(const char *user, const char *host)
 	{
 		k = (kline_t *)n->data;
 
-		if ((!match(k->user, user)) && (!match(k->host, host)))
+		if ((!match_pattern(k->user_match, user)) && (!match_pattern(k->host_match, host)))
 			return k;
 	}
 
@@ -221,22 +524,64 @@ kline_t *kline_find_num(unsigned long number)
 	return NULL;
 }
 
+/* an indexed kline whose host is known to match u, if it beats best */
+static kline_t *kline_find_better(kline_t *best, kline_t *k, user_t *u)
+{
+	if (best != NULL && best->seq < k->seq)
+		return best;
+	if (k->duration != 0 && k->expires <= CURRTIME)
+		return best;
+	if (match_pattern(k->user_match, u->user))
+		return best;
+
+	return k;
+}
+
 kline_t *kline_find_user(user_t *u)
 {
-	kline_t *k;
+	unsigned char addr[16];
+	kline_t *k, *best = NULL;
+	cidr_node_t *node = NULL;
+	mowgli_list_t *l;
 	mowgli_node_t *n;
+	int bits = 0;
 
-	MOWGLI_ITER_FOREACH(n, klnlist.head)
+	index_check();
+
+	if ((l = mask_index_find(&kline_index, u->host)) != NULL)
+		MOWGLI_ITER_FOREACH(n, l->head)
+			best = kline_find_better(best, n->data, u);
+
+	if ((l = mask_index_find(&kline_index, u->ip)) != NULL)
+		MOWGLI_ITER_FOREACH(n, l->head)
+			best = kline_find_better(best, n->data, u);
+
+	if (u->ip != NULL && (bits = ip_parse(u->ip, addr)) != 0)
+		node = bits == 32 ? kline_cidr4 : kline_cidr6;
+
+	/* every node on the path to the address holds a prefix containing it */
+	for (; node != NULL && cidr_common(node->addr, addr, node->bits) == node->bits; node = node->child[cidr_bit(addr, node->bits)])
+	{
+		MOWGLI_ITER_FOREACH(n, node->klines.head)
+			best = kline_find_better(best, n->data, u);
+
+		if (node->bits == bits)
+			break;
+	}
+
+	MOWGLI_ITER_FOREACH(n, kline_index.wild.head)
 	{
 		k = (kline_t *)n->data;
 
+		if (best != NULL && best->seq < k->seq)
+			break;
 		if (k->duration != 0 && k->expires <= CURRTIME)
 			continue;
-		if (!match(k->user, u->user) && (!match(k->host, u->host) || !match(k->host, u->ip) || !match_ips(k->host, u->ip)))
+		if (!match_pattern(k->user_match, u->user) && (!match_pattern(k->host_match, u->host) || !match_pattern(k->host_match, u->ip) || !match_ips(k->host, u->ip)))
 			return k;
 	}
 
-	return NULL;
+	return best;
 }
 
 void kline_expire(void *arg)
@@ -280,20 +625,28 @@ xline_t *xline_add(const char *realname, const char *reason, long duration, cons
 
 	slog(LG_DEBUG, "xline_add(): %s -> %s (%ld)", realname, reason, duration);
 
+	index_check();
+
 	x = mowgli_heap_alloc(xline_heap);
 
 	mowgli_node_add(x, n, &xlnlist);
 
 	x->realname = sstrdup(realname);
+	x->realname_match = match_compile(realname);
 	x->reason = sstrdup(reason);
 	x->setby = sstrdup(setby);
 	x->duration = duration;
 	x->settime = CURRTIME;
 	x->expires = CURRTIME + duration;
 	x->number = ++xcnt;
+	x->seq = ++xline_seq;
+
+	mask_index_add(&xline_index, x->realname, mask_index_literal(x->realname), &x->index_node, x);
 
 	cnt.xline++;
 
+	journal_xline(x);
+
 	if (me.connected)
 		xline_sts("*", realname, duration, reason);
 
@@ -313,14 +666,20 @@ void xline_delete(const char *realname)
 
 	slog(LG_DEBUG, "xline_delete(): %s -> %s", x->realname, x->reason);
 
+	journal_xline_delete(x);
+
 	/* only unxline if ircd has not already removed this -- jilles */
 	if (me.connected && (x->duration == 0 || x->expires > CURRTIME))
 		unxline_sts("*", x->realname);
 
+	index_check();
+	mask_index_delete(&xline_index, x->realname, mask_index_literal(x->realname), &x->index_node);
+
 	n = mowgli_node_find(x, &xlnlist);
 	mowgli_node_delete(n, &xlnlist);
 	mowgli_node_free(n);
 
+	match_pattern_free(x->realname_match);
 	free(x->realname);
 	free(x->reason);
 	free(x->setby);
@@ -339,7 +698,7 @@ xline_t *xline_find(const char *realname)
 	{
 		x = (xline_t *)n->data;
 
-		if (!match(x->realname, realname))
+		if (!match_pattern(x->realname_match, realname))
 			return x;
 	}
 
@@ -364,21 +723,42 @@ xline_t *xline_find_num(unsigned int number)
 
 xline_t *xline_find_user(user_t *u)
 {
-	xline_t *x;
+	xline_t *x, *best = NULL;
+	mowgli_list_t *l;
 	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, xlnlist.head)
+	index_check();
+
+	/* xlines are sequenced in list order */
+	if ((l = mask_index_find(&xline_index, u->gecos)) != NULL)
+	{
+		MOWGLI_ITER_FOREACH(n, l->head)
+		{
+			x = (xline_t *)n->data;
+
+			if (x->duration != 0 && x->expires <= CURRTIME)
+				continue;
+
+			if (best == NULL || x->seq < best->seq)
+				best = x;
+		}
+	}
+
+	MOWGLI_ITER_FOREACH(n, xline_index.wild.head)
 	{
 		x = (xline_t *)n->data;
 
+		if (best != NULL && best->seq < x->seq)
+			break;
+
 		if (x->duration != 0 && x->expires <= CURRTIME)
 			continue;
 
-		if (!match(x->realname, u->gecos))
+		if (!match_pattern(x->realname_match, u->gecos))
 			return x;
 	}
 
-	return NULL;
+	return best;
 }
 
 void xline_expire(void *arg)
@@ -418,19 +798,27 @@ qline_t *qline_add(const char *mask, const char *reason, long duration, const ch
 
 	slog(LG_DEBUG, "qline_add(): %s -> %s (%ld)", mask, reason, duration);
 
+	index_check();
+
 	q = mowgli_heap_alloc(qline_heap);
 	mowgli_node_add(q, n, &qlnlist);
 
 	q->mask = sstrdup(mask);
+	q->mask_match = match_compile(mask);
 	q->reason = sstrdup(reason);
 	q->setby = sstrdup(setby);
 	q->duration = duration;
 	q->settime = CURRTIME;
 	q->expires = CURRTIME + duration;
 	q->number = ++qcnt;
+	q->seq = ++qline_seq;
+
+	mask_index_add(&qline_index, q->mask, mask_index_literal(q->mask), &q->index_node, q);
 
 	cnt.qline++;
 
+	journal_qline(q);
+
 	if (me.connected)
 		qline_sts("*", mask, duration, reason);
 
@@ -450,14 +838,20 @@ void qline_delete(const char *mask)
 
 	slog(LG_DEBUG, "qline_delete(): %s -> %s", q->mask, q->reason);
 
+	journal_qline_delete(q);
+
 	/* only unqline if ircd has not already removed this -- jilles */
 	if (me.connected && (q->duration == 0 || q->expires > CURRTIME))
 		unqline_sts("*", q->mask);
 
+	index_check();
+	mask_index_delete(&qline_index, q->mask, mask_index_literal(q->mask), &q->index_node);
+
 	n = mowgli_node_find(q, &qlnlist);
 	mowgli_node_delete(n, &qlnlist);
 	mowgli_node_free(n);
 
+	match_pattern_free(q->mask_match);
 	free(q->mask);
 	free(q->reason);
 	free(q->setby);
@@ -483,22 +877,52 @@ qline_t *qline_find(const char *mask)
 	return NULL;
 }
 
-qline_t *qline_find_match(const char *mask)
+/* qlines are sequenced in list order */
+static qline_t *qline_find_indexed(const char *name, bool nicks_only)
 {
-	qline_t *q;
+	qline_t *q, *best = NULL;
+	mowgli_list_t *l;
 	mowgli_node_t *n;
 
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
+	index_check();
+
+	if ((l = mask_index_find(&qline_index, name)) != NULL)
+	{
+		MOWGLI_ITER_FOREACH(n, l->head)
+		{
+			q = (qline_t *)n->data;
+
+			if (q->duration != 0 && q->expires <= CURRTIME)
+				continue;
+			if (nicks_only && (q->mask[0] == '#' || q->mask[0] == '&'))
+				continue;
+
+			if (best == NULL || q->seq < best->seq)
+				best = q;
+		}
+	}
+
+	MOWGLI_ITER_FOREACH(n, qline_index.wild.head)
 	{
 		q = (qline_t *)n->data;
 
+		if (best != NULL && best->seq < q->seq)
+			break;
+
 		if (q->duration != 0 && q->expires <= CURRTIME)
 			continue;
-		if (!match(q->mask, mask))
+		if (nicks_only && (q->mask[0] == '#' || q->mask[0] == '&'))
+			continue;
+		if (!match_pattern(q->mask_match, name))
 			return q;
 	}
 
-	return NULL;
+	return best;
+}
+
+qline_t *qline_find_match(const char *mask)
+{
+	return qline_find_indexed(mask, false);
 }
 
 qline_t *qline_find_num(unsigned int number)
@@ -519,22 +943,7 @@ qline_t *qline_find_num(unsigned int number)
 
 qline_t *qline_find_user(user_t *u)
 {
-	qline_t *q;
-	mowgli_node_t *n;
-
-	MOWGLI_ITER_FOREACH(n, qlnlist.head)
-	{
-		q = (qline_t *)n->data;
-
-		if (q->duration != 0 && q->expires <= CURRTIME)
-			continue;
-		if (q->mask[0] == '#' || q->mask[0] == '&')
-			continue;
-		if (!match(q->mask, u->nick))
-			return q;
-	}
-
-	return NULL;
+	return qline_find_indexed(u->nick, true);
 }
 
 qline_t *qline_find_channel(channel_t *c)
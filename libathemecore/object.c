@@ -29,6 +29,18 @@ mowgli_list_t object_list = { NULL, NULL, 0 };
 
 mowgli_heap_t *metadata_heap;	/* HEAP_CHANUSER */
 
+typedef struct {
+	stringref name;			/* NULL if the slot is free */
+	unsigned int refcount;		/* registrations and entries */
+} metadata_key_t;
+
+/* the key registry: atoms index metadata_keys, names map to atoms */
+static metadata_key_t *metadata_keys;
+static metadata_atom_t metadata_keys_size;
+static metadata_atom_t metadata_keys_top;
+static metadata_atom_t metadata_keys_freelist;
+static mowgli_patricia_t *metadata_keytree;
+
 void init_metadata(void)
 {
 	metadata_heap = sharedheap_get(sizeof(metadata_t));
@@ -38,6 +50,8 @@ void init_metadata(void)
 		slog(LG_ERROR, "init_metadata(): block allocator failure.");
 		exit(EXIT_FAILURE);
 	}
+
+	metadata_keytree = mowgli_patricia_create(strcasecanon);
 }
 
 /*
@@ -180,7 +194,7 @@ void object_unref(void *obj)
 void object_dispose(void *object)
 {
 	object_t *obj;
-	mowgli_patricia_t *privatedata, *metadata;
+	mowgli_patricia_t *privatedata;
 
 	return_if_fail(object != NULL);
 	obj = object(object);
@@ -195,12 +209,12 @@ void object_dispose(void *object)
 	obj->refcount = -1;
 
 	privatedata = obj->privatedata;
-	metadata = obj->metadata;
 
 #ifdef OBJECT_DEBUG
 	mowgli_node_delete(&obj->dnode, &object_list);
 #endif
 
+	/* a custom destructor releases the metadata with metadata_delete_all() */
 	if (obj->destructor != NULL)
 		obj->destructor(obj);
 	else
@@ -211,88 +225,436 @@ void object_dispose(void *object)
 
 	if (privatedata != NULL)
 		mowgli_patricia_destroy(privatedata, NULL, NULL);
+}
+
+/*
+ * The inline array holds a power of two number of pointers, at least two,
+ * so it is resized only when the entry count crosses one of those.
+ */
+static unsigned int metadata_vec_size(unsigned int count)
+{
+	unsigned int size = 2;
+
+	if (count == 0)
+		return 0;
+
+	while (size < count)
+		size <<= 1;
 
-	if (metadata != NULL)
-		mowgli_patricia_destroy(metadata, NULL, NULL);
+	return size;
 }
 
-metadata_t *metadata_add(void *target, const char *name, const char *value)
+static void metadata_vec_resize(object_t *obj, unsigned int count)
+{
+	unsigned int oldsize, newsize;
+
+	oldsize = metadata_vec_size(obj->metadata_count);
+	newsize = metadata_vec_size(count);
+
+	if (newsize != oldsize)
+	{
+		if (newsize == 0)
+		{
+			free(obj->metadata.vec);
+			obj->metadata.vec = NULL;
+		}
+		else
+			obj->metadata.vec = srealloc(obj->metadata.vec, newsize * sizeof(metadata_t *));
+
+		cnt.metadata_bytes -= oldsize * sizeof(metadata_t *);
+		cnt.metadata_bytes += newsize * sizeof(metadata_t *);
+	}
+
+	obj->metadata_count = count;
+}
+
+static unsigned int metadata_vec_find(object_t *obj, metadata_atom_t atom)
+{
+	unsigned int i;
+
+	for (i = 0; i < obj->metadata_count; i++)
+		if (obj->metadata.vec[i]->atom == atom)
+			return i;
+
+	return obj->metadata_count;
+}
+
+/* moves the entries of an object that outgrew its array into a tree */
+static void metadata_promote(object_t *obj)
+{
+	mowgli_patricia_t *tree;
+	unsigned int i;
+
+	tree = mowgli_patricia_create(strcasecanon);
+
+	for (i = 0; i < obj->metadata_count; i++)
+		mowgli_patricia_add(tree, obj->metadata.vec[i]->name, obj->metadata.vec[i]);
+
+	metadata_vec_resize(obj, 0);
+
+	obj->metadata.tree = tree;
+	obj->metadata_promoted = true;
+	cnt.metadata_tree++;
+}
+
+static void metadata_free(metadata_t *md)
+{
+	cnt.metadata--;
+	cnt.metadata_bytes -= sizeof(metadata_t) + strlen(md->value) + 1;
+
+	metadata_atom_unregister(md->atom);
+	free(md->value);
+
+	mowgli_heap_free(metadata_heap, md);
+}
+
+static inline bool metadata_atom_valid(metadata_atom_t atom)
+{
+	return atom != METADATA_ATOM_NONE && atom <= metadata_keys_top && metadata_keys[atom].name != NULL;
+}
+
+/*
+ * Tells modules about changes to account metadata.  Loading the database
+ * and replaying the journal do not count, and neither does an account
+ * taking its metadata along when it is destroyed.  Deletions pass the
+ * value being removed, like SET PROPERTY always did.
+ */
+static void metadata_changed(void *target, metadata_t *md)
+{
+	hook_metadata_change_t hdata;
+
+	if (runflags & RF_STARTING || object(target)->refcount == -1)
+		return;
+
+	if (myobject_type(target) != MYOBJECT_MYUSER)
+		return;
+
+	hdata.target = target;
+	hdata.name = md->name;
+	hdata.value = md->value;
+	hook_call_metadata_change(&hdata);
+}
+
+/* takes an entry out of its object without freeing it */
+static metadata_t *metadata_unlink(object_t *obj, metadata_atom_t atom)
+{
+	metadata_t *md;
+	unsigned int i;
+
+	if (obj->metadata_promoted)
+		return mowgli_patricia_delete(obj->metadata.tree, metadata_keys[atom].name);
+
+	if ((i = metadata_vec_find(obj, atom)) == obj->metadata_count)
+		return NULL;
+
+	md = obj->metadata.vec[i];
+
+	/* keep the order, METADATA_FOREACH relies on it */
+	memmove(&obj->metadata.vec[i], &obj->metadata.vec[i + 1],
+			(obj->metadata_count - i - 1) * sizeof(metadata_t *));
+	metadata_vec_resize(obj, obj->metadata_count - 1);
+
+	return md;
+}
+
+/*
+ * metadata_atom_register
+ *
+ * Interns a metadata key.
+ *
+ * Inputs:
+ *      - name of the key, compared case insensitively
+ *
+ * Outputs:
+ *      - the atom for the key
+ *
+ * Side Effects:
+ *      - the key stays registered until metadata_atom_unregister() has
+ *        been called once for every registration and no entry uses it
+ */
+metadata_atom_t metadata_atom_register(const char *name)
+{
+	metadata_atom_t atom;
+
+	return_val_if_fail(name != NULL, METADATA_ATOM_NONE);
+
+	if ((atom = metadata_atom_find(name)) != METADATA_ATOM_NONE)
+	{
+		metadata_keys[atom].refcount++;
+		return atom;
+	}
+
+	if (metadata_keys_freelist != METADATA_ATOM_NONE)
+	{
+		atom = metadata_keys_freelist;
+		metadata_keys_freelist = metadata_keys[atom].refcount;
+	}
+	else
+	{
+		if (metadata_keys_top + 1 >= metadata_keys_size)
+		{
+			metadata_keys_size = metadata_keys_size ? metadata_keys_size * 2 : 256;
+			metadata_keys = srealloc(metadata_keys, metadata_keys_size * sizeof(metadata_key_t));
+		}
+
+		atom = ++metadata_keys_top;
+	}
+
+	metadata_keys[atom].name = strshare_get(name);
+	metadata_keys[atom].refcount = 1;
+	mowgli_patricia_add(metadata_keytree, name, (void *)(uintptr_t) atom);
+
+	return atom;
+}
+
+void metadata_atom_unregister(metadata_atom_t atom)
+{
+	return_if_fail(metadata_atom_valid(atom));
+
+	if (--metadata_keys[atom].refcount > 0)
+		return;
+
+	mowgli_patricia_delete(metadata_keytree, metadata_keys[atom].name);
+	strshare_unref(metadata_keys[atom].name);
+
+	/* free slots are chained through their refcount */
+	metadata_keys[atom].name = NULL;
+	metadata_keys[atom].refcount = metadata_keys_freelist;
+	metadata_keys_freelist = atom;
+}
+
+metadata_atom_t metadata_atom_find(const char *name)
+{
+	return_val_if_fail(name != NULL, METADATA_ATOM_NONE);
+
+	return (metadata_atom_t)(uintptr_t) mowgli_patricia_retrieve(metadata_keytree, name);
+}
+
+const char *metadata_atom_name(metadata_atom_t atom)
+{
+	if (!metadata_atom_valid(atom))
+		return NULL;
+
+	return metadata_keys[atom].name;
+}
+
+/* the highest atom that may be in use, for walking the registry */
+metadata_atom_t metadata_atom_max(void)
+{
+	return metadata_keys_top;
+}
+
+metadata_t *metadata_add_atom(void *target, metadata_atom_t atom, const char *value)
 {
 	object_t *obj;
 	metadata_t *md;
 
-	return_val_if_fail(name != NULL, NULL);
+	return_val_if_fail(target != NULL, NULL);
+	return_val_if_fail(metadata_atom_valid(atom), NULL);
 	return_val_if_fail(value != NULL, NULL);
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	/* reference the key first, the old entry may hold the last one */
+	metadata_keys[atom].refcount++;
 
-	if (metadata_find(target, name))
-		metadata_delete(target, name);
+	/* a replaced entry is a single change, the new record supersedes it */
+	if ((md = metadata_unlink(obj, atom)) != NULL)
+		metadata_free(md);
 
 	md = mowgli_heap_alloc(metadata_heap);
 
-	md->name = strshare_get(name);
+	md->atom = atom;
+	md->name = metadata_keys[atom].name;
 	md->value = sstrdup(value);
 
-	mowgli_patricia_add(obj->metadata, md->name, md);
+	cnt.metadata++;
+	cnt.metadata_bytes += sizeof(metadata_t) + strlen(md->value) + 1;
+
+	if (!obj->metadata_promoted && obj->metadata_count >= METADATA_INLINE_MAX)
+		metadata_promote(obj);
+
+	if (obj->metadata_promoted)
+		mowgli_patricia_add(obj->metadata.tree, md->name, md);
+	else
+	{
+		metadata_vec_resize(obj, obj->metadata_count + 1);
+		obj->metadata.vec[obj->metadata_count - 1] = md;
+	}
+
+	journal_metadata(target, md->name, md->value);
+	metadata_changed(target, md);
 
 	return md;
 }
 
-void metadata_delete(void *target, const char *name)
+void metadata_delete_atom(void *target, metadata_atom_t atom)
 {
-	object_t *obj;
-	metadata_t *md = metadata_find(target, name);
+	metadata_t *md;
+
+	return_if_fail(target != NULL);
 
-	if (!md)
+	if (!metadata_atom_valid(atom))
 		return;
 
+	if ((md = metadata_unlink(object(target), atom)) == NULL)
+		return;
+
+	journal_metadata(target, md->name, NULL);
+	metadata_changed(target, md);
+
+	metadata_free(md);
+}
+
+metadata_t *metadata_find_atom(void *target, metadata_atom_t atom)
+{
+	object_t *obj;
+	unsigned int i;
+
+	return_val_if_fail(target != NULL, NULL);
+
+	if (!metadata_atom_valid(atom))
+		return NULL;
+
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	if (obj->metadata_promoted)
+		return mowgli_patricia_retrieve(obj->metadata.tree, metadata_keys[atom].name);
 
-	mowgli_patricia_delete(obj->metadata, name);
+	if ((i = metadata_vec_find(obj, atom)) == obj->metadata_count)
+		return NULL;
 
-	strshare_unref(md->name);
-	free(md->value);
+	return obj->metadata.vec[i];
+}
 
-	mowgli_heap_free(metadata_heap, md);
+metadata_t *metadata_add(void *target, const char *name, const char *value)
+{
+	metadata_atom_t atom;
+	metadata_t *md;
+
+	return_val_if_fail(name != NULL, NULL);
+	return_val_if_fail(value != NULL, NULL);
+
+	/* the entry holds its own reference to the key */
+	atom = metadata_atom_register(name);
+	md = metadata_add_atom(target, atom, value);
+	metadata_atom_unregister(atom);
+
+	return md;
+}
+
+void metadata_delete(void *target, const char *name)
+{
+	return_if_fail(name != NULL);
+
+	metadata_delete_atom(target, metadata_atom_find(name));
 }
 
 metadata_t *metadata_find(void *target, const char *name)
+{
+	return_val_if_fail(name != NULL, NULL);
+
+	/* a key nobody registered cannot be set on any object */
+	return metadata_find_atom(target, metadata_atom_find(name));
+}
+
+void metadata_delete_all(void *target)
 {
 	object_t *obj;
+	metadata_t *md;
+	metadata_iteration_state_t state;
 
-	return_val_if_fail(target != NULL, NULL);
-	return_val_if_fail(name != NULL, NULL);
+	return_if_fail(target != NULL);
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	METADATA_FOREACH(md, &state, target)
+	{
+		metadata_delete_atom(target, md->atom);
+	}
 
-	return mowgli_patricia_retrieve(obj->metadata, name);
+	/* an object that once outgrew its array keeps the tree until now */
+	if (obj->metadata_promoted)
+	{
+		mowgli_patricia_destroy(obj->metadata.tree, NULL, NULL);
+		obj->metadata.vec = NULL;
+		obj->metadata_promoted = false;
+		cnt.metadata_tree--;
+	}
 }
 
-void metadata_delete_all(void *target)
+unsigned int metadata_count(void *target)
+{
+	object_t *obj;
+
+	return_val_if_fail(target != NULL, 0);
+
+	obj = object(target);
+
+	if (obj->metadata_promoted)
+		return mowgli_patricia_size(obj->metadata.tree);
+
+	return obj->metadata_count;
+}
+
+/*
+ * metadata_foreach_start, metadata_foreach_cur, metadata_foreach_next
+ *
+ * Iterate over the metadata of an object, see METADATA_FOREACH.  The
+ * current entry may be deleted during the iteration; adding entries ends
+ * an iteration over the inline array early if that promotes it to a tree.
+ */
+void metadata_foreach_start(void *target, metadata_iteration_state_t *state)
 {
 	object_t *obj;
-	metadata_t *md;
-	mowgli_patricia_iteration_state_t state;
 
 	obj = object(target);
 
-	if (obj->metadata == NULL)
-		obj->metadata = mowgli_patricia_create(strcasecanon);
+	state->obj = obj;
+	state->pos = 0;
+	state->cur = NULL;
+	state->tree = NULL;
+
+	if (obj->metadata_promoted)
+	{
+		state->tree = obj->metadata.tree;
+		mowgli_patricia_foreach_start(state->tree, &state->tstate);
+		state->cur = mowgli_patricia_foreach_cur(state->tree, &state->tstate);
+	}
+	else if (obj->metadata_count > 0)
+		state->cur = obj->metadata.vec[0];
+}
+
+metadata_t *metadata_foreach_cur(metadata_iteration_state_t *state)
+{
+	return state->cur;
+}
+
+void metadata_foreach_next(metadata_iteration_state_t *state)
+{
+	object_t *obj = state->obj;
+
+	if (state->cur == NULL)
+		return;
+
+	if (state->tree != NULL)
+	{
+		mowgli_patricia_foreach_next(state->tree, &state->tstate);
+		state->cur = mowgli_patricia_foreach_cur(state->tree, &state->tstate);
+		return;
+	}
 
-	MOWGLI_PATRICIA_FOREACH(md, &state, obj->metadata)
+	if (obj->metadata_promoted)
 	{
-		metadata_delete(obj, md->name);
+		state->cur = NULL;
+		return;
 	}
+
+	/* if the current entry was deleted, its successor moved into its slot */
+	if (state->pos < obj->metadata_count && obj->metadata.vec[state->pos] == state->cur)
+		state->pos++;
+
+	state->cur = state->pos < obj->metadata_count ? obj->metadata.vec[state->pos] : NULL;
 }
 
 void *privatedata_get(void *target, const char *key)
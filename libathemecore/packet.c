@@ -35,24 +35,20 @@ mowgli_eventloop_timer_t *ping_uplink_timer = NULL;
 static void irc_recvq_handler(connection_t *cptr)
 {
 	bool wasnonl;
-	char parsebuf[BUFSIZE + 1];
+	char *line;
 	int count;
 
 	wasnonl = cptr->flags & CF_NONEWLINE ? true : false;
-	count = recvq_getline(cptr, parsebuf, sizeof parsebuf - 1);
-	if (count <= 0)
+	if ((line = recvq_getline_inplace(cptr, BUFSIZE, &count)) == NULL)
 		return;
 	cnt.bin += count;
 	/* ignore the excessive part of a too long line */
 	if (wasnonl)
 		return;
 	me.uplinkpong = CURRTIME;
-	if (parsebuf[count - 1] == '\n')
-		count--;
-	if (count > 0 && parsebuf[count - 1] == '\r')
-		count--;
-	parsebuf[count] = '\0';
-	parse(parsebuf);
+	/* the line may change anything cached access flags depend on */
+	chanacs_user_flags_invalidate();
+	parse(line);
 }
 
 static void ping_uplink(void *arg)
@@ -86,7 +82,7 @@ void irc_handle_connect(connection_t *cptr)
 {
 	/* add our server */
 	{
-		cptr->flags = CF_UPLINK;
+		cptr->flags = CF_UPLINK | CF_RECVQ_INPLACE;
 		cptr->recvq_handler = irc_recvq_handler;
 		connection_setselect_read(cptr, recvq_put);
 		slog(LG_INFO, "irc_handle_connect(): connection to uplink established");
@@ -94,7 +90,7 @@ void irc_handle_connect(connection_t *cptr)
 		/* no SERVER message received */
 		me.recvsvr = false;
 
-
+		sendq_batch_begin(cptr);
 		server_login();
 
 #ifdef HAVE_GETTIMEOFDAY
@@ -104,6 +100,7 @@ void irc_handle_connect(connection_t *cptr)
 
 		/* done bursting by this time... */
 		ping_sts();
+		sendq_batch_end(cptr);
 
 		/* ping our uplink every 5 minutes */
 		if (ping_uplink_timer != NULL)
@@ -345,7 +345,7 @@ mowgli_node_t *generic_next_matching_host_chanacs(mychan_t *mc, user_t *u, mowgl
 
 		if (ca->entity != NULL)
 		       continue;
-		if (!match(ca->host, hostbuf) || !match(ca->host, hostbuf2) || !match(ca->host, ipbuf) || (ircd->flags & IRCD_CIDR_BANS && !match_cidr(ca->host, ipbuf)))
+		if (!match_pattern(ca->host_match, hostbuf) || !match_pattern(ca->host_match, hostbuf2) || !match_pattern(ca->host_match, ipbuf) || (ircd->flags & IRCD_CIDR_BANS && !match_cidr(ca->host, ipbuf)))
 			return n;
 	}
 	return NULL;
@@ -34,6 +34,13 @@ static operclass_t *user_r = NULL;
 static operclass_t *authenticated_r = NULL;
 static operclass_t *ircop_r = NULL;
 
+/* priv name -> id + 1; ids are handed out as operclasses mention new
+ * privs and never reused, so the bitsets stay valid. */
+static mowgli_patricia_t *privnames = NULL;
+static unsigned int privcount = 0;
+
+#define PRIVSET_BITS	(sizeof(unsigned int) * CHAR_BIT)
+
 void init_privs(void)
 {
 	operclass_heap = sharedheap_get(sizeof(operclass_t));
@@ -45,6 +52,8 @@ void init_privs(void)
 		exit(EXIT_FAILURE);
 	}
 
+	privnames = mowgli_patricia_create(strcasecanon);
+
 	/* create built-in operclasses. */
 	user_r = operclass_add("user", "", OPERCLASS_BUILTIN);
 	authenticated_r = operclass_add("authenticated", AC_AUTHENTICATED, OPERCLASS_BUILTIN);
@@ -54,6 +63,63 @@ void init_privs(void)
 /*************************
  * O P E R C L A S S E S *
  *************************/
+
+/* returns the id of a priv some operclass has, or -1 if none has it */
+static int priv_find_id(const char *priv)
+{
+	void *id = mowgli_patricia_retrieve(privnames, priv);
+
+	return id != NULL ? (int) ((uintptr_t) id - 1) : -1;
+}
+
+static unsigned int priv_intern(const char *priv)
+{
+	int id = priv_find_id(priv);
+
+	if (id >= 0)
+		return id;
+
+	mowgli_patricia_add(privnames, priv, (void *) (uintptr_t) (privcount + 1));
+	return privcount++;
+}
+
+/* rebuilds operclass->privset from operclass->privs */
+static void operclass_compile(operclass_t *operclass)
+{
+	char *privs, *priv, *save;
+	unsigned int id;
+
+	free(operclass->privset);
+	operclass->privset = NULL;
+	operclass->privset_words = 0;
+
+	privs = sstrdup(operclass->privs);
+	for (priv = strtok_r(privs, " ", &save); priv != NULL; priv = strtok_r(NULL, " ", &save))
+	{
+		id = priv_intern(priv);
+
+		if (id / PRIVSET_BITS >= operclass->privset_words)
+		{
+			unsigned int words = id / PRIVSET_BITS + 1;
+
+			operclass->privset = srealloc(operclass->privset, words * sizeof(unsigned int));
+			memset(operclass->privset + operclass->privset_words, 0,
+					(words - operclass->privset_words) * sizeof(unsigned int));
+			operclass->privset_words = words;
+		}
+
+		operclass->privset[id / PRIVSET_BITS] |= 1U << (id % PRIVSET_BITS);
+	}
+	free(privs);
+}
+
+static inline bool has_priv_operclass_id(const operclass_t *operclass, int id)
+{
+	if (operclass == NULL || id < 0 || (unsigned int) id / PRIVSET_BITS >= operclass->privset_words)
+		return false;
+
+	return (operclass->privset[id / PRIVSET_BITS] & (1U << (id % PRIVSET_BITS))) != 0;
+}
 /*
  * operclass_add(const char *name, const char *privs)
  *
@@ -75,6 +141,7 @@ operclass_t *operclass_add(const char *name, const char *privs, int flags)
 		free(operclass->privs);
 		operclass->privs = sstrdup(privs);
 		operclass->flags = flags | (builtin ? OPERCLASS_BUILTIN : 0);
+		operclass_compile(operclass);
 
 		return operclass;
 	}
@@ -85,6 +152,9 @@ operclass_t *operclass_add(const char *name, const char *privs, int flags)
 	operclass->name = sstrdup(name);
 	operclass->privs = sstrdup(privs);
 	operclass->flags = flags;
+	operclass->privset = NULL;
+	operclass->privset_words = 0;
+	operclass_compile(operclass);
 
 	mowgli_node_add(operclass, &operclass->node, &operclasslist);
 
@@ -123,6 +193,7 @@ void operclass_delete(operclass_t *operclass)
 
 	free(operclass->name);
 	free(operclass->privs);
+	free(operclass->privset);
 
 	mowgli_heap_free(operclass_heap, operclass);
 	cnt.operclass--;
@@ -290,36 +361,11 @@ bool is_conf_soper(myuser_t *myuser)
 	return false;
 }
 
-/* name1 name2 name3... */
-static bool string_in_list(const char *str, const char *name)
-{
-	char *p;
-	int l;
-
-	if (str == NULL)
-		return false;
-	l = strlen(name);
-	while (*str != '\0')
-	{
-		p = strchr(str, ' ');
-		if (p != NULL ? p - str == l && !strncasecmp(str, name, p - str) : !strcasecmp(str, name))
-			return true;
-		if (p == NULL)
-			return false;
-		str = p;
-		while (*str == ' ')
-			str++;
-	}
-	return false;
-}
-
 bool has_priv_operclass(operclass_t *operclass, const char *priv)
 {
 	if (operclass == NULL)
 		return false;
-	if (string_in_list(operclass->privs, priv))
-		return true;
-	return false;
+	return has_priv_operclass_id(operclass, priv_find_id(priv));
 }
 
 bool has_any_privs(sourceinfo_t *si)
@@ -342,29 +388,20 @@ bool has_any_privs_user(user_t *u)
 	return false;
 }
 
-bool has_priv(sourceinfo_t *si, const char *priv)
-{
-	return si->su != NULL ? has_priv_user(si->su, priv) :
-		has_priv_myuser(si->smu, priv);
-}
-
-bool has_priv_user(user_t *u, const char *priv)
+static bool has_priv_user_id(user_t *u, int id)
 {
 	operclass_t *operclass;
 
-	if (priv == NULL)
-		return true;
-
-	if (u == NULL)
+	if (u == NULL || id < 0)
 		return false;
 
-	if (has_priv_operclass(user_r, priv))
+	if (has_priv_operclass_id(user_r, id))
 		return true;
 
-	if (is_ircop(u) && has_priv_operclass(ircop_r, priv))
+	if (is_ircop(u) && has_priv_operclass_id(ircop_r, id))
 		return true;
 
-	if (u->myuser != NULL && has_priv_operclass(authenticated_r, priv))
+	if (u->myuser != NULL && has_priv_operclass_id(authenticated_r, id))
 		return true;
 
 	if (u->myuser && is_soper(u->myuser))
@@ -376,53 +413,67 @@ bool has_priv_user(user_t *u, const char *priv)
 			return false;
 		if (u->myuser->soper->password != NULL && !(u->flags & UF_SOPER_PASS))
 			return false;
-		if (has_priv_operclass(operclass, priv))
+		if (has_priv_operclass_id(operclass, id))
 			return true;
 	}
 
 	return false;
 }
 
-bool has_priv_myuser(myuser_t *mu, const char *priv)
+static bool has_priv_myuser_id(myuser_t *mu, int id)
 {
-	operclass_t *operclass;
-
-	if (priv == NULL)
-		return true;
-	if (mu == NULL)
+	if (mu == NULL || id < 0)
 		return false;
 
-	if (has_priv_operclass(authenticated_r, priv))
+	if (has_priv_operclass_id(authenticated_r, id))
 		return true;
 
 	if (!is_soper(mu))
 		return false;
-	operclass = mu->soper->operclass;
-	if (operclass == NULL)
-		return false;
-	if (has_priv_operclass(operclass, priv))
+
+	return has_priv_operclass_id(mu->soper->operclass, id);
+}
+
+bool has_priv(sourceinfo_t *si, const char *priv)
+{
+	return si->su != NULL ? has_priv_user(si->su, priv) :
+		has_priv_myuser(si->smu, priv);
+}
+
+bool has_priv_user(user_t *u, const char *priv)
+{
+	if (priv == NULL)
 		return true;
 
-	return false;
+	return has_priv_user_id(u, priv_find_id(priv));
+}
+
+bool has_priv_myuser(myuser_t *mu, const char *priv)
+{
+	if (priv == NULL)
+		return true;
+
+	return has_priv_myuser_id(mu, priv_find_id(priv));
 }
 
 bool has_all_operclass(sourceinfo_t *si, operclass_t *operclass)
 {
-	char *privs2;
-	char *priv;
+	unsigned int i, bit;
+	int id;
 
-	privs2 = sstrdup(operclass->privs);
-	priv = strtok(privs2, " ");
-	while (priv != NULL)
+	for (i = 0; i < operclass->privset_words; i++)
 	{
-		if (!has_priv(si, priv))
+		for (bit = 0; bit < PRIVSET_BITS; bit++)
 		{
-			free(privs2);
-			return false;
+			if (!(operclass->privset[i] & (1U << bit)))
+				continue;
+
+			id = i * PRIVSET_BITS + bit;
+			if (si->su != NULL ? !has_priv_user_id(si->su, id) : !has_priv_myuser_id(si->smu, id))
+				return false;
 		}
-		priv = strtok(NULL, " ");
 	}
-	free(privs2);
+
 	return true;
 }
 
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Latency profiling of hook handlers and commands.
+ *
+ * Every hook handler and command has an entry, found by the kind, the
+ * hook or command name and the module that added it, so that a module
+ * keeps its numbers across a reload.  Entries are never freed, which
+ * lets hooks and commands point at them without caring about unloads.
+ *
+ * With general::profile_sample set to N, one call in N (counted over
+ * all hooks and commands together) is timed with the monotonic clock;
+ * every call is counted.  Times include any nested hooks and commands.
+ */
+
+#include "atheme.h"
+
+static mowgli_patricia_t *profile_entries;
+
+int profile_countdown = 0;
+
+profile_entry_t *profile_entry_get(unsigned int kind, const char *name)
+{
+	profile_entry_t *p;
+	const char *module;
+	char key[BUFSIZE];
+
+	return_val_if_fail(name != NULL, NULL);
+
+	if (profile_entries == NULL)
+		profile_entries = mowgli_patricia_create(strcasecanon);
+
+	module = modtarget != NULL ? modtarget->name : "core";
+	snprintf(key, sizeof key, "%c %s %s", kind == PROFILE_HOOK ? 'H' : 'C', module, name);
+
+	if ((p = mowgli_patricia_retrieve(profile_entries, key)) != NULL)
+		return p;
+
+	p = smalloc(sizeof *p);
+	p->kind = kind;
+	p->name = sstrdup(name);
+	p->module = sstrdup(module);
+
+	mowgli_patricia_add(profile_entries, key, p);
+
+	return p;
+}
+
+unsigned long long profile_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return ts.tv_sec * 1000000000ULL + ts.tv_nsec + 1;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL + 1;
+#else
+	return 0;
+#endif
+}
+
+void profile_record(profile_entry_t *p, unsigned long long start)
+{
+	unsigned long long ns, us;
+	unsigned int i;
+
+	ns = profile_now();
+	ns = ns > start ? ns - start : 0;
+
+	p->timed++;
+	p->total_ns += ns;
+	if (ns > p->max_ns)
+		p->max_ns = ns;
+
+	for (i = 0, us = ns / 1000; us != 0 && i < PROFILE_BUCKETS - 1; us >>= 1)
+		i++;
+	p->hist[i]++;
+}
+
+void profile_reset(void)
+{
+	mowgli_patricia_iteration_state_t state;
+	profile_entry_t *p;
+
+	if (profile_entries == NULL)
+		return;
+
+	MOWGLI_PATRICIA_FOREACH(p, &state, profile_entries)
+	{
+		p->calls = p->timed = 0;
+		p->total_ns = p->max_ns = 0;
+		memset(p->hist, 0, sizeof p->hist);
+	}
+}
+
+/* the time spent in all calls, extrapolated from the sampled ones */
+double profile_estimate_ns(const profile_entry_t *p)
+{
+	if (p->timed == 0)
+		return 0;
+
+	return (double) p->total_ns * p->calls / p->timed;
+}
+
+/* an upper bound for the pct-th percentile of the sampled calls */
+unsigned int profile_percentile_us(const profile_entry_t *p, unsigned int pct)
+{
+	unsigned long long seen = 0, want;
+	unsigned int i;
+
+	if (p->timed == 0)
+		return 0;
+
+	want = (p->timed * pct + 99) / 100;
+
+	for (i = 0; i < PROFILE_BUCKETS - 1; i++)
+	{
+		seen += p->hist[i];
+		if (seen >= want)
+			break;
+	}
+
+	return 1U << i;
+}
+
+static void profile_merge(profile_entry_t *into, const profile_entry_t *p)
+{
+	unsigned int i;
+
+	into->calls += p->calls;
+	into->timed += p->timed;
+	into->total_ns += p->total_ns;
+	if (p->max_ns > into->max_ns)
+		into->max_ns = p->max_ns;
+
+	for (i = 0; i < PROFILE_BUCKETS; i++)
+		into->hist[i] += p->hist[i];
+}
+
+static int profile_cmp(const void *a, const void *b)
+{
+	double ea = profile_estimate_ns(a), eb = profile_estimate_ns(b);
+
+	return ea < eb ? 1 : ea > eb ? -1 : 0;
+}
+
+/*
+ * profile_top
+ *
+ * Collects the entries that took the most time.
+ *
+ * Inputs:
+ *      - PROFILE_HOOK and/or PROFILE_COMMAND
+ *      - whether to add up the entries of each module
+ *      - array to fill and its size
+ *
+ * Outputs:
+ *      - number of entries filled in, busiest first; when adding up by
+ *        module, name is NULL and kind has the kinds that were added
+ *
+ * Side Effects:
+ *      - none; the entries are copies and must not be freed
+ */
+unsigned int profile_top(unsigned int kinds, bool by_module, profile_entry_t *out, unsigned int count)
+{
+	mowgli_patricia_iteration_state_t state;
+	profile_entry_t *p, *all;
+	unsigned int i, n = 0, size = 64;
+
+	if (profile_entries == NULL || count == 0)
+		return 0;
+
+	all = scalloc(size, sizeof *all);
+
+	MOWGLI_PATRICIA_FOREACH(p, &state, profile_entries)
+	{
+		if (!(p->kind & kinds) || p->calls == 0)
+			continue;
+
+		if (by_module)
+		{
+			for (i = 0; i < n; i++)
+				if (!strcmp(all[i].module, p->module))
+					break;
+
+			if (i < n)
+			{
+				all[i].kind |= p->kind;
+				profile_merge(&all[i], p);
+				continue;
+			}
+		}
+
+		if (n == size)
+		{
+			size *= 2;
+			all = srealloc(all, size * sizeof *all);
+		}
+
+		all[n] = *p;
+		if (by_module)
+			all[n].name = NULL;
+		n++;
+	}
+
+	qsort(all, n, sizeof *all, profile_cmp);
+
+	if (n > count)
+		n = count;
+	memcpy(out, all, n * sizeof *all);
+	free(all);
+
+	return n;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
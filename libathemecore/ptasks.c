@@ -100,6 +100,7 @@ void handle_stats(user_t *u, char req)
 	soper_t *soper;
 	int j;
 	char fl[10];
+	hook_stats_t hdata;
 
 	if (floodcheck(u, NULL))
 		return;
@@ -248,6 +249,11 @@ void handle_stats(user_t *u, char req)
 		  numeric_sts(me.me, 249, u, "T :myuser_nam %7d", cnt.myuser_name);
 		  numeric_sts(me.me, 249, u, "T :mychan     %7d", cnt.mychan);
 		  numeric_sts(me.me, 249, u, "T :chanacs    %7d", cnt.chanacs);
+		  numeric_sts(me.me, 249, u, "T :metadata   %7u (%u objects with trees)", cnt.metadata, cnt.metadata_tree);
+		  numeric_sts(me.me, 249, u, "T :md memory  %7.2f%s", bytes(cnt.metadata_bytes), sbytes(cnt.metadata_bytes));
+		  numeric_sts(me.me, 249, u, "T :strshare   %7u (%u refs)", cnt.strshare, cnt.strshare_refs);
+		  numeric_sts(me.me, 249, u, "T :ss memory  %7.2f%s (%.2f%s saved)", bytes(cnt.strshare_bytes), sbytes(cnt.strshare_bytes),
+				  bytes(cnt.strshare_saved), sbytes(cnt.strshare_saved));
 
 #ifdef OBJECT_DEBUG
 		  numeric_sts(me.me, 249, u, "T :objects    %7zu", MOWGLI_LIST_LENGTH(&object_list));
@@ -255,6 +261,13 @@ void handle_stats(user_t *u, char req)
 
 		  numeric_sts(me.me, 249, u, "T :bytes sent %7.2f%s", bytes(cnt.bout), sbytes(cnt.bout));
 		  numeric_sts(me.me, 249, u, "T :bytes recv %7.2f%s", bytes(cnt.bin), sbytes(cnt.bin));
+		  numeric_sts(me.me, 249, u, "T :flushes    %7u", cnt.sendq_flush);
+		  numeric_sts(me.me, 249, u, "T :writes     %7u (%.2f per flush)", cnt.sendq_syscall,
+				  cnt.sendq_flush ? (double) cnt.sendq_syscall / cnt.sendq_flush : 0.0);
+		  numeric_sts(me.me, 249, u, "T :written    %7.2f%s (%.0f bytes per flush)", bytes(cnt.sendq_bytes), sbytes(cnt.sendq_bytes),
+				  cnt.sendq_flush ? (double) cnt.sendq_bytes / cnt.sendq_flush : 0.0);
+		  numeric_sts(me.me, 249, u, "T :acs hits   %7u (%u misses)", cnt.chanacs_cache_hit, cnt.chanacs_cache_miss);
+		  numeric_sts(me.me, 249, u, "T :log queued %7u (%u dropped)", cnt.log_queued, cnt.log_dropped);
 		  break;
 
 	  case 'u':
@@ -268,8 +281,8 @@ void handle_stats(user_t *u, char req)
 
 		  /* we received this command from the uplink, so,
 		   * hmm, it is not idle */
-		  numeric_sts(me.me, 249, u, "V :%s (AutoConn.!*@*) Idle: 0 SendQ: ? Connected: %s",
-				  curr_uplink->name,
+		  numeric_sts(me.me, 249, u, "V :%s (AutoConn.!*@*) Idle: 0 SendQ: %zu Connected: %s",
+				  curr_uplink->name, curr_uplink->conn->sendq_len,
 				  timediff(CURRTIME - curr_uplink->conn->first_recv));
 		  break;
 
@@ -320,6 +333,11 @@ void handle_stats(user_t *u, char req)
 		  break;
 	}
 
+	/* modules may add their own lines to any report */
+	hdata.u = u;
+	hdata.req = req;
+	hook_call_stats(&hdata);
+
 	numeric_sts(me.me, 219, u, "%c :End of /STATS report", req);
 }
 
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Matching a string against many regexes in one pass.
+ *
+ * For every regex we look for literal text that any match must contain:
+ * the longest run of plain characters outside groups, classes and
+ * optional parts, one per top-level alternative.  These factors are put
+ * in an Aho-Corasick automaton, so that one scan of the string finds the
+ * regexes that can match it; only those are run.  Regexes without a
+ * factor are always run.  The factors and the scan ignore ASCII case and
+ * use no other characters, so no match is ever missed.
+ *
+ * Adding a regex inserts its factors into the trie; the transition table
+ * is rebuilt from the trie before the next scan.  Deleting a regex only
+ * removes it from the outputs, until enough of the trie is dead to make
+ * rebuilding it worthwhile.
+ */
+
+#include "atheme.h"
+
+#define REGEX_FACTOR_MAX	BUFSIZE
+
+typedef struct {
+	unsigned int child;		/* first child */
+	unsigned int sibling;
+	unsigned int fail;
+	unsigned int dict;		/* next node on the fail chain with outputs */
+	unsigned char c;
+	unsigned int nout;
+	regex_set_entry_t **out;
+} regex_set_node_t;
+
+struct regex_set_entry_ {
+	atheme_regex_t *re;
+	void *data;
+	unsigned int seq;		/* keeps results in insertion order */
+	unsigned int gen;		/* last scan that picked it */
+	char **factors;			/* NULL: always run */
+	unsigned int nfactors;
+	mowgli_node_t node;
+};
+
+struct atheme_regex_set_ {
+	mowgli_list_t entries;
+	unsigned int seq;
+	unsigned int gen;
+
+	regex_set_node_t *nodes;
+	unsigned int nnodes, maxnodes;
+	unsigned int live, dead;	/* characters of live and deleted factors */
+
+	bool dirty;
+	unsigned char classes[128];	/* ASCII character -> column of delta */
+	unsigned int nclasses;
+	unsigned int *delta;
+
+	regex_set_entry_t **cand;
+	void **results;
+	unsigned int maxresults;
+};
+
+static inline unsigned char regex_fold(unsigned char c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static const char *regex_skip_bracket(const char *p, bool pcre)
+{
+	const char *e;
+
+	p++;
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+
+	while (*p != '\0')
+	{
+		if (*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.'))
+		{
+			char close[3] = { p[1], ']', '\0' };
+
+			if ((e = strstr(p + 2, close)) == NULL)
+				return p + strlen(p);
+			p = e + 2;
+		}
+		else if (pcre && *p == '\\' && p[1] != '\0')
+			p += 2;
+		else if (*p == ']')
+			return p + 1;
+		else
+			p++;
+	}
+
+	return p;
+}
+
+static const char *regex_skip_group(const char *p, bool pcre)
+{
+	unsigned int depth = 0;
+
+	while (*p != '\0')
+	{
+		if (*p == '\\')
+			p += p[1] != '\0' ? 2 : 1;
+		else if (*p == '[')
+			p = regex_skip_bracket(p, pcre);
+		else if (*p == '(')
+			depth++, p++;
+		else if (*p == ')' && --depth == 0)
+			return p + 1;
+		else
+			p++;
+	}
+
+	return p;
+}
+
+/* returns the end of an interval such as {n,m} at p, or p if there is none */
+static const char *regex_skip_interval(const char *p)
+{
+	const char *q = p + 1;
+
+	if (*p != '{')
+		return p;
+	while (isdigit((unsigned char)*q) || *q == ',')
+		q++;
+
+	return *q == '}' && q > p + 1 ? q + 1 : p;
+}
+
+/* skips a quantifier and a lazy or possessive suffix */
+static const char *regex_skip_quantifier(const char *p)
+{
+	const char *q;
+
+	if (*p == '*' || *p == '+' || *p == '?')
+		p++;
+	else if ((q = regex_skip_interval(p)) != p)
+		p = q;
+	else
+		return p;
+
+	if (*p == '?' || *p == '+')
+		p++;
+
+	return p;
+}
+
+static bool regex_is_literal(unsigned char c)
+{
+	return c >= 0x20 && c < 0x7f && strchr("\\.[]()*+?{}|^$", c) == NULL;
+}
+
+/* escaped characters that are plain text to both POSIX and PCRE */
+static bool regex_is_literal_escape(unsigned char c)
+{
+	return c != '\0' && strchr(".[](){}*+?|^$\\/-!@#%&=:;,\"~_ ", c) != NULL;
+}
+
+/*
+ * Finds the longest literal run of the alternative starting at *pp and
+ * moves *pp to the next alternative, setting *more if there is one.
+ * Returns the length of the run, which is put in buf.
+ */
+static size_t regex_branch_factor(const char **pp, bool *more, bool pcre, char *buf)
+{
+	const char *p = *pp, *q;
+	char cur[REGEX_FACTOR_MAX];
+	size_t curlen = 0, bestlen = 0;
+	unsigned char c;
+
+#define END_RUN() do {							\
+	if (curlen > bestlen)						\
+	{								\
+		memcpy(buf, cur, curlen);				\
+		bestlen = curlen;					\
+	}								\
+	curlen = 0;							\
+} while (0)
+
+	while (*p != '\0' && *p != '|')
+	{
+		c = *p;
+
+		if (c == '\\' && regex_is_literal_escape(p[1]))
+		{
+			c = p[1];
+			p += 2;
+		}
+		else if (regex_is_literal(c))
+			p++;
+		else
+		{
+			END_RUN();
+
+			if (c == '\\')
+			{
+				/* a class, anchor, back reference or code:
+				 * skip it and whatever arguments it may have */
+				p++;
+				while (*p != '\0' && strchr("()[]|.^$*?\\", *p) == NULL)
+					p++;
+				continue;
+			}
+			else if (c == '[')
+				p = regex_skip_bracket(p, pcre);
+			else if (c == '(')
+				p = regex_skip_group(p, pcre);
+			else if ((q = regex_skip_quantifier(p)) != p)
+				p = q;
+			else
+				p++;
+
+			p = regex_skip_quantifier(p);
+			continue;
+		}
+
+		if (curlen == sizeof cur)
+			END_RUN();
+
+		/* an optional or repeated character ends the run; one that
+		 * is only repeated still belongs to it */
+		q = regex_skip_quantifier(p);
+		if (q != p)
+		{
+			if (*p == '+' && q == p + 1 && regex_skip_quantifier(q) == q)
+				cur[curlen++] = regex_fold(c);
+			END_RUN();
+			p = q;
+			continue;
+		}
+
+		cur[curlen++] = regex_fold(c);
+	}
+
+	END_RUN();
+
+#undef END_RUN
+
+	*more = *p == '|';
+	*pp = *more ? p + 1 : p;
+
+	return bestlen;
+}
+
+/* PCRE constructs that change how the rest of the pattern is read */
+static bool regex_pcre_unsafe(const char *pattern)
+{
+	const char *p;
+
+	if (strstr(pattern, "(?#") || strstr(pattern, "\\Q") || strstr(pattern, "\\c"))
+		return true;
+
+	for (p = pattern; (p = strstr(p, "(?")) != NULL; p += 2)
+	{
+		size_t n = strspn(p + 2, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-^");
+
+		if (memchr(p + 2, 'x', n) != NULL)
+			return true;
+	}
+
+	return false;
+}
+
+/* one factor per top-level alternative, or NULL if one of them has none */
+static char **regex_factors(const char *pattern, int flags, unsigned int *count)
+{
+	bool pcre = (flags & AREGEX_PCRE) != 0;
+	char **factors = NULL;
+	char buf[REGEX_FACTOR_MAX];
+	const char *p = pattern;
+	unsigned int n = 0;
+	bool more;
+	size_t len;
+
+	if (pcre && regex_pcre_unsafe(pattern))
+		return NULL;
+
+	do
+	{
+		/* any '|' seen here separates top-level alternatives; one
+		 * inside a group or class is skipped along with it */
+		if ((len = regex_branch_factor(&p, &more, pcre, buf)) == 0)
+		{
+			while (n > 0)
+				free(factors[--n]);
+			free(factors);
+			return NULL;
+		}
+
+		factors = srealloc(factors, (n + 1) * sizeof(char *));
+		factors[n] = smalloc(len + 1);
+		memcpy(factors[n], buf, len);
+		n++;
+	} while (more);
+
+	*count = n;
+	return factors;
+}
+
+atheme_regex_set_t *regex_set_create(void)
+{
+	atheme_regex_set_t *set;
+
+	set = smalloc(sizeof *set);
+	set->maxnodes = 64;
+	set->nodes = scalloc(set->maxnodes, sizeof(regex_set_node_t));
+	set->nnodes = 1;
+	set->dirty = true;
+
+	return set;
+}
+
+static void regex_set_trie_free(atheme_regex_set_t *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->nnodes; i++)
+		free(set->nodes[i].out);
+	memset(set->nodes, 0, set->nnodes * sizeof(regex_set_node_t));
+	set->nnodes = 1;
+	set->live = set->dead = 0;
+	set->dirty = true;
+}
+
+static void regex_set_trie_add(atheme_regex_set_t *set, regex_set_entry_t *e)
+{
+	regex_set_node_t *node;
+	unsigned int i, n, child;
+	const char *s;
+
+	for (i = 0; i < e->nfactors; i++)
+	{
+		n = 0;
+
+		for (s = e->factors[i]; *s != '\0'; s++)
+		{
+			for (child = set->nodes[n].child; child != 0; child = set->nodes[child].sibling)
+				if (set->nodes[child].c == (unsigned char)*s)
+					break;
+
+			if (child == 0)
+			{
+				if (set->nnodes == set->maxnodes)
+				{
+					set->nodes = srealloc(set->nodes, 2 * set->maxnodes * sizeof(regex_set_node_t));
+					memset(set->nodes + set->maxnodes, 0, set->maxnodes * sizeof(regex_set_node_t));
+					set->maxnodes *= 2;
+				}
+
+				child = set->nnodes++;
+				set->nodes[child].c = *s;
+				set->nodes[child].sibling = set->nodes[n].child;
+				set->nodes[n].child = child;
+			}
+
+			n = child;
+		}
+
+		node = &set->nodes[n];
+		node->out = srealloc(node->out, (node->nout + 1) * sizeof(regex_set_entry_t *));
+		node->out[node->nout++] = e;
+		set->live += strlen(e->factors[i]);
+	}
+
+	set->dirty = true;
+}
+
+static void regex_set_trie_del(atheme_regex_set_t *set, regex_set_entry_t *e)
+{
+	regex_set_node_t *node;
+	unsigned int i, j, n, child;
+	const char *s;
+
+	for (i = 0; i < e->nfactors; i++)
+	{
+		n = 0;
+
+		for (s = e->factors[i]; *s != '\0'; s++)
+		{
+			for (child = set->nodes[n].child; child != 0; child = set->nodes[child].sibling)
+				if (set->nodes[child].c == (unsigned char)*s)
+					break;
+			n = child;
+		}
+
+		node = &set->nodes[n];
+		for (j = 0; j < node->nout; j++)
+			if (node->out[j] == e)
+			{
+				node->out[j] = node->out[--node->nout];
+				break;
+			}
+
+		set->live -= strlen(e->factors[i]);
+		set->dead += strlen(e->factors[i]);
+	}
+
+	if (set->dead > set->live)
+		set->dirty = true;
+}
+
+/* builds the transition table from the trie */
+static void regex_set_compile(atheme_regex_set_t *set)
+{
+	regex_set_node_t *nodes = set->nodes;
+	unsigned int *queue, *row, head = 0, tail = 0;
+	unsigned int i, u, v, k, ncl;
+
+	/* rebuild the trie if most of it is dead */
+	if (set->dead > set->live)
+	{
+		mowgli_node_t *n;
+
+		regex_set_trie_free(set);
+		MOWGLI_ITER_FOREACH(n, set->entries.head)
+		{
+			regex_set_entry_t *e = n->data;
+
+			if (e->factors != NULL)
+				regex_set_trie_add(set, e);
+		}
+		nodes = set->nodes;
+	}
+
+	memset(set->classes, 0, sizeof set->classes);
+	ncl = 1;
+	for (i = 1; i < set->nnodes; i++)
+		if (set->classes[nodes[i].c] == 0)
+			set->classes[nodes[i].c] = ncl++;
+	for (i = 'A'; i <= 'Z'; i++)
+		set->classes[i] = set->classes[i - 'A' + 'a'];
+	set->nclasses = ncl;
+
+	free(set->delta);
+	set->delta = scalloc((size_t)set->nnodes * ncl, sizeof(unsigned int));
+	queue = smalloc(set->nnodes * sizeof(unsigned int));
+
+	queue[tail++] = 0;
+	nodes[0].fail = nodes[0].dict = 0;
+
+	while (head < tail)
+	{
+		u = queue[head++];
+		row = set->delta + (size_t)u * ncl;
+
+		if (u != 0)
+			memcpy(row, set->delta + (size_t)nodes[u].fail * ncl, ncl * sizeof(unsigned int));
+
+		for (v = nodes[u].child; v != 0; v = nodes[v].sibling)
+		{
+			k = set->classes[nodes[v].c];
+
+			nodes[v].fail = u != 0 ? set->delta[(size_t)nodes[u].fail * ncl + k] : 0;
+			nodes[v].dict = nodes[nodes[v].fail].nout != 0 ? nodes[v].fail : nodes[nodes[v].fail].dict;
+
+			row[k] = v;
+			queue[tail++] = v;
+		}
+	}
+
+	free(queue);
+	set->dirty = false;
+}
+
+/*
+ * regex_set_add()
+ *  Adds a regex to a set.  `pattern' and `flags' are what `re' was
+ *  compiled from; `data' is what regex_set_match() returns for it.
+ *  Returns a handle for regex_set_delete().
+ */
+regex_set_entry_t *regex_set_add(atheme_regex_set_t *set, const char *pattern, int flags, atheme_regex_t *re, void *data)
+{
+	regex_set_entry_t *e;
+
+	return_val_if_fail(set != NULL, NULL);
+	return_val_if_fail(re != NULL, NULL);
+
+	e = smalloc(sizeof *e);
+	e->re = re;
+	e->data = data;
+	e->seq = set->seq++;
+	e->factors = regex_factors(pattern, flags, &e->nfactors);
+
+	mowgli_node_add(e, &e->node, &set->entries);
+
+	if (e->factors != NULL)
+		regex_set_trie_add(set, e);
+
+	return e;
+}
+
+/*
+ * regex_set_delete()
+ *  Removes a regex added by regex_set_add().  The regex itself belongs
+ *  to the caller and is not destroyed.
+ */
+void regex_set_delete(atheme_regex_set_t *set, regex_set_entry_t *e)
+{
+	unsigned int i;
+
+	return_if_fail(set != NULL);
+	return_if_fail(e != NULL);
+
+	if (e->factors != NULL)
+		regex_set_trie_del(set, e);
+
+	mowgli_node_delete(&e->node, &set->entries);
+
+	for (i = 0; i < e->nfactors; i++)
+		free(e->factors[i]);
+	free(e->factors);
+	free(e);
+}
+
+void regex_set_destroy(atheme_regex_set_t *set)
+{
+	mowgli_node_t *n, *tn;
+
+	return_if_fail(set != NULL);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, set->entries.head)
+		regex_set_delete(set, n->data);
+
+	regex_set_trie_free(set);
+	free(set->nodes);
+	free(set->delta);
+	free(set->cand);
+	free(set->results);
+	free(set);
+}
+
+static int regex_set_entry_cmp(const void *a, const void *b)
+{
+	const regex_set_entry_t *ea = *(regex_set_entry_t * const *)a;
+	const regex_set_entry_t *eb = *(regex_set_entry_t * const *)b;
+
+	return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/*
+ * regex_set_match()
+ *  Finds the regexes in a set that match `string'.
+ *  Returns the `data' of each, in the order they were added, in an array
+ *  that is valid until the next call; `*count' is set to its length.
+ */
+void **regex_set_match(atheme_regex_set_t *set, char *string, unsigned int *count)
+{
+	regex_set_node_t *nodes;
+	regex_set_entry_t *e;
+	mowgli_node_t *n;
+	unsigned int state = 0, ncand = 0, nres = 0, i, j;
+	const unsigned char *s;
+
+	*count = 0;
+
+	return_val_if_fail(set != NULL, NULL);
+	return_val_if_fail(string != NULL, NULL);
+
+	if (set->maxresults < MOWGLI_LIST_LENGTH(&set->entries))
+	{
+		set->maxresults = MOWGLI_LIST_LENGTH(&set->entries);
+		set->cand = srealloc(set->cand, set->maxresults * sizeof(regex_set_entry_t *));
+		set->results = srealloc(set->results, set->maxresults * sizeof(void *));
+	}
+
+	if (set->dirty)
+		regex_set_compile(set);
+
+	nodes = set->nodes;
+	set->gen++;
+
+	for (s = (const unsigned char *)string; *s != '\0'; s++)
+	{
+		state = set->delta[(size_t)state * set->nclasses + (*s < 128 ? set->classes[*s] : 0)];
+
+		for (i = state; i != 0; i = nodes[i].dict)
+			for (j = 0; j < nodes[i].nout; j++)
+			{
+				e = nodes[i].out[j];
+				if (e->gen != set->gen)
+				{
+					e->gen = set->gen;
+					set->cand[ncand++] = e;
+				}
+			}
+	}
+
+	MOWGLI_ITER_FOREACH(n, set->entries.head)
+	{
+		e = n->data;
+		if (e->factors == NULL)
+			set->cand[ncand++] = e;
+	}
+
+	qsort(set->cand, ncand, sizeof(regex_set_entry_t *), regex_set_entry_cmp);
+
+	for (i = 0; i < ncand; i++)
+		if (regex_match(set->cand[i]->re, string))
+			set->results[nres++] = set->cand[i]->data;
+
+	*count = nres;
+	return set->results;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -0,0 +1,649 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Scans over snapshots of the user and channel tables.
+ *
+ * A scan copies the rows it is given, so that a pool of worker threads
+ * (general::scan_threads) can test them against a predicate while the
+ * main thread goes on changing the real tables. The rows are split in
+ * chunks that the workers take in turn; the results come back through a
+ * pipe watched by the event loop, so the done callback never runs before
+ * scan_start() has returned. Without workers, the main thread tests the
+ * rows itself.
+ *
+ * Scans asked for by anything but an IRC user (XML-RPC, JSON-RPC) are
+ * done before scan_start() returns: those transports send their answer
+ * as soon as the command has returned, and drop the sourceinfo with it.
+ *
+ * Started scans are on scan_queue until all of their chunks are done and
+ * then on scan_done; those lists and the chunk counts of a scan are
+ * protected by scan_pool.lock.
+ */
+
+#include "atheme.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#define SCAN_CHUNK	1024		/* rows per chunk */
+#define SCAN_BLOCK	65536		/* bytes per block of copied strings */
+
+struct scan_block_ {
+	struct scan_block_ *next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+static mowgli_list_t scan_new = { NULL, NULL, 0 };	/* being filled in */
+static mowgli_list_t scan_queue = { NULL, NULL, 0 };	/* being scanned */
+static mowgli_list_t scan_done = { NULL, NULL, 0 };	/* waiting for the main thread */
+
+static int scan_pipe[2] = { -1, -1 };
+static mowgli_eventloop_pollable_t *scan_pollable;
+
+#ifdef HAVE_PTHREAD
+static struct {
+	pthread_t *threads;
+	unsigned int nthreads;
+	bool started;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work;	/* main thread -> workers */
+	pthread_cond_t idle;	/* workers -> scan_cancel() */
+} scan_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.idle = PTHREAD_COND_INITIALIZER,
+};
+
+#define scan_lock()	pthread_mutex_lock(&scan_pool.lock)
+#define scan_unlock()	pthread_mutex_unlock(&scan_pool.lock)
+#else
+#define scan_lock()	do { } while (0)
+#define scan_unlock()	do { } while (0)
+#endif
+
+static void scan_move(scan_t *scan, mowgli_list_t *list)
+{
+	if (scan->list != NULL)
+		mowgli_node_delete(&scan->node, scan->list);
+	if (list != NULL)
+		mowgli_node_add(scan, &scan->node, list);
+	scan->list = list;
+}
+
+static void scan_wakeup(void)
+{
+	/* if the pipe is full, the main thread has a wakeup pending anyway */
+	(void) write(scan_pipe[1], "", 1);
+}
+
+static void scan_chunk(scan_t *scan, unsigned int chunk)
+{
+	unsigned int i, end;
+
+	end = (chunk + 1) * SCAN_CHUNK;
+	if (end > scan->nrows)
+		end = scan->nrows;
+
+	for (i = chunk * SCAN_CHUNK; i < end; i++)
+		scan->hit[i] = scan->pred(&scan->rows[i], scan->priv);
+}
+
+static void scan_free(scan_t *scan)
+{
+	struct scan_block_ *b;
+
+	while ((b = scan->blocks) != NULL)
+	{
+		scan->blocks = b->next;
+		free(b);
+	}
+
+	if (scan->si != NULL)
+		object_unref(scan->si);
+
+	free(scan->rows);
+	free(scan->hit);
+	free(scan->matches);
+	free(scan);
+}
+
+static void scan_finish(scan_t *scan)
+{
+	unsigned int i;
+
+	if (!scan->cancelled && scan->nrows > 0)
+	{
+		scan->matches = smalloc(scan->nrows * sizeof(scan_row_t *));
+		for (i = 0; i < scan->nrows; i++)
+			if (scan->hit[i])
+				scan->matches[scan->nmatches++] = &scan->rows[i];
+	}
+
+	scan->done(scan, scan->priv);
+	scan_free(scan);
+}
+
+static void scan_done_read(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
+{
+	scan_t *scan;
+	char buf[64];
+
+	while (read(scan_pipe[0], buf, sizeof buf) > 0)
+		;
+
+	/* callbacks may start or cancel other scans, so take them off the
+	 * list one at a time.
+	 */
+	for (;;)
+	{
+		scan_lock();
+		if (scan_done.head == NULL)
+		{
+			scan_unlock();
+			break;
+		}
+		scan = scan_done.head->data;
+		scan_move(scan, NULL);
+		scan_unlock();
+
+		scan_finish(scan);
+	}
+}
+
+/* finds a scan whoever asked for has gone, or one with the given callback */
+static scan_t *scan_find(user_t *u, myuser_t *mu, scan_done_cb_t done)
+{
+	mowgli_list_t *lists[] = { &scan_new, &scan_queue, &scan_done };
+	mowgli_node_t *n;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(lists); i++)
+		MOWGLI_ITER_FOREACH(n, lists[i]->head)
+		{
+			scan_t *scan = n->data;
+
+			if (u != NULL && scan->si != NULL && scan->si->su == u)
+				return scan;
+			if (mu != NULL && scan->si != NULL && scan->si->smu == mu)
+				return scan;
+			if (done != NULL && scan->done == done)
+				return scan;
+		}
+
+	return NULL;
+}
+
+static void scan_user_delete(user_t *u)
+{
+	scan_t *scan;
+
+	for (;;)
+	{
+		scan_lock();
+		scan = scan_find(u, NULL, NULL);
+		scan_unlock();
+
+		if (scan == NULL)
+			break;
+
+		object_unref(scan->si);
+		scan->si = NULL;
+		scan_cancel(scan);
+	}
+}
+
+/* logcommand() in the done callback would look at the account */
+static void scan_myuser_delete(myuser_t *mu)
+{
+	scan_t *scan;
+
+	for (;;)
+	{
+		scan_lock();
+		scan = scan_find(NULL, mu, NULL);
+		scan_unlock();
+
+		if (scan == NULL)
+			break;
+
+		object_unref(scan->si);
+		scan->si = NULL;
+		scan_cancel(scan);
+	}
+}
+
+static bool scan_init(void)
+{
+	int i;
+
+	if (scan_pollable != NULL)
+		return true;
+
+	if (pipe(scan_pipe) < 0)
+	{
+		slog(LG_ERROR, "scan_init(): pipe: %s", strerror(errno));
+		return false;
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		fcntl(scan_pipe[i], F_SETFL, fcntl(scan_pipe[i], F_GETFL, 0) | O_NONBLOCK);
+		fcntl(scan_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+
+	scan_pollable = mowgli_pollable_create(base_eventloop, scan_pipe[0], NULL);
+	mowgli_pollable_setselect(base_eventloop, scan_pollable, MOWGLI_EVENTLOOP_IO_READ, scan_done_read);
+
+	hook_add_event("user_delete");
+	hook_add_user_delete(scan_user_delete);
+	hook_add_event("myuser_delete");
+	hook_add_myuser_delete(scan_myuser_delete);
+
+	return true;
+}
+
+#ifdef HAVE_PTHREAD
+/* the scan with chunks to hand out that was started first */
+static scan_t *scan_next(void)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, scan_queue.head)
+	{
+		scan_t *scan = n->data;
+
+		if (scan->next < scan->nchunks)
+			return scan;
+	}
+
+	return NULL;
+}
+
+static void *scan_worker(void *unused)
+{
+	scan_t *scan;
+	unsigned int chunk;
+
+	scan_lock();
+
+	for (;;)
+	{
+		while ((scan = scan_next()) == NULL)
+			pthread_cond_wait(&scan_pool.work, &scan_pool.lock);
+
+		chunk = scan->next++;
+		scan->busy++;
+		scan_unlock();
+
+		scan_chunk(scan, chunk);
+
+		scan_lock();
+		scan->busy--;
+		if (--scan->left == 0)
+		{
+			scan_move(scan, &scan_done);
+			scan_wakeup();
+		}
+		if (scan->cancelled)
+			pthread_cond_broadcast(&scan_pool.idle);
+	}
+
+	return NULL;
+}
+
+/* the child of a fork has no workers; make sure the lock is not held by
+ * one of them when it is copied.
+ */
+static void scan_atfork_prepare(void)
+{
+	scan_lock();
+}
+
+static void scan_atfork_parent(void)
+{
+	scan_unlock();
+}
+
+static void scan_atfork_child(void)
+{
+	scan_pool.nthreads = 0;
+	scan_unlock();
+}
+
+static void scan_pool_start(void)
+{
+	sigset_t all, old;
+	unsigned int i;
+	int err = 0;
+
+	scan_pool.started = true;
+
+	if (config_options.scan_threads == 0)
+		return;
+
+	scan_pool.threads = scalloc(config_options.scan_threads, sizeof(pthread_t));
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < config_options.scan_threads; i++)
+		if ((err = pthread_create(&scan_pool.threads[i], NULL, scan_worker, NULL)) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+		slog(LG_ERROR, "scan_pool_start(): cannot start scan worker %u, scanning %s: %s", i + 1,
+				i > 0 ? "with fewer workers" : "in the main thread", strerror(err));
+
+	pthread_atfork(scan_atfork_prepare, scan_atfork_parent, scan_atfork_child);
+
+	scan_pool.nthreads = i;
+	slog(LG_DEBUG, "scan_pool_start(): started %u scan workers", i);
+}
+#endif
+
+static void *scan_alloc(scan_t *scan, size_t size)
+{
+	struct scan_block_ *b = scan->blocks;
+	void *p;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+	if (b == NULL || b->size - b->used < size)
+	{
+		size_t bsize = size > SCAN_BLOCK ? size : SCAN_BLOCK;
+
+		b = smalloc(sizeof(struct scan_block_) + bsize);
+		b->size = bsize;
+		b->next = scan->blocks;
+		scan->blocks = b;
+	}
+
+	p = b->data + b->used;
+	b->used += size;
+
+	return p;
+}
+
+static const char *scan_strdup(scan_t *scan, const char *s)
+{
+	size_t len;
+	char *p;
+
+	if (s == NULL)
+		return NULL;
+
+	len = strlen(s) + 1;
+	p = scan_alloc(scan, len);
+	memcpy(p, s, len);
+
+	return p;
+}
+
+static scan_row_t *scan_row_new(scan_t *scan)
+{
+	scan_row_t *row;
+
+	return_val_if_fail(scan->list == &scan_new, NULL);
+
+	if (scan->nrows == scan->maxrows)
+	{
+		scan->maxrows = scan->maxrows ? scan->maxrows * 2 : 64;
+		scan->rows = srealloc(scan->rows, scan->maxrows * sizeof(scan_row_t));
+	}
+
+	row = &scan->rows[scan->nrows++];
+	memset(row, 0, sizeof *row);
+
+	return row;
+}
+
+/*
+ * scan_create()
+ *
+ * Sets up a scan; add rows to it and start it with scan_start(), or get
+ * rid of it with scan_cancel().
+ *
+ * Inputs:
+ *      - whoever asked for the scan, or NULL
+ *      - predicate the rows are tested against
+ *      - callback for when the scan is over
+ *      - data for both
+ *
+ * Outputs:
+ *      - the scan, or NULL if scans cannot be done
+ *
+ * Side Effects:
+ *      - the scan is cancelled if the user in si quits or the account
+ *        in si is dropped
+ */
+scan_t *scan_create(sourceinfo_t *si, scan_pred_t pred, scan_done_cb_t done, void *priv)
+{
+	scan_t *scan;
+
+	return_val_if_fail(pred != NULL, NULL);
+	return_val_if_fail(done != NULL, NULL);
+
+	if (!scan_init())
+		return NULL;
+
+#ifdef HAVE_PTHREAD
+	if (!scan_pool.started)
+		scan_pool_start();
+#endif
+
+	scan = smalloc(sizeof(scan_t));
+	scan->si = si != NULL ? object_ref(si) : NULL;
+	scan->pred = pred;
+	scan->done = done;
+	scan->priv = priv;
+
+	scan_move(scan, &scan_new);
+
+	return scan;
+}
+
+/* adds a row with just a name and a number, for scans over other tables */
+void scan_add(scan_t *scan, const char *name, unsigned int count)
+{
+	scan_row_t *row;
+
+	return_if_fail(scan != NULL);
+
+	if ((row = scan_row_new(scan)) == NULL)
+		return;
+
+	row->name = scan_strdup(scan, name);
+	row->count = count;
+}
+
+void scan_add_user(scan_t *scan, user_t *u, unsigned int flags)
+{
+	scan_row_t *row;
+	char mask[NICKLEN + USERLEN + HOSTLEN + GECOSLEN];
+
+	return_if_fail(scan != NULL);
+	return_if_fail(u != NULL);
+
+	if ((row = scan_row_new(scan)) == NULL)
+		return;
+
+	snprintf(mask, sizeof mask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
+
+	row->name = scan_strdup(scan, u->nick);
+	row->user = scan_strdup(scan, u->user);
+	row->host = scan_strdup(scan, u->host);
+	row->ip = scan_strdup(scan, u->ip);
+	row->gecos = scan_strdup(scan, u->gecos);
+	row->server = u->server != NULL ? scan_strdup(scan, u->server->name) : NULL;
+	row->mask = scan_strdup(scan, mask);
+	row->count = MOWGLI_LIST_LENGTH(&u->channels);
+
+	if (flags & SCAN_USER_CHANNELS)
+	{
+		const char **channels;
+		mowgli_node_t *n;
+		unsigned int i = 0;
+
+		channels = scan_alloc(scan, (row->count + 1) * sizeof(char *));
+
+		MOWGLI_ITER_FOREACH(n, u->channels.head)
+		{
+			chanuser_t *cu = n->data;
+
+			channels[i++] = scan_strdup(scan, cu->chan->name);
+		}
+		channels[i] = NULL;
+
+		row->channels = channels;
+	}
+}
+
+void scan_add_users(scan_t *scan, unsigned int flags)
+{
+	mowgli_patricia_iteration_state_t state;
+	user_t *u;
+
+	return_if_fail(scan != NULL);
+
+	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
+		scan_add_user(scan, u, flags);
+}
+
+void scan_add_channel(scan_t *scan, channel_t *c)
+{
+	scan_row_t *row;
+
+	return_if_fail(scan != NULL);
+	return_if_fail(c != NULL);
+
+	if ((row = scan_row_new(scan)) == NULL)
+		return;
+
+	row->name = scan_strdup(scan, c->name);
+	row->topic = scan_strdup(scan, c->topic);
+	row->count = c->nummembers;
+}
+
+void scan_add_channels(scan_t *scan)
+{
+	mowgli_patricia_iteration_state_t state;
+	channel_t *c;
+
+	return_if_fail(scan != NULL);
+
+	MOWGLI_PATRICIA_FOREACH(c, &state, chanlist)
+		scan_add_channel(scan, c);
+}
+
+/*
+ * scan_start()
+ *
+ * Hands the rows of a scan to the workers. The done callback is called
+ * from the event loop once they have all been tested, or before this
+ * returns if si is not an IRC user.
+ */
+void scan_start(scan_t *scan)
+{
+	unsigned int i;
+
+	return_if_fail(scan != NULL);
+	return_if_fail(scan->list == &scan_new);
+
+	scan->hit = scalloc(scan->nrows ? scan->nrows : 1, 1);
+	scan->nchunks = (scan->nrows + SCAN_CHUNK - 1) / SCAN_CHUNK;
+	scan->left = scan->nchunks;
+
+#ifdef HAVE_PTHREAD
+	if (scan_pool.nthreads > 0 && scan->nchunks > 0 && (scan->si == NULL || scan->si->su != NULL))
+	{
+		scan_lock();
+		scan_move(scan, &scan_queue);
+		pthread_cond_broadcast(&scan_pool.work);
+		scan_unlock();
+		return;
+	}
+#endif
+
+	for (i = 0; i < scan->nchunks; i++)
+		scan_chunk(scan, i);
+	scan->next = scan->nchunks;
+	scan->left = 0;
+
+	scan_lock();
+	scan_move(scan, scan->si != NULL && scan->si->su == NULL ? NULL : &scan_done);
+	scan_unlock();
+
+	/* the reply must be in before the transport answers */
+	if (scan->list == NULL)
+	{
+		scan_finish(scan);
+		return;
+	}
+
+	scan_wakeup();
+}
+
+/*
+ * scan_cancel()
+ *
+ * Stops a scan, waiting for the workers to finish the chunks they have
+ * taken, and calls its done callback with scan->cancelled set.
+ */
+void scan_cancel(scan_t *scan)
+{
+	return_if_fail(scan != NULL);
+
+	scan_lock();
+
+	scan->cancelled = true;
+	scan->left -= scan->nchunks - scan->next;
+	scan->next = scan->nchunks;
+
+#ifdef HAVE_PTHREAD
+	while (scan->busy > 0)
+		pthread_cond_wait(&scan_pool.idle, &scan_pool.lock);
+#endif
+
+	scan_move(scan, NULL);
+	scan_unlock();
+
+	scan_finish(scan);
+}
+
+/*
+ * scan_forget()
+ *
+ * Cancels the scans with the given done callback; modules call this
+ * when they are unloaded.
+ */
+void scan_forget(scan_done_cb_t done)
+{
+	scan_t *scan;
+
+	return_if_fail(done != NULL);
+
+	for (;;)
+	{
+		scan_lock();
+		scan = scan_find(NULL, NULL, done);
+		scan_unlock();
+
+		if (scan == NULL)
+			break;
+
+		scan_cancel(scan);
+	}
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -29,7 +29,7 @@
 int sts(const char *fmt, ...)
 {
 	va_list ap;
-	char buf[513];
+	char *buf;
 	int len;
 
 	if (!me.connected)
@@ -39,19 +39,29 @@ int sts(const char *fmt, ...)
 	return_val_if_fail(curr_uplink->conn != NULL, 0);
 	return_val_if_fail(fmt != NULL, 0);
 
+	/* format straight into the sendq */
+	if ((buf = sendq_reserve(curr_uplink->conn, 512)) == NULL)
+		return 0;
+
 	va_start(ap, fmt);
-	vsnprintf(buf, 511, fmt, ap); /* leave two bytes for \r\n */
+	len = vsnprintf(buf, 511, fmt, ap); /* leave two bytes for \r\n */
 	va_end(ap);
 
-	len = strlen(buf);
+	if (len < 0)
+		return 0;
+	if (len > 510)
+		len = 510;
+
 	buf[len++] = '\r';
 	buf[len++] = '\n';
-	buf[len] = '\0';
 
 	cnt.bout += len;
 
-	sendq_add(curr_uplink->conn, buf, len);
+	sendq_commit(curr_uplink->conn, len);
 
+	/* only now: logging may send to a log channel, and a nested sts()
+	 * must not reuse the reserved space.  The line stays in the sendq
+	 * until it is flushed from the event loop. */
 	slog(LG_RAWDATA, "<- %.*s", len, buf);
 
 	return 0;
@@ -215,7 +215,7 @@ static void server_delete_serv(server_t *s)
 		 * XXX should we do this here?
 		 * -- jilles */
 		if (u->myuser != NULL)
-			u->myuser->flags &= ~MU_NOBURSTLOGIN;
+			myuser_set_flags(u->myuser, 0, MU_NOBURSTLOGIN);
 		user_delete(u, "*.net *.split");
 	}
 
@@ -435,6 +435,7 @@ void handle_burstlogin(user_t *u, const char *login, time_t ts)
 		mu = myuser_add(login, "*", "noemail", MU_CRYPTPASS);
 		if (ts != 0)
 			mu->registered = ts;
+		myuser_commit(mu);
 		metadata_add(mu, "fake", "1");
 	}
 	if (u->myuser != NULL)	/* already logged in, hmm */
@@ -462,6 +463,7 @@ void handle_burstlogin(user_t *u, const char *login, time_t ts)
 		return;
 	}
 	u->myuser = mu;
+	chanacs_user_flags_invalidate();
 	u->flags &= ~UF_SOPER_PASS;
 	n = mowgli_node_create();
 	mowgli_node_add(u, n, &mu->logins);
@@ -471,7 +473,7 @@ void handle_burstlogin(user_t *u, const char *login, time_t ts)
 	if (mu->flags & MU_PENDINGLOGIN && authservice_loaded)
 	{
 		slog(LG_DEBUG, "handle_burstlogin(): handling pending login hooks for %s", u->nick);
-		mu->flags &= ~MU_PENDINGLOGIN;
+		myuser_set_flags(mu, 0, MU_PENDINGLOGIN);
 		hook_call_user_identify(u);
 	}
 }
@@ -508,6 +510,7 @@ void handle_setlogin(sourceinfo_t *si, user_t *u, const char *login, time_t ts)
 			mowgli_node_free(n);
 		}
 		u->myuser = NULL;
+		chanacs_user_flags_invalidate();
 	}
 	if (mu == NULL)
 	{
@@ -520,6 +523,7 @@ void handle_setlogin(sourceinfo_t *si, user_t *u, const char *login, time_t ts)
 		mu = myuser_add(login, "*", "noemail", MU_CRYPTPASS);
 		if (ts != 0)
 			mu->registered = ts;
+		myuser_commit(mu);
 		metadata_add(mu, "fake", "1");
 	}
 	else if (ts != 0 && ts != mu->registered)
@@ -540,6 +544,7 @@ void handle_setlogin(sourceinfo_t *si, user_t *u, const char *login, time_t ts)
 		mu->registered = ts;
 	}
 	u->myuser = mu;
+	chanacs_user_flags_invalidate();
 	u->flags &= ~UF_SOPER_PASS;
 	n = mowgli_node_create();
 	mowgli_node_add(u, n, &mu->logins);
@@ -570,6 +575,7 @@ void handle_clearlogin(sourceinfo_t *si, user_t *u)
 		mowgli_node_free(n);
 	}
 	u->myuser = NULL;
+	chanacs_user_flags_invalidate();
 }
 
 void handle_certfp(sourceinfo_t *si, user_t *u, const char *certfp)
@@ -638,6 +644,7 @@ void myuser_login(service_t *svs, user_t *u, myuser_t *mu, bool sendaccount)
 	myuser_notice(svs->me->nick, mu, "%s!%s@%s has just authenticated as you (%s)", u->nick, u->user, u->vhost, entity(mu)->name);
 
 	u->myuser = mu;
+	chanacs_user_flags_invalidate();
 	mowgli_node_add(u, mowgli_node_create(), &mu->logins);
 	u->flags &= ~UF_SOPER_PASS;
 
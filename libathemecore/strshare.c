@@ -23,35 +23,172 @@
 
 #include "atheme.h"
 
-mowgli_patricia_t *strshare_dict;
-
+/*
+ * Shared strings are kept in an open addressing hash table with linear
+ * probing.  Each string is preceded by a header holding its reference
+ * count, hash and length, and short ones are carved out of block heaps
+ * by size class instead of being allocated one at a time.
+ */
 typedef struct
 {
-	int refcount;
+	unsigned int refcount;
+	unsigned int hash;
+	unsigned int len;
 } strshare_t;
 
+#define STRSHARE_CLASS_SIZE	16
+#define STRSHARE_CLASSES	16	/* header and string up to 256 bytes */
+#define STRSHARE_MIN_SLOTS	4096
+
+static strshare_t **strshare_table;
+static unsigned int strshare_slots;	/* a power of two */
+static mowgli_heap_t *strshare_heaps[STRSHARE_CLASSES];
+
+#define STRSHARE(str)	((strshare_t *)(uintptr_t)(str) - 1)
+
 void strshare_init(void)
 {
-	strshare_dict = mowgli_patricia_create(noopcanon);
+	strshare_slots = STRSHARE_MIN_SLOTS;
+	strshare_table = scalloc(strshare_slots, sizeof(strshare_t *));
+}
+
+/* 32-bit FNV-1a */
+static inline unsigned int strshare_hash_len(const char *str, unsigned int *len)
+{
+	const unsigned char *p;
+	unsigned int hash = 2166136261U;
+
+	for (p = (const unsigned char *)str; *p != '\0'; p++)
+	{
+		hash ^= *p;
+		hash *= 16777619U;
+	}
+
+	*len = p - (const unsigned char *)str;
+	return hash;
+}
+
+static unsigned int strshare_lookup(const char *str, unsigned int hash, unsigned int len)
+{
+	unsigned int mask = strshare_slots - 1, i;
+	strshare_t *ss;
+
+	for (i = hash & mask; (ss = strshare_table[i]) != NULL; i = (i + 1) & mask)
+		if (ss->hash == hash && ss->len == len && !memcmp(ss + 1, str, len))
+			break;
+
+	return i;
+}
+
+static void strshare_grow(void)
+{
+	strshare_t **old = strshare_table;
+	unsigned int oldslots = strshare_slots, i, j, mask;
+
+	strshare_slots *= 2;
+	strshare_table = scalloc(strshare_slots, sizeof(strshare_t *));
+	mask = strshare_slots - 1;
+
+	for (i = 0; i < oldslots; i++)
+	{
+		if (old[i] == NULL)
+			continue;
+
+		for (j = old[i]->hash & mask; strshare_table[j] != NULL; j = (j + 1) & mask)
+			;
+		strshare_table[j] = old[i];
+	}
+
+	free(old);
+}
+
+/* empties a slot, moving back entries that probed past it */
+static void strshare_remove(unsigned int i)
+{
+	unsigned int mask = strshare_slots - 1, j, home;
+
+	strshare_table[i] = NULL;
+
+	for (j = (i + 1) & mask; strshare_table[j] != NULL; j = (j + 1) & mask)
+	{
+		home = strshare_table[j]->hash & mask;
+
+		/* leave it if its home slot lies cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		strshare_table[i] = strshare_table[j];
+		strshare_table[j] = NULL;
+		i = j;
+	}
+}
+
+static strshare_t *strshare_alloc(unsigned int len)
+{
+	size_t size = sizeof(strshare_t) + len + 1, class;
+
+	class = (size - 1) / STRSHARE_CLASS_SIZE;
+	if (class >= STRSHARE_CLASSES)
+		return smalloc(size);
+
+	size = (class + 1) * STRSHARE_CLASS_SIZE;
+
+	if (strshare_heaps[class] == NULL)
+		strshare_heaps[class] = mowgli_heap_create(size, 4096 / size, BH_LAZY);
+
+	return mowgli_heap_alloc(strshare_heaps[class]);
+}
+
+static void strshare_free(strshare_t *ss)
+{
+	size_t class = (sizeof(strshare_t) + ss->len) / STRSHARE_CLASS_SIZE;
+
+	if (class >= STRSHARE_CLASSES)
+		free(ss);
+	else
+		mowgli_heap_free(strshare_heaps[class], ss);
 }
 
 stringref strshare_get(const char *str)
 {
 	strshare_t *ss;
+	unsigned int hash, len, i;
 
 	if (str == NULL)
 		return NULL;
 
-	ss = mowgli_patricia_retrieve(strshare_dict, str);
-	if (ss != NULL)
+	hash = strshare_hash_len(str, &len);
+	i = strshare_lookup(str, hash, len);
+
+	if ((ss = strshare_table[i]) != NULL)
+	{
 		ss->refcount++;
-	else
+
+		cnt.strshare_refs++;
+		cnt.strshare_saved += len + 1;
+
+		return (char *)(ss + 1);
+	}
+
+	/* keep the table at most half full */
+	if ((cnt.strshare + 1) * 2 > strshare_slots)
 	{
-		ss = smalloc(sizeof(strshare_t) + strlen(str) + 1);
-		ss->refcount = 1;
-		strcpy((char *)(ss + 1), str);
-		mowgli_patricia_add(strshare_dict, (char *)(ss + 1), ss);
+		strshare_grow();
+		i = strshare_lookup(str, hash, len);
 	}
+
+	ss = strshare_alloc(len);
+	ss->refcount = 1;
+	ss->hash = hash;
+	ss->len = len;
+	memcpy(ss + 1, str, len + 1);
+
+	strshare_table[i] = ss;
+
+	cnt.strshare++;
+	cnt.strshare_refs++;
+	cnt.strshare_bytes += len + 1;
+
 	return (char *)(ss + 1);
 }
 
@@ -62,28 +199,41 @@ stringref strshare_ref(stringref str)
 	if (str == NULL)
 		return NULL;
 
-	/* intermediate cast to suppress gcc -Wcast-qual */
-	ss = (strshare_t *)(uintptr_t)str - 1;
+	ss = STRSHARE(str);
 	ss->refcount++;
 
+	cnt.strshare_refs++;
+	cnt.strshare_saved += ss->len + 1;
+
 	return str;
 }
 
 void strshare_unref(stringref str)
 {
 	strshare_t *ss;
+	unsigned int mask = strshare_slots - 1, i;
 
 	if (str == NULL)
 		return;
 
-	/* intermediate cast to suppress gcc -Wcast-qual */
-	ss = (strshare_t *)(uintptr_t)str - 1;
-	ss->refcount--;
-	if (ss->refcount == 0)
+	ss = STRSHARE(str);
+	cnt.strshare_refs--;
+
+	if (--ss->refcount > 0)
 	{
-		mowgli_patricia_delete(strshare_dict, str);
-		free(ss);
+		cnt.strshare_saved -= ss->len + 1;
+		return;
 	}
+
+	for (i = ss->hash & mask; strshare_table[i] != ss; i = (i + 1) & mask)
+		return_if_fail(strshare_table[i] != NULL);
+
+	strshare_remove(i);
+
+	cnt.strshare--;
+	cnt.strshare_bytes -= ss->len + 1;
+
+	strshare_free(ss);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
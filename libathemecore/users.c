@@ -163,8 +163,8 @@ user_t *user_add(const char *nick, const char *user, const char *host,
 	u->user = strshare_get(user);
 	u->host = strshare_get(host);
 	u->gecos = strshare_get(gecos);
-	u->chost = strshare_get(vhost ? vhost : host);
-	u->vhost = strshare_get(vhost ? vhost : host);
+	u->chost = vhost ? strshare_get(vhost) : strshare_ref(u->host);
+	u->vhost = strshare_ref(u->chost);
 
 	if (ip && strcmp(ip, "0") && strcmp(ip, "0.0.0.0") && strcmp(ip, "255.255.255.255"))
 		u->ip = strshare_get(ip);
@@ -278,6 +278,8 @@ void user_delete(user_t *u, const char *comment)
 	strshare_unref(u->chost);
 	strshare_unref(u->ip);
 
+	metadata_delete_all(u);
+
 	mowgli_heap_free(user_heap, u);
 
 	cnt.user--;
@@ -493,6 +495,7 @@ bool user_changenick(user_t *u, const char *nick, time_t ts)
 
 	strshare_unref(u->nick);
 	u->nick = strshare_get(nick);
+	chanacs_user_flags_invalidate();
 
 	u->ts = ts;
 
@@ -575,6 +578,7 @@ void user_mode(user_t *user, const char *modes)
 		slog(LG_DEBUG, "user_mode(): %s is now an IRCop", user->nick);
 		slog(LG_INFO, "OPER: \2%s\2 (\2%s\2)", user->nick, user->server->name);
 		user->server->opers++;
+		chanacs_user_flags_invalidate();
 		hook_call_user_oper(user);
 	}
 	else if (was_ircop && !is_ircop(user))
@@ -582,6 +586,7 @@ void user_mode(user_t *user, const char *modes)
 		slog(LG_DEBUG, "user_mode(): %s is no longer an IRCop", user->nick);
 		slog(LG_INFO, "DEOPER: \2%s\2 (\2%s\2)", user->nick, user->server->name);
 		user->server->opers--;
+		chanacs_user_flags_invalidate();
 		hook_call_user_deoper(user);
 	}
 }
@@ -616,6 +621,7 @@ void user_sethost(user_t *source, user_t *target, stringref host)
 
 	strshare_unref(target->vhost);
 	target->vhost = strshare_get(host);
+	chanacs_user_flags_invalidate();
 
 	sethost_sts(source, target, target->vhost);
 	hook_call_user_sethost(target);
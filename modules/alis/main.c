@@ -79,15 +79,245 @@ struct alis_query
 	int showsecret;
 };
 
+/*
+ * Channel index.
+ *
+ * Every channel is kept in a bucket for its number of members, so that
+ * channels can be listed biggest first, and -min and -max only look at
+ * the buckets in range. Channels are also listed under each trigram
+ * (three consecutive characters, case folded) of their name; a mask
+ * only has to be matched against the channels listed under the rarest
+ * trigram of the literal text in it.
+ */
+#define ALIS_GRAMLEN	3
+
+typedef struct {
+	char key[ALIS_GRAMLEN + 1];
+	mowgli_list_t chans;
+} alis_gram_t;
+
+typedef struct {
+	channel_t *chan;
+	unsigned int members;		/* bucket it is in */
+	mowgli_node_t bnode;
+	unsigned int ngrams;
+	alis_gram_t **grams;
+	mowgli_node_t *gnodes;
+} alis_chan_t;
+
+static mowgli_patricia_t *alis_chans;
+static mowgli_patricia_t *alis_grams;
+static mowgli_list_t *alis_buckets;
+static unsigned int alis_nbuckets;
+
+static void alis_buckets_grow(unsigned int members)
+{
+	unsigned int n = alis_nbuckets ? alis_nbuckets : 64;
+
+	if (members < alis_nbuckets)
+		return;
+
+	while (n <= members)
+		n *= 2;
+
+	/* nodes do not point back at their list, so moving the lists is
+	 * fine */
+	alis_buckets = srealloc(alis_buckets, n * sizeof(mowgli_list_t));
+	memset(alis_buckets + alis_nbuckets, 0, (n - alis_nbuckets) * sizeof(mowgli_list_t));
+	alis_nbuckets = n;
+}
+
+static void alis_bucket_set(alis_chan_t *ac, unsigned int members)
+{
+	if (members == ac->members)
+		return;
+
+	alis_buckets_grow(members);
+	mowgli_node_delete(&ac->bnode, &alis_buckets[ac->members]);
+	mowgli_node_add(ac, &ac->bnode, &alis_buckets[members]);
+	ac->members = members;
+}
+
+static void alis_gram_key(char *key, const char *s)
+{
+	int i;
+
+	for (i = 0; i < ALIS_GRAMLEN; i++)
+		key[i] = ToLower(s[i]);
+	key[i] = '\0';
+}
+
+static alis_chan_t *alis_index_add(channel_t *c)
+{
+	alis_chan_t *ac;
+	alis_gram_t *g;
+	char key[ALIS_GRAMLEN + 1];
+	size_t len, i, j;
+
+	if ((ac = mowgli_patricia_retrieve(alis_chans, c->name)) != NULL)
+		return ac;
+
+	ac = smalloc(sizeof(alis_chan_t));
+	ac->chan = c;
+
+	len = strlen(c->name);
+	if (len >= ALIS_GRAMLEN)
+	{
+		ac->grams = smalloc((len - ALIS_GRAMLEN + 1) * sizeof(alis_gram_t *));
+		ac->gnodes = scalloc(len - ALIS_GRAMLEN + 1, sizeof(mowgli_node_t));
+	}
+
+	for (i = 0; i + ALIS_GRAMLEN <= len; i++)
+	{
+		alis_gram_key(key, c->name + i);
+
+		if ((g = mowgli_patricia_retrieve(alis_grams, key)) == NULL)
+		{
+			g = smalloc(sizeof(alis_gram_t));
+			memcpy(g->key, key, sizeof key);
+			mowgli_patricia_add(alis_grams, g->key, g);
+		}
+
+		/* list the channel once per trigram */
+		for (j = 0; j < ac->ngrams; j++)
+			if (ac->grams[j] == g)
+				break;
+		if (j < ac->ngrams)
+			continue;
+
+		ac->grams[ac->ngrams] = g;
+		mowgli_node_add(ac, &ac->gnodes[ac->ngrams], &g->chans);
+		ac->ngrams++;
+	}
+
+	mowgli_patricia_add(alis_chans, c->name, ac);
+
+	ac->members = MOWGLI_LIST_LENGTH(&c->members);
+	alis_buckets_grow(ac->members);
+	mowgli_node_add(ac, &ac->bnode, &alis_buckets[ac->members]);
+
+	return ac;
+}
+
+static void alis_index_delete(channel_t *c)
+{
+	alis_chan_t *ac;
+	alis_gram_t *g;
+	unsigned int i;
+
+	if ((ac = mowgli_patricia_delete(alis_chans, c->name)) == NULL)
+		return;
+
+	for (i = 0; i < ac->ngrams; i++)
+	{
+		g = ac->grams[i];
+		mowgli_node_delete(&ac->gnodes[i], &g->chans);
+
+		if (MOWGLI_LIST_LENGTH(&g->chans) == 0)
+		{
+			mowgli_patricia_delete(alis_grams, g->key);
+			free(g);
+		}
+	}
+
+	mowgli_node_delete(&ac->bnode, &alis_buckets[ac->members]);
+
+	free(ac->grams);
+	free(ac->gnodes);
+	free(ac);
+}
+
+static void alis_channel_add(channel_t *c)
+{
+	alis_index_add(c);
+}
+
+static void alis_channel_delete(channel_t *c)
+{
+	alis_index_delete(c);
+}
+
+static void alis_channel_join(hook_channel_joinpart_t *hdata)
+{
+	channel_t *c;
+
+	/* a hook before this one may have kicked the user again */
+	if (hdata->cu == NULL)
+		return;
+
+	c = hdata->cu->chan;
+
+	/* channels services create are not announced by channel_add */
+	alis_bucket_set(alis_index_add(c), MOWGLI_LIST_LENGTH(&c->members));
+}
+
+static void alis_channel_part(hook_channel_joinpart_t *hdata)
+{
+	channel_t *c;
+	alis_chan_t *ac;
+
+	if (hdata->cu == NULL)
+		return;
+
+	c = hdata->cu->chan;
+
+	/* this is called before the user is taken off the channel */
+	if ((ac = mowgli_patricia_retrieve(alis_chans, c->name)) != NULL)
+		alis_bucket_set(ac, MOWGLI_LIST_LENGTH(&c->members) - 1);
+}
+
+static void alis_free_chan(const char *key, void *data, void *privdata)
+{
+	alis_chan_t *ac = data;
+
+	free(ac->grams);
+	free(ac->gnodes);
+	free(ac);
+}
+
+static void alis_free_gram(const char *key, void *data, void *privdata)
+{
+	free(data);
+}
+
 void _modinit(module_t *m)
 {
+	mowgli_patricia_iteration_state_t state;
+	channel_t *c;
+
 	alis = service_add("alis", NULL);
 	service_bind_command(alis, &alis_list);
 	service_bind_command(alis, &alis_help);
+
+	alis_chans = mowgli_patricia_create(irccasecanon);
+	alis_grams = mowgli_patricia_create(noopcanon);
+
+	MOWGLI_PATRICIA_FOREACH(c, &state, chanlist)
+		alis_index_add(c);
+
+	hook_add_event("channel_add");
+	hook_add_channel_add(alis_channel_add);
+	hook_add_event("channel_delete");
+	hook_add_channel_delete(alis_channel_delete);
+	hook_add_event("channel_join");
+	hook_add_channel_join(alis_channel_join);
+	hook_add_event("channel_part");
+	hook_add_channel_part(alis_channel_part);
 }
 
 void _moddeinit(module_unload_intent_t intent)
 {
+	hook_del_channel_add(alis_channel_add);
+	hook_del_channel_delete(alis_channel_delete);
+	hook_del_channel_join(alis_channel_join);
+	hook_del_channel_part(alis_channel_part);
+
+	mowgli_patricia_destroy(alis_chans, alis_free_chan, NULL);
+	mowgli_patricia_destroy(alis_grams, alis_free_gram, NULL);
+	free(alis_buckets);
+	alis_buckets = NULL;
+	alis_nbuckets = 0;
+
 	service_unbind_command(alis, &alis_list);
 	service_unbind_command(alis, &alis_help);
 
@@ -400,11 +630,152 @@ static int show_channel(channel_t *chptr, struct alis_query *query)
 	return 1;
 }
 
+/*
+ * alis_best_gram()
+ *
+ * Finds the trigram in the literal text of a channel name mask that the
+ * fewest channels have.
+ *
+ * Inputs:
+ *     - mask as given to match()
+ *     - where to put the trigram
+ *
+ * Outputs:
+ *     - false if the mask has no literal text three characters long,
+ *       otherwise true and the trigram, or NULL if no channel has one
+ *       of the trigrams (and so none can match)
+ *
+ * Side Effects:
+ *     - none
+ */
+static bool alis_best_gram(const char *mask, alis_gram_t **best)
+{
+	alis_gram_t *g;
+	char key[ALIS_GRAMLEN + 1];
+	const char *p, *run;
+	bool found = false;
+
+	*best = NULL;
+
+	for (p = run = mask; ; p++)
+	{
+		/* everything that match() does not take literally ends a run;
+		 * an escaped character is skipped as well */
+		if (*p != '\0' && strchr("*?&#%\\", *p) == NULL)
+			continue;
+
+		for (; run + ALIS_GRAMLEN <= p; run++)
+		{
+			alis_gram_key(key, run);
+
+			if ((g = mowgli_patricia_retrieve(alis_grams, key)) == NULL)
+			{
+				*best = NULL;
+				return true;
+			}
+
+			if (!found || MOWGLI_LIST_LENGTH(&g->chans) < MOWGLI_LIST_LENGTH(&(*best)->chans))
+				*best = g;
+			found = true;
+		}
+
+		if (*p == '\0')
+			break;
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		run = p + 1;
+	}
+
+	return found;
+}
+
+static int alis_members_cmp(const void *a, const void *b)
+{
+	const alis_chan_t *aa = *(alis_chan_t * const *)a;
+	const alis_chan_t *bb = *(alis_chan_t * const *)b;
+
+	if (aa->members != bb->members)
+		return aa->members > bb->members ? -1 : 1;
+
+	return irccasecmp(aa->chan->name, bb->chan->name);
+}
+
+/*
+ * alis_candidates()
+ *
+ * Collects the channels that may match a query, biggest first, using the
+ * channel index.
+ *
+ * Inputs:
+ *     - query
+ *     - where to put the number of channels
+ *
+ * Outputs:
+ *     - array of channels, to be freed by the caller, or NULL if there
+ *       are none
+ *
+ * Side Effects:
+ *     - none
+ */
+static alis_chan_t **alis_candidates(struct alis_query *query, size_t *count)
+{
+	alis_chan_t **cand, *ac;
+	alis_gram_t *g;
+	mowgli_node_t *n;
+	unsigned int lo, hi, i;
+	size_t num = 0;
+
+	*count = 0;
+
+	lo = query->min > 0 ? query->min : 0;
+	hi = alis_nbuckets ? alis_nbuckets - 1 : 0;
+	if (query->max > 0 && (unsigned int)query->max < hi)
+		hi = query->max;
+
+	if (alis_best_gram(query->mask, &g))
+	{
+		if (g == NULL)
+			return NULL;
+
+		cand = smalloc(MOWGLI_LIST_LENGTH(&g->chans) * sizeof(alis_chan_t *));
+
+		MOWGLI_ITER_FOREACH(n, g->chans.head)
+		{
+			ac = n->data;
+			if (ac->members >= lo && ac->members <= hi)
+				cand[num++] = ac;
+		}
+
+		qsort(cand, num, sizeof(alis_chan_t *), alis_members_cmp);
+	}
+	else
+	{
+		if (lo >= alis_nbuckets)
+			return NULL;
+
+		for (i = lo; i <= hi; i++)
+			num += MOWGLI_LIST_LENGTH(&alis_buckets[i]);
+		if (num == 0)
+			return NULL;
+
+		cand = smalloc(num * sizeof(alis_chan_t *));
+		num = 0;
+
+		for (i = hi + 1; i-- > lo; )
+			MOWGLI_ITER_FOREACH(n, alis_buckets[i].head)
+				cand[num++] = n->data;
+	}
+
+	*count = num;
+	return cand;
+}
+
 static void alis_cmd_list(sourceinfo_t *si, int parc, char *parv[])
 {
 	channel_t *chptr;
 	struct alis_query query;
-	mowgli_patricia_iteration_state_t state;
+	alis_chan_t **cand;
+	size_t count, i;
 	int maxmatch;
 
 	memset(&query, 0, sizeof(struct alis_query));
@@ -439,8 +810,12 @@ static void alis_cmd_list(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	MOWGLI_PATRICIA_FOREACH(chptr, &state, chanlist)
+	cand = alis_candidates(&query, &count);
+
+	for (i = 0; i < count; i++)
 	{
+		chptr = cand[i]->chan;
+
 		/* matches, so show it */
 		if(show_channel(chptr, &query))
 		{
@@ -455,6 +830,7 @@ static void alis_cmd_list(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	command_success_nodata(si, "End of output");
+	free(cand);
 	free_alis(&query);
 	return;
 }
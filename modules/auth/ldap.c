@@ -22,9 +22,22 @@
    binddn -- distinguished name to bind to for searching (optional)
    bindauth -- password for the distinguished name (optional, must specify if binddn given)
 
+ and optionally:
+
+   pool_size -- number of connections used for logins (default 2)
+   timeout -- how long a login may take before it fails (default 5s)
+   cache_ttl -- how long a successful login is remembered (default 5m)
+   negative_cache_ttl -- how long a failed login is remembered (default 30s)
+
+ Logins through verify_password_async() (NickServ IDENTIFY, SASL, the RPC
+ login methods) are checked with the asynchronous libldap calls on a pool
+ of connections whose sockets are watched by the event loop; only
+ connecting to the server still blocks, for at most a second.  Other
+ password checks use a separate connection and wait for the result.
 */
 
 #include "atheme.h"
+#include "md5.h"
 
 #include <ldap.h>
 
@@ -40,31 +53,568 @@ struct
 	char *binddn;
 	char *bindauth;
 	bool useDN;
+	bool valid;
+	unsigned int pool_size;
+	unsigned int timeout;
+	unsigned int cache_ttl;
+	unsigned int negative_cache_ttl;
 } ldap_config;
-LDAP *ldap_conn;
 
-static void ldap_config_ready(void *unused)
+typedef struct ldap_request_ ldap_request_t;
+
+typedef struct {
+	LDAP *ld;
+	mowgli_eventloop_pollable_t *pollable;	/* NULL for the blocking connection */
+	ldap_request_t *req;			/* request using the connection */
+} ldap_pconn_t;
+
+typedef enum {
+	LR_BIND_USER,		/* dnformat: bind as the user */
+	LR_BIND_SEARCH,		/* bind as binddn to search */
+	LR_SEARCH,		/* look for the user's entries */
+	LR_BIND_FOUND,		/* bind as one of the entries found */
+} ldap_request_state_t;
+
+struct ldap_request_ {
+	char *name;
+	char *password;
+	unsigned char digest[16];	/* cache key */
+
+	ldap_request_state_t state;
+	int msgid;
+	bool retried;
+	char **dns;
+	unsigned int ndns, nextdn;
+
+	ldap_pconn_t *conn;
+	mowgli_node_t node;		/* in ldap_queue while waiting */
+	mowgli_eventloop_timer_t *timer;
+
+	bool done, verified;
+	auth_user_cb_t cb;		/* NULL for a blocking check */
+	void *priv;
+};
+
+typedef struct {
+	char key[33];
+	bool verified;
+	time_t expires;
+} ldap_cache_entry_t;
+
+static ldap_pconn_t *ldap_pool;
+static unsigned int ldap_pool_count;
+static ldap_pconn_t ldap_sync_conn;
+static mowgli_list_t ldap_queue;
+static mowgli_eventloop_timer_t *ldap_dispatch_timer;
+
+static mowgli_patricia_t *ldap_cache;
+static mowgli_eventloop_timer_t *ldap_cache_timer;
+static unsigned char ldap_cache_salt[16];
+
+static char *ldap_noattrs[] = { LDAP_NO_ATTRS, NULL };
+
+static void ldap_pool_dispatch(void);
+
+static void ldap_warn(int res)
+{
+	static time_t lastwarning;
+
+	if (CURRTIME > lastwarning + 300)
+	{
+		slog(LG_INFO, "LDAP:ERROR: \2%s\2", ldap_err2string(res));
+		wallops("Problem with LDAP server: %s", ldap_err2string(res));
+		lastwarning = CURRTIME;
+	}
+}
+
+/* the cache is keyed by a salted hash, so passwords are not kept around */
+static void ldap_cache_key(const char *name, const char *password, unsigned char digest[16])
+{
+	md5_state_t ctx;
+
+	md5_init(&ctx);
+	md5_append(&ctx, ldap_cache_salt, sizeof ldap_cache_salt);
+	md5_append(&ctx, (const unsigned char *)name, strlen(name) + 1);
+	md5_append(&ctx, (const unsigned char *)password, strlen(password));
+	md5_finish(&ctx, digest);
+}
+
+static void ldap_cache_keystr(const unsigned char digest[16], char *buf)
+{
+	unsigned int i;
+
+	for (i = 0; i < 16; i++)
+		sprintf(buf + 2 * i, "%02x", digest[i]);
+}
+
+static ldap_cache_entry_t *ldap_cache_find(const unsigned char digest[16])
+{
+	ldap_cache_entry_t *ce;
+	char key[33];
+
+	ldap_cache_keystr(digest, key);
+	ce = mowgli_patricia_retrieve(ldap_cache, key);
+
+	return ce != NULL && ce->expires > CURRTIME ? ce : NULL;
+}
+
+static void ldap_cache_store(const unsigned char digest[16], bool verified)
+{
+	ldap_cache_entry_t *ce;
+	unsigned int ttl = verified ? ldap_config.cache_ttl : ldap_config.negative_cache_ttl;
+	char key[33];
+
+	if (ttl == 0)
+		return;
+
+	ldap_cache_keystr(digest, key);
+	if ((ce = mowgli_patricia_retrieve(ldap_cache, key)) == NULL)
+	{
+		ce = smalloc(sizeof *ce);
+		mowgli_strlcpy(ce->key, key, sizeof ce->key);
+		mowgli_patricia_add(ldap_cache, ce->key, ce);
+	}
+
+	ce->verified = verified;
+	ce->expires = CURRTIME + ttl;
+}
+
+static void ldap_cache_flush(bool expired_only)
+{
+	mowgli_patricia_iteration_state_t state;
+	ldap_cache_entry_t *ce;
+
+	MOWGLI_PATRICIA_FOREACH(ce, &state, ldap_cache)
+	{
+		if (expired_only && ce->expires > CURRTIME)
+			continue;
+
+		mowgli_patricia_delete(ldap_cache, ce->key);
+		free(ce);
+	}
+}
+
+static void ldap_cache_expire(void *unused)
+{
+	ldap_cache_flush(true);
+}
+
+static void ldap_pconn_close(ldap_pconn_t *pc)
+{
+	if (pc->pollable != NULL)
+	{
+		mowgli_pollable_destroy(base_eventloop, pc->pollable);
+		pc->pollable = NULL;
+	}
+
+	if (pc->ld != NULL)
+		ldap_unbind_ext(pc->ld, NULL, NULL);
+	pc->ld = NULL;
+}
+
+static bool ldap_pconn_open(ldap_pconn_t *pc)
+{
+	int res;
+
+	if (pc->ld != NULL)
+		return true;
+
+	res = ldap_initialize(&pc->ld, ldap_config.url);
+	if (res != LDAP_SUCCESS)
+	{
+		slog(LG_ERROR, "ldap_pconn_open(): ldap_initialize(%s) failed: %s", ldap_config.url, ldap_err2string(res));
+		ldap_warn(res);
+		pc->ld = NULL;
+		return false;
+	}
+
+	/* short timeouts, connecting still blocks atheme as a whole */
+	ldap_set_option(pc->ld, LDAP_OPT_TIMEOUT, &(const struct timeval){1, 0});
+	ldap_set_option(pc->ld, LDAP_OPT_NETWORK_TIMEOUT, &(const struct timeval){1, 0});
+	ldap_set_option(pc->ld, LDAP_OPT_DEREF, &(const int){false});
+	ldap_set_option(pc->ld, LDAP_OPT_REFERRALS, &(const int){false});
+
+	return true;
+}
+
+static void ldap_request_free(ldap_request_t *req)
+{
+	unsigned int i;
+
+	for (i = 0; i < req->ndns; i++)
+		free(req->dns[i]);
+	free(req->dns);
+
+	explicit_bzero(req->password, strlen(req->password));
+	free(req->password);
+	free(req->name);
+	free(req);
+}
+
+/* forgets the progress of a request, to start over on another connection */
+static void ldap_request_reset(ldap_request_t *req)
+{
+	unsigned int i;
+
+	for (i = 0; i < req->ndns; i++)
+		free(req->dns[i]);
+	free(req->dns);
+
+	req->dns = NULL;
+	req->ndns = req->nextdn = 0;
+	req->state = ldap_config.useDN ? LR_BIND_USER : LR_BIND_SEARCH;
+	req->conn = NULL;
+}
+
+static void ldap_request_finish(ldap_request_t *req, bool verified, bool cacheable)
+{
+	if (cacheable)
+		ldap_cache_store(req->digest, verified);
+
+	if (req->conn != NULL)
+		req->conn->req = NULL;
+	req->conn = NULL;
+
+	if (req->timer != NULL)
+		mowgli_timer_destroy(base_eventloop, req->timer);
+	req->timer = NULL;
+
+	req->done = true;
+	req->verified = verified;
+
+	if (req->cb != NULL)
+	{
+		req->cb(verified, req->priv);
+		ldap_request_free(req);
+	}
+}
+
+/* the connection is in an unknown state; the request fails without being cached */
+static void ldap_request_abort(ldap_request_t *req)
+{
+	if (req->conn != NULL)
+		ldap_pconn_close(req->conn);
+
+	ldap_request_finish(req, false, false);
+}
+
+static void ldap_pconn_readable(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata);
+
+static void ldap_pconn_watch(ldap_pconn_t *pc)
+{
+	int fd = -1;
+
+	if (pc == &ldap_sync_conn || pc->pollable != NULL)
+		return;
+
+	if (ldap_get_option(pc->ld, LDAP_OPT_DESC, &fd) != LDAP_OPT_SUCCESS || fd < 0)
+		return;
+
+	pc->pollable = mowgli_pollable_create(base_eventloop, fd, pc);
+	mowgli_pollable_setselect(base_eventloop, pc->pollable, MOWGLI_EVENTLOOP_IO_READ, ldap_pconn_readable);
+}
+
+static int ldap_pconn_bind(ldap_pconn_t *pc, const char *dn, const char *password, int *msgid)
+{
+	struct berval cred;
+
+	cred.bv_val = (char *)password;
+	cred.bv_len = password != NULL ? strlen(password) : 0;
+
+	return ldap_sasl_bind(pc->ld, dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, msgid);
+}
+
+/* sends the operation for the current state of the request */
+static void ldap_request_step(ldap_request_t *req)
+{
+	ldap_pconn_t *pc = req->conn;
+	char buf[512];
+	int res;
+
+	if (!ldap_pconn_open(pc))
+	{
+		ldap_request_finish(req, false, false);
+		return;
+	}
+
+	switch (req->state)
+	{
+		case LR_BIND_USER:
+			snprintf(buf, sizeof buf, ldap_config.dnformat, req->name);
+			res = ldap_pconn_bind(pc, buf, req->password, &req->msgid);
+			break;
+		case LR_BIND_SEARCH:
+			res = ldap_pconn_bind(pc, ldap_config.binddn, ldap_config.bindauth, &req->msgid);
+			break;
+		case LR_SEARCH:
+			snprintf(buf, sizeof buf, "%s=%s", ldap_config.attribute, req->name);
+			res = ldap_search_ext(pc->ld, ldap_config.base, LDAP_SCOPE_SUBTREE, buf, ldap_noattrs, 0,
+					NULL, NULL, NULL, 0, &req->msgid);
+			break;
+		case LR_BIND_FOUND:
+		default:
+			res = ldap_pconn_bind(pc, req->dns[req->nextdn], req->password, &req->msgid);
+			break;
+	}
+
+	if (res == LDAP_SUCCESS)
+	{
+		ldap_pconn_watch(pc);
+		return;
+	}
+
+	/* the server may have closed an idle connection; reconnect once */
+	if (res == LDAP_SERVER_DOWN && !req->retried)
+	{
+		req->retried = true;
+		ldap_pconn_close(pc);
+		ldap_request_reset(req);
+		req->conn = pc;
+		ldap_request_step(req);
+		return;
+	}
+
+	slog(LG_INFO, "ldap_auth_user(%s): ldap request failed: %s", req->name, ldap_err2string(res));
+	ldap_warn(res);
+	ldap_request_abort(req);
+}
+
+/* handles the result of the operation sent by ldap_request_step() */
+static void ldap_request_result(ldap_request_t *req, LDAPMessage *msg)
+{
+	LDAP *ld = req->conn->ld;
+	LDAPMessage *entry;
+	char *dn;
+	int res;
+
+	if (req->state == LR_SEARCH)
+	{
+		for (entry = ldap_first_entry(ld, msg); entry != NULL; entry = ldap_next_entry(ld, entry))
+		{
+			if ((dn = ldap_get_dn(ld, entry)) == NULL)
+				continue;
+
+			req->dns = srealloc(req->dns, (req->ndns + 1) * sizeof(char *));
+			req->dns[req->ndns++] = sstrdup(dn);
+			ldap_memfree(dn);
+		}
+	}
+
+	res = ldap_result2error(ld, msg, 1);
+
+	switch (req->state)
+	{
+		case LR_BIND_SEARCH:
+			if (res != LDAP_SUCCESS)
+			{
+				slog(LG_INFO, "ldap_auth_user(): ldap_bind failed: %s", ldap_err2string(res));
+				ldap_request_finish(req, false, false);
+				return;
+			}
+
+			req->state = LR_SEARCH;
+			break;
+
+		case LR_SEARCH:
+			if (req->ndns == 0)
+			{
+				if (res != LDAP_SUCCESS && res != LDAP_NO_SUCH_OBJECT)
+				{
+					slog(LG_INFO, "ldap_auth_user(%s): ldap search failed: %s", req->name, ldap_err2string(res));
+					ldap_request_finish(req, false, false);
+				}
+				else
+				{
+					slog(LG_INFO, "ldap_auth_user(%s): no matching entry", req->name);
+					ldap_request_finish(req, false, true);
+				}
+				return;
+			}
+
+			req->state = LR_BIND_FOUND;
+			req->nextdn = 0;
+			break;
+
+		case LR_BIND_FOUND:
+			if (res == LDAP_SUCCESS)
+			{
+				ldap_request_finish(req, true, true);
+				return;
+			}
+
+			if (res == LDAP_INVALID_CREDENTIALS && ++req->nextdn < req->ndns)
+				break;
+			/* FALLTHROUGH */
+
+		case LR_BIND_USER:
+		default:
+			if (res == LDAP_SUCCESS)
+				ldap_request_finish(req, true, true);
+			else if (res == LDAP_INVALID_CREDENTIALS)
+			{
+				slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", req->name, ldap_err2string(res));
+				ldap_request_finish(req, false, true);
+			}
+			else
+			{
+				slog(LG_INFO, "ldap_auth_user(%s): ldap_bind failed: %s", req->name, ldap_err2string(res));
+				ldap_request_finish(req, false, false);
+			}
+			return;
+	}
+
+	ldap_request_step(req);
+}
+
+static void ldap_pconn_readable(mowgli_eventloop_t *eventloop, mowgli_eventloop_io_t *io,
+	mowgli_eventloop_io_dir_t dir, void *userdata)
 {
+	ldap_pconn_t *pc = userdata;
+	LDAPMessage *msg;
 	int res;
+
+	/* nothing is expected on an idle connection; the server hung up */
+	if (pc->req == NULL)
+	{
+		ldap_pconn_close(pc);
+		return;
+	}
+
+	while (pc->req != NULL && pc->ld != NULL)
+	{
+		res = ldap_result(pc->ld, pc->req->msgid, LDAP_MSG_ALL, &(struct timeval){0, 0}, &msg);
+		if (res == 0)
+			break;
+
+		if (res < 0)
+		{
+			ldap_get_option(pc->ld, LDAP_OPT_RESULT_CODE, &res);
+			slog(LG_INFO, "ldap_auth_user(%s): ldap_result failed: %s", pc->req->name, ldap_err2string(res));
+			ldap_warn(res);
+			ldap_request_abort(pc->req);
+			break;
+		}
+
+		ldap_request_result(pc->req, msg);
+	}
+
+	ldap_pool_dispatch();
+}
+
+static void ldap_request_timeout(void *arg)
+{
+	ldap_request_t *req = arg;
+
+	req->timer = NULL;
+	slog(LG_INFO, "ldap_auth_user(%s): timed out", req->name);
+
+	if (req->conn == NULL)
+	{
+		mowgli_node_delete(&req->node, &ldap_queue);
+		ldap_request_finish(req, false, false);
+		return;
+	}
+
+	ldap_request_abort(req);
+	ldap_pool_dispatch();
+}
+
+/* hands waiting requests to idle connections */
+static void ldap_pool_dispatch(void)
+{
+	ldap_request_t *req;
+	unsigned int i;
+
+	for (i = 0; i < ldap_pool_count && ldap_queue.head != NULL; i++)
+	{
+		if (ldap_pool[i].req != NULL)
+			continue;
+
+		req = ldap_queue.head->data;
+		mowgli_node_delete(&req->node, &ldap_queue);
+
+		req->conn = &ldap_pool[i];
+		ldap_pool[i].req = req;
+		ldap_request_step(req);
+	}
+}
+
+static void ldap_pool_dispatch_deferred(void *unused)
+{
+	ldap_dispatch_timer = NULL;
+	ldap_pool_dispatch();
+}
+
+static void ldap_pool_dispatch_later(void)
+{
+	if (ldap_dispatch_timer == NULL)
+		ldap_dispatch_timer = mowgli_timer_add_once(base_eventloop, "ldap_pool_dispatch", ldap_pool_dispatch_deferred, NULL, 0);
+}
+
+static void ldap_pool_destroy(void)
+{
+	unsigned int i;
+
+	/* requests in progress start over on the new connections */
+	for (i = 0; i < ldap_pool_count; i++)
+	{
+		ldap_request_t *req = ldap_pool[i].req;
+
+		if (req != NULL)
+		{
+			ldap_request_reset(req);
+			mowgli_node_add_head(req, &req->node, &ldap_queue);
+		}
+
+		ldap_pconn_close(&ldap_pool[i]);
+	}
+
+	free(ldap_pool);
+	ldap_pool = NULL;
+	ldap_pool_count = 0;
+
+	ldap_pconn_close(&ldap_sync_conn);
+}
+
+static void ldap_fail_all(void)
+{
+	ldap_request_t *req;
+
+	while (ldap_queue.head != NULL)
+	{
+		req = ldap_queue.head->data;
+		mowgli_node_delete(&req->node, &ldap_queue);
+		ldap_request_finish(req, false, false);
+	}
+}
+
+static void ldap_config_ready(void *unused)
+{
+	mowgli_node_t *n;
 	char *p;
-	static time_t lastwarning;
 
-	if (ldap_conn != NULL)
-		ldap_unbind_ext_s(ldap_conn, NULL, NULL);
-	ldap_conn = NULL;
+	ldap_pool_destroy();
+	ldap_cache_flush(false);
+
+	ldap_config.valid = false;
+
 	if (ldap_config.url == NULL)
 	{
 		slog(LG_ERROR, "ldap_config_ready(): ldap {} missing url definition");
+		ldap_fail_all();
 		return;
 	}
 	if ((ldap_config.dnformat == NULL) && ((ldap_config.base == NULL) || (ldap_config.attribute == NULL)))
 	{
 		slog(LG_ERROR, "ldap_config_ready(): ldap {} block requires dnformat or base & attribute definition");
+		ldap_fail_all();
 		return;
 	}
 	if (ldap_config.binddn != NULL && ldap_config.bindauth == NULL)
 	{
 		slog(LG_ERROR, "ldap_config_ready(): ldap{} block requires bindauth to be defined if binddn is defined");
+		ldap_fail_all();
 		return;
 	}
 
@@ -75,6 +625,7 @@ static void ldap_config_ready(void *unused)
 		if (p == NULL || p[1] != 's' || strchr(p + 1, '%'))
 		{
 			slog(LG_ERROR, "ldap_config_ready(): dnformat must contain exactly one %%s and no other %%");
+			ldap_fail_all();
 			return;
 		}
 	}
@@ -84,139 +635,145 @@ static void ldap_config_ready(void *unused)
 	ldap_set_option(NULL, LDAP_OPT_PROTOCOL_VERSION, &(const int)
 			{
 			3});
-	res = ldap_initialize(&ldap_conn, ldap_config.url);
-	if (res != LDAP_SUCCESS)
+
+	if (ldap_config.timeout == 0)
+		ldap_config.timeout = 1;
+
+	ldap_config.valid = true;
+
+	ldap_pool_count = ldap_config.pool_size;
+	ldap_pool = scalloc(ldap_pool_count, sizeof(ldap_pconn_t));
+
+	/* the requests put back by ldap_pool_destroy() may have the wrong mode */
+	MOWGLI_ITER_FOREACH(n, ldap_queue.head)
+		ldap_request_reset(n->data);
+
+	ldap_pool_dispatch();
+}
+
+static bool ldap_check_name(const char *name)
+{
+	const char *bad = strpbrk(name, " ,/*()\\");
+
+	if (bad != NULL)
 	{
-		slog(LG_ERROR, "ldap_config_ready(): ldap_initialize(%s) failed: %s", ldap_config.url, ldap_err2string(res));
-		if (CURRTIME > lastwarning + 300)
-		{
-			slog(LG_INFO, "LDAP:ERROR: \2%s\2", ldap_err2string(res));
-			wallops("Problem with LDAP server: %s", ldap_err2string(res));
-			lastwarning = CURRTIME;
-		}
-		return;
+		slog(LG_INFO, "ldap_auth_user(%s): bad name: found '%c'", name, *bad);
+		return false;
 	}
 
-	/* short timeouts, because this blocks atheme as a whole */
-	ldap_set_option(ldap_conn, LDAP_OPT_TIMEOUT, &(const struct timeval){1, 0});
-	ldap_set_option(ldap_conn, LDAP_OPT_NETWORK_TIMEOUT, &(const struct timeval){1, 0});
-	ldap_set_option(ldap_conn, LDAP_OPT_DEREF, &(const int){false});
-	ldap_set_option(ldap_conn, LDAP_OPT_REFERRALS, &(const int){false});
+	return true;
+}
+
+static ldap_request_t *ldap_request_create(myuser_t *mu, const char *password)
+{
+	ldap_request_t *req;
+
+	req = scalloc(1, sizeof *req);
+	req->name = sstrdup(entity(mu)->name);
+	req->password = sstrdup(password);
+	ldap_cache_key(req->name, req->password, req->digest);
+	ldap_request_reset(req);
+
+	return req;
 }
 
 static bool ldap_auth_user(myuser_t *mu, const char *password)
 {
+	ldap_cache_entry_t *ce;
+	ldap_request_t *req;
+	LDAPMessage *msg;
+	unsigned char digest[16];
+	bool verified;
 	int res;
-	struct berval cred;
-	LDAPMessage *message, *entry;
 
-	if (ldap_conn == NULL)
-	{
-		ldap_config_ready(NULL);
-	}
-	if (ldap_conn == NULL)
+	if (!ldap_config.valid)
 	{
 		slog(LG_INFO, "ldap_auth_user(): no connection");
 		return false;
 	}
 
-	if (strchr(entity(mu)->name, ' '))
-	{
-		slog(LG_INFO, "ldap_auth_user(%s): bad name: found space", entity(mu)->name);
-		return false;
-	}
-	if (strchr(entity(mu)->name, ','))
-	{
-		slog(LG_INFO, "ldap_auth_user(%s): bad name: found comma", entity(mu)->name);
+	/* an empty password would be an unauthenticated bind */
+	if (*password == '\0' || !ldap_check_name(entity(mu)->name))
 		return false;
-	}
-	if (strchr(entity(mu)->name, '/'))
+
+	ldap_cache_key(entity(mu)->name, password, digest);
+	if ((ce = ldap_cache_find(digest)) != NULL)
+		return ce->verified;
+
+	if (ldap_sync_conn.req != NULL)
 	{
-		slog(LG_INFO, "ldap_auth_user(%s): bad name: found /", entity(mu)->name);
+		slog(LG_INFO, "ldap_auth_user(%s): blocking check already in progress", entity(mu)->name);
 		return false;
 	}
 
-/* Use DN to find exact match */
-	if (ldap_config.useDN)
+	req = ldap_request_create(mu, password);
+	req->conn = &ldap_sync_conn;
+	ldap_sync_conn.req = req;
+
+	ldap_request_step(req);
+
+	while (!req->done)
 	{
-		char dn[512];
-		cred.bv_len = strlen(password);
-		/* sstrdup it to remove the const */
-		cred.bv_val = sstrdup(password);
-
-		snprintf(dn, sizeof dn, ldap_config.dnformat, entity(mu)->name);
-		res = ldap_sasl_bind_s(ldap_conn, dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		if (res == LDAP_SERVER_DOWN)
-		{
-			ldap_config_ready(NULL);
-			res = ldap_sasl_bind_s(ldap_conn, dn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		}
-		if (res == LDAP_SUCCESS)
-			return true;
-		else if (res == LDAP_INVALID_CREDENTIALS)
+		res = ldap_result(ldap_sync_conn.ld, req->msgid, LDAP_MSG_ALL,
+				&(struct timeval){ldap_config.timeout, 0}, &msg);
+		if (res <= 0)
 		{
-			slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", entity(mu)->name, ldap_err2string(res));
-			return false;
+			slog(LG_INFO, "ldap_auth_user(%s): %s", req->name, res == 0 ? "timed out" : "ldap_result failed");
+			ldap_request_abort(req);
+			break;
 		}
-		slog(LG_INFO, "ldap_auth_user(): ldap_bind_s failed: %s", ldap_err2string(res));
-		return false;
-
 
-/* Use base + attribute search for Auth */
+		ldap_request_result(req, msg);
 	}
-	else
-	{
-		char what[512];
-		char *binddn = NULL;
 
-		cred.bv_len = 0;
+	verified = req->verified;
+	ldap_request_free(req);
 
-		if (ldap_config.binddn != NULL && ldap_config.bindauth != NULL)
-		{
-			binddn = ldap_config.binddn;
-			cred.bv_val = ldap_config.bindauth;
-			cred.bv_len = strlen(ldap_config.bindauth);
-		}
+	return verified;
+}
 
-		res = ldap_sasl_bind_s(ldap_conn, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		if (res == LDAP_SERVER_DOWN)
-		{
-			ldap_config_ready(NULL);
-			res = ldap_sasl_bind_s(ldap_conn, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-		}
-		if (res != LDAP_SUCCESS)
-		{
-			slog(LG_INFO, "ldap_auth_user(): ldap_bind_s failed: %s", ldap_err2string(res));
-			return false;
-		}
+static void *ldap_auth_user_async(myuser_t *mu, const char *password, auth_user_cb_t cb, void *priv)
+{
+	ldap_request_t *req;
 
-		sprintf(what, "%s=%s", ldap_config.attribute, entity(mu)->name);
-		if ((res = ldap_search_ext_s(ldap_conn, ldap_config.base, LDAP_SCOPE_SUBTREE, what, NULL, 0, NULL, NULL, NULL, 0, &message)) != LDAP_SUCCESS)
-		{
-			slog(LG_INFO, "ldap_auth_user(%s): ldap search failed: %s", entity(mu)->name, ldap_err2string(res));
-			return false;
-		}
+	/* cached answers and rejects are quick; ldap_auth_user() gives them */
+	if (!ldap_config.valid || *password == '\0' || !ldap_check_name(entity(mu)->name))
+		return NULL;
 
-		cred.bv_len = strlen(password);
-		/* sstrdup it to remove the const */
-		cred.bv_val = sstrdup(password);
+	req = ldap_request_create(mu, password);
+	if (ldap_cache_find(req->digest) != NULL)
+	{
+		ldap_request_free(req);
+		return NULL;
+	}
 
-		for (entry = ldap_first_message(ldap_conn, message); entry && ldap_msgtype(entry) == LDAP_RES_SEARCH_ENTRY; entry = ldap_next_message(ldap_conn, entry))
-		{
+	req->cb = cb;
+	req->priv = priv;
+	req->timer = mowgli_timer_add_once(base_eventloop, "ldap_request_timeout", ldap_request_timeout, req, ldap_config.timeout);
+	mowgli_node_add(req, &req->node, &ldap_queue);
 
-			res = ldap_sasl_bind_s(ldap_conn, ldap_get_dn(ldap_conn, entry), LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL);
-			if (res == LDAP_SUCCESS)
-			{
-				ldap_msgfree(message);
-				return true;
-			}
-		}
+	/* the callback must not run before we return */
+	ldap_pool_dispatch_later();
 
-		ldap_msgfree(message);
-	}
+	return req;
+}
 
-	slog(LG_INFO, "ldap_auth_user(%s): ldap auth bind failed: %s", entity(mu)->name, ldap_err2string(res));
-	return false;
+static void ldap_auth_user_cancel(void *handle)
+{
+	ldap_request_t *req = handle;
+
+	req->cb = NULL;
+
+	if (req->conn == NULL)
+		mowgli_node_delete(&req->node, &ldap_queue);
+	else
+		/* the operation cannot be called back; drop the connection */
+		ldap_pconn_close(req->conn);
+
+	ldap_request_finish(req, false, false);
+	ldap_request_free(req);
+
+	ldap_pool_dispatch_later();
 }
 
 void _modinit(module_t * m)
@@ -231,8 +788,18 @@ void _modinit(module_t * m)
 	add_dupstr_conf_item("ATTRIBUTE", &conf_ldap_table, 0, &ldap_config.attribute, NULL);
 	add_dupstr_conf_item("BINDDN", &conf_ldap_table, 0, &ldap_config.binddn, NULL);
 	add_dupstr_conf_item("BINDAUTH", &conf_ldap_table, 0, &ldap_config.bindauth, NULL);
+	add_uint_conf_item("POOL_SIZE", &conf_ldap_table, 0, &ldap_config.pool_size, 1, 32, 2);
+	add_duration_conf_item("TIMEOUT", &conf_ldap_table, 0, &ldap_config.timeout, "s", 5);
+	add_duration_conf_item("CACHE_TTL", &conf_ldap_table, 0, &ldap_config.cache_ttl, "s", 300);
+	add_duration_conf_item("NEGATIVE_CACHE_TTL", &conf_ldap_table, 0, &ldap_config.negative_cache_ttl, "s", 30);
+
+	ldap_cache = mowgli_patricia_create(noopcanon);
+	ldap_cache_timer = mowgli_timer_add(base_eventloop, "ldap_cache_expire", ldap_cache_expire, NULL, 60);
+	arc4random_buf(ldap_cache_salt, sizeof ldap_cache_salt);
 
 	auth_user_custom = &ldap_auth_user;
+	auth_user_custom_async = &ldap_auth_user_async;
+	auth_user_custom_cancel = &ldap_auth_user_cancel;
 
 	auth_module_loaded = true;
 }
@@ -240,11 +807,19 @@ void _modinit(module_t * m)
 void _moddeinit(module_unload_intent_t intent)
 {
 	auth_user_custom = NULL;
+	auth_user_custom_async = NULL;
+	auth_user_custom_cancel = NULL;
 
 	auth_module_loaded = false;
 
-	if (ldap_conn != NULL)
-		ldap_unbind_ext_s(ldap_conn, NULL, NULL);
+	ldap_pool_destroy();
+	ldap_fail_all();
+
+	if (ldap_dispatch_timer != NULL)
+		mowgli_timer_destroy(base_eventloop, ldap_dispatch_timer);
+	mowgli_timer_destroy(base_eventloop, ldap_cache_timer);
+	ldap_cache_flush(false);
+	mowgli_patricia_destroy(ldap_cache, NULL, NULL);
 
 	hook_del_config_ready(ldap_config_ready);
 	del_conf_item("URL", &conf_ldap_table);
@@ -253,6 +828,10 @@ void _moddeinit(module_unload_intent_t intent)
 	del_conf_item("ATTRIBUTE", &conf_ldap_table);
 	del_conf_item("BINDDN", &conf_ldap_table);
 	del_conf_item("BINDAUTH", &conf_ldap_table);
+	del_conf_item("POOL_SIZE", &conf_ldap_table);
+	del_conf_item("TIMEOUT", &conf_ldap_table);
+	del_conf_item("CACHE_TTL", &conf_ldap_table);
+	del_conf_item("NEGATIVE_CACHE_TTL", &conf_ldap_table);
 	del_top_conf("LDAP");
 }
 
@@ -0,0 +1,953 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Binary database backend.  It stores the same logical rows as OpenSEX, but
+ * as length-prefixed records made of typed cells.  Loading needs no text
+ * parsing and strings are handed out straight from the mapped file.
+ *
+ * File layout (all integers are little-endian):
+ *
+ *   header    "ATHEMEDB" u32 version u32 reserved
+ *   row       u32 length, u16 cells, cells...     (first cell is the type)
+ *   cell      u8 kind, u32 length, payload        (strings carry a NUL)
+ *   trailer   u64 end of the rows, "ATHEMEND"
+ *
+ * Rows are loaded in the order they were written, since later rows refer
+ * to objects made by earlier ones; there is no index to seek by type.
+ */
+
+#include "atheme.h"
+
+#ifndef MOWGLI_OS_WIN
+# include <sys/mman.h>
+#endif
+
+DECLARE_MODULE_V1
+(
+	"backend/binary", true, _modinit, NULL,
+	PACKAGE_STRING,
+	VENDOR_STRING
+);
+
+#define BINDB_MAGIC		"ATHEMEDB"
+#define BINDB_END_MAGIC		"ATHEMEND"
+#define BINDB_VERSION		2
+#define BINDB_HEADER_SIZE	16
+#define BINDB_TRAILER_SIZE	16
+#define BINDB_DEFAULT_FILE	"services.bdb"
+#define BINDB_NUMLEN		24		/* a formatted integer cell and its NUL */
+
+typedef enum {
+	BINDB_CELL_WORD = 1,
+	BINDB_CELL_STR,
+	BINDB_CELL_INT,
+	BINDB_CELL_UINT,
+	BINDB_CELL_TIME
+} bindb_cell_kind_t;
+
+typedef struct bindb_ {
+	/* Reading state */
+	const unsigned char *data;
+	size_t datalen;
+	size_t rowsend;
+	const unsigned char *pos;
+	const unsigned char *cell;
+	unsigned int cellsleft;
+	bool mapped;
+	char *numbuf;		/* integer cells of the row, as text */
+	size_t numbufsize, numbuflen;
+	char *strbuf;
+	size_t strbufsize;
+
+	/* Writing state */
+	FILE *f;
+	uint64_t offset;
+	unsigned char *row;
+	size_t rowlen, rowsize;
+	unsigned int rowcells;
+} bindb_t;
+
+/***************************************************************************************************/
+
+static inline uint16_t bindb_get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t bindb_get32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t bindb_get64(const unsigned char *p)
+{
+	return (uint64_t) bindb_get32(p) | ((uint64_t) bindb_get32(p + 4) << 32);
+}
+
+static inline void bindb_put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static inline void bindb_put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static inline void bindb_put64(unsigned char *p, uint64_t v)
+{
+	bindb_put32(p, v & 0xffffffffU);
+	bindb_put32(p + 4, v >> 32);
+}
+
+/***************************************************************************************************/
+
+static void bindb_db_parse(database_handle_t *db)
+{
+	const char *cmd;
+
+	while (db_read_next_row(db))
+	{
+		cmd = db_read_word(db);
+		if (!cmd || !*cmd)
+			continue;
+		db_process(db, cmd);
+	}
+}
+
+static void bindb_corrupt(database_handle_t *db, const char *what)
+{
+	slog(LG_ERROR, "bindb: %s at %s row %u cell %u", what, db->file, db->line, db->token);
+	slog(LG_ERROR, "bindb: exiting to avoid data loss");
+	exit(EXIT_FAILURE);
+}
+
+static bool bindb_read_next_row(database_handle_t *db)
+{
+	bindb_t *bs = db->priv;
+	size_t left;
+	uint32_t len;
+
+	if (bs->pos == NULL)
+		return false;
+
+	left = bs->data + bs->rowsend - bs->pos;
+	if (left == 0)
+		return false;
+
+	if (left < 6)
+		bindb_corrupt(db, "truncated row header");
+
+	len = bindb_get32(bs->pos);
+	if (len < 2 || len > left - 4)
+		bindb_corrupt(db, "row length out of bounds");
+
+	bs->cellsleft = bindb_get16(bs->pos + 4);
+	bs->cell = bs->pos + 6;
+	bs->pos += 4 + len;
+
+	/* room for every cell of the row as a number, so that the words
+	 * handed out for it stay put until the next row */
+	if (bs->cellsleft * BINDB_NUMLEN > bs->numbufsize)
+	{
+		bs->numbufsize = bs->cellsleft * BINDB_NUMLEN;
+		bs->numbuf = srealloc(bs->numbuf, bs->numbufsize);
+	}
+	bs->numbuflen = 0;
+
+	db->line++;
+	db->token = 0;
+	return true;
+}
+
+/* returns the next cell of the current row, validating it against the row
+ * bounds; strings are guaranteed to be NUL-terminated.
+ */
+static const unsigned char *bindb_next_cell(database_handle_t *db, bindb_cell_kind_t *kind, uint32_t *len)
+{
+	bindb_t *bs = db->priv;
+	const unsigned char *cell = bs->cell;
+
+	if (bs->cellsleft == 0)
+		return NULL;
+
+	if ((size_t) (bs->pos - cell) < 5)
+		bindb_corrupt(db, "truncated cell header");
+
+	*kind = cell[0];
+	*len = bindb_get32(cell + 1);
+
+	switch (*kind)
+	{
+		case BINDB_CELL_WORD:
+		case BINDB_CELL_STR:
+			if (*len >= (size_t) (bs->pos - cell) - 5 || cell[5 + *len] != '\0')
+				bindb_corrupt(db, "malformed string cell");
+			bs->cell = cell + 5 + *len + 1;
+			break;
+		case BINDB_CELL_INT:
+		case BINDB_CELL_UINT:
+		case BINDB_CELL_TIME:
+			if (*len != (*kind == BINDB_CELL_TIME ? 8 : 4) || *len > (size_t) (bs->pos - cell) - 5)
+				bindb_corrupt(db, "malformed integer cell");
+			bs->cell = cell + 5 + *len;
+			break;
+		default:
+			bindb_corrupt(db, "unknown cell kind");
+	}
+
+	bs->cellsleft--;
+	db->token++;
+
+	return cell + 5;
+}
+
+/* integer cells are formatted into the row's own space in numbuf */
+static const char *bindb_format_cell(bindb_t *bs, bindb_cell_kind_t kind, const unsigned char *p)
+{
+	char *buf = bs->numbuf + bs->numbuflen;
+	int n;
+
+	switch (kind)
+	{
+		case BINDB_CELL_INT:
+			n = snprintf(buf, BINDB_NUMLEN, "%d", (int) bindb_get32(p));
+			break;
+		case BINDB_CELL_UINT:
+			n = snprintf(buf, BINDB_NUMLEN, "%u", (unsigned int) bindb_get32(p));
+			break;
+		case BINDB_CELL_TIME:
+			n = snprintf(buf, BINDB_NUMLEN, "%lu", (unsigned long) bindb_get64(p));
+			break;
+		default:
+			return (const char *) p;
+	}
+
+	bs->numbuflen += n + 1;
+
+	return buf;
+}
+
+static const char *bindb_read_word(database_handle_t *db)
+{
+	bindb_t *bs = db->priv;
+	bindb_cell_kind_t kind;
+	uint32_t len;
+	const unsigned char *p;
+
+	if ((p = bindb_next_cell(db, &kind, &len)) == NULL)
+		return NULL;
+
+	return bindb_format_cell(bs, kind, p);
+}
+
+/* a string runs to the end of the row, like in OpenSEX.  rows converted
+ * from OpenSEX carry it as separate words, which are joined back here.
+ */
+static const char *bindb_read_str(database_handle_t *db)
+{
+	bindb_t *bs = db->priv;
+	bindb_cell_kind_t kind;
+	uint32_t len;
+	const unsigned char *p;
+	const unsigned char *first = NULL;
+	const char *s;
+	size_t n = 0, slen;
+
+	/* OpenSEX hands out an empty string past the last word */
+	if (bs->cellsleft == 0)
+		return "";
+
+	if (bs->cellsleft == 1)
+		return bindb_read_word(db);
+
+	while ((p = bindb_next_cell(db, &kind, &len)) != NULL)
+	{
+		if (first == NULL)
+			first = p;
+
+		s = bindb_format_cell(bs, kind, p);
+		slen = strlen(s);
+
+		if (n + slen + 2 > bs->strbufsize)
+		{
+			bs->strbufsize = (n + slen + 2) * 2;
+			bs->strbuf = srealloc(bs->strbuf, bs->strbufsize);
+		}
+
+		if (p != first)
+			bs->strbuf[n++] = ' ';
+		memcpy(bs->strbuf + n, s, slen);
+		n += slen;
+		bs->strbuf[n] = '\0';
+	}
+
+	return bs->strbuf;
+}
+
+static bool bindb_read_number(database_handle_t *db, bool is_signed, uint64_t *res)
+{
+	bindb_cell_kind_t kind;
+	uint32_t len;
+	const unsigned char *p;
+	char *rp;
+
+	if ((p = bindb_next_cell(db, &kind, &len)) == NULL)
+		return false;
+
+	switch (kind)
+	{
+		case BINDB_CELL_INT:
+			*res = (uint64_t) (int64_t) (int32_t) bindb_get32(p);
+			return true;
+		case BINDB_CELL_UINT:
+			*res = bindb_get32(p);
+			return true;
+		case BINDB_CELL_TIME:
+			*res = bindb_get64(p);
+			return true;
+		default:
+			/* text written through db_write_format() or converted */
+			if (is_signed)
+				*res = (uint64_t) (int64_t) strtol((const char *) p, &rp, 0);
+			else
+				*res = strtoul((const char *) p, &rp, 0);
+			return *p && !*rp;
+	}
+}
+
+static bool bindb_read_int(database_handle_t *db, int *res)
+{
+	uint64_t v;
+
+	if (!bindb_read_number(db, true, &v))
+		return false;
+
+	*res = (int) (int64_t) v;
+	return true;
+}
+
+static bool bindb_read_uint(database_handle_t *db, unsigned int *res)
+{
+	uint64_t v;
+
+	if (!bindb_read_number(db, false, &v))
+		return false;
+
+	*res = (unsigned int) v;
+	return true;
+}
+
+static bool bindb_read_time(database_handle_t *db, time_t *res)
+{
+	uint64_t v;
+
+	if (!bindb_read_number(db, false, &v))
+		return false;
+
+	*res = (time_t) v;
+	return true;
+}
+
+/***************************************************************************************************/
+
+static unsigned char *bindb_row_reserve(bindb_t *bs, size_t n)
+{
+	unsigned char *p;
+
+	if (bs->rowlen + n > bs->rowsize)
+	{
+		while (bs->rowlen + n > bs->rowsize)
+			bs->rowsize *= 2;
+		bs->row = srealloc(bs->row, bs->rowsize);
+	}
+
+	p = bs->row + bs->rowlen;
+	bs->rowlen += n;
+	return p;
+}
+
+static bool bindb_write_cell(database_handle_t *db, bindb_cell_kind_t kind, const void *data, size_t len)
+{
+	bindb_t *bs;
+	unsigned char *p;
+
+	return_val_if_fail(db != NULL, false);
+	bs = db->priv;
+
+	return_val_if_fail(len < UINT32_MAX, false);
+	return_val_if_fail(bs->rowcells < UINT16_MAX, false);
+
+	p = bindb_row_reserve(bs, 5 + len + (kind == BINDB_CELL_WORD || kind == BINDB_CELL_STR ? 1 : 0));
+	p[0] = kind;
+	bindb_put32(p + 1, len);
+	memcpy(p + 5, data, len);
+	if (kind == BINDB_CELL_WORD || kind == BINDB_CELL_STR)
+		p[5 + len] = '\0';
+
+	bs->rowcells++;
+	return true;
+}
+
+static bool bindb_write_word(database_handle_t *db, const char *word)
+{
+	if (word == NULL)
+		word = "*";
+
+	return bindb_write_cell(db, BINDB_CELL_WORD, word, strlen(word));
+}
+
+static bool bindb_write_str(database_handle_t *db, const char *str)
+{
+	if (str == NULL)
+		str = "*";
+
+	return bindb_write_cell(db, BINDB_CELL_STR, str, strlen(str));
+}
+
+static bool bindb_write_int(database_handle_t *db, int num)
+{
+	unsigned char buf[4];
+
+	bindb_put32(buf, (uint32_t) num);
+	return bindb_write_cell(db, BINDB_CELL_INT, buf, sizeof buf);
+}
+
+static bool bindb_write_uint(database_handle_t *db, unsigned int num)
+{
+	unsigned char buf[4];
+
+	bindb_put32(buf, num);
+	return bindb_write_cell(db, BINDB_CELL_UINT, buf, sizeof buf);
+}
+
+static bool bindb_write_time(database_handle_t *db, time_t tm)
+{
+	unsigned char buf[8];
+
+	bindb_put64(buf, (uint64_t) tm);
+	return bindb_write_cell(db, BINDB_CELL_TIME, buf, sizeof buf);
+}
+
+static bool bindb_start_row(database_handle_t *db, const char *type)
+{
+	bindb_t *bs;
+
+	return_val_if_fail(db != NULL, false);
+	return_val_if_fail(type != NULL, false);
+	bs = db->priv;
+
+	/* row length and cell count are filled in by commit_row() */
+	bs->rowlen = 0;
+	bs->rowcells = 0;
+	bindb_row_reserve(bs, 6);
+
+	return bindb_write_word(db, type);
+}
+
+static bool bindb_commit_row(database_handle_t *db)
+{
+	bindb_t *bs;
+
+	return_val_if_fail(db != NULL, false);
+	bs = db->priv;
+
+	bindb_put32(bs->row, bs->rowlen - 4);
+	bindb_put16(bs->row + 4, bs->rowcells);
+
+	if (fwrite(bs->row, 1, bs->rowlen, bs->f) != bs->rowlen)
+		return false;
+
+	bs->offset += bs->rowlen;
+
+	return true;
+}
+
+static database_vtable_t bindb_vt = {
+	.name = "binary",
+
+	.read_next_row = bindb_read_next_row,
+
+	.read_word = bindb_read_word,
+	.read_str = bindb_read_str,
+	.read_int = bindb_read_int,
+	.read_uint = bindb_read_uint,
+	.read_time = bindb_read_time,
+
+	.start_row = bindb_start_row,
+	.write_word = bindb_write_word,
+	.write_str = bindb_write_str,
+	.write_int = bindb_write_int,
+	.write_uint = bindb_write_uint,
+	.write_time = bindb_write_time,
+	.commit_row = bindb_commit_row
+};
+
+/***************************************************************************************************/
+
+/* the trailer tells a complete file from one cut short while writing */
+static bool bindb_write_trailer(bindb_t *bs)
+{
+	unsigned char buf[BINDB_TRAILER_SIZE];
+
+	bindb_put64(buf, bs->offset);
+	memcpy(buf + 8, BINDB_END_MAGIC, 8);
+	fwrite(buf, 1, BINDB_TRAILER_SIZE, bs->f);
+
+	return !ferror(bs->f);
+}
+
+static void bindb_path(char *path, size_t size, const char *filename)
+{
+	snprintf(path, size, "%s/%s", datadir, filename != NULL ? filename : BINDB_DEFAULT_FILE);
+}
+
+static bool bindb_load_file(bindb_t *bs, int fd, const char *path)
+{
+	struct stat sb;
+	unsigned char *buf;
+	size_t done = 0;
+	ssize_t r;
+
+	if (fstat(fd, &sb) < 0)
+	{
+		slog(LG_ERROR, "db-open-read: cannot stat '%s': %s", path, strerror(errno));
+		return false;
+	}
+
+	bs->datalen = sb.st_size;
+	if (bs->datalen < BINDB_HEADER_SIZE + BINDB_TRAILER_SIZE)
+	{
+		slog(LG_ERROR, "db-open-read: '%s' is too short to be a binary database", path);
+		return false;
+	}
+
+#ifndef MOWGLI_OS_WIN
+	bs->data = mmap(NULL, bs->datalen, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (bs->data != MAP_FAILED)
+	{
+#ifdef MADV_SEQUENTIAL
+		madvise((void *) bs->data, bs->datalen, MADV_SEQUENTIAL);
+#endif
+		bs->mapped = true;
+		return true;
+	}
+
+	slog(LG_DEBUG, "db-open-read: cannot map '%s', reading it instead: %s", path, strerror(errno));
+#endif
+
+	buf = smalloc(bs->datalen);
+	while (done < bs->datalen)
+	{
+		r = read(fd, buf + done, bs->datalen - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			slog(LG_ERROR, "db-open-read: cannot read '%s': %s", path, r < 0 ? strerror(errno) : "unexpected end of file");
+			free(buf);
+			return false;
+		}
+		done += r;
+	}
+
+	bs->data = buf;
+	return true;
+}
+
+static void bindb_unload_file(bindb_t *bs)
+{
+	if (bs->data == NULL)
+		return;
+
+#ifndef MOWGLI_OS_WIN
+	if (bs->mapped)
+		munmap((void *) bs->data, bs->datalen);
+	else
+#endif
+		free((void *) bs->data);
+
+	bs->data = NULL;
+	bs->pos = NULL;
+}
+
+static bool bindb_check_file(bindb_t *bs, const char *path)
+{
+	const unsigned char *trailer = bs->data + bs->datalen - BINDB_TRAILER_SIZE;
+	uint64_t rowsend;
+
+	if (memcmp(bs->data, BINDB_MAGIC, 8))
+	{
+		slog(LG_ERROR, "db-open-read: '%s' is not a binary database (use dbconvert to convert OpenSEX databases)", path);
+		return false;
+	}
+
+	if (bindb_get32(bs->data + 8) != BINDB_VERSION)
+	{
+		slog(LG_ERROR, "db-open-read: '%s' has unsupported binary database version %u", path, bindb_get32(bs->data + 8));
+		return false;
+	}
+
+	if (memcmp(trailer + 8, BINDB_END_MAGIC, 8))
+	{
+		slog(LG_ERROR, "db-open-read: '%s' has no trailer; it was probably not written completely", path);
+		return false;
+	}
+
+	rowsend = bindb_get64(trailer);
+	if (rowsend != bs->datalen - BINDB_TRAILER_SIZE)
+	{
+		slog(LG_ERROR, "db-open-read: '%s' has a trailer that does not match its size", path);
+		return false;
+	}
+
+	bs->rowsend = rowsend;
+	bs->pos = bs->data + BINDB_HEADER_SIZE;
+	return true;
+}
+
+static database_handle_t *bindb_db_open_read(const char *filename)
+{
+	database_handle_t *db;
+	bindb_t *bs;
+	int fd;
+	int errno1;
+	char path[BUFSIZE];
+
+	bindb_path(path, sizeof path, filename);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		errno1 = errno;
+
+		/* ENOENT can happen if the database does not exist yet. */
+		if (errno == ENOENT)
+		{
+			slog(LG_ERROR, "db-open-read: database '%s' does not yet exist; a new one will be created.", path);
+			return NULL;
+		}
+
+		slog(LG_ERROR, "db-open-read: cannot open '%s' for reading: %s", path, strerror(errno1));
+		wallops(_("\2DATABASE ERROR\2: db-open-read: cannot open '%s' for reading: %s"), path, strerror(errno1));
+		return NULL;
+	}
+
+	bs = scalloc(sizeof(bindb_t), 1);
+
+	if (!bindb_load_file(bs, fd, path) || !bindb_check_file(bs, path))
+	{
+		slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = bs;
+	db->vt = &bindb_vt;
+	db->txn = DB_READ;
+	db->file = sstrdup(path);
+	db->line = 0;
+	db->token = 0;
+
+	return db;
+}
+
+static database_handle_t *bindb_db_open_write(const char *filename)
+{
+	database_handle_t *db;
+	bindb_t *bs;
+	int fd;
+	FILE *f;
+	int errno1;
+	unsigned char header[BINDB_HEADER_SIZE];
+	char bpath[BUFSIZE], path[BUFSIZE];
+
+	bindb_path(bpath, sizeof bpath, filename);
+
+	mowgli_strlcpy(path, bpath, sizeof path);
+	mowgli_strlcat(path, ".new", sizeof path);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	if (fd < 0 || ! (f = fdopen(fd, "w")))
+	{
+		errno1 = errno;
+		slog(LG_ERROR, "db-open-write: cannot open '%s' for writing: %s", path, strerror(errno1));
+		wallops(_("\2DATABASE ERROR\2: db-open-write: cannot open '%s' for writing: %s"), path, strerror(errno1));
+		return NULL;
+	}
+
+	bs = scalloc(sizeof(bindb_t), 1);
+	bs->f = f;
+	bs->rowsize = 512;
+	bs->row = smalloc(bs->rowsize);
+
+	memcpy(header, BINDB_MAGIC, 8);
+	bindb_put32(header + 8, BINDB_VERSION);
+	bindb_put32(header + 12, 0);
+	fwrite(header, 1, sizeof header, f);
+	bs->offset = sizeof header;
+
+	db = scalloc(sizeof(database_handle_t), 1);
+	db->priv = bs;
+	db->vt = &bindb_vt;
+	db->txn = DB_WRITE;
+	db->file = sstrdup(bpath);
+	db->line = 0;
+	db->token = 0;
+
+	return db;
+}
+
+static database_handle_t *bindb_db_open(const char *filename, database_transaction_t txn)
+{
+	if (txn == DB_WRITE)
+		return bindb_db_open_write(filename);
+	return bindb_db_open_read(filename);
+}
+
+static void bindb_db_close(database_handle_t *db)
+{
+	bindb_t *bs;
+	int errno1;
+	bool write_failed;
+	char oldpath[BUFSIZE], newpath[BUFSIZE];
+
+	return_if_fail(db != NULL);
+	bs = db->priv;
+
+	mowgli_strlcpy(oldpath, db->file, sizeof oldpath);
+	mowgli_strlcat(oldpath, ".new", sizeof oldpath);
+
+	mowgli_strlcpy(newpath, db->file, sizeof newpath);
+
+	if (db->txn == DB_WRITE)
+	{
+		write_failed = !bindb_write_trailer(bs);
+		if (fclose(bs->f) != 0)
+			write_failed = true;
+
+		if (write_failed)
+		{
+			errno1 = errno != 0 ? errno : EIO;
+			slog(LG_ERROR, "db_save(): cannot write %s: %s", oldpath, strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot write %s: %s"), oldpath, strerror(errno1));
+			errno = errno1;
+		}
+		/* now, replace the old database with the new one, using an atomic rename */
+		else if (srename(oldpath, newpath) < 0)
+		{
+			errno1 = errno;
+			slog(LG_ERROR, "db_save(): cannot rename %s to %s: %s", oldpath, newpath, strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot rename %s to %s: %s"), oldpath, newpath, strerror(errno1));
+			errno = errno1;
+		}
+
+		free(bs->row);
+	}
+	else
+		bindb_unload_file(bs);
+
+	free(bs->numbuf);
+	free(bs->strbuf);
+	free(bs);
+	free(db->file);
+	free(db);
+}
+
+static database_module_t bindb_mod = {
+	.db_open = bindb_db_open,
+	.db_close = bindb_db_close,
+	.db_parse = bindb_db_parse,
+};
+
+/***************************************************************************************************
+ * Conversion between OpenSEX and the binary format, used by dbconvert.
+ * File names are relative to the data directory, like for db_open().
+ *
+ * This works on rows rather than on objects, so rows belonging to modules
+ * which are not loaded survive the trip.  An OpenSEX row is a list of words
+ * each followed by a space, optionally ending in a string without one; the
+ * binary row keeps the same cells, so converting back yields the same text.
+ * Comment lines and the OpenSEX grammar version row are not carried over.
+ */
+
+static char *bindb_getline(FILE *f, char **buf, size_t *size)
+{
+	size_t n = 0;
+
+	if (*buf == NULL)
+	{
+		*size = BUFSIZE;
+		*buf = smalloc(*size);
+	}
+
+	while (fgets(*buf + n, *size - n, f) != NULL)
+	{
+		n += strlen(*buf + n);
+		if (n > 0 && (*buf)[n - 1] == '\n')
+		{
+			(*buf)[n - 1] = '\0';
+			return *buf;
+		}
+
+		*size *= 2;
+		*buf = srealloc(*buf, *size);
+	}
+
+	return n > 0 ? *buf : NULL;
+}
+
+bool bindb_import_opensex(const char *from, const char *to)
+{
+	database_handle_t *db;
+	FILE *in;
+	char *buf = NULL, *word, *next;
+	size_t bufsize;
+	bool ok = true;
+	char path[BUFSIZE];
+
+	snprintf(path, sizeof path, "%s/%s", datadir, from);
+	if ((in = fopen(path, "r")) == NULL)
+	{
+		slog(LG_ERROR, "bindb_import_opensex(): cannot open '%s': %s", path, strerror(errno));
+		return false;
+	}
+
+	if ((db = bindb_db_open_write(to)) == NULL)
+	{
+		fclose(in);
+		return false;
+	}
+
+	while (bindb_getline(in, &buf, &bufsize) != NULL)
+	{
+		if (!*buf || strchr("#\n\t \r", *buf))
+			continue;
+
+		word = buf;
+		next = strchr(word, ' ');
+		if (next != NULL)
+			*next++ = '\0';
+
+		if (!strcmp(word, "GRVER"))
+			continue;
+
+		db_start_row(db, word);
+
+		while (next != NULL && *next != '\0')
+		{
+			word = next;
+			next = strchr(word, ' ');
+			if (next != NULL)
+			{
+				*next++ = '\0';
+				db_write_word(db, word);
+			}
+			else
+				db_write_str(db, word);
+		}
+
+		if (!db_commit_row(db))
+			ok = false;
+	}
+
+	if (ferror(in))
+	{
+		slog(LG_ERROR, "bindb_import_opensex(): cannot read '%s': %s", path, strerror(errno));
+		ok = false;
+	}
+
+	fclose(in);
+	free(buf);
+
+	errno = 0;
+	bindb_db_close(db);
+
+	return ok && errno == 0;
+}
+
+bool bindb_export_opensex(const char *from, const char *to)
+{
+	database_handle_t *db;
+	bindb_t *bs;
+	bindb_cell_kind_t kind;
+	uint32_t len;
+	const unsigned char *p;
+	FILE *out;
+	bool ok;
+	char path[BUFSIZE], newpath[BUFSIZE + 4];
+
+	if ((db = bindb_db_open_read(from)) == NULL)
+		return false;
+
+	bs = db->priv;
+
+	snprintf(path, sizeof path, "%s/%s", datadir, to);
+	snprintf(newpath, sizeof newpath, "%s.new", path);
+	if ((out = fopen(newpath, "w")) == NULL)
+	{
+		slog(LG_ERROR, "bindb_export_opensex(): cannot open '%s': %s", newpath, strerror(errno));
+		bindb_db_close(db);
+		return false;
+	}
+
+	fprintf(out, "GRVER 1 \n");
+
+	while (bindb_read_next_row(db))
+	{
+		while ((p = bindb_next_cell(db, &kind, &len)) != NULL)
+		{
+			fputs(bindb_format_cell(bs, kind, p), out);
+			if (kind != BINDB_CELL_STR)
+				fputc(' ', out);
+		}
+
+		fputc('\n', out);
+	}
+
+	ok = !ferror(out);
+	if (fclose(out) != 0)
+		ok = false;
+
+	if (!ok)
+		slog(LG_ERROR, "bindb_export_opensex(): cannot write '%s': %s", newpath, strerror(errno));
+	else if (srename(newpath, path) < 0)
+	{
+		slog(LG_ERROR, "bindb_export_opensex(): cannot rename '%s' to '%s': %s", newpath, path, strerror(errno));
+		ok = false;
+	}
+
+	bindb_db_close(db);
+
+	return ok;
+}
+
+static void bindb_h_grver(database_handle_t *db, const char *type)
+{
+	/* OpenSEX grammar version; meaningless here. */
+}
+
+void _modinit(module_t *m)
+{
+	MODULE_TRY_REQUEST_DEPENDENCY(m, "backend/corestorage");
+
+	m->mflags = MODTYPE_CORE;
+
+	db_mod = &bindb_mod;
+
+	db_register_type_handler("GRVER", bindb_h_grver);
+
+	backend_loaded = true;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -18,6 +18,10 @@
 
 #include "atheme.h"
 
+#ifdef HAVE_FORK
+# include <sys/wait.h>
+#endif
+
 DECLARE_MODULE_V1
 (
 	"backend/corestorage", true, _modinit, NULL,
@@ -28,6 +32,15 @@ DECLARE_MODULE_V1
 unsigned int dbv;
 unsigned int their_ca_all;
 
+/* metadata keys of the database being loaded, by their number in the file */
+static metadata_atom_t *db_mdkeys;
+static unsigned int db_mdkeys_size;
+
+#ifdef HAVE_FORK
+/* the child currently writing a snapshot of the database, if any */
+static pid_t db_save_child = 0;
+#endif
+
 extern mowgli_list_t modules;
 
 /* write atheme.db (core fields) */
@@ -48,12 +61,14 @@ corestorage_db_save(database_handle_t *db)
 	mowgli_node_t *n, *tn;
 	mowgli_patricia_iteration_state_t state;
 	myentity_iteration_state_t mestate;
+	metadata_iteration_state_t mdstate;
+	metadata_atom_t atom;
 
 	errno = 0;
 
 	/* write the database version */
 	db_start_row(db, "DBV");
-	db_write_int(db, 12);
+	db_write_int(db, 13);
 	db_commit_row(db);
 
 	MOWGLI_ITER_FOREACH(n, modules.head)
@@ -73,6 +88,18 @@ corestorage_db_save(database_handle_t *db)
 	db_write_word(db, bitmask_to_flags(ca_all));
 	db_commit_row(db);
 
+	/* metadata rows refer to their key by its number in this table */
+	for (atom = 1; atom <= metadata_atom_max(); atom++)
+	{
+		if (metadata_atom_name(atom) == NULL)
+			continue;
+
+		db_start_row(db, "MDK");
+		db_write_uint(db, atom);
+		db_write_word(db, metadata_atom_name(atom));
+		db_commit_row(db);
+	}
+
 	slog(LG_DEBUG, "db_save(): saving myusers");
 
 	MYENTITY_FOREACH_T(ment, &mestate, ENT_USER)
@@ -95,16 +122,13 @@ corestorage_db_save(database_handle_t *db)
 		db_write_word(db, language_get_name(mu->language));
 		db_commit_row(db);
 
-		if (object(mu)->metadata)
+		METADATA_FOREACH(md, &mdstate, mu)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state, object(mu)->metadata)
-			{
-				db_start_row(db, "MDU");
-				db_write_word(db, entity(mu)->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
+			db_start_row(db, "MDU");
+			db_write_word(db, entity(mu)->name);
+			db_write_uint(db, md->atom);
+			db_write_str(db, md->value);
+			db_commit_row(db);
 		}
 
 		MOWGLI_ITER_FOREACH(tn, mu->memos.head)
@@ -166,8 +190,6 @@ corestorage_db_save(database_handle_t *db)
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		mowgli_patricia_iteration_state_t state2;
-
 		char *flags = gflags_tostr(mc_flags, mc->flags);
 		/* find a founder */
 		mu = NULL;
@@ -204,52 +226,41 @@ corestorage_db_save(database_handle_t *db)
 			db_write_word(db, ca->setter ? ca->setter : "*");
 			db_commit_row(db);
 
-			if (object(ca)->metadata)
+			METADATA_FOREACH(md, &mdstate, ca)
 			{
-				MOWGLI_PATRICIA_FOREACH(md, &state2, object(ca)->metadata)
-				{
-					db_start_row(db, "MDA");
-					db_write_word(db, ca->mychan->name);
-					db_write_word(db, (ca->entity) ? ca->entity->name : ca->host);
-					db_write_word(db, md->name);
-					db_write_str(db, md->value);
-					db_commit_row(db);
-				}
+				db_start_row(db, "MDA");
+				db_write_word(db, ca->mychan->name);
+				db_write_word(db, (ca->entity) ? ca->entity->name : ca->host);
+				db_write_uint(db, md->atom);
+				db_write_str(db, md->value);
+				db_commit_row(db);
 			}
 		}
 
-		if (object(mc)->metadata)
+		METADATA_FOREACH(md, &mdstate, mc)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state2, object(mc)->metadata)
-			{
-				db_start_row(db, "MDC");
-				db_write_word(db, mc->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
+			db_start_row(db, "MDC");
+			db_write_word(db, mc->name);
+			db_write_uint(db, md->atom);
+			db_write_str(db, md->value);
+			db_commit_row(db);
 		}
 	}
 
 	/* Old names */
 	MOWGLI_PATRICIA_FOREACH(mun, &state, oldnameslist)
 	{
-		mowgli_patricia_iteration_state_t state2;
-
 		db_start_row(db, "NAM");
 		db_write_word(db, mun->name);
 		db_commit_row(db);
 
-		if (object(mun)->metadata)
+		METADATA_FOREACH(md, &mdstate, mun)
 		{
-			MOWGLI_PATRICIA_FOREACH(md, &state2, object(mun)->metadata)
-			{
-				db_start_row(db, "MDN");
-				db_write_word(db, mun->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
+			db_start_row(db, "MDN");
+			db_write_word(db, mun->name);
+			db_write_uint(db, md->atom);
+			db_write_str(db, md->value);
+			db_commit_row(db);
 		}
 	}
 
@@ -659,14 +670,68 @@ convert_templates(const char *value)
 	return newvalue;
 }
 
+static void corestorage_h_mdk(database_handle_t *db, const char *type)
+{
+	unsigned int num = db_sread_uint(db);
+	const char *name = db_sread_word(db);
+	unsigned int oldsize;
+
+	if (num >= db_mdkeys_size)
+	{
+		oldsize = db_mdkeys_size;
+		db_mdkeys_size = num + 256;
+		db_mdkeys = srealloc(db_mdkeys, db_mdkeys_size * sizeof(metadata_atom_t));
+		memset(db_mdkeys + oldsize, 0, (db_mdkeys_size - oldsize) * sizeof(metadata_atom_t));
+	}
+
+	if (db_mdkeys[num] != METADATA_ATOM_NONE)
+		metadata_atom_unregister(db_mdkeys[num]);
+
+	db_mdkeys[num] = metadata_atom_register(name);
+}
+
+/*
+ * Reads the key of a metadata row; older databases spell it out, newer
+ * ones refer to the MDK table.  The result must be passed to
+ * corestorage_mdkey_release().
+ */
+static metadata_atom_t corestorage_sread_mdkey(database_handle_t *db)
+{
+	unsigned int num;
+
+	if (dbv < 13)
+		return metadata_atom_register(db_sread_word(db));
+
+	num = db_sread_uint(db);
+
+	if (num >= db_mdkeys_size || db_mdkeys[num] == METADATA_ATOM_NONE)
+	{
+		slog(LG_ERROR, "db %s:%d: metadata key %u is not in the key table", db->file, db->line, num);
+		return METADATA_ATOM_NONE;
+	}
+
+	return db_mdkeys[num];
+}
+
+static void corestorage_mdkey_release(metadata_atom_t atom)
+{
+	/* keys from the table stay registered until the load is done */
+	if (dbv < 13 && atom != METADATA_ATOM_NONE)
+		metadata_atom_unregister(atom);
+}
+
 static void corestorage_h_md(database_handle_t *db, const char *type)
 {
 	const char *name = db_sread_word(db);
-	const char *prop = db_sread_word(db);
+	metadata_atom_t atom = corestorage_sread_mdkey(db);
+	const char *prop = metadata_atom_name(atom);
 	const char *value = db_sread_str(db);
 	char *newvalue = NULL;
 	void *obj = NULL;
 
+	if (atom == METADATA_ATOM_NONE)
+		return;
+
 	if (!strcmp(type, "MDU"))
 	{
 		obj = myuser_find(name);
@@ -697,6 +762,7 @@ static void corestorage_h_md(database_handle_t *db, const char *type)
 	else
 	{
 		slog(LG_INFO, "db-h-md: unknown metadata type '%s'; name %s, prop %s", type, name, prop);
+		corestorage_mdkey_release(atom);
 		return;
 	}
 
@@ -705,16 +771,19 @@ static void corestorage_h_md(database_handle_t *db, const char *type)
 		slog(LG_INFO, "db-h-md: attempting to add %s property to non-existant object %s",
 		     prop, name);
 		free(newvalue);
+		corestorage_mdkey_release(atom);
 		return;
 	}
 
-	metadata_add(obj, prop, value);
+	metadata_add_atom(obj, atom, value);
 	free(newvalue);
+	corestorage_mdkey_release(atom);
 }
 
 static void corestorage_h_mda(database_handle_t *db, const char *type)
 {
-	const char *name, *prop, *value, *mask;
+	const char *name, *value, *mask;
+	metadata_atom_t atom;
 	void *obj = NULL;
 
 	if (dbv < 12)
@@ -722,19 +791,24 @@ static void corestorage_h_mda(database_handle_t *db, const char *type)
 
 	name = db_sread_word(db);
 	mask = db_sread_word(db);
-	prop = db_sread_word(db);
+	atom = corestorage_sread_mdkey(db);
 	value = db_sread_str(db);
 
+	if (atom == METADATA_ATOM_NONE)
+		return;
+
 	obj = chanacs_find_by_mask(mychan_find(name), mask, CA_NONE);
 
 	if (obj == NULL)
 	{
 		slog(LG_INFO, "db-h-mda: attempting to add %s property to non-existant object %s (acl %s)",
-		     prop, name, mask);
+		     metadata_atom_name(atom), name, mask);
+		corestorage_mdkey_release(atom);
 		return;
 	}
 
-	metadata_add(obj, prop, value);
+	metadata_add_atom(obj, atom, value);
+	corestorage_mdkey_release(atom);
 }
 
 static void corestorage_h_ca(database_handle_t *db, const char *type)
@@ -923,18 +997,130 @@ static void corestorage_db_load(const char *filename)
 
 	db_parse(db);
 	db_close(db);
+
+	/* the loaded entries hold their own references to the keys */
+	while (db_mdkeys_size > 0)
+		if (db_mdkeys[--db_mdkeys_size] != METADATA_ATOM_NONE)
+			metadata_atom_unregister(db_mdkeys[db_mdkeys_size]);
+
+	free(db_mdkeys);
+	db_mdkeys = NULL;
 }
 
-static void corestorage_db_write(void *filename)
+static bool corestorage_db_write_blocking(void *filename)
 {
 	database_handle_t *db;
 
 	db = db_open(filename, DB_WRITE);
+	if (db == NULL)
+		return false;
 
 	corestorage_db_save(db);
 	hook_call_db_write(db);
 
+	/* the backend leaves errno set if it could not commit the file */
+	errno = 0;
 	db_close(db);
+
+	return errno == 0;
+}
+
+#ifdef HAVE_FORK
+static void corestorage_db_write_done(pid_t pid, int status, void *data)
+{
+	db_save_child = 0;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+	{
+		slog(LG_DEBUG, "db_save(): child %d finished writing the database", (int) pid);
+		journal_commit();
+		hook_call_db_saved();
+		return;
+	}
+
+	if (WIFSIGNALED(status))
+	{
+		slog(LG_ERROR, "db_save(): child %d writing the database was killed by signal %d", (int) pid, WTERMSIG(status));
+		wallops(_("\2DATABASE ERROR\2: db_save(): child writing the database was killed by signal %d"), WTERMSIG(status));
+	}
+	else
+	{
+		slog(LG_ERROR, "db_save(): child %d failed to write the database, see the log for details", (int) pid);
+		wallops(_("\2DATABASE ERROR\2: db_save(): child failed to write the database, see the log for details"));
+	}
+}
+
+/* wait for a running snapshot to finish so that it cannot race with a
+ * newer write of the same file.
+ */
+static void corestorage_db_write_wait(void)
+{
+	pid_t pid;
+	int status;
+
+	if (db_save_child == 0)
+		return;
+
+	slog(LG_DEBUG, "db_save(): waiting for child %d to finish writing the database", (int) db_save_child);
+
+	while ((pid = waitpid(db_save_child, &status, 0)) < 0 && errno == EINTR)
+		;
+
+	childproc_delete_all(corestorage_db_write_done);
+
+	if (pid == db_save_child)
+		corestorage_db_write_done(pid, status, NULL);
+	else
+		db_save_child = 0;
+}
+#endif
+
+static void corestorage_db_write(void *filename, db_save_strategy_t strategy)
+{
+#ifdef HAVE_FORK
+	pid_t pid;
+
+	if (strategy == DB_SAVE_BG_REGULAR && db_save_child != 0)
+	{
+		slog(LG_INFO, "db_save(): previous commit by child %d is still running, skipping this one", (int) db_save_child);
+		return;
+	}
+
+	corestorage_db_write_wait();
+#endif
+
+	/* changes from here on are not part of this snapshot */
+	journal_rotate();
+
+#ifdef HAVE_FORK
+	if (strategy != DB_SAVE_BLOCKING && config_options.db_save_fork)
+	{
+		switch (pid = fork())
+		{
+			case -1:
+				slog(LG_ERROR, "db_save(): cannot fork, writing the database in the foreground: %s", strerror(errno));
+				break;
+			case 0:
+				/* the child must never talk to the uplink or touch the
+				 * parent's connections; it only writes the snapshot.
+				 */
+				connection_close_all_fds();
+				me.connected = false;
+
+				_exit(corestorage_db_write_blocking(filename) ? EXIT_SUCCESS : EXIT_FAILURE);
+			default:
+				db_save_child = pid;
+				childproc_add(pid, "db_save", corestorage_db_write_done, NULL);
+				return;
+		}
+	}
+#endif
+
+	if (corestorage_db_write_blocking(filename))
+	{
+		journal_commit();
+		hook_call_db_saved();
+	}
 }
 
 void _modinit(module_t *m)
@@ -958,6 +1144,7 @@ void _modinit(module_t *m)
 	db_register_type_handler("NAM", corestorage_h_nam);
 	db_register_type_handler("SO", corestorage_h_so);
 	db_register_type_handler("MC", corestorage_h_mc);
+	db_register_type_handler("MDK", corestorage_h_mdk);
 	db_register_type_handler("MDU", corestorage_h_md);
 	db_register_type_handler("MDC", corestorage_h_md);
 	db_register_type_handler("MDA", corestorage_h_mda);
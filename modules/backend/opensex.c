@@ -10,6 +10,10 @@
 
 #include "atheme.h"
 
+#ifndef MOWGLI_OS_WIN
+# include <sys/mman.h>
+#endif
+
 DECLARE_MODULE_V1
 (
 	"backend/opensex", true, _modinit, NULL,
@@ -24,6 +28,15 @@ typedef struct opensex_ {
 	char *token;
 	FILE *f;
 
+	/* Reading state: the whole file, tokenized in place */
+	char *data;
+	size_t datalen;
+	char *pos;
+	bool mapped;
+#ifdef HAVE_GETTIMEOFDAY
+	struct timeval sttime;
+#endif
+
 	/* Interpreting state */
 	unsigned int grver;
 } opensex_t;
@@ -53,31 +66,38 @@ static void opensex_h_grver(database_handle_t *db, const char *type)
 
 static bool opensex_read_next_row(database_handle_t *hdl)
 {
-	int c = 0;
-	unsigned int n = 0;
+	size_t n;
+	char *line, *end;
 	opensex_t *rs = (opensex_t *)hdl->priv;
 
-	while ((c = getc(rs->f)) != EOF && c != '\n')
+	if (rs->pos == NULL || rs->pos >= rs->data + rs->datalen)
+		return false;
+
+	line = rs->pos;
+	end = memchr(line, '\n', rs->data + rs->datalen - line);
+	if (end != NULL)
 	{
-		rs->buf[n++] = c;
-		if (n == rs->bufsize)
+		*end = '\0';
+		rs->pos = end + 1;
+	}
+	else
+	{
+		/* the last row has no newline and there may be no room to
+		 * terminate it in the mapping, so it gets copied.
+		 */
+		n = rs->data + rs->datalen - line;
+		if (n >= rs->bufsize)
 		{
-			rs->bufsize *= 2;
+			rs->bufsize = n + 1;
 			rs->buf = srealloc(rs->buf, rs->bufsize);
 		}
+		memcpy(rs->buf, line, n);
+		rs->buf[n] = '\0';
+		rs->pos = rs->data + rs->datalen;
+		line = rs->buf;
 	}
-	rs->buf[n] = '\0';
-	rs->token = rs->buf;
 
-	if (c == EOF && ferror(rs->f))
-	{
-		slog(LG_ERROR, "opensex-read-next-row: error at %s line %d: %s", hdl->file, hdl->line, strerror(errno));
-		slog(LG_ERROR, "opensex-read-next-row: exiting to avoid data loss");
-		exit(EXIT_FAILURE);
-	}
-
-	if (c == EOF && n == 0)
-		return false;
+	rs->token = line;
 
 	hdl->line++;
 	hdl->token = 0;
@@ -243,17 +263,87 @@ static database_vtable_t opensex_vt = {
 	.commit_row = opensex_commit_row
 };
 
+static bool opensex_load_file(opensex_t *rs, int fd, const char *path)
+{
+	struct stat sb;
+	size_t done = 0;
+	ssize_t r;
+
+	if (fstat(fd, &sb) < 0)
+	{
+		slog(LG_ERROR, "db-open-read: cannot stat '%s': %s", path, strerror(errno));
+		return false;
+	}
+
+	rs->datalen = sb.st_size;
+	if (rs->datalen == 0)
+		return true;
+
+#ifndef MOWGLI_OS_WIN
+	/* a private writable mapping lets rows be tokenized in place
+	 * without ever touching the file itself.
+	 */
+	rs->data = mmap(NULL, rs->datalen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (rs->data != MAP_FAILED)
+	{
+#ifdef MADV_SEQUENTIAL
+		madvise(rs->data, rs->datalen, MADV_SEQUENTIAL);
+#endif
+		rs->mapped = true;
+		rs->pos = rs->data;
+		return true;
+	}
+
+	slog(LG_DEBUG, "db-open-read: cannot map '%s', reading it instead: %s", path, strerror(errno));
+#endif
+
+	rs->data = smalloc(rs->datalen);
+	while (done < rs->datalen)
+	{
+		r = read(fd, rs->data + done, rs->datalen - done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			slog(LG_ERROR, "db-open-read: cannot read '%s': %s", path, r < 0 ? strerror(errno) : "unexpected end of file");
+			free(rs->data);
+			rs->data = NULL;
+			return false;
+		}
+		done += r;
+	}
+
+	rs->pos = rs->data;
+	return true;
+}
+
+static void opensex_unload_file(opensex_t *rs)
+{
+	if (rs->data == NULL)
+		return;
+
+#ifndef MOWGLI_OS_WIN
+	if (rs->mapped)
+		munmap(rs->data, rs->datalen);
+	else
+#endif
+		free(rs->data);
+
+	rs->data = NULL;
+	rs->pos = NULL;
+}
+
 static database_handle_t *opensex_db_open_read(const char *filename)
 {
 	database_handle_t *db;
 	opensex_t *rs;
-	FILE *f;
+	int fd;
 	int errno1;
 	char path[BUFSIZE];
 
 	snprintf(path, BUFSIZE, "%s/%s", datadir, filename != NULL ? filename : "services.db");
-	f = fopen(path, "r");
-	if (!f)
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
 	{
 		errno1 = errno;
 
@@ -274,7 +364,19 @@ static database_handle_t *opensex_db_open_read(const char *filename)
 	rs->buf = scalloc(512, 1);
 	rs->bufsize = 512;
 	rs->token = NULL;
-	rs->f = f;
+	rs->f = NULL;
+
+#ifdef HAVE_GETTIMEOFDAY
+	s_time(&rs->sttime);
+#endif
+
+	if (!opensex_load_file(rs, fd, path))
+	{
+		slog(LG_ERROR, "db-open-read: exiting to avoid data loss");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
 
 	db = scalloc(sizeof(database_handle_t), 1);
 	db->priv = rs;
@@ -287,6 +389,24 @@ static database_handle_t *opensex_db_open_read(const char *filename)
 	return db;
 }
 
+#ifdef HAVE_GETTIMEOFDAY
+static void opensex_report_load(database_handle_t *db)
+{
+	opensex_t *rs = db->priv;
+	struct timeval ttime;
+	double secs;
+
+	e_time(rs->sttime, &ttime);
+	secs = ttime.tv_sec + ttime.tv_usec / 1000000.0;
+	if (secs <= 0)
+		secs = 0.000001;
+
+	slog(LG_INFO, "opensex: loaded %u rows (%lu bytes) from %s in %d ms: %.0f rows/s, %.2f MB/s",
+			db->line, (unsigned long) rs->datalen, db->file, tv2ms(&ttime),
+			db->line / secs, rs->datalen / secs / 1048576.0);
+}
+#endif
+
 static database_handle_t *opensex_db_open_write(const char *filename)
 {
 	database_handle_t *db;
@@ -301,7 +421,7 @@ static database_handle_t *opensex_db_open_write(const char *filename)
 	mowgli_strlcpy(path, bpath, sizeof path);
 	mowgli_strlcat(path, ".new", sizeof path);
 
-	fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 	if (fd < 0 || ! (f = fdopen(fd, "w")))
 	{
 		errno1 = errno;
@@ -340,6 +460,7 @@ static void opensex_db_close(database_handle_t *db)
 {
 	opensex_t *rs;
 	int errno1;
+	bool write_failed;
 	char oldpath[BUFSIZE], newpath[BUFSIZE];
 
 	return_if_fail(db != NULL);
@@ -350,19 +471,34 @@ static void opensex_db_close(database_handle_t *db)
 
 	mowgli_strlcpy(newpath, db->file, sizeof newpath);
 
-	fclose(rs->f);
-
 	if (db->txn == DB_WRITE)
 	{
+		write_failed = ferror(rs->f) != 0;
+		if (fclose(rs->f) != 0)
+			write_failed = true;
+
+		if (write_failed)
+		{
+			errno1 = errno != 0 ? errno : EIO;
+			slog(LG_ERROR, "db_save(): cannot write services.db.new: %s", strerror(errno1));
+			wallops(_("\2DATABASE ERROR\2: db_save(): cannot write services.db.new: %s"), strerror(errno1));
+			errno = errno1;
+		}
 		/* now, replace the old database with the new one, using an atomic rename */
-		if (srename(oldpath, newpath) < 0)
+		else if (srename(oldpath, newpath) < 0)
 		{
 			errno1 = errno;
 			slog(LG_ERROR, "db_save(): cannot rename services.db.new to services.db: %s", strerror(errno1));
 			wallops(_("\2DATABASE ERROR\2: db_save(): cannot rename services.db.new to services.db: %s"), strerror(errno1));
+			errno = errno1;
 		}
-
-		hook_call_db_saved();
+	}
+	else
+	{
+#ifdef HAVE_GETTIMEOFDAY
+		opensex_report_load(db);
+#endif
+		opensex_unload_file(rs);
 	}
 
 	free(rs->buf);
@@ -38,6 +38,13 @@ fn_botserv_bot_find botserv_bot_find;
 
 service_t *botsvs;
 
+/* metadata keys checked for every message a bot relays */
+static metadata_atom_t md_bot_assigned;
+static metadata_atom_t md_bot_fantasy;
+static metadata_atom_t md_disable_fantasy;
+static metadata_atom_t md_prefix;
+static metadata_atom_t md_entrymsg;
+
 unsigned int min_users = 0;
 
 E mowgli_list_t mychan;
@@ -56,7 +63,7 @@ static botserv_bot_t *bs_mychan_find_bot(mychan_t *mc)
 	metadata_t *md;
 	botserv_bot_t *bot;
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_atom(mc, md_bot_assigned);
 	bot = md != NULL ? botserv_bot_find(md->value) : NULL;
 	if (bot != NULL && !user_find_named(bot->nick))
 		bot = NULL;
@@ -65,8 +72,8 @@ static botserv_bot_t *bs_mychan_find_bot(mychan_t *mc)
 		slog(LG_INFO, "bs_mychan_find_bot(): unassigning invalid bot %s from %s",
 				md->value, mc->name);
 
-		metadata_delete(mc, "private:botserv:bot-assigned");
-		metadata_delete(mc, "private:botserv:bot-handle-fantasy");
+		metadata_delete_atom(mc, md_bot_assigned);
+		metadata_delete_atom(mc, md_bot_fantasy);
 	}
 	return bot;
 }
@@ -173,7 +180,7 @@ bs_modestack_mode_simple(const char *source, channel_t *channel, int dir, int fl
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = mychan_from(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_atom(mc, md_bot_assigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_simple_real(bot ? bot->nick : source, channel, dir, flags);
@@ -192,7 +199,7 @@ bs_modestack_mode_limit(const char *source, channel_t *channel, int dir, unsigne
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = mychan_from(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_atom(mc, md_bot_assigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_limit_real(bot ? bot->nick : source, channel, dir, limit);
@@ -211,7 +218,7 @@ bs_modestack_mode_ext(const char *source, channel_t *channel, int dir, unsigned
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = mychan_from(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_atom(mc, md_bot_assigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_ext_real(bot ? bot->nick : source, channel, dir, i, value);
@@ -230,7 +237,7 @@ bs_modestack_mode_param(const char *source, channel_t *channel, int dir, char ty
 	if (source != NULL && chansvs.nick != NULL &&
 			!strcmp(source, chansvs.nick) &&
 			(mc = mychan_from(channel)) != NULL &&
-			(bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+			(bs = metadata_find_atom(mc, md_bot_assigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	modestack_mode_param_real(bot ? bot->nick : source, channel, dir, type, value);
@@ -249,7 +256,7 @@ bs_try_kick(user_t *source, channel_t *chan, user_t *target, const char *reason)
 	if (source != chansvs.me->me)
 		return try_kick_real(source, chan, target, reason);
 
-	if ((mc = mychan_from(chan)) != NULL && (bs = metadata_find(mc, "private:botserv:bot-assigned")) != NULL)
+	if ((mc = mychan_from(chan)) != NULL && (bs = metadata_find_atom(mc, md_bot_assigned)) != NULL)
 		bot = user_find_named(bs->value);
 
 	try_kick_real(bot ? bot : source, chan, target, reason);
@@ -270,7 +277,7 @@ bs_join_registered(bool all)
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_atom(mc, md_bot_assigned)) == NULL)
 			continue;
 
 		if (all)
@@ -299,8 +306,8 @@ static void bs_channel_drop(mychan_t *mc)
 	if ((bot = bs_mychan_find_bot(mc)) == NULL)
 		return;
 
-	metadata_delete(mc, "private:botserv:bot-assigned");
-	metadata_delete(mc, "private:botserv:bot-handle-fantasy");
+	metadata_delete_atom(mc, md_bot_assigned);
+	metadata_delete_atom(mc, md_bot_fantasy);
 	part(mc->name, bot->nick);
 }
 
@@ -340,14 +347,14 @@ botserv_channel_handler(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_find(mc, "disable_fantasy");
+	md = metadata_find_atom(mc, md_disable_fantasy);
 	if (md)
 	{
 		/* fantasy disabled on this channel. don't message them, just bail. */
 		return;
 	}
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_atom(mc, md_bot_assigned);
 	if (md == NULL)
 	{
 		/* we received this, but have no record of a bot assigned. WTF */
@@ -355,7 +362,7 @@ botserv_channel_handler(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_find(mc, "private:botserv:bot-handle-fantasy");
+	md = metadata_find_atom(mc, md_bot_fantasy);
 	if (md == NULL || irccasecmp(si->service->me->nick, md->value))
 		return;
 
@@ -374,7 +381,7 @@ botserv_channel_handler(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	/* take the command through the hash table, handling both !prefix and Bot, ... styles */
-	metadata_t *mdp = metadata_find(mc, "private:prefix");
+	metadata_t *mdp = metadata_find_atom(mc, md_prefix);
 	const char *prefix = (mdp ? mdp->value : chansvs.trigger);
 
 	if ((sptr = service_find("chanserv")) == NULL)
@@ -668,13 +675,13 @@ static void bs_cmd_change(sourceinfo_t *si, int parc, char *parv[])
 	/* join it back and also update the metadata */
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_atom(mc, md_bot_assigned)) == NULL)
 			continue;
 
 		if (!irccasecmp(md->value, parv[0]))
 		{
-			metadata_add(mc, "private:botserv:bot-assigned", parv[1]);
-			metadata_add(mc, "private:botserv:bot-handle-fantasy", parv[1]);
+			metadata_add_atom(mc, md_bot_assigned, parv[1]);
+			metadata_add_atom(mc, md_bot_fantasy, parv[1]);
 			if (!config_options.leave_chans || (mc->chan != NULL && MOWGLI_LIST_LENGTH(&mc->chan->members) > 0))
 				join(mc->name, parv[1]);
 		}
@@ -779,7 +786,7 @@ static void bs_cmd_delete(sourceinfo_t *si, int parc, char *parv[])
 
 	MOWGLI_PATRICIA_FOREACH(mc, &state, mclist)
 	{
-		if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+		if ((md = metadata_find_atom(mc, md_bot_assigned)) == NULL)
 			continue;
 
 		if (!irccasecmp(md->value, bot->nick))
@@ -790,8 +797,8 @@ static void bs_cmd_delete(sourceinfo_t *si, int parc, char *parv[])
 					  MOWGLI_LIST_LENGTH(&mc->chan->members) > 1)))
 				join(mc->name, chansvs.nick);
 
-			metadata_delete(mc, "private:botserv:bot-assigned");
-			metadata_delete(mc, "private:botserv:bot-handle-fantasy");
+			metadata_delete_atom(mc, md_bot_assigned);
+			metadata_delete_atom(mc, md_bot_fantasy);
 		}
 	}
 
@@ -884,7 +891,7 @@ static void bs_cmd_assign(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_atom(mc, md_bot_assigned);
 
 	bot = botserv_bot_find(parv[1]);
 	if (bot == NULL)
@@ -915,8 +922,8 @@ static void bs_cmd_assign(sourceinfo_t *si, int parc, char *parv[])
 	if (!(mc->chan->flags & CHAN_LOG) && chanuser_find(mc->chan, chansvs.me->me))
 		part(mc->name, chansvs.nick);
 
-	metadata_add(mc, "private:botserv:bot-assigned", parv[1]);
-	metadata_add(mc, "private:botserv:bot-handle-fantasy", parv[1]);
+	metadata_add_atom(mc, md_bot_assigned, parv[1]);
+	metadata_add_atom(mc, md_bot_fantasy, parv[1]);
 
 	logcommand(si, CMDLOG_SET, "BOT:ASSIGN: \2%s\2 to \2%s\2", parv[1], parv[0]);
 	command_success_nodata(si, _("Assigned the bot \2%s\2 to \2%s\2."), parv[1], parv[0]);
@@ -949,7 +956,7 @@ static void bs_cmd_unassign(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	if ((md = metadata_find(mc, "private:botserv:bot-assigned")) == NULL)
+	if ((md = metadata_find_atom(mc, md_bot_assigned)) == NULL)
 	{
 		command_fail(si, fault_nosuch_key, _("\2%s\2 does not have a bot assigned."), mc->name);
 		return;
@@ -960,8 +967,8 @@ static void bs_cmd_unassign(sourceinfo_t *si, int parc, char *parv[])
 				 MOWGLI_LIST_LENGTH(&mc->chan->members) > 1)))
 		join(mc->name, chansvs.nick);
 	part(mc->name, md->value);
-	metadata_delete(mc, "private:botserv:bot-assigned");
-	metadata_delete(mc, "private:botserv:bot-handle-fantasy");
+	metadata_delete_atom(mc, md_bot_assigned);
+	metadata_delete_atom(mc, md_bot_fantasy);
 	logcommand(si, CMDLOG_SET, "BOT:UNASSIGN: \2%s\2", parv[0]);
 	command_success_nodata(si, _("Unassigned the bot from \2%s\2."), parv[0]);
 }
@@ -977,6 +984,12 @@ void _modinit(module_t *m)
 		return;
 	}
 
+	md_bot_assigned = metadata_atom_register("private:botserv:bot-assigned");
+	md_bot_fantasy = metadata_atom_register("private:botserv:bot-handle-fantasy");
+	md_disable_fantasy = metadata_atom_register("disable_fantasy");
+	md_prefix = metadata_atom_register("private:prefix");
+	md_entrymsg = metadata_atom_register("private:entrymsg");
+
 	hook_add_event("config_ready");
 	hook_add_config_ready(botserv_config_ready);
 
@@ -1058,6 +1071,12 @@ void _moddeinit(module_unload_intent_t intent)
 	modestack_mode_ext    = modestack_mode_ext_real;
 	modestack_mode_param  = modestack_mode_param_real;
 	try_kick              = try_kick_real;
+
+	metadata_atom_unregister(md_bot_assigned);
+	metadata_atom_unregister(md_bot_fantasy);
+	metadata_atom_unregister(md_disable_fantasy);
+	metadata_atom_unregister(md_prefix);
+	metadata_atom_unregister(md_entrymsg);
 	topic_sts             = topic_sts_real;
 	msg                   = msg_real;
 	notice                = notice_real;
@@ -1103,7 +1122,7 @@ static void bs_join(hook_channel_joinpart_t *hdata)
 		return;
 
 	/* chanserv's function handles those */
-	if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+	if (metadata_find_atom(mc, md_bot_assigned) == NULL)
 		return;
 
 	bot = bs_mychan_find_bot(mc);
@@ -1118,7 +1137,7 @@ static void bs_join(hook_channel_joinpart_t *hdata)
 			join(chan->name, bot->nick);
 
 		if (u->server->flags & SF_EOB &&
-				(md = metadata_find(mc, "private:entrymsg")) != NULL)
+				(md = metadata_find_atom(mc, md_entrymsg)) != NULL)
 		{
 			if (!u->myuser || !(u->myuser->flags & MU_NOGREET))
 				notice(bot->nick, u->nick, "[%s] %s", mc->name, md->value);
@@ -1144,7 +1163,7 @@ bs_part(hook_channel_joinpart_t *hdata)
 		return;
 
 	/* chanserv's function handles those */
-	if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+	if (metadata_find_atom(mc, md_bot_assigned) == NULL)
 		return;
 
 	bot = bs_mychan_find_bot(mc);
@@ -121,6 +121,8 @@ static void chanfix_channel_delete(chanfix_channel_t *c)
 		chanfix_oprecord_delete(orec);
 	}
 
+	metadata_delete_all(c);
+
 	free(c->name);
 	mowgli_heap_free(chanfix_channel_heap, c);
 }
@@ -265,6 +267,8 @@ static void write_chanfixdb(database_handle_t *db)
 {
 	chanfix_channel_t *chan;
 	mowgli_patricia_iteration_state_t state;
+	metadata_iteration_state_t mdstate;
+	metadata_t *md;
 
 	return_if_fail(db != NULL);
 
@@ -305,19 +309,13 @@ static void write_chanfixdb(database_handle_t *db)
 			db_commit_row(db);
 		}
 
-		if (object(chan)->metadata != NULL)
+		METADATA_FOREACH(md, &mdstate, chan)
 		{
-			mowgli_patricia_iteration_state_t state2;
-			metadata_t *md;
-
-			MOWGLI_PATRICIA_FOREACH(md, &state2, object(chan)->metadata)
-			{
-				db_start_row(db, "CFMD");
-				db_write_word(db, chan->name);
-				db_write_word(db, md->name);
-				db_write_str(db, md->value);
-				db_commit_row(db);
-			}
+			db_start_row(db, "CFMD");
+			db_write_word(db, chan->name);
+			db_write_word(db, md->name);
+			db_write_str(db, md->value);
+			db_commit_row(db);
 		}
 	}
 }
@@ -33,7 +33,7 @@ static void cs_cmd_clone(sourceinfo_t *si, int parc, char *parv[])
 {
 	mychan_t *mc, *mc2;
 	mowgli_node_t *n, *tn;
-	mowgli_patricia_iteration_state_t state;
+	metadata_iteration_state_t state;
 	metadata_t *md;
 	chanacs_t *ca;
 	char *source = parv[0];
@@ -123,7 +123,7 @@ static void cs_cmd_clone(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	/* Copy ze metadata! */
-	MOWGLI_PATRICIA_FOREACH(md, &state, object(mc)->metadata)
+	METADATA_FOREACH(md, &state, mc)
 	{
 		if(!strncmp(md->name, "private:topic:", 14))
 		{
@@ -32,6 +32,18 @@ static void on_shutdown(void *unused);
 
 static mowgli_eventloop_timer_t *cs_leave_empty_timer = NULL;
 
+/* metadata keys checked on joins, parts and topic changes */
+static metadata_atom_t md_bot_assigned;
+static metadata_atom_t md_disable_fantasy;
+static metadata_atom_t md_prefix;
+static metadata_atom_t md_entrymsg;
+static metadata_atom_t md_url;
+static metadata_atom_t md_close_closer;
+static metadata_atom_t md_topic_text;
+static metadata_atom_t md_topic_setter;
+static metadata_atom_t md_topic_ts;
+static metadata_atom_t md_channelts;
+
 static void join_registered(bool all)
 {
 	mychan_t *mc;
@@ -41,7 +53,7 @@ static void join_registered(bool all)
 	{
 		if (!(mc->flags & MC_GUARD))
 			continue;
-		if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+		if (metadata_find_atom(mc, md_bot_assigned) != NULL)
 			continue;
 
 		if (all)
@@ -91,7 +103,7 @@ static void chanserv(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		md = metadata_find(mc, "disable_fantasy");
+		md = metadata_find_atom(mc, md_disable_fantasy);
 		if (md)
 		{
 			/* fantasy disabled on this channel. don't message them, just bail. */
@@ -118,7 +130,7 @@ static void chanserv(sourceinfo_t *si, int parc, char *parv[])
 		command_exec_split(si->service, si, cmd, strtok(NULL, ""), si->service->commands);
 	else
 	{
-		metadata_t *md = metadata_find(mc, "private:prefix");
+		metadata_t *md = metadata_find_atom(mc, md_prefix);
 		const char *prefix = (md ? md->value : chansvs.trigger);
 
 		if (strlen(cmd) >= 2 && strchr(prefix, cmd[0]) && isalpha((unsigned char)*++cmd))
@@ -266,6 +278,17 @@ static int c_ci_templates(mowgli_config_file_entry_t *ce)
 
 void _modinit(module_t *m)
 {
+	md_bot_assigned = metadata_atom_register("private:botserv:bot-assigned");
+	md_disable_fantasy = metadata_atom_register("disable_fantasy");
+	md_prefix = metadata_atom_register("private:prefix");
+	md_entrymsg = metadata_atom_register("private:entrymsg");
+	md_url = metadata_atom_register("url");
+	md_close_closer = metadata_atom_register("private:close:closer");
+	md_topic_text = metadata_atom_register("private:topic:text");
+	md_topic_setter = metadata_atom_register("private:topic:setter");
+	md_topic_ts = metadata_atom_register("private:topic:ts");
+	md_channelts = metadata_atom_register("private:channelts");
+
 	hook_add_event("config_ready");
 	hook_add_config_ready(chanserv_config_ready);
 
@@ -339,6 +362,17 @@ void _moddeinit(module_unload_intent_t intent)
 	hook_del_shutdown(on_shutdown);
 
 	mowgli_timer_destroy(base_eventloop, cs_leave_empty_timer);
+
+	metadata_atom_unregister(md_bot_assigned);
+	metadata_atom_unregister(md_disable_fantasy);
+	metadata_atom_unregister(md_prefix);
+	metadata_atom_unregister(md_entrymsg);
+	metadata_atom_unregister(md_url);
+	metadata_atom_unregister(md_close_closer);
+	metadata_atom_unregister(md_topic_text);
+	metadata_atom_unregister(md_topic_setter);
+	metadata_atom_unregister(md_topic_ts);
+	metadata_atom_unregister(md_channelts);
 }
 
 static void cs_join(hook_channel_joinpart_t *hdata)
@@ -373,7 +407,7 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 			chan->nummembers == 1 && chan->ts > CURRTIME - 300);
 
 	if (chan->nummembers == 1 && mc->flags & MC_GUARD &&
-		metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+		metadata_find_atom(mc, md_bot_assigned) == NULL)
 		join(chan->name, chansvs.nick);
 
 	/*
@@ -575,16 +609,16 @@ static void cs_join(hook_channel_joinpart_t *hdata)
 		}
 	}
 
-	if (u->server->flags & SF_EOB && (md = metadata_find(mc, "private:entrymsg")))
+	if (u->server->flags & SF_EOB && (md = metadata_find_atom(mc, md_entrymsg)))
 	{
-		if (metadata_find(mc, "private:botserv:bot-assigned") == NULL)
+		if (metadata_find_atom(mc, md_bot_assigned) == NULL)
 		{
 			if (!u->myuser || !(u->myuser->flags & MU_NOGREET))
 				notice(chansvs.nick, cu->user->nick, "[%s] %s", mc->name, md->value);
 		}
 	}
 
-	if (u->server->flags & SF_EOB && (md = metadata_find(mc, "url")))
+	if (u->server->flags & SF_EOB && (md = metadata_find_atom(mc, md_url)))
 		numeric_sts(me.me, 328, cu->user, "%s :%s", mc->name, md->value);
 
 	if (flags & CA_USEDUPDATE)
@@ -602,7 +636,7 @@ static void cs_part(hook_channel_joinpart_t *hdata)
 	mc = mychan_find(cu->chan->name);
 	if (mc == NULL)
 		return;
-	if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+	if (metadata_find_atom(mc, md_bot_assigned) != NULL)
 		return;
 
 	if (CURRTIME - mc->used >= 3600)
@@ -648,7 +682,7 @@ static user_t *get_changets_user(mychan_t *mc)
 
 	return_val_if_fail(mc != NULL, chansvs.me->me);
 
-	md = metadata_find(mc, "private:botserv:bot-assigned");
+	md = metadata_find_atom(mc, md_bot_assigned);
 	if (md != NULL)
 	{
 		user_t *u = user_find(md->value);
@@ -670,7 +704,7 @@ static void cs_register(hook_channel_req_t *hdata)
 	{
 		if (mc->flags & MC_GUARD)
 			join(mc->name, chansvs.nick);
-		if (metadata_find(mc, "private:botserv:bot-assigned") != NULL)
+		if (metadata_find_atom(mc, md_bot_assigned) != NULL)
 			return;
 
 		mlock_sts(mc->chan);
@@ -695,29 +729,29 @@ static void cs_keeptopic_topicset(channel_t *c)
 	if (mc == NULL)
 		return;
 
-	md = metadata_find(mc, "private:topic:text");
+	md = metadata_find_atom(mc, md_topic_text);
 	if (md != NULL)
 	{
 		if (c->topic != NULL && !strcmp(md->value, c->topic))
 			return;
-		metadata_delete(mc, "private:topic:text");
+		metadata_delete_atom(mc, md_topic_text);
 	}
 
-	if (metadata_find(mc, "private:topic:setter"))
-		metadata_delete(mc, "private:topic:setter");
+	if (metadata_find_atom(mc, md_topic_setter))
+		metadata_delete_atom(mc, md_topic_setter);
 
-	if (metadata_find(mc, "private:topic:ts"))
-		metadata_delete(mc, "private:topic:ts");
+	if (metadata_find_atom(mc, md_topic_ts))
+		metadata_delete_atom(mc, md_topic_ts);
 
 	if (c->topic && c->topic_setter)
 	{
 		slog(LG_DEBUG, "KeepTopic: topic set for %s by %s: %s", c->name,
 			c->topic_setter, c->topic);
-		metadata_add(mc, "private:topic:setter",
+		metadata_add_atom(mc, md_topic_setter,
 			c->topic_setter);
-		metadata_add(mc, "private:topic:text",
+		metadata_add_atom(mc, md_topic_text,
 			c->topic);
-		metadata_add(mc, "private:topic:ts",
+		metadata_add_atom(mc, md_topic_ts,
 			number_to_string(c->topicts));
 	}
 	else
@@ -784,7 +818,7 @@ static void cs_newchan(channel_t *c)
 	 * -- jilles */
 	mc->flags |= MC_MLOCK_CHECK;
 
-	md = metadata_find(mc, "private:channelts");
+	md = metadata_find_atom(mc, md_channelts);
 	if (md != NULL)
 		channelts = atol(md->value);
 	if (channelts == 0)
@@ -816,7 +850,7 @@ static void cs_newchan(channel_t *c)
 	else if (c->ts != channelts)
 	{
 		snprintf(str, sizeof str, "%lu", (unsigned long)c->ts);
-		metadata_add(mc, "private:channelts", str);
+		metadata_add_atom(mc, md_channelts, str);
 	}
 	else if (!(MC_TOPICLOCK & mc->flags) && MOWGLI_LIST_LENGTH(&c->members) == 0)
 	{
@@ -836,17 +870,17 @@ static void cs_newchan(channel_t *c)
 	if (!(MC_KEEPTOPIC & mc->flags))
 		return;
 
-	md = metadata_find(mc, "private:topic:setter");
+	md = metadata_find_atom(mc, md_topic_setter);
 	if (md == NULL)
 		return;
 	setter = md->value;
 
-	md = metadata_find(mc, "private:topic:text");
+	md = metadata_find_atom(mc, md_topic_text);
 	if (md == NULL)
 		return;
 	text = md->value;
 
-	md = metadata_find(mc, "private:topic:ts");
+	md = metadata_find_atom(mc, md_topic_ts);
 	if (md == NULL)
 		return;
 	topicts = atol(md->value);
@@ -865,7 +899,7 @@ static void cs_tschange(channel_t *c)
 
 	/* store new TS */
 	snprintf(str, sizeof str, "%lu", (unsigned long)c->ts);
-	metadata_add(mc, "private:channelts", str);
+	metadata_add_atom(mc, md_channelts, str);
 
 	/* schedule a mode lock check when we know the new modes
 	 * -- jilles */
@@ -900,7 +934,7 @@ static void cs_leave_empty(void *unused)
 				!(mc->chan->flags & CHAN_LOG) &&
 				(!(mc->flags & MC_GUARD) ||
 				 (config_options.leave_chans && mc->chan->nummembers == mc->chan->numsvcmembers) ||
-				 metadata_find(mc, "private:close:closer")) &&
+				 metadata_find_atom(mc, md_close_closer)) &&
 				chanuser_find(mc->chan, chansvs.me->me))
 		{
 			slog(LG_DEBUG, "cs_leave_empty(): leaving %s", mc->chan->name);
@@ -102,29 +102,42 @@ static const char *pbkdf2_salt(void)
 	return buf;
 }
 
-static const char *pbkdf2_crypt(const char *key, const char *salt)
+static const char *pbkdf2_crypt_r(const char *key, const char *salt, char *outbuf, size_t outlen)
 {
-	static char outbuf[PASSLEN];
-	static unsigned char digestbuf[SHA512_DIGEST_LENGTH];
-	int res, iter;
+	unsigned char digestbuf[SHA512_DIGEST_LENGTH];
+	int iter;
 
-	if (strlen(salt) < SALTLEN)
-		salt = pbkdf2_salt();
+	/* a stored hash always has its salt; this may be called from a
+	 * crypt worker, which must not make up a new one.
+	 */
+	if (strlen(salt) < SALTLEN || outlen < SALTLEN + 2 * SHA512_DIGEST_LENGTH + 1)
+		return NULL;
 
 	memcpy(outbuf, salt, SALTLEN);
 
-	res = PKCS5_PBKDF2_HMAC(key, strlen(key), (const unsigned char *)salt, SALTLEN, ROUNDS, EVP_sha512(), SHA512_DIGEST_LENGTH, digestbuf);
+	PKCS5_PBKDF2_HMAC(key, strlen(key), (const unsigned char *)salt, SALTLEN, ROUNDS, EVP_sha512(), SHA512_DIGEST_LENGTH, digestbuf);
 
 	for (iter = 0; iter < SHA512_DIGEST_LENGTH; iter++)
-		sprintf(outbuf + SALTLEN + (iter * 2), "%02x", 255 & digestbuf[iter]);
+		snprintf(outbuf + SALTLEN + (iter * 2), 3, "%02x", 255 & digestbuf[iter]);
 
 	return outbuf;
 }
 
+static const char *pbkdf2_crypt(const char *key, const char *salt)
+{
+	static char outbuf[PASSLEN];
+
+	if (strlen(salt) < SALTLEN)
+		salt = pbkdf2_salt();
+
+	return pbkdf2_crypt_r(key, salt, outbuf, sizeof outbuf);
+}
+
 static crypt_impl_t pbkdf2_crypt_impl = {
 	.id = "pbkdf2",
 	.crypt = &pbkdf2_crypt,
-	.salt = &pbkdf2_salt
+	.salt = &pbkdf2_salt,
+	.crypt_r = &pbkdf2_crypt_r,
 };
 
 void _modinit(module_t *m)
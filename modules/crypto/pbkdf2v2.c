@@ -47,6 +47,10 @@ DECLARE_MODULE_V1("crypto/pbkdf2v2", false, _modinit, _moddeinit,
 #define PBKDF2_F_SALT		"$z$%u$%u$%s$"
 #define PBKDF2_F_PRINT		"$z$%u$%u$%s$%s"
 
+#define PBKDF2_LEGACYLEN	15
+#define PBKDF2_F_WRAP_SCAN	"$zw$%15[a-z0-9]$%u$%u$%16[A-Za-z0-9]$"
+#define PBKDF2_F_WRAP_PRINT	"$zw$%s$%u$%u$%s$%s"
+
 static const char salt_chars[62] =
 	"AaBbCcDdEeFfGgHhIiJjKkLlMmNnOoPpQqRrSsTtUuVvWwXxYyZz0123456789";
 
@@ -124,24 +128,14 @@ static const char *pbkdf2v2_make_salt(void)
 	return result;
 }
 
-static const char *pbkdf2v2_crypt(const char *pass, const char *crypt_str)
+/*
+ * Compute the Base 64 PBKDF2 digest of key with the given parameters
+ */
+static bool pbkdf2v2_digest(const char *key, unsigned int prf, unsigned int iter,
+                            const char *salt, char *digest_b64, size_t b64len)
 {
-	unsigned int	prf = 0, iter = 0;
-	char		salt[PBKDF2_SALTLEN + 1];
-
 	const EVP_MD*	md = NULL;
 	unsigned char	digest[EVP_MAX_MD_SIZE];
-	char		digest_b64[(EVP_MAX_MD_SIZE * 2) + 5];
-	static char	result[PASSLEN];
-
-	/*
-	 * Attempt to extract the PRF, iteration count and salt
-	 *
-	 * If this fails, we're trying to verify a hash not produced by
-	 * this module - just bail out, libathemecore can handle NULL
-	 */
-	if (sscanf(crypt_str, PBKDF2_F_SCAN, &prf, &iter, salt) < 3)
-		return NULL;
 
 	/* Look up the digest method corresponding to the PRF */
 	switch (prf) {
@@ -156,36 +150,167 @@ static const char *pbkdf2v2_crypt(const char *pass, const char *crypt_str)
 
 	default:
 		/*
-		 * Similar to above, trying to verify a password
-		 * that we cannot ever verify - bail out here
+		 * Trying to verify a password that we cannot
+		 * ever verify - bail out here
 		 */
-		return NULL;
+		return false;
 	}
 
 	/* Compute the PBKDF2 digest */
 	size_t sl = strlen(salt);
-	size_t pl = strlen(pass);
-	(void) PKCS5_PBKDF2_HMAC(pass, pl, (unsigned char *) salt, sl,
+	size_t pl = strlen(key);
+	(void) PKCS5_PBKDF2_HMAC(key, pl, (unsigned char *) salt, sl,
 	                         iter, md, EVP_MD_size(md), digest);
 
 	/* Convert the digest to Base 64 */
-	memset(digest_b64, 0x00, sizeof digest_b64);
+	memset(digest_b64, 0x00, b64len);
 	(void) base64_encode((const char *) digest, EVP_MD_size(md),
-	                     digest_b64, sizeof digest_b64);
+	                     digest_b64, b64len);
+
+	return true;
+}
+
+/*
+ * Unsalted legacy schemes whose hashes can be wrapped, see pbkdf2v2_wrap()
+ *
+ * These must produce exactly what crypto/rawmd5 and crypto/rawsha1 do
+ */
+static const struct {
+	const char	*id;
+	const EVP_MD	*(*md)(void);
+} pbkdf2v2_legacy[] = {
+	{ "rawmd5",	EVP_md5 },
+	{ "rawsha1",	EVP_sha1 },
+};
+
+static bool pbkdf2v2_legacy_hash(const char *id, const char *pass, char *out, size_t outlen)
+{
+	unsigned char	digest[EVP_MAX_MD_SIZE];
+	unsigned int	dl, i;
+	size_t		n;
+
+	for (n = 0; n < sizeof pbkdf2v2_legacy / sizeof pbkdf2v2_legacy[0]; n++)
+		if (!strcmp(pbkdf2v2_legacy[n].id, id))
+			break;
+
+	if (n == sizeof pbkdf2v2_legacy / sizeof pbkdf2v2_legacy[0])
+		return false;
+
+	if (!EVP_Digest(pass, strlen(pass), digest, &dl, pbkdf2v2_legacy[n].md(), NULL))
+		return false;
+
+	if (outlen < strlen(id) + 2 + dl * 2 + 1)
+		return false;
+
+	n = snprintf(out, outlen, "$%s$", id);
+	for (i = 0; i < dl; i++)
+		n += snprintf(out + n, outlen - n, "%02x", 255 & digest[i]);
+
+	return true;
+}
+
+static const char *pbkdf2v2_crypt_r(const char *pass, const char *crypt_str, char *result, size_t resultlen)
+{
+	unsigned int	prf = 0, iter = 0;
+	char		salt[PBKDF2_SALTLEN + 1];
+	char		legacy[PBKDF2_LEGACYLEN + 1];
+	char		inner[PASSLEN];
+	char		digest_b64[(EVP_MAX_MD_SIZE * 2) + 5];
+
+	/*
+	 * A legacy hash wrapped by pbkdf2v2_wrap() - redo the legacy
+	 * hash of the password first, and derive from that
+	 */
+	if (sscanf(crypt_str, PBKDF2_F_WRAP_SCAN, legacy, &prf, &iter, salt) == 4)
+	{
+		if (!pbkdf2v2_legacy_hash(legacy, pass, inner, sizeof inner))
+			return NULL;
+
+		if (!pbkdf2v2_digest(inner, prf, iter, salt, digest_b64, sizeof digest_b64))
+			return NULL;
+
+		memset(result, 0x00, resultlen);
+		(void) snprintf(result, resultlen, PBKDF2_F_WRAP_PRINT,
+		                legacy, prf, iter, salt, digest_b64);
+
+		return result;
+	}
+
+	/*
+	 * Attempt to extract the PRF, iteration count and salt
+	 *
+	 * If this fails, we're trying to verify a hash not produced by
+	 * this module - just bail out, libathemecore can handle NULL
+	 */
+	if (sscanf(crypt_str, PBKDF2_F_SCAN, &prf, &iter, salt) < 3)
+		return NULL;
+
+	if (!pbkdf2v2_digest(pass, prf, iter, salt, digest_b64, sizeof digest_b64))
+		return NULL;
 
 	/* Format the result */
-	memset(result, 0x00, sizeof result);
-	(void) snprintf(result, sizeof result, PBKDF2_F_PRINT,
+	memset(result, 0x00, resultlen);
+	(void) snprintf(result, resultlen, PBKDF2_F_PRINT,
 	                prf, iter, salt, digest_b64);
 
 	return result;
 }
 
+/*
+ * Wrap a rawmd5 or rawsha1 hash, so that it is checked with PBKDF2
+ * from now on without knowing the password; it is replaced with a
+ * plain PBKDF2 hash on the next successful login
+ */
+static const char *pbkdf2v2_wrap(const char *hash, const char *crypt_str, char *result, size_t resultlen)
+{
+	unsigned int	prf = 0, iter = 0;
+	char		salt[PBKDF2_SALTLEN + 1];
+	char		digest_b64[(EVP_MAX_MD_SIZE * 2) + 5];
+	const char	*id = NULL;
+	size_t		n, il;
+
+	for (n = 0; n < sizeof pbkdf2v2_legacy / sizeof pbkdf2v2_legacy[0]; n++)
+	{
+		il = strlen(pbkdf2v2_legacy[n].id);
+
+		if (hash[0] == '$' && !strncmp(hash + 1, pbkdf2v2_legacy[n].id, il) && hash[il + 1] == '$' &&
+		    strlen(hash + il + 2) == (size_t) EVP_MD_size(pbkdf2v2_legacy[n].md()) * 2 &&
+		    strspn(hash + il + 2, "0123456789abcdef") == strlen(hash + il + 2))
+			id = pbkdf2v2_legacy[n].id;
+	}
+
+	if (id == NULL)
+		return NULL;
+
+	if (sscanf(crypt_str, PBKDF2_F_SCAN, &prf, &iter, salt) < 3)
+		return NULL;
+
+	if (!pbkdf2v2_digest(hash, prf, iter, salt, digest_b64, sizeof digest_b64))
+		return NULL;
+
+	memset(result, 0x00, resultlen);
+	(void) snprintf(result, resultlen, PBKDF2_F_WRAP_PRINT,
+	                id, prf, iter, salt, digest_b64);
+
+	return result;
+}
+
+static const char *pbkdf2v2_crypt(const char *pass, const char *crypt_str)
+{
+	static char	result[PASSLEN];
+
+	return pbkdf2v2_crypt_r(pass, crypt_str, result, sizeof result);
+}
+
 static bool pbkdf2v2_needs_param_upgrade(const char *user_pass_string)
 {
 	unsigned int	prf = 0, iter = 0;
 	char		salt[PBKDF2_SALTLEN + 1];
 
+	/* Wrapped legacy hashes are always replaced */
+	if (!strncmp(user_pass_string, "$zw$", 4))
+		return 1;
+
 	if (sscanf(user_pass_string, PBKDF2_F_SCAN, &prf, &iter, salt) < 3)
 		return 0;
 
@@ -203,6 +328,8 @@ static crypt_impl_t pbkdf2_crypt_impl = {
 	.crypt = &pbkdf2v2_crypt,
 	.salt = &pbkdf2v2_make_salt,
 	.needs_param_upgrade = &pbkdf2v2_needs_param_upgrade,
+	.crypt_r = &pbkdf2v2_crypt_r,
+	.wrap = &pbkdf2v2_wrap,
 };
 
 void _modinit(module_t* m)
@@ -75,7 +75,10 @@ static void gs_cmd_fflags(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	if (ga != NULL && flags != 0)
+	{
 		ga->flags = flags;
+		chanacs_user_flags_invalidate();
+	}
 	else if (ga != NULL)
 	{
 		groupacs_delete(mg, mt);
@@ -161,7 +161,10 @@ no_founder:
 	if (ga != NULL && flags != 0)
 	{
 		if (ga->flags != flags)
+		{
 			ga->flags = flags;
+			chanacs_user_flags_invalidate();
+		}
 		else
 		{
 			command_fail(si, fault_nochange, _("Group \2%s\2 access for \2%s\2 unchanged."), entity(mg)->name, mt->name);
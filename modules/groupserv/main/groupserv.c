@@ -132,6 +132,9 @@ groupacs_t *groupacs_add(mygroup_t *mg, myentity_t *mt, unsigned int flags)
 	mowgli_node_add(ga, &ga->gnode, &mg->acs);
 	mowgli_node_add(ga, &ga->unode, myentity_get_membership_list(mt));
 
+	/* group members get the group's channel access */
+	chanacs_user_flags_invalidate();
+
 	return ga;
 }
 
@@ -188,6 +191,8 @@ void groupacs_delete(mygroup_t *mg, myentity_t *mt)
 		mowgli_node_delete(&ga->gnode, &mg->acs);
 		mowgli_node_delete(&ga->unode, myentity_get_membership_list(mt));
 		object_unref(ga);
+
+		chanacs_user_flags_invalidate();
 	}
 }
 
@@ -50,6 +50,8 @@ static void clear_httpddata(struct httpddata *hd)
 	hd->correct_content_type = false;
 	hd->expect_100_continue = false;
 	hd->sent_reply = false;
+	hd->reply_pending = false;
+	hd->cancel_reply = NULL;
 }
 
 static int open_file(const char *filename)
@@ -171,6 +173,10 @@ static void httpd_recvqhandler(connection_t *cptr)
 
 	hd = cptr->userdata;
 
+	/* leave pipelined requests alone until the reply has been sent */
+	if (hd->reply_pending)
+		return;
+
 	MOWGLI_ITER_FOREACH(n, httpd_path_handlers.head)
 	{
 		ph = (path_handler_t *)n->data;
@@ -194,7 +200,8 @@ static void httpd_recvqhandler(connection_t *cptr)
 
 			ph->handler(cptr, hd->requestbuf);
 
-			clear_httpddata(hd);
+			if (!hd->reply_pending)
+				clear_httpddata(hd);
 			return;
 		}
 	}
@@ -332,12 +339,48 @@ static void httpd_closehandler(connection_t *cptr)
 	hd = cptr->userdata;
 	if (hd != NULL)
 	{
+		if (hd->reply_pending && hd->cancel_reply != NULL)
+			hd->cancel_reply(cptr);
 		free(hd->requestbuf);
 		free(hd);
 	}
 	cptr->userdata = NULL;
 }
 
+/*
+ * httpd_reply_done()
+ *
+ * inputs:
+ *       connection whose handler set reply_pending
+ *
+ * outputs:
+ *       none
+ *
+ * side effects:
+ *       requests received meanwhile are handled
+ */
+void httpd_reply_done(connection_t *cptr)
+{
+	struct httpddata *hd = cptr->userdata;
+	int l, ll;
+
+	return_if_fail(hd != NULL && hd->reply_pending);
+
+	clear_httpddata(hd);
+
+	sendq_batch_begin(cptr);
+	l = recvq_length(cptr);
+	while (l != 0)
+	{
+		httpd_recvqhandler(cptr);
+		ll = l;
+		l = recvq_length(cptr);
+		if (ll == l)
+			break;
+	}
+	sendq_batch_end(cptr);
+}
+
 static void do_listen(connection_t *cptr)
 {
 	connection_t *newptr;
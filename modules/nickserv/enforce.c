@@ -82,6 +82,7 @@ static bool log_enforce_victim_out(user_t *u, myuser_t *mu)
 		}
 
 		u->myuser = NULL;
+		chanacs_user_flags_invalidate();
 		return false;
 	}
 
@@ -431,6 +432,7 @@ static void ns_cmd_regain(sourceinfo_t *si, int parc, char *parv[])
 					}
 				}
 				si->su->myuser = NULL;
+				chanacs_user_flags_invalidate();
 			}
 
 			myuser_login(si->service, si->su, mn->owner, true);
@@ -53,6 +53,7 @@ void _modinit(module_t *m)
 	static list_param_t frozen;
 	frozen.opttype = OPT_BOOL;
 	frozen.is_match = is_frozen;
+	frozen.mdkey = "private:freeze:freezer";
 
 	static list_param_t frozen_reason;
 	frozen_reason.opttype = OPT_STRING;
@@ -125,11 +126,12 @@ static void ns_cmd_freeze(sourceinfo_t *si, int parc, char *parv[])
 			if (!ircd_on_logout(u, entity(mu)->name))
 			{
 				u->myuser = NULL;
+				chanacs_user_flags_invalidate();
 				mowgli_node_delete(n, &mu->logins);
 				mowgli_node_free(n);
 			}
 		}
-		mu->flags |= MU_NOBURSTLOGIN;
+		myuser_set_flags(mu, MU_NOBURSTLOGIN, 0);
 		authcookie_destroy_all(mu);
 
 		wallops("%s froze the account \2%s\2 (%s).", get_oper_name(si), target, reason);
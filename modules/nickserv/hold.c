@@ -79,7 +79,7 @@ static void ns_cmd_hold(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mu->flags |= MU_HOLD;
+		myuser_set_flags(mu, MU_HOLD, 0);
 
 		wallops("%s set the HOLD option for the account \2%s\2.", get_oper_name(si), entity(mu)->name);
 		logcommand(si, CMDLOG_ADMIN, "HOLD:ON: \2%s\2", entity(mu)->name);
@@ -93,7 +93,7 @@ static void ns_cmd_hold(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mu->flags &= ~MU_HOLD;
+		myuser_set_flags(mu, 0, MU_HOLD);
 
 		wallops("%s removed the HOLD option on the account \2%s\2.", get_oper_name(si), entity(mu)->name);
 		logcommand(si, CMDLOG_ADMIN, "HOLD:OFF: \2%s\2", entity(mu)->name);
@@ -25,6 +25,17 @@ DECLARE_MODULE_V1
 );
 
 static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[]);
+static void ns_login_verified(myuser_t *mu, bool verified, void *priv);
+static void ns_login_user_delete(user_t *u);
+
+/* logins waiting for their password to be checked */
+typedef struct {
+	sourceinfo_t *si;
+	verify_request_t *req;
+	mowgli_node_t node;
+} login_pending_t;
+
+static mowgli_list_t pending_logins;
 
 #ifdef NICKSERV_LOGIN
 command_t ns_login = { "LOGIN", N_("Authenticates to a services account."), AC_NONE, 2, ns_cmd_login, { .path = "nickserv/login" } };
@@ -41,6 +52,13 @@ void _modinit(module_t *m)
 #endif
 
 	hook_add_event("user_can_login");
+	hook_add_user_delete(ns_login_user_delete);
+}
+
+static void login_pending_free(login_pending_t *lp)
+{
+	object_unref(lp->si);
+	free(lp);
 }
 
 void _moddeinit(module_unload_intent_t intent)
@@ -50,17 +68,73 @@ void _moddeinit(module_unload_intent_t intent)
 #else
 	service_named_unbind_command("nickserv", &ns_identify);
 #endif
+
+	hook_del_user_delete(ns_login_user_delete);
+
+	while (pending_logins.head != NULL)
+	{
+		login_pending_t *lp = pending_logins.head->data;
+
+		mowgli_node_delete(&lp->node, &pending_logins);
+		verify_password_cancel(lp->req);
+		login_pending_free(lp);
+	}
 }
 
-static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
+static login_pending_t *login_pending_find(user_t *u)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, pending_logins.head)
+	{
+		login_pending_t *lp = n->data;
+
+		if (lp->si->su == u)
+			return lp;
+	}
+
+	return NULL;
+}
+
+static void ns_login_user_delete(user_t *u)
+{
+	login_pending_t *lp;
+
+	if ((lp = login_pending_find(u)) != NULL)
+	{
+		mowgli_node_delete(&lp->node, &pending_logins);
+		verify_password_cancel(lp->req);
+		login_pending_free(lp);
+	}
+}
+
+static bool ns_login_check_session(sourceinfo_t *si, myuser_t *mu)
 {
 	user_t *u = si->su;
+
+	if (u->myuser == mu)
+	{
+		command_fail(si, fault_nochange, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
+		if (mu->flags & MU_WAITAUTH)
+			command_fail(si, fault_nochange, _("Please check your email for instructions to complete your registration."));
+		return false;
+	}
+	else if (u->myuser != NULL && !command_find(si->service->commands, "LOGOUT"))
+	{
+		command_fail(si, fault_alreadyexists, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
+		return false;
+	}
+
+	return true;
+}
+
+static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
+{
 	myuser_t *mu;
-	mowgli_node_t *n, *tn;
 	const char *target = parv[0];
 	const char *password = parv[1];
-	char lau[BUFSIZE];
 	hook_user_login_check_t req;
+	login_pending_t *lp;
 
 	if (si->su == NULL)
 	{
@@ -117,21 +191,51 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	if (u->myuser == mu)
+	if (!ns_login_check_session(si, mu))
+		return;
+
+	if (login_pending_find(si->su) != NULL)
 	{
-		command_fail(si, fault_nochange, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
-		if (mu->flags & MU_WAITAUTH)
-			command_fail(si, fault_nochange, _("Please check your email for instructions to complete your registration."));
+		command_fail(si, fault_toomany, _("Your previous \2%s\2 is still being processed."), COMMAND_UC);
 		return;
 	}
-	else if (u->myuser != NULL && !command_find(si->service->commands, "LOGOUT"))
+
+	/* the rest happens in ns_login_verified() once the password has
+	 * been checked.
+	 */
+	lp = smalloc(sizeof(login_pending_t));
+	lp->si = object_ref(si);
+	mowgli_node_add(lp, &lp->node, &pending_logins);
+	lp->req = verify_password_async(mu, password, ns_login_verified, lp);
+}
+
+static void ns_login_verified(myuser_t *mu, bool verified, void *priv)
+{
+	login_pending_t *lp = priv;
+	sourceinfo_t *si = lp->si;
+	user_t *u = si->su;
+	mowgli_node_t *n, *tn;
+	char lau[BUFSIZE];
+
+	/* the request is done with; logging out may even quit the user */
+	mowgli_node_delete(&lp->node, &pending_logins);
+
+	if (mu == NULL)
 	{
-		command_fail(si, fault_alreadyexists, _("You are already logged in as \2%s\2."), entity(u->myuser)->name);
+		command_fail(si, fault_nosuch_target, _("The account you tried to identify to has been dropped."));
+		login_pending_free(lp);
 		return;
 	}
 
-	if (verify_password(mu, password))
+	if (verified)
 	{
+		/* things may have changed while the password was checked */
+		if (!ns_login_check_session(si, mu))
+		{
+			login_pending_free(lp);
+			return;
+		}
+
 		if (MOWGLI_LIST_LENGTH(&mu->logins) >= me.maxlogins)
 		{
 			command_fail(si, fault_toomany, _("There are already \2%zu\2 sessions logged in to \2%s\2 (maximum allowed: %u)."), MOWGLI_LIST_LENGTH(&mu->logins), entity(mu)->name, me.maxlogins);
@@ -144,6 +248,7 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 			}
 			command_fail(si, fault_toomany, _("Logged in nicks are: %s"), lau);
 			logcommand(si, CMDLOG_LOGIN, "failed " COMMAND_UC " to \2%s\2 (too many logins)", entity(mu)->name);
+			login_pending_free(lp);
 			return;
 		}
 
@@ -153,8 +258,11 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 			command_success_nodata(si, _("You have been logged out of \2%s\2."), entity(u->myuser)->name);
 
 			if (ircd_on_logout(u, entity(u->myuser)->name))
+			{
 				/* logout killed the user... */
+				login_pending_free(lp);
 				return;
+			}
 		        u->myuser->lastlogin = CURRTIME;
 		        MOWGLI_ITER_FOREACH_SAFE(n, tn, u->myuser->logins.head)
 		        {
@@ -166,6 +274,7 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 		                }
 		        }
 		        u->myuser = NULL;
+		        chanacs_user_flags_invalidate();
 		}
 
 		command_success_nodata(si, nicksvs.no_nick_ownership ? _("You are now logged in as \2%s\2.") : _("You are now identified for \2%s\2."), entity(mu)->name);
@@ -173,6 +282,7 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 		myuser_login(si->service, u, mu, true);
 		logcommand(si, CMDLOG_LOGIN, COMMAND_UC);
 
+		login_pending_free(lp);
 		return;
 	}
 
@@ -180,6 +290,8 @@ static void ns_cmd_login(sourceinfo_t *si, int parc, char *parv[])
 
 	command_fail(si, fault_authfail, _("Invalid password for \2%s\2."), entity(mu)->name);
 	bad_password(si, mu);
+
+	login_pending_free(lp);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -36,9 +36,9 @@ static bool email_match(const mynick_t *mn, const void *arg)
 static bool lastlogin_match(const mynick_t *mn, const void *arg)
 {
 	myuser_t *mu = mn->owner;
-	const time_t lastlogin = *(time_t *)arg;
+	const list_age_t *lastlogin = arg;
 
-	return (CURRTIME - mu->lastlogin) > lastlogin;
+	return mu->lastlogin < lastlogin->cutoff;
 }
 
 static bool pattern_match(const mynick_t *mn, const void *arg)
@@ -94,9 +94,9 @@ static bool pattern_match(const mynick_t *mn, const void *arg)
 static bool registered_match(const mynick_t *mn, const void *arg)
 {
 	myuser_t *mu = mn->owner;
-	const time_t age = *(time_t *)arg;
+	const list_age_t *age = arg;
 
-	return (CURRTIME - mu->registered) > age;
+	return mu->registered < age->cutoff;
 }
 
 static bool has_waitauth(const mynick_t *mn, const void *arg) {
@@ -105,25 +105,362 @@ static bool has_waitauth(const mynick_t *mn, const void *arg) {
 	return ( mu->flags & MU_WAITAUTH ) == MU_WAITAUTH;
 }
 
+static list_param_t email, lastlogin, pattern, registered, waitauth;
+
+/*
+ * Indexes over accounts for the criteria that tend to be selective: the
+ * e-mail domain, registration and last login time, unverified accounts
+ * and boolean criteria backed by a metadata key (list_param_t.mdkey).
+ *
+ * They are built by the first LIST that can use them and not updated in
+ * place afterwards. Accounts registered since, and accounts whose e-mail
+ * address or indexed metadata has changed, are put on a dirty list that
+ * every indexed LIST checks as well, and deleted accounts are skipped.
+ * Registration times do not change and last login times only grow, so
+ * the times recorded at build time are good enough to rule accounts out.
+ * Once enough accounts are dirty or deleted, the next LIST rebuilds.
+ */
+typedef struct {
+	myuser_t *mu;		/* NULL once the account is deleted */
+	time_t registered;	/* as of the last build */
+	time_t lastlogin;
+	bool dirty;
+	mowgli_node_t node;	/* in list_dirty or list_dead */
+} list_entry_t;
+
+typedef struct {
+	list_entry_t **v;
+	size_t n, max;
+} list_vec_t;
+
+static mowgli_patricia_t *list_entries;		/* list_entry_t by account UID */
+static bool list_built;
+static size_t list_nindexed;
+static list_entry_t **list_by_registered;
+static list_entry_t **list_by_lastlogin;
+static mowgli_patricia_t *list_domains;		/* list_vec_t by e-mail domain */
+static mowgli_patricia_t *list_mdkeys;		/* list_vec_t by metadata key */
+static list_vec_t list_waitauth;
+static mowgli_list_t list_dirty;
+static mowgli_list_t list_dead;
+
+static void list_vec_add(list_vec_t *vec, list_entry_t *e)
+{
+	if (vec->n == vec->max)
+	{
+		vec->max = vec->max ? vec->max * 2 : 16;
+		vec->v = srealloc(vec->v, vec->max * sizeof(list_entry_t *));
+	}
+
+	vec->v[vec->n++] = e;
+}
+
+static void list_vec_destroy(const char *key, void *data, void *privdata)
+{
+	list_vec_t *vec = data;
+
+	free(vec->v);
+	free(vec);
+}
+
+static void list_entry_destroy(const char *key, void *data, void *privdata)
+{
+	free(data);
+}
+
+static const char *list_email_domain(const char *email)
+{
+	const char *p = strrchr(email, '@');
+
+	return p != NULL ? p + 1 : NULL;
+}
+
+static void list_entry_dirty(list_entry_t *e)
+{
+	if (e->dirty)
+		return;
+
+	e->dirty = true;
+	mowgli_node_add(e, &e->node, &list_dirty);
+}
+
+static int list_registered_cmp(const void *a, const void *b)
+{
+	const list_entry_t *ea = *(list_entry_t * const *)a;
+	const list_entry_t *eb = *(list_entry_t * const *)b;
+
+	return ea->registered < eb->registered ? -1 : ea->registered > eb->registered;
+}
+
+static int list_lastlogin_cmp(const void *a, const void *b)
+{
+	const list_entry_t *ea = *(list_entry_t * const *)a;
+	const list_entry_t *eb = *(list_entry_t * const *)b;
+
+	return ea->lastlogin < eb->lastlogin ? -1 : ea->lastlogin > eb->lastlogin;
+}
+
+static void list_index_clear(void)
+{
+	mowgli_node_t *n, *tn;
+
+	free(list_by_registered);
+	free(list_by_lastlogin);
+	list_by_registered = list_by_lastlogin = NULL;
+	list_nindexed = 0;
+
+	if (list_domains != NULL)
+		mowgli_patricia_destroy(list_domains, list_vec_destroy, NULL);
+	if (list_mdkeys != NULL)
+		mowgli_patricia_destroy(list_mdkeys, list_vec_destroy, NULL);
+	list_domains = list_mdkeys = NULL;
+
+	free(list_waitauth.v);
+	memset(&list_waitauth, 0, sizeof list_waitauth);
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_dirty.head)
+	{
+		list_entry_t *e = n->data;
+
+		e->dirty = false;
+		mowgli_node_delete(&e->node, &list_dirty);
+	}
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_dead.head)
+	{
+		mowgli_node_delete(n, &list_dead);
+		free(n->data);
+	}
+}
+
+static void list_index_build(void)
+{
+	mowgli_patricia_iteration_state_t state;
+	myentity_iteration_state_t mestate;
+	myentity_t *mt;
+	list_entry_t *e;
+	list_vec_t *vec;
+	const char *domain;
+	size_t i = 0;
+
+	list_index_clear();
+
+	if (!list_built)
+	{
+		MYENTITY_FOREACH_T(mt, &mestate, ENT_USER)
+		{
+			e = smalloc(sizeof(list_entry_t));
+			e->mu = user(mt);
+			mowgli_patricia_add(list_entries, mt->id, e);
+		}
+		list_built = true;
+	}
+
+	list_nindexed = mowgli_patricia_size(list_entries);
+	list_by_registered = smalloc((list_nindexed + 1) * sizeof(list_entry_t *));
+	list_by_lastlogin = smalloc((list_nindexed + 1) * sizeof(list_entry_t *));
+	list_domains = mowgli_patricia_create(irccasecanon);
+	list_mdkeys = mowgli_patricia_create(noopcanon);
+
+	MOWGLI_PATRICIA_FOREACH(e, &state, list_entries)
+	{
+		e->registered = e->mu->registered;
+		e->lastlogin = e->mu->lastlogin;
+		list_by_registered[i] = list_by_lastlogin[i] = e;
+		i++;
+
+		if ((domain = list_email_domain(e->mu->email)) != NULL)
+		{
+			if ((vec = mowgli_patricia_retrieve(list_domains, domain)) == NULL)
+			{
+				vec = smalloc(sizeof(list_vec_t));
+				mowgli_patricia_add(list_domains, domain, vec);
+			}
+			list_vec_add(vec, e);
+		}
+
+		if (e->mu->flags & MU_WAITAUTH)
+			list_vec_add(&list_waitauth, e);
+	}
+
+	qsort(list_by_registered, list_nindexed, sizeof(list_entry_t *), list_registered_cmp);
+	qsort(list_by_lastlogin, list_nindexed, sizeof(list_entry_t *), list_lastlogin_cmp);
+
+	slog(LG_DEBUG, "list_index_build(): indexed %zu accounts", list_nindexed);
+}
+
+static list_vec_t *list_mdkey_vec(const char *key)
+{
+	mowgli_patricia_iteration_state_t state;
+	list_entry_t *e;
+	list_vec_t *vec;
+
+	if ((vec = mowgli_patricia_retrieve(list_mdkeys, key)) != NULL)
+		return vec;
+
+	/* keys are indexed when a LIST first asks for them */
+	vec = smalloc(sizeof(list_vec_t));
+	mowgli_patricia_add(list_mdkeys, key, vec);
+
+	MOWGLI_PATRICIA_FOREACH(e, &state, list_entries)
+		if (metadata_find(e->mu, key) != NULL)
+			list_vec_add(vec, e);
+
+	return vec;
+}
+
+/* number of entries in a sorted array with a time before the cutoff */
+static size_t list_count_before(list_entry_t **v, size_t n, time_t cutoff, bool by_lastlogin)
+{
+	size_t lo = 0, hi = n, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if ((by_lastlogin ? v[mid]->lastlogin : v[mid]->registered) < cutoff)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * A LIST with its criteria looked up and their arguments parsed, going
+ * through a snapshot of nicknames a chunk at a time.
+ */
+typedef struct {
+	list_param_t *param;
+	union {
+		bool b;
+		int i;
+		list_age_t age;
+		char *s;
+	} arg;
+} list_crit_t;
+
+typedef struct {
+	sourceinfo_t *si;
+	list_crit_t crit[10];	/* as many as ns_list takes parameters */
+	unsigned int ncrit;
+	char criteriastr[BUFSIZE];
+
+	char *names;		/* NUL-separated nicknames to check */
+	size_t len, size, pos;
+	int matches;
+
+	mowgli_eventloop_timer_t *timer;
+	mowgli_node_t node;
+} list_scan_t;
+
+#define LIST_CHUNK	1000	/* nicknames checked per main loop iteration */
+
+static mowgli_list_t list_scans;
+
+static void list_scan_free(list_scan_t *scan)
+{
+	unsigned int i;
+
+	if (scan->timer != NULL)
+		mowgli_timer_destroy(base_eventloop, scan->timer);
+
+	for (i = 0; i < scan->ncrit; i++)
+		if (scan->crit[i].param->opttype == OPT_STRING)
+			free(scan->crit[i].arg.s);
+
+	mowgli_node_delete(&scan->node, &list_scans);
+	object_unref(scan->si);
+	free(scan->names);
+	free(scan);
+}
+
+static void list_user_delete(user_t *u)
+{
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_scans.head)
+	{
+		list_scan_t *scan = n->data;
+
+		if (scan->si->su == u)
+			list_scan_free(scan);
+	}
+}
+
+static void list_myuser_add(myuser_t *mu)
+{
+	list_entry_t *e;
+
+	if (!list_built)
+		return;
+
+	e = smalloc(sizeof(list_entry_t));
+	e->mu = mu;
+	mowgli_patricia_add(list_entries, entity(mu)->id, e);
+	list_entry_dirty(e);
+}
+
+static void list_myuser_delete(myuser_t *mu)
+{
+	mowgli_node_t *n, *tn;
+	list_entry_t *e;
+
+	/* LISTs by the account's users cannot log anything any more */
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_scans.head)
+	{
+		list_scan_t *scan = n->data;
+
+		if (scan->si->smu == mu)
+			list_scan_free(scan);
+	}
+
+	if (!list_built || (e = mowgli_patricia_delete(list_entries, entity(mu)->id)) == NULL)
+		return;
+
+	/* the indexes may still point to it */
+	e->mu = NULL;
+	if (e->dirty)
+		mowgli_node_delete(&e->node, &list_dirty);
+	e->dirty = false;
+	mowgli_node_add(e, &e->node, &list_dead);
+}
+
+static void list_myuser_email_change(myuser_t *mu)
+{
+	list_entry_t *e;
+
+	if (list_built && (e = mowgli_patricia_retrieve(list_entries, entity(mu)->id)) != NULL)
+		list_entry_dirty(e);
+}
+
+static void list_metadata_change(hook_metadata_change_t *hdata)
+{
+	list_entry_t *e;
+
+	if (!list_built || list_mdkeys == NULL || mowgli_patricia_retrieve(list_mdkeys, hdata->name) == NULL)
+		return;
+
+	if ((e = mowgli_patricia_retrieve(list_entries, entity(hdata->target)->id)) != NULL)
+		list_entry_dirty(e);
+}
+
 void _modinit(module_t *m)
 {
 	list_params = mowgli_patricia_create(strcasecanon);
+	list_entries = mowgli_patricia_create(noopcanon);
 	service_named_bind_command("nickserv", &ns_list);
 
 	/* list email */
-	static list_param_t email;
 	email.opttype = OPT_STRING;
 	email.is_match = email_match;
 
-	static list_param_t lastlogin;
 	lastlogin.opttype = OPT_AGE;
 	lastlogin.is_match = lastlogin_match;
 
-	static list_param_t pattern;
 	pattern.opttype = OPT_STRING;
 	pattern.is_match = pattern_match;
 
-	static list_param_t registered;
 	registered.opttype = OPT_AGE;
 	registered.is_match = registered_match;
 
@@ -134,15 +471,40 @@ void _modinit(module_t *m)
 	list_register("pattern", &pattern);
 	list_register("registered", &registered);
 
-	static list_param_t waitauth;
 	waitauth.opttype = OPT_BOOL;
 	waitauth.is_match = has_waitauth;
 
 	list_register("waitauth", &waitauth);
+
+	hook_add_event("myuser_add");
+	hook_add_myuser_add(list_myuser_add);
+	hook_add_event("myuser_delete");
+	hook_add_myuser_delete(list_myuser_delete);
+	hook_add_event("myuser_email_change");
+	hook_add_myuser_email_change(list_myuser_email_change);
+	hook_add_event("metadata_change");
+	hook_add_metadata_change(list_metadata_change);
+	hook_add_event("user_delete");
+	hook_add_user_delete(list_user_delete);
 }
 
 void _moddeinit(module_unload_intent_t intent)
 {
+	mowgli_node_t *n, *tn;
+
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_scans.head)
+		list_scan_free(n->data);
+
+	hook_del_myuser_add(list_myuser_add);
+	hook_del_myuser_delete(list_myuser_delete);
+	hook_del_myuser_email_change(list_myuser_email_change);
+	hook_del_metadata_change(list_metadata_change);
+	hook_del_user_delete(list_user_delete);
+
+	list_index_clear();
+	mowgli_patricia_destroy(list_entries, list_entry_destroy, NULL);
+	list_built = false;
+
 	service_named_unbind_command("nickserv", &ns_list);
 
 	list_unregister("email");
@@ -160,7 +522,26 @@ void list_register(const char *param_name, list_param_t *param) {
 }
 
 void list_unregister(const char *param_name) {
-	mowgli_patricia_delete(list_params, param_name);
+	mowgli_node_t *n, *tn;
+	list_param_t *param;
+	unsigned int i;
+
+	param = mowgli_patricia_delete(list_params, param_name);
+
+	/* the module providing it is going away; so are LISTs using it */
+	MOWGLI_ITER_FOREACH_SAFE(n, tn, list_scans.head)
+	{
+		list_scan_t *scan = n->data;
+
+		for (i = 0; i < scan->ncrit; i++)
+			if (scan->crit[i].param == param)
+				break;
+		if (i == scan->ncrit)
+			continue;
+
+		command_fail(scan->si, fault_nosuch_key, _("\2%s\2 is no longer a recognized LIST criterion"), param_name);
+		list_scan_free(scan);
+	}
 }
 
 
@@ -239,100 +620,338 @@ static void list_one(sourceinfo_t *si, myuser_t *mu, mynick_t *mn)
 		command_success_nodata(si, "- %s (%s) (%s) %s", mn->nick, mu->email, entity(mu)->name, buf);
 }
 
-static void ns_cmd_list(sourceinfo_t *si, int parc, char *parv[])
+/*
+ * list_compile()
+ *
+ * Looks up the criteria of a LIST and parses their arguments.
+ *
+ * Inputs:
+ *     - the LIST
+ *     - its parameters
+ *
+ * Outputs:
+ *     - false if they are not valid, having told the user why
+ *
+ * Side Effects:
+ *     - scan->crit is filled in
+ */
+static bool list_compile(list_scan_t *scan, int parc, char *parv[])
 {
-	char criteriastr[BUFSIZE];
+	list_param_t *param;
+	list_crit_t *c;
+	int i;
 
-	mowgli_patricia_iteration_state_t state;
-	myentity_iteration_state_t mestate;
-	mynick_t *mn;
+	for (i = 0; i < parc; i++)
+	{
+		param = mowgli_patricia_retrieve(list_params, parv[i]);
 
-	int matches = 0;
+		if (param == NULL) {
+			command_fail(scan->si, fault_badparams, _("\2%s\2 is not a recognized LIST criterion"), parv[i]);
+			return false;
+		}
 
-	int i;
-	bool error = false;
-	bool found;
+		if (param->opttype != OPT_BOOL && param->opttype != OPT_INT &&
+				param->opttype != OPT_STRING && param->opttype != OPT_AGE)
+			continue;
+
+		if (param->opttype != OPT_BOOL && i + 1 >= parc) {
+			command_fail(scan->si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, parv[i]);
+			return false;
+		}
 
-	MOWGLI_PATRICIA_FOREACH(mn, &state, nicklist)
+		c = &scan->crit[scan->ncrit++];
+		c->param = param;
+
+		if (param->opttype == OPT_BOOL)
+			c->arg.b = true;
+		else if (param->opttype == OPT_INT)
+			c->arg.i = atoi(parv[++i]);
+		else if (param->opttype == OPT_STRING)
+			c->arg.s = sstrdup(parv[++i]);
+		else
+		{
+			/* later chunks must not move the cutoff */
+			c->arg.age.age = parse_age(parv[++i]);
+			c->arg.age.cutoff = CURRTIME - c->arg.age.age;
+		}
+	}
+
+	return true;
+}
+
+static bool list_matches(list_scan_t *scan, const mynick_t *mn)
+{
+	list_crit_t *c;
+	unsigned int i;
+
+	for (i = 0; i < scan->ncrit; i++)
 	{
+		c = &scan->crit[i];
+
+		if (!c->param->is_match(mn, c->param->opttype == OPT_STRING ? (const void *)c->arg.s : (const void *)&c->arg))
+			return false;
+	}
+
+	return true;
+}
+
+/* the e-mail domain an e-mail mask requires, if it has no wildcards */
+static const char *list_mask_domain(const char *mask)
+{
+	const char *domain = list_email_domain(mask);
+
+	if (domain == NULL || *domain == '\0' || strpbrk(domain, "*?&#%\\") != NULL)
+		return NULL;
+
+	return domain;
+}
+
+/*
+ * list_crit_index()
+ *
+ * Finds the accounts a criterion can match according to the indexes.
+ *
+ * Inputs:
+ *     - the criterion
+ *     - whether the indexes are up to date; if not, only tells whether
+ *       they can be used for the criterion
+ *     - where to put the accounts and their number
+ *
+ * Outputs:
+ *     - false if the criterion is not indexed
+ *
+ * Side Effects:
+ *     - the index of a metadata key is built on first use
+ */
+static bool list_crit_index(list_crit_t *c, bool built, list_entry_t ***v, size_t *n)
+{
+	list_vec_t *vec = NULL;
+	const char *domain;
+
+	if (c->param == &email && (domain = list_mask_domain(c->arg.s)) != NULL)
+	{
+		if (built && (vec = mowgli_patricia_retrieve(list_domains, domain)) == NULL)
+		{
+			*v = NULL;
+			*n = 0;
+			return true;
+		}
+	}
+	else if (c->param == &registered || c->param == &lastlogin)
+	{
+		if (built)
+		{
+			*v = c->param == &registered ? list_by_registered : list_by_lastlogin;
+			*n = list_count_before(*v, list_nindexed, c->arg.age.cutoff, c->param == &lastlogin);
+		}
+		return true;
+	}
+	else if (c->param == &waitauth)
+		vec = &list_waitauth;
+	else if (c->param->opttype == OPT_BOOL && c->param->mdkey != NULL)
+	{
+		if (built)
+			vec = list_mdkey_vec(c->param->mdkey);
+	}
+	else
+		return false;
+
+	if (built)
+	{
+		*v = vec->v;
+		*n = vec->n;
+	}
+
+	return true;
+}
+
+/*
+ * list_select()
+ *
+ * Picks the indexed criterion of a LIST that leaves the fewest accounts
+ * to check.
+ *
+ * Inputs:
+ *     - the LIST
+ *     - where to put the accounts and their number
+ *
+ * Outputs:
+ *     - false if no criterion narrows the LIST down enough to beat
+ *       checking every nickname
+ *
+ * Side Effects:
+ *     - the indexes are (re)built if needed
+ */
+static bool list_select(list_scan_t *scan, list_entry_t ***vp, size_t *np)
+{
+	list_entry_t **v;
+	size_t n;
+	unsigned int i;
+	bool found = false;
+
+	for (i = 0; i < scan->ncrit; i++)
+		if (list_crit_index(&scan->crit[i], false, &v, &n))
+			break;
+	if (i == scan->ncrit)
+		return false;
+
+	if (list_by_registered == NULL ||
+			MOWGLI_LIST_LENGTH(&list_dirty) + MOWGLI_LIST_LENGTH(&list_dead) > list_nindexed / 4)
+		list_index_build();
+
+	for (i = 0; i < scan->ncrit; i++)
+	{
+		if (!list_crit_index(&scan->crit[i], true, &v, &n))
+			continue;
+
+		if (!found || n < *np)
+		{
+			*vp = v;
+			*np = n;
+		}
 		found = true;
+	}
+
+	return *np + MOWGLI_LIST_LENGTH(&list_dirty) <= list_nindexed / 2;
+}
+
+static void list_scan_add(list_scan_t *scan, const char *name)
+{
+	size_t len = strlen(name) + 1;
 
-		for (i = 0; i < parc; i++)
+	if (scan->len + len > scan->size)
+	{
+		scan->size = scan->size ? scan->size * 2 : 4096;
+		if (scan->size < scan->len + len)
+			scan->size = scan->len + len;
+		scan->names = srealloc(scan->names, scan->size);
+	}
+
+	memcpy(scan->names + scan->len, name, len);
+	scan->len += len;
+}
+
+static int list_nick_cmp(const void *a, const void *b)
+{
+	return irccasecmp((*(mynick_t * const *)a)->nick, (*(mynick_t * const *)b)->nick);
+}
+
+/* queues the nicknames of the given accounts and the dirty ones, sorted */
+static void list_scan_add_accounts(list_scan_t *scan, list_entry_t **v, size_t nv)
+{
+	mynick_t **nicks = NULL;
+	size_t n = 0, max = 0, i;
+	mowgli_node_t *dn, *n2;
+	list_entry_t *e;
+
+	dn = list_dirty.head;
+
+	for (i = 0; i < nv || dn != NULL; )
+	{
+		if (i < nv)
 		{
-			list_param_t *param = mowgli_patricia_retrieve(list_params, parv[i]);
+			e = v[i++];
 
-			if (param == NULL) {
-				command_fail(si, fault_badparams, _("\2%s\2 is not a recognized LIST criterion"), parv[i]);
-				error = true;
-				break;
-			}
+			/* dirty accounts come from list_dirty */
+			if (e->mu == NULL || e->dirty)
+				continue;
+		}
+		else
+		{
+			e = dn->data;
+			dn = dn->next;
+		}
 
-			if (param->opttype == OPT_BOOL) {
-				bool arg = true;
-
-				if (!param->is_match(mn, &arg)) {
-					found = false;
-					break;
-				}
-			} else if (param->opttype == OPT_INT) {
-				if (i + 1 < parc) {
-					int arg = atoi(parv[++i]);
-
-					if (!param->is_match (mn, &arg)) {
-						found = false;
-						break;
-					}
-				} else {
-					command_fail(si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, parv[i]);
-					error = true;
-					break;
-				}
-			} else if (param->opttype == OPT_STRING) {
-				if (i + 1 < parc) {
-					if (!param->is_match (mn, parv[++i])) {
-						found = false;
-						break;
-					}
-				} else {
-					command_fail(si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, parv[i]);
-					error = true;
-					break;
-				}
-			}
-			else if (param->opttype == OPT_AGE) {
-				if (i + 1 < parc)
-				{
-					time_t age = parse_age(parv[++i]);
-
-					if (!param->is_match (mn, &age)) {
-						found = false;
-						break;
-					}
-				} else {
-					command_fail(si, fault_needmoreparams, STR_INSUFFICIENT_PARAMS, parv[i]);
-					error = true;
-					break;
-				}
+		MOWGLI_ITER_FOREACH(n2, e->mu->nicks.head)
+		{
+			if (n == max)
+			{
+				max = max ? max * 2 : 64;
+				nicks = srealloc(nicks, max * sizeof(mynick_t *));
 			}
-		} //for (i = 0; i < parc; i++)
+			nicks[n++] = n2->data;
+		}
+	}
 
-		if (error) {
-			break;
+	if (n > 0)
+		qsort(nicks, n, sizeof(mynick_t *), list_nick_cmp);
+
+	for (i = 0; i < n; i++)
+		list_scan_add(scan, nicks[i]->nick);
+
+	free(nicks);
+}
+
+static void list_scan_run(void *arg)
+{
+	list_scan_t *scan = arg;
+	sourceinfo_t *si = scan->si;
+	mynick_t *mn;
+	const char *name;
+	unsigned int checked;
+
+	scan->timer = NULL;
+
+	for (checked = 0; scan->pos < scan->len; checked++)
+	{
+		/* let the rest of services run now and then, unless the
+		 * replies are collected when the command returns */
+		if (checked == LIST_CHUNK && si->su != NULL)
+		{
+			scan->timer = mowgli_timer_add_once(base_eventloop, "list_scan_run", list_scan_run, scan, 0);
+			return;
 		}
 
-		if (found) {
+		name = scan->names + scan->pos;
+		scan->pos += strlen(name) + 1;
+
+		if ((mn = mynick_find(name)) != NULL && list_matches(scan, mn))
+		{
 			list_one(si, NULL, mn);
-			matches++;
+			scan->matches++;
 		}
-	} //MOWGLI_PATRICIA_FOREACH(mn, &state, nicklist)
+	}
+
+	logcommand(si, CMDLOG_ADMIN, "LIST: \2%s\2 (\2%d\2 matches)", scan->criteriastr, scan->matches);
+	if (scan->matches == 0)
+		command_success_nodata(si, _("No nicknames matched criteria \2%s\2"), scan->criteriastr);
+	else
+		command_success_nodata(si, ngettext(N_("\2%d\2 match for criteria \2%s\2"), N_("\2%d\2 matches for criteria \2%s\2"), scan->matches), scan->matches, scan->criteriastr);
+
+	list_scan_free(scan);
+}
 
-	build_criteriastr(criteriastr, parc, parv);
+static void ns_cmd_list(sourceinfo_t *si, int parc, char *parv[])
+{
+	mowgli_patricia_iteration_state_t state;
+	list_scan_t *scan;
+	list_entry_t **v;
+	mynick_t *mn;
+	size_t n;
 
-	logcommand(si, CMDLOG_ADMIN, "LIST: \2%s\2 (\2%d\2 matches)", criteriastr, matches);
-	if (matches == 0)
-		command_success_nodata(si, _("No nicknames matched criteria \2%s\2"), criteriastr);
+	scan = smalloc(sizeof(list_scan_t));
+	scan->si = object_ref(si);
+	mowgli_node_add(scan, &scan->node, &list_scans);
+
+	if (!list_compile(scan, parc, parv))
+	{
+		list_scan_free(scan);
+		return;
+	}
+
+	build_criteriastr(scan->criteriastr, parc, parv);
+
+	/* check a snapshot of the nicknames that may match, a chunk at a
+	 * time, so that big databases do not stall services */
+	if (list_select(scan, &v, &n))
+		list_scan_add_accounts(scan, v, n);
 	else
-		command_success_nodata(si, ngettext(N_("\2%d\2 match for criteria \2%s\2"), N_("\2%d\2 matches for criteria \2%s\2"), matches), matches, criteriastr);
+	{
+		MOWGLI_PATRICIA_FOREACH(mn, &state, nicklist)
+			list_scan_add(scan, mn->nick);
+	}
+
+	list_scan_run(scan);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
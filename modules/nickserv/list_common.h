@@ -15,9 +15,20 @@ typedef enum {
 	OPT_AGE,
 } list_opttype_t;
 
+/* what OPT_AGE criteria are passed; the age comes first, so matchers
+ * may still read the argument as a time_t */
+typedef struct {
+	time_t age;
+	time_t cutoff;		/* CURRTIME - age when the LIST started */
+} list_age_t;
+
 typedef struct {
 	list_opttype_t opttype;
 	bool (*is_match)(const mynick_t *mn, const void *arg);
+
+	/* OPT_BOOL criteria that are true exactly when the account has
+	 * this metadata key may set it, so LIST can index them */
+	const char *mdkey;
 } list_param_t;
 
 #endif /* !NSLIST_COMMON_H */
@@ -113,6 +113,7 @@ static void ns_cmd_logout(sourceinfo_t *si, int parc, char *parv[])
 			}
 		}
 		u->myuser = NULL;
+		chanacs_user_flags_invalidate();
 	}
 }
 
@@ -65,6 +65,7 @@ void _modinit(module_t *m)
 	static list_param_t marked;
 	marked.opttype = OPT_BOOL;
 	marked.is_match = is_marked;
+	marked.mdkey = "private:mark:setter";
 
 	list_register("mark-reason", &mark);
 	list_register("marked", &marked);
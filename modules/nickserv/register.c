@@ -161,6 +161,9 @@ static void ns_cmd_register(sourceinfo_t *si, int parc, char *parv[])
 	mu = myuser_add(account, auth_module_loaded ? "*" : pass, email, config_options.defuflags | MU_NOBURSTLOGIN | (auth_module_loaded ? MU_CRYPTPASS : 0));
 	mu->registered = CURRTIME;
 	mu->lastlogin = CURRTIME;
+	if (me.auth == AUTH_EMAIL)
+		mu->flags |= MU_WAITAUTH;
+	myuser_commit(mu);
 	if (!nicksvs.no_nick_ownership)
 	{
 		mn = mynick_add(mu, entity(mu)->name);
@@ -184,7 +187,6 @@ static void ns_cmd_register(sourceinfo_t *si, int parc, char *parv[])
 	if (me.auth == AUTH_EMAIL)
 	{
 		char *key = random_string(12);
-		mu->flags |= MU_WAITAUTH;
 
 		metadata_add(mu, "private:verify:register:key", key);
 		metadata_add(mu, "private:verify:register:timestamp", number_to_string(time(NULL)));
@@ -206,6 +208,7 @@ static void ns_cmd_register(sourceinfo_t *si, int parc, char *parv[])
 	if (si->su != NULL)
 	{
 		si->su->myuser = mu;
+		chanacs_user_flags_invalidate();
 		n = mowgli_node_create();
 		mowgli_node_add(si->su, n, &mu->logins);
 
@@ -75,7 +75,7 @@ static void ns_cmd_regnolimit(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mu->flags |= MU_REGNOLIMIT;
+		myuser_set_flags(mu, MU_REGNOLIMIT, 0);
 
 		wallops("%s set the REGNOLIMIT option for the account \2%s\2.", get_oper_name(si), entity(mu)->name);
 		logcommand(si, CMDLOG_ADMIN, "REGNOLIMIT:ON: \2%s\2", entity(mu)->name);
@@ -89,7 +89,7 @@ static void ns_cmd_regnolimit(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mu->flags &= ~MU_REGNOLIMIT;
+		myuser_set_flags(mu, 0, MU_REGNOLIMIT);
 
 		wallops("%s removed the REGNOLIMIT option on the account \2%s\2.", get_oper_name(si), entity(mu)->name);
 		logcommand(si, CMDLOG_ADMIN, "REGNOLIMIT:OFF: \2%s\2", entity(mu)->name);
@@ -78,6 +78,7 @@ void _modinit(module_t *m)
 	static list_param_t restricted;
 	restricted.opttype = OPT_BOOL;
 	restricted.is_match = is_restricted;
+	restricted.mdkey = "private:restrict:setter";
 
 	static list_param_t restrict_match;
 	restrict_match.opttype = OPT_STRING;
@@ -97,11 +97,12 @@ static void ns_cmd_return(sourceinfo_t *si, int parc, char *parv[])
 		if (!ircd_on_logout(u, entity(mu)->name))
 		{
 			u->myuser = NULL;
+			chanacs_user_flags_invalidate();
 			mowgli_node_delete(n, &mu->logins);
 			mowgli_node_free(n);
 		}
 	}
-	mu->flags |= MU_NOBURSTLOGIN;
+	myuser_set_flags(mu, MU_NOBURSTLOGIN, 0);
 	authcookie_destroy_all(mu);
 
 	wallops("%s returned the account \2%s\2 to \2%s\2", get_oper_name(si), target, newmail);
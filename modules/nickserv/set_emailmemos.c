@@ -84,7 +84,7 @@ static void ns_cmd_set_emailmemos(sourceinfo_t *si, int parc, char *parv[])
 		}
 
 		logcommand(si, CMDLOG_SET, "SET:EMAILMEMOS:ON");
-		si->smu->flags |= MU_EMAILMEMOS;
+		myuser_set_flags(si->smu, MU_EMAILMEMOS, 0);
 		command_success_nodata(si, _("The \2%s\2 flag has been set for account \2%s\2."), "EMAILMEMOS", entity(si->smu)->name);
 		return;
 	}
@@ -98,7 +98,7 @@ static void ns_cmd_set_emailmemos(sourceinfo_t *si, int parc, char *parv[])
 		}
 
 		logcommand(si, CMDLOG_SET, "SET:EMAILMEMOS:OFF");
-		si->smu->flags &= ~MU_EMAILMEMOS;
+		myuser_set_flags(si->smu, 0, MU_EMAILMEMOS);
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for account \2%s\2."), "EMAILMEMOS", entity(si->smu)->name);
 		return;
 	}
@@ -75,7 +75,7 @@ static void ns_cmd_set_nevergroup(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:NEVERGROUP:ON");
 
-		si->smu->flags |= MU_NEVERGROUP;
+		myuser_set_flags(si->smu, MU_NEVERGROUP, 0);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been set for account \2%s\2."), "NEVERGROUP", entity(si->smu)->name);
 
@@ -92,7 +92,7 @@ static void ns_cmd_set_nevergroup(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:NEVERGROUP:OFF");
 
-		si->smu->flags &= ~MU_NEVERGROUP;
+		myuser_set_flags(si->smu, 0, MU_NEVERGROUP);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for account \2%s\2."), "NEVERGROUP", entity(si->smu)->name);
 
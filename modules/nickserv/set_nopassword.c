@@ -82,7 +82,7 @@ static void ns_cmd_set_nopassword(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:NOPASSWORD:ON");
 
-		si->smu->flags |= MU_NOPASSWORD;
+		myuser_set_flags(si->smu, MU_NOPASSWORD, 0);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been set for account \2%s\2."), "NOPASSWORD" ,entity(si->smu)->name);
 
@@ -98,7 +98,7 @@ static void ns_cmd_set_nopassword(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:NOPASSWORD:OFF");
 
-		si->smu->flags &= ~MU_NOPASSWORD;
+		myuser_set_flags(si->smu, 0, MU_NOPASSWORD);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for account \2%s\2."), "NOPASSWORD", entity(si->smu)->name);
 
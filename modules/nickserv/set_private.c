@@ -39,8 +39,7 @@ static void ns_cmd_set_private(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:PRIVATE:ON");
 
-		si->smu->flags |= MU_PRIVATE;
-		si->smu->flags |= MU_HIDEMAIL;
+		myuser_set_flags(si->smu, MU_PRIVATE | MU_HIDEMAIL, 0);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been set for \2%s\2."), "PRIVATE" ,entity(si->smu)->name);
 
@@ -56,7 +55,7 @@ static void ns_cmd_set_private(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:PRIVATE:OFF");
 
-		si->smu->flags &= ~MU_PRIVATE;
+		myuser_set_flags(si->smu, 0, MU_PRIVATE);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for \2%s\2."), "PRIVATE", entity(si->smu)->name);
 
@@ -39,7 +39,7 @@ static void ns_cmd_set_privmsg(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:PRIVMSG:ON");
 
-		si->smu->flags |= MU_USE_PRIVMSG;
+		myuser_set_flags(si->smu, MU_USE_PRIVMSG, 0);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been set for \2%s\2."), "PRIVMSG" ,entity(si->smu)->name);
 
@@ -55,7 +55,7 @@ static void ns_cmd_set_privmsg(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:PRIVMSG:OFF");
 
-		si->smu->flags &= ~MU_USE_PRIVMSG;
+		myuser_set_flags(si->smu, 0, MU_USE_PRIVMSG);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for \2%s\2."), "PRIVMSG", entity(si->smu)->name);
 
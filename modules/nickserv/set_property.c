@@ -41,9 +41,8 @@ static void ns_cmd_set_property(sourceinfo_t *si, int parc, char *parv[])
 	char *property = strtok(parv[0], " ");
 	char *value = strtok(NULL, "");
 	unsigned int count;
-	mowgli_patricia_iteration_state_t state;
+	metadata_iteration_state_t state;
 	metadata_t *md;
-	hook_metadata_change_t mdchange;
 
 	if (!property)
 	{
@@ -70,11 +69,6 @@ static void ns_cmd_set_property(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mdchange.target = si->smu;
-		mdchange.name = md->name;
-		mdchange.value = md->value;
-		hook_call_metadata_change(&mdchange);
-
 		metadata_delete(si->smu, property);
 		logcommand(si, CMDLOG_SET, "SET:PROPERTY: \2%s\2 (deleted)", property);
 		command_success_nodata(si, _("Metadata entry \2%s\2 has been deleted."), property);
@@ -82,7 +76,7 @@ static void ns_cmd_set_property(sourceinfo_t *si, int parc, char *parv[])
 	}
 
 	count = 0;
-	MOWGLI_PATRICIA_FOREACH(md, &state, object(si->smu)->metadata)
+	METADATA_FOREACH(md, &state, si->smu)
 	{
 		if (strncmp(md->name, "private:", 8))
 			count++;
@@ -100,14 +94,7 @@ static void ns_cmd_set_property(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	md = metadata_add(si->smu, property, value);
-	if (md != NULL)
-	{
-		mdchange.target = si->smu;
-		mdchange.name = md->name;
-		mdchange.value = md->value;
-		hook_call_metadata_change(&mdchange);
-	}
+	metadata_add(si->smu, property, value);
 	logcommand(si, CMDLOG_SET, "SET:PROPERTY: \2%s\2 to \2%s\2", property, value);
 	command_success_nodata(si, _("Metadata entry \2%s\2 added."), property);
 }
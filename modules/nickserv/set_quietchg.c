@@ -75,7 +75,7 @@ static void ns_cmd_set_quietchg(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:QUIETCHG:ON");
 
-		si->smu->flags |= MU_QUIETCHG;
+		myuser_set_flags(si->smu, MU_QUIETCHG, 0);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been set for account \2%s\2."), "QUIETCHG" ,entity(si->smu)->name);
 
@@ -91,7 +91,7 @@ static void ns_cmd_set_quietchg(sourceinfo_t *si, int parc, char *parv[])
 
 		logcommand(si, CMDLOG_SET, "SET:QUIETCHG:OFF");
 
-		si->smu->flags &= ~MU_QUIETCHG;
+		myuser_set_flags(si->smu, 0, MU_QUIETCHG);
 
 		command_success_nodata(si, _("The \2%s\2 flag has been removed for account \2%s\2."), "QUIETCHG", entity(si->smu)->name);
 
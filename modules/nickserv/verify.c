@@ -75,7 +75,8 @@ static void ns_cmd_verify(sourceinfo_t *si, int parc, char *parv[])
 
 		if (!strcasecmp(key, md->value))
 		{
-			mu->flags &= ~MU_WAITAUTH;
+			myuser_set_flags(mu, 0, MU_WAITAUTH);
+			chanacs_user_flags_invalidate();
 
 			logcommand(si, CMDLOG_SET, "VERIFY:REGISTER: \2%s\2 (email: \2%s\2)", get_source_name(si), mu->email);
 
@@ -183,7 +184,8 @@ static void ns_cmd_fverify(sourceinfo_t *si, int parc, char *parv[])
 			return;
 		}
 
-		mu->flags &= ~MU_WAITAUTH;
+		myuser_set_flags(mu, 0, MU_WAITAUTH);
+		chanacs_user_flags_invalidate();
 
 		logcommand(si, CMDLOG_REGISTER, "FVERIFY:REGISTER: \2%s\2 (email: \2%s\2)", entity(mu)->name, mu->email);
 
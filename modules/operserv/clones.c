@@ -30,6 +30,7 @@ static void os_cmd_clones_delexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_setexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_listexempt(sourceinfo_t *si, int parc, char *parv[]);
 static void os_cmd_clones_duration(sourceinfo_t *si, int parc, char *parv[]);
+static void clones_list_done(scan_t *scan, void *priv);
 
 static void write_exemptdb(database_handle_t *db);
 
@@ -83,7 +84,7 @@ static inline bool cexempt_expired(cexcept_t *c)
 command_t os_clones = { "CLONES", N_("Manages network wide clones."), PRIV_AKILL, 5, os_cmd_clones, { .path = "oservice/clones" } };
 
 command_t os_clones_kline = { "KLINE", N_("Enables/disables klines for excessive clones."), AC_NONE, 1, os_cmd_clones_kline, { .path = "" } };
-command_t os_clones_list = { "LIST", N_("Lists clones on the network."), AC_NONE, 0, os_cmd_clones_list, { .path = "" } };
+command_t os_clones_list = { "LIST", N_("Lists clones on the network."), AC_NONE, 2, os_cmd_clones_list, { .path = "" } };
 command_t os_clones_addexempt = { "ADDEXEMPT", N_("Adds a clones exemption."), AC_NONE, 3, os_cmd_clones_addexempt, { .path = "" } };
 command_t os_clones_delexempt = { "DELEXEMPT", N_("Deletes a clones exemption."), AC_NONE, 1, os_cmd_clones_delexempt, { .path = "" } };
 command_t os_clones_setexempt = { "SETEXEMPT", N_("Sets a clone exemption details."), AC_NONE, 1, os_cmd_clones_setexempt, { .path = "" } };
@@ -168,6 +169,8 @@ void _moddeinit(module_unload_intent_t intent)
 {
 	mowgli_node_t *n, *tn;
 
+	scan_forget(clones_list_done);
+
 	mowgli_patricia_destroy(hostlist, free_hostentry, NULL);
 	mowgli_heap_destroy(hostentry_heap);
 
@@ -408,27 +411,88 @@ static void os_cmd_clones_kline(sourceinfo_t *si, int parc, char *parv[])
 	}
 }
 
-static void os_cmd_clones_list(sourceinfo_t *si, int parc, char *parv[])
+typedef struct {
+	unsigned int min;
+	char *mask;
+} clones_list_t;
+
+static bool clones_list_pred(const scan_row_t *row, void *priv)
 {
-	hostentry_t *he;
-	int k = 0;
-	mowgli_patricia_iteration_state_t state;
+	clones_list_t *cl = priv;
 
-	MOWGLI_PATRICIA_FOREACH(he, &state, hostlist)
-	{
-		k = MOWGLI_LIST_LENGTH(&he->clients);
+	if (row->count < cl->min)
+		return false;
+
+	return cl->mask == NULL || !match_ips(cl->mask, row->name) || !match(cl->mask, row->name);
+}
 
-		if (k > 3)
+static void clones_list_done(scan_t *scan, void *priv)
+{
+	clones_list_t *cl = priv;
+	sourceinfo_t *si = scan->si;
+	unsigned int i;
+
+	if (si != NULL && !scan->cancelled)
+	{
+		for (i = 0; i < scan->nmatches; i++)
 		{
-			cexcept_t *c = find_exempt(he->ip);
+			scan_row_t *row = scan->matches[i];
+			cexcept_t *c = find_exempt(row->name);
+
 			if (c)
-				command_success_nodata(si, _("%d from %s (\2EXEMPT\2; allowed %d)"), k, he->ip, c->allowed);
+				command_success_nodata(si, _("%u from %s (\2EXEMPT\2; allowed %d)"), row->count, row->name, c->allowed);
 			else
-				command_success_nodata(si, _("%d from %s"), k, he->ip);
+				command_success_nodata(si, _("%u from %s"), row->count, row->name);
 		}
+		command_success_nodata(si, _("End of CLONES LIST"));
+		logcommand(si, CMDLOG_ADMIN, "CLONES:LIST: \2%u\2 \2%s\2 (\2%u\2 matches)", cl->min, cl->mask ? cl->mask : "*", scan->nmatches);
 	}
-	command_success_nodata(si, _("End of CLONES LIST"));
-	logcommand(si, CMDLOG_ADMIN, "CLONES:LIST");
+
+	free(cl->mask);
+	free(cl);
+}
+
+static void os_cmd_clones_list(sourceinfo_t *si, int parc, char *parv[])
+{
+	hostentry_t *he;
+	mowgli_patricia_iteration_state_t state;
+	clones_list_t *cl;
+	scan_t *scan;
+	char *minstr = parv[0];
+	char *mask = parv[1];
+	unsigned int min = 4;
+
+	/* CLONES LIST <ip mask> */
+	if (minstr != NULL && strspn(minstr, "0123456789") != strlen(minstr))
+	{
+		mask = minstr;
+		minstr = NULL;
+	}
+
+	if (minstr != NULL && (min = atoi(minstr)) < 2)
+	{
+		command_fail(si, fault_badparams, STR_INVALID_PARAMS, "CLONES LIST");
+		command_fail(si, fault_badparams, _("Syntax: CLONES LIST [min clients] [ip mask]"));
+		return;
+	}
+
+	cl = smalloc(sizeof(clones_list_t));
+	cl->min = min;
+	cl->mask = mask != NULL ? sstrdup(mask) : NULL;
+
+	/* the hosts are shown by clones_list_done() */
+	if ((scan = scan_create(si, clones_list_pred, clones_list_done, cl)) == NULL)
+	{
+		command_fail(si, fault_toomany, _("Cannot scan the network right now."));
+		free(cl->mask);
+		free(cl);
+		return;
+	}
+
+	MOWGLI_PATRICIA_FOREACH(he, &state, hostlist)
+		scan_add(scan, he->ip, MOWGLI_LIST_LENGTH(&he->clients));
+
+	scan_start(scan);
 }
 
 static void os_cmd_clones_addexempt(sourceinfo_t *si, int parc, char *parv[])
@@ -16,6 +16,7 @@ DECLARE_MODULE_V1
 );
 
 static void os_cmd_compare(sourceinfo_t *si, int parc, char *parv[]);
+static void compare_done(scan_t *scan, void *priv);
 
 command_t os_compare = { "COMPARE", N_("Compares two users or channels."), PRIV_CHAN_AUSPEX, 2, os_cmd_compare, { .path = "oservice/compare" } };
 
@@ -27,6 +28,68 @@ void _modinit(module_t *m)
 void _moddeinit(module_unload_intent_t intent)
 {
 	service_named_unbind_command("operserv", &os_compare);
+	scan_forget(compare_done);
+}
+
+typedef struct {
+	char *object1;
+	char *object2;
+	char *other;	/* the channel the scanned members must also be in */
+} compare_t;
+
+static bool compare_pred(const scan_row_t *row, void *priv)
+{
+	compare_t *cmp = priv;
+	const char **ch;
+
+	for (ch = row->channels; *ch != NULL; ch++)
+		if (!irccasecmp(*ch, cmp->other))
+			return true;
+
+	return false;
+}
+
+static void compare_done(scan_t *scan, void *priv)
+{
+	compare_t *cmp = priv;
+	sourceinfo_t *si = scan->si;
+	unsigned int i;
+	int temp = 0;
+	char buf[512];
+	char tmpbuf[100];
+
+	memset(buf, '\0', 512);
+
+	if (si != NULL && !scan->cancelled)
+	{
+		for (i = 0; i < scan->nmatches; i++)
+		{
+			/* common user! */
+			snprintf(tmpbuf, 99, "%s, ", scan->matches[i]->name);
+			strcat((char *)buf, tmpbuf);
+
+			/* if too many, output to user */
+			if (temp >= 5 || strlen(buf) > 300)
+			{
+				command_success_nodata(si, "%s", buf);
+				memset(buf, '\0', 512);
+				temp = 0;
+			}
+
+			temp++;
+		}
+
+		if (buf[0] != 0)
+			command_success_nodata(si, "%s", buf);
+
+		command_success_nodata(si, _("\2%u\2 matches comparing %s and %s"), scan->nmatches, cmp->object1, cmp->object2);
+		logcommand(si, CMDLOG_ADMIN, "COMPARE: \2%s\2 to \2%s\2 (\2%u\2 matches)", cmp->object1, cmp->object2, scan->nmatches);
+	}
+
+	free(cmp->object1);
+	free(cmp->object2);
+	free(cmp->other);
+	free(cmp);
 }
 
 static void os_cmd_compare(sourceinfo_t *si, int parc, char *parv[])
@@ -37,6 +100,8 @@ static void os_cmd_compare(sourceinfo_t *si, int parc, char *parv[])
 	user_t *u1, *u2;
 	mowgli_node_t *n1, *n2;
 	chanuser_t *cu1, *cu2;
+	compare_t *cmp;
+	scan_t *scan;
 	int matches = 0;
 
 	int temp = 0;
@@ -69,37 +134,40 @@ static void os_cmd_compare(sourceinfo_t *si, int parc, char *parv[])
 
 			command_success_nodata(si, _("Common users in \2%s\2 and \2%s\2"), object1, object2);
 
-			/* iterate over the users in channel 1 */
-			MOWGLI_ITER_FOREACH(n1, c1->members.head)
+			/* look for the other channel among the channels of each
+			 * member of the smaller one; the results are shown by
+			 * compare_done().
+			 */
+			if (c2->nummembers < c1->nummembers)
 			{
-				cu1 = n1->data;
-
-				/* now iterate over each of channel 2's members, and compare them to the current user from ch1 */
-				MOWGLI_ITER_FOREACH(n2, c2->members.head)
-				{
-					cu2 = n2->data;
+				channel_t *tc = c1;
+				c1 = c2;
+				c2 = tc;
+			}
 
-					/* match! */
-					if (cu1->user == cu2->user)
-					{
-						/* common user! */
-						snprintf(tmpbuf, 99, "%s, ", cu1->user->nick);
-						strcat((char *)buf, tmpbuf);
-						memset(tmpbuf, '\0', 100);
+			cmp = smalloc(sizeof(compare_t));
+			cmp->object1 = sstrdup(object1);
+			cmp->object2 = sstrdup(object2);
+			cmp->other = sstrdup(c2->name);
 
-						/* if too many, output to user */
-						if (temp >= 5 || strlen(buf) > 300)
-						{
-							command_success_nodata(si, "%s", buf);
-							memset(buf, '\0', 512);
-							temp = 0;
-						}
+			if ((scan = scan_create(si, compare_pred, compare_done, cmp)) == NULL)
+			{
+				command_fail(si, fault_toomany, _("Cannot scan the network right now."));
+				free(cmp->object1);
+				free(cmp->object2);
+				free(cmp->other);
+				free(cmp);
+				return;
+			}
 
-						temp++;
-						matches++;
-					}
-				}
+			MOWGLI_ITER_FOREACH(n1, c1->members.head)
+			{
+				cu1 = n1->data;
+				scan_add_user(scan, cu1->user, SCAN_USER_CHANNELS);
 			}
+
+			scan_start(scan);
+			return;
 		}
 		else
 		{
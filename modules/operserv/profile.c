@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Shows the hook handlers and commands services spend the most time in.
+ */
+
+#include "atheme.h"
+
+DECLARE_MODULE_V1
+(
+	"operserv/profile", false, _modinit, _moddeinit,
+	PACKAGE_STRING,
+	VENDOR_STRING
+);
+
+#define PROFILE_MAX_SHOWN	100
+
+static void os_cmd_profile(sourceinfo_t *si, int parc, char *parv[]);
+
+command_t os_profile = { "PROFILE", N_("Shows where services spend their time."), PRIV_SERVER_AUSPEX, 2, os_cmd_profile, { .path = "oservice/profile" } };
+
+void _modinit(module_t *m)
+{
+	service_named_bind_command("operserv", &os_profile);
+}
+
+void _moddeinit(module_unload_intent_t intent)
+{
+	service_named_unbind_command("operserv", &os_profile);
+}
+
+static void os_cmd_profile(sourceinfo_t *si, int parc, char *parv[])
+{
+	profile_entry_t top[PROFILE_MAX_SHOWN];
+	unsigned int kinds = PROFILE_HOOK | PROFILE_COMMAND;
+	bool by_module = false;
+	const char *what = "ALL";
+	char *countstr = NULL;
+	unsigned int count = 10, n, i;
+
+	if (parc >= 1 && !strcasecmp(parv[0], "RESET"))
+	{
+		profile_reset();
+		logcommand(si, CMDLOG_ADMIN, "PROFILE:RESET");
+		command_success_nodata(si, _("Profiling statistics have been reset."));
+		return;
+	}
+
+	if (parc >= 1 && isdigit((unsigned char)*parv[0]))
+		countstr = parv[0];
+	else if (parc >= 1)
+	{
+		what = parv[0];
+		countstr = parv[1];
+
+		if (!strcasecmp(what, "HOOKS"))
+			kinds = PROFILE_HOOK;
+		else if (!strcasecmp(what, "COMMANDS"))
+			kinds = PROFILE_COMMAND;
+		else if (!strcasecmp(what, "MODULES"))
+			by_module = true;
+		else
+		{
+			command_fail(si, fault_badparams, STR_INVALID_PARAMS, "PROFILE");
+			command_fail(si, fault_badparams, _("Syntax: PROFILE [HOOKS|COMMANDS|MODULES] [count]"));
+			return;
+		}
+	}
+
+	if (countstr != NULL)
+	{
+		count = atoi(countstr);
+		if (count < 1 || count > PROFILE_MAX_SHOWN)
+		{
+			command_fail(si, fault_badparams, _("The count must be between 1 and %u."), PROFILE_MAX_SHOWN);
+			return;
+		}
+	}
+
+	logcommand(si, CMDLOG_GET, "PROFILE: \2%s\2", what);
+
+	if (config_options.profile_sample == 0)
+		command_success_nodata(si, _("Profiling is disabled (general::profile_sample)."));
+	else
+		command_success_nodata(si, _("Timing one in %u hook handler and command calls."), config_options.profile_sample);
+
+	n = profile_top(kinds, by_module, top, count);
+
+	for (i = 0; i < n; i++)
+	{
+		profile_entry_t *p = &top[i];
+
+		if (by_module)
+			command_success_nodata(si, _("%2u: \2%s\2: %llu calls, %.3fs total, %llu us avg, %u us p99, %llu us max"),
+					i + 1, p->module, p->calls, profile_estimate_ns(p) / 1e9,
+					p->timed ? p->total_ns / p->timed / 1000 : 0,
+					profile_percentile_us(p, 99), p->max_ns / 1000);
+		else
+			command_success_nodata(si, _("%2u: %s \2%s\2 (%s): %llu calls, %.3fs total, %llu us avg, %u us p99, %llu us max"),
+					i + 1, p->kind == PROFILE_HOOK ? "hook" : "command",
+					p->name, p->module, p->calls, profile_estimate_ns(p) / 1e9,
+					p->timed ? p->total_ns / p->timed / 1000 : 0,
+					profile_percentile_us(p, 99), p->max_ns / 1000);
+	}
+
+	command_success_nodata(si, _("End of profile, %u shown."), n);
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
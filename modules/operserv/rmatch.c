@@ -21,6 +21,7 @@ DECLARE_MODULE_V1
 );
 
 static void os_cmd_rmatch(sourceinfo_t *si, int parc, char *parv[]);
+static void rmatch_done(scan_t *scan, void *priv);
 
 command_t os_rmatch = { "RMATCH", N_("Scans the network for users based on a specific regex pattern."), PRIV_USER_AUSPEX, 1, os_cmd_rmatch, { .path = "oservice/rmatch" } };
 
@@ -32,20 +33,59 @@ void _modinit(module_t *m)
 void _moddeinit(module_unload_intent_t intent)
 {
 	service_named_unbind_command("operserv", &os_rmatch);
+	scan_forget(rmatch_done);
 }
 
 #define MAXMATCHES_DEF 1000
 
+typedef struct {
+	atheme_regex_t *regex;
+	char *pattern;
+	unsigned int maxmatches;
+} rmatch_t;
+
+static bool rmatch_pred(const scan_row_t *row, void *priv)
+{
+	rmatch_t *rm = priv;
+
+	return regex_match(rm->regex, (char *)row->mask);
+}
+
+static void rmatch_done(scan_t *scan, void *priv)
+{
+	rmatch_t *rm = priv;
+	sourceinfo_t *si = scan->si;
+	unsigned int i;
+
+	if (si != NULL && !scan->cancelled)
+	{
+		for (i = 0; i < scan->nmatches && i < rm->maxmatches; i++)
+			command_success_nodata(si, _("\2Match:\2  %s"), scan->matches[i]->mask);
+
+		if (scan->nmatches > rm->maxmatches)
+		{
+			command_success_nodata(si, _("Too many matches, not displaying any more"));
+			command_success_nodata(si, _("Add the FORCE keyword to see them all"));
+		}
+
+		command_success_nodata(si, _("\2%u\2 matches for %s"), scan->nmatches, rm->pattern);
+		logcommand(si, CMDLOG_ADMIN, "RMATCH: \2%s\2 (\2%u\2 matches)", rm->pattern, scan->nmatches);
+	}
+
+	regex_destroy(rm->regex);
+	free(rm->pattern);
+	free(rm);
+}
+
 static void os_cmd_rmatch(sourceinfo_t *si, int parc, char *parv[])
 {
 	atheme_regex_t *regex;
-	char usermask[512];
-	unsigned int matches = 0, maxmatches;
-	mowgli_patricia_iteration_state_t state;
-	user_t *u;
+	unsigned int maxmatches;
 	char *args = parv[0];
 	char *pattern;
 	int flags = 0;
+	rmatch_t *rm;
+	scan_t *scan;
 
 	if (args == NULL)
 	{
@@ -84,26 +124,23 @@ static void os_cmd_rmatch(sourceinfo_t *si, int parc, char *parv[])
 		return;
 	}
 
-	MOWGLI_PATRICIA_FOREACH(u, &state, userlist)
-	{
-		sprintf(usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
+	rm = smalloc(sizeof(rmatch_t));
+	rm->regex = regex;
+	rm->pattern = sstrdup(pattern);
+	rm->maxmatches = maxmatches;
 
-		if (regex_match(regex, usermask))
-		{
-			matches++;
-			if (matches <= maxmatches)
-				command_success_nodata(si, _("\2Match:\2  %s!%s@%s %s"), u->nick, u->user, u->host, u->gecos);
-			else if (matches == maxmatches + 1)
-			{
-				command_success_nodata(si, _("Too many matches, not displaying any more"));
-				command_success_nodata(si, _("Add the FORCE keyword to see them all"));
-			}
-		}
+	/* the results are shown by rmatch_done() */
+	if ((scan = scan_create(si, rmatch_pred, rmatch_done, rm)) == NULL)
+	{
+		command_fail(si, fault_toomany, _("Cannot scan the network right now."));
+		regex_destroy(regex);
+		free(rm->pattern);
+		free(rm);
+		return;
 	}
 
-	regex_destroy(regex);
-	command_success_nodata(si, _("\2%d\2 matches for %s"), matches, pattern);
-	logcommand(si, CMDLOG_ADMIN, "RMATCH: \2%s\2 (\2%d\2 matches)", pattern, matches);
+	scan_add_users(scan, 0);
+	scan_start(scan);
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -32,6 +32,7 @@ static void db_h_rr(database_handle_t *db, const char *type);
 mowgli_patricia_t *os_rwatch_cmds;
 
 mowgli_list_t rwatch_list;
+static atheme_regex_set_t *rwatch_set;
 
 #define RWACT_SNOOP 		1
 #define RWACT_KLINE 		2
@@ -45,6 +46,7 @@ struct rwatch_
 	char *reason;
 	int actions; /* RWACT_* */
 	atheme_regex_t *re;
+	regex_set_entry_t *rse;
 };
 
 command_t os_rwatch = { "RWATCH", N_("Performs actions on connecting clients matching regexes."), PRIV_USER_AUSPEX, 2, os_cmd_rwatch, { .path = "oservice/rwatch" } };
@@ -57,8 +59,29 @@ command_t os_rwatch_set = { "SET", N_("Changes actions on an entry in the regex
 rwatch_t *rwread = NULL;
 FILE *f;
 
+/* adds an entry to the list and its regex to the set */
+static void rwatch_link(rwatch_t *rw)
+{
+	rw->rse = rw->re != NULL ? regex_set_add(rwatch_set, rw->regex, rw->reflags, rw->re, rw) : NULL;
+	mowgli_node_add(rw, mowgli_node_create(), &rwatch_list);
+}
+
+static void rwatch_free(rwatch_t *rw)
+{
+	if (rw->rse != NULL)
+		regex_set_delete(rwatch_set, rw->rse);
+
+	free(rw->regex);
+	free(rw->reason);
+	if (rw->re != NULL)
+		regex_destroy(rw->re);
+	free(rw);
+}
+
 void _modinit(module_t *m)
 {
+	rwatch_set = regex_set_create();
+
 	service_named_bind_command("operserv", &os_rwatch);
 
 	os_rwatch_cmds = mowgli_patricia_create(strcasecanon);
@@ -96,18 +119,14 @@ void _moddeinit(module_unload_intent_t intent)
 
 	MOWGLI_ITER_FOREACH_SAFE(n, tn, rwatch_list.head)
 	{
-		rwatch_t *rw = n->data;
-
-		free(rw->regex);
-		free(rw->reason);
-		if (rw->re != NULL)
-			regex_destroy(rw->re);
-		free(rw);
+		rwatch_free(n->data);
 
 		mowgli_node_delete(n, &rwatch_list);
 		mowgli_node_free(n);
 	}
 
+	regex_set_destroy(rwatch_set);
+
 	service_named_unbind_command("operserv", &os_rwatch);
 
 	command_delete(&os_rwatch_add, os_rwatch_cmds);
@@ -188,7 +207,7 @@ static void load_rwatchdb(char *path)
 			{
 				rw->actions = atoi(actionstr);
 				rw->reason = sstrdup(reason);
-				mowgli_node_add(rw, mowgli_node_create(), &rwatch_list);
+				rwatch_link(rw);
 				rw = NULL;
 			}
 		}
@@ -207,13 +226,7 @@ static void load_rwatchdb(char *path)
 	}
 
 	if (rw != NULL)
-	{
-		free(rw->regex);
-		free(rw->reason);
-		if (rw->re != NULL)
-			regex_destroy(rw->re);
-		free(rw);
-	}
+		rwatch_free(rw);
 }
 
 static void db_h_rw(database_handle_t *db, const char *type)
@@ -234,7 +247,7 @@ static void db_h_rr(database_handle_t *db, const char *type)
 
 	rwread->actions = actions;
 	rwread->reason = sstrdup(reason);
-	mowgli_node_add(rwread, mowgli_node_create(), &rwatch_list);
+	rwatch_link(rwread);
 	rwread = NULL;
 }
 
@@ -322,7 +335,7 @@ static void os_cmd_rwatch_add(sourceinfo_t *si, int parc, char *parv[])
 	rw->actions = RWACT_SNOOP | ((flags & AREGEX_KLINE) == AREGEX_KLINE ? RWACT_KLINE : 0);
 	rw->re = regex;
 
-	mowgli_node_add(rw, mowgli_node_create(), &rwatch_list);
+	rwatch_link(rw);
 	command_success_nodata(si, _("Added \2%s\2 to regex watch list."), pattern);
 	logcommand(si, CMDLOG_ADMIN, "RWATCH:ADD: \2%s\2 (reason: \2%s\2)", pattern, reason);
 }
@@ -373,11 +386,7 @@ static void os_cmd_rwatch_del(sourceinfo_t *si, int parc, char *parv[])
 				}
 				wallops("\2%s\2 disabled quarantine on regex watch pattern \2%s\2", get_oper_name(si), pattern);
 			}
-			free(rw->regex);
-			free(rw->reason);
-			if (rw->re != NULL)
-				regex_destroy(rw->re);
-			free(rw);
+			rwatch_free(rw);
 			mowgli_node_delete(n, &rwatch_list);
 			mowgli_node_free(n);
 			command_success_nodata(si, _("Removed \2%s\2 from regex watch list."), pattern);
@@ -517,7 +526,8 @@ static void rwatch_newuser(hook_user_nick_t *data)
 {
 	user_t *u = data->u;
 	char usermask[NICKLEN+USERLEN+HOSTLEN+GECOSLEN];
-	mowgli_node_t *n;
+	void **matches;
+	unsigned int i, count;
 	rwatch_t *rw;
 
 	/* If the user has been killed, don't do anything. */
@@ -529,49 +539,46 @@ static void rwatch_newuser(hook_user_nick_t *data)
 
 	snprintf(usermask, sizeof usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
 
-	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
+	matches = regex_set_match(rwatch_set, usermask, &count);
+
+	for (i = 0; i < count; i++)
 	{
-		rw = n->data;
-		if (!rw->re)
-			continue;
-		if (regex_match(rw->re, usermask))
+		rw = matches[i];
+		if (rw->actions & RWACT_SNOOP)
 		{
-			if (rw->actions & RWACT_SNOOP)
-			{
-				slog(LG_INFO, "RWATCH:%s \2%s\2 matches \2%s\2 (reason: \2%s\2)",
-						rw->actions & RWACT_KLINE ? "KLINE:" : "",
-						usermask, rw->regex, rw->reason);
-			}
-			if (rw->actions & RWACT_KLINE)
+			slog(LG_INFO, "RWATCH:%s \2%s\2 matches \2%s\2 (reason: \2%s\2)",
+					rw->actions & RWACT_KLINE ? "KLINE:" : "",
+					usermask, rw->regex, rw->reason);
+		}
+		if (rw->actions & RWACT_KLINE)
+		{
+			if (is_autokline_exempt(u))
+				slog(LG_INFO, "rwatch_newuser(): not klining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+			else
 			{
-				if (is_autokline_exempt(u))
-					slog(LG_INFO, "rwatch_newuser(): not klining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-				else
-				{
-					slog(LG_VERBOSE, "rwatch_newuser(): klining *@%s (user %s!%s@%s matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-					if (! (u->flags & UF_KLINESENT)) {
-						kline_sts("*", "*", u->host, 86400, rw->reason);
-						u->flags |= UF_KLINESENT;
-					}
+				slog(LG_VERBOSE, "rwatch_newuser(): klining *@%s (user %s!%s@%s matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+				if (! (u->flags & UF_KLINESENT)) {
+					kline_sts("*", "*", u->host, 86400, rw->reason);
+					u->flags |= UF_KLINESENT;
 				}
 			}
-			else if (rw->actions & RWACT_QUARANTINE)
+		}
+		else if (rw->actions & RWACT_QUARANTINE)
+		{
+			if (is_autokline_exempt(u))
+				slog(LG_INFO, "rwatch_newuser(): not qurantining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+			else
 			{
-				if (is_autokline_exempt(u))
-					slog(LG_INFO, "rwatch_newuser(): not qurantining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-				else
-				{
-					slog(LG_VERBOSE, "rwatch_newuser(): quaranting *@%s (user %s!%s@%s matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-					quarantine_sts(service_find("operserv")->me, u, 86400, rw->reason);
-				}
+				slog(LG_VERBOSE, "rwatch_newuser(): quaranting *@%s (user %s!%s@%s matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+				quarantine_sts(service_find("operserv")->me, u, 86400, rw->reason);
 			}
 		}
 	}
@@ -582,7 +589,8 @@ static void rwatch_nickchange(hook_user_nick_t *data)
 	user_t *u = data->u;
 	char usermask[NICKLEN+USERLEN+HOSTLEN+GECOSLEN];
 	char oldusermask[NICKLEN+USERLEN+HOSTLEN+GECOSLEN];
-	mowgli_node_t *n;
+	void **matches;
+	unsigned int i, count;
 	rwatch_t *rw;
 
 	/* If the user has been killed, don't do anything. */
@@ -595,52 +603,50 @@ static void rwatch_nickchange(hook_user_nick_t *data)
 	snprintf(usermask, sizeof usermask, "%s!%s@%s %s", u->nick, u->user, u->host, u->gecos);
 	snprintf(oldusermask, sizeof oldusermask, "%s!%s@%s %s", data->oldnick, u->user, u->host, u->gecos);
 
-	MOWGLI_ITER_FOREACH(n, rwatch_list.head)
+	matches = regex_set_match(rwatch_set, usermask, &count);
+
+	for (i = 0; i < count; i++)
 	{
-		rw = n->data;
-		if (!rw->re)
+		rw = matches[i];
+
+		/* Only process if they did not match before. */
+		if (regex_match(rw->re, oldusermask))
 			continue;
-		if (regex_match(rw->re, usermask))
+		if (rw->actions & RWACT_SNOOP)
 		{
-			/* Only process if they did not match before. */
-			if (regex_match(rw->re, oldusermask))
-				continue;
-			if (rw->actions & RWACT_SNOOP)
-			{
-				slog(LG_INFO, "RWATCH:NICKCHANGE:%s \2%s\2 -> \2%s\2 matches \2%s\2 (reason: \2%s\2)",
-						rw->actions & RWACT_KLINE ? "KLINE:" : "",
-						data->oldnick, usermask, rw->regex, rw->reason);
-			}
-			if (rw->actions & RWACT_KLINE)
+			slog(LG_INFO, "RWATCH:NICKCHANGE:%s \2%s\2 -> \2%s\2 matches \2%s\2 (reason: \2%s\2)",
+					rw->actions & RWACT_KLINE ? "KLINE:" : "",
+					data->oldnick, usermask, rw->regex, rw->reason);
+		}
+		if (rw->actions & RWACT_KLINE)
+		{
+			if (is_autokline_exempt(u))
+				slog(LG_INFO, "rwatch_nickchange(): not klining *@%s (user %s -> %s!%s@%s is autokline exempt but matches %s %s)",
+						u->host, data->oldnick, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+			else
 			{
-				if (is_autokline_exempt(u))
-					slog(LG_INFO, "rwatch_nickchange(): not klining *@%s (user %s -> %s!%s@%s is autokline exempt but matches %s %s)",
-							u->host, data->oldnick, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-				else
-				{
-					slog(LG_VERBOSE, "rwatch_nickchange(): klining *@%s (user %s -> %s!%s@%s matches %s %s)",
-							u->host, data->oldnick, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-					if (! (u->flags & UF_KLINESENT)) {
-						kline_sts("*", "*", u->host, 86400, rw->reason);
-						u->flags |= UF_KLINESENT;
-					}
+				slog(LG_VERBOSE, "rwatch_nickchange(): klining *@%s (user %s -> %s!%s@%s matches %s %s)",
+						u->host, data->oldnick, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+				if (! (u->flags & UF_KLINESENT)) {
+					kline_sts("*", "*", u->host, 86400, rw->reason);
+					u->flags |= UF_KLINESENT;
 				}
 			}
-			else if (rw->actions & RWACT_QUARANTINE)
+		}
+		else if (rw->actions & RWACT_QUARANTINE)
+		{
+			if (is_autokline_exempt(u))
+				slog(LG_INFO, "rwatch_newuser(): not qurantining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+			else
 			{
-				if (is_autokline_exempt(u))
-					slog(LG_INFO, "rwatch_newuser(): not qurantining *@%s (user %s!%s@%s is autokline exempt but matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-				else
-				{
-					slog(LG_VERBOSE, "rwatch_newuser(): quaranting *@%s (user %s!%s@%s matches %s %s)",
-							u->host, u->nick, u->user, u->host,
-							rw->regex, rw->reason);
-					quarantine_sts(service_find("operserv")->me, u, 86400, rw->reason);
-				}
+				slog(LG_VERBOSE, "rwatch_newuser(): quaranting *@%s (user %s!%s@%s matches %s %s)",
+						u->host, u->nick, u->user, u->host,
+						rw->regex, rw->reason);
+				quarantine_sts(service_find("operserv")->me, u, 86400, rw->reason);
 			}
 		}
 	}
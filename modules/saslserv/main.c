@@ -16,7 +16,30 @@ DECLARE_MODULE_V1
 	VENDOR_STRING
 );
 
+/* sessions expire after this many seconds without progress */
+#define SASL_SESSION_TIMEOUT	60
+/* one slot per second; must be more than SASL_SESSION_TIMEOUT */
+#define SASL_WHEEL_SLOTS	64
+
+/* upper bounds of the handshake latency buckets, in milliseconds */
+static const unsigned int sasl_latency_bounds[] = { 10, 50, 100, 250, 500, 1000, 2500, 5000, 10000 };
+#define SASL_LATENCY_BUCKETS	(sizeof sasl_latency_bounds / sizeof sasl_latency_bounds[0] + 1)
+
+typedef enum {
+	SASL_OUTCOME_SUCCESS,
+	SASL_OUTCOME_FAILED,
+	SASL_OUTCOME_ABORTED,
+	SASL_OUTCOME_TIMEOUT,
+	SASL_OUTCOME_COUNT
+} sasl_outcome_t;
+
 mowgli_list_t sessions;
+static mowgli_patricia_t *sessions_by_uid;
+static mowgli_list_t sasl_wheel[SASL_WHEEL_SLOTS];
+static time_t sasl_wheel_time;
+static unsigned int sasl_sessions_started;
+static unsigned int sasl_outcomes[SASL_OUTCOME_COUNT];
+static unsigned int sasl_latency[SASL_LATENCY_BUCKETS];
 static mowgli_list_t sasl_mechanisms;
 static char mechlist_string[400];
 static bool hide_server_names;
@@ -27,19 +50,22 @@ void destroy_session(sasl_session_t *p);
 static void sasl_logcommand(sasl_session_t *p, myuser_t *login, int level, const char *fmt, ...);
 static void sasl_input(sasl_message_t *smsg);
 static void sasl_packet(sasl_session_t *p, char *buf, int len);
+static void sasl_packet_result(sasl_session_t *p, int rc, char *out, size_t out_len);
+static void sasl_mech_complete(sasl_session_t *p, int rc);
 static void sasl_write(char *target, char *data, int length);
 static bool may_impersonate(myuser_t *source_mu, myuser_t *target_mu);
 static myuser_t *login_user(sasl_session_t *p);
 static void sasl_newuser(hook_user_nick_t *data);
 static void sasl_server_eob(server_t *s);
-static void delete_stale(void *vptr);
+static void sasl_wheel_tick(void *vptr);
+static void sasl_stats(hook_stats_t *hdata);
 static void sasl_mech_register(sasl_mechanism_t *mech);
 static void sasl_mech_unregister(sasl_mechanism_t *mech);
 static void mechlist_build_string(char *ptr, size_t buflen);
 static void mechlist_do_rebuild();
 static const char *sasl_get_source_name(sourceinfo_t *si);
 
-sasl_mech_register_func_t sasl_mech_register_funcs = { &sasl_mech_register, &sasl_mech_unregister };
+sasl_mech_register_func_t sasl_mech_register_funcs = { &sasl_mech_register, &sasl_mech_unregister, &sasl_mech_complete };
 
 /* main services client routine */
 static void saslserv(sourceinfo_t *si, int parc, char *parv[])
@@ -76,7 +102,7 @@ static void saslserv(sourceinfo_t *si, int parc, char *parv[])
 }
 
 service_t *saslsvs = NULL;
-mowgli_eventloop_timer_t *delete_stale_timer = NULL;
+mowgli_eventloop_timer_t *sasl_wheel_timer = NULL;
 
 static void sasl_mech_register(sasl_mechanism_t *mech)
 {
@@ -130,8 +156,12 @@ void _modinit(module_t *m)
 	hook_add_server_eob(sasl_server_eob);
 	hook_add_event("sasl_may_impersonate");
 	hook_add_event("user_can_login");
+	hook_add_event("stats");
+	hook_add_stats(sasl_stats);
 
-	delete_stale_timer = mowgli_timer_add(base_eventloop, "sasl_delete_stale", delete_stale, NULL, 30);
+	sessions_by_uid = mowgli_patricia_create(noopcanon);
+	sasl_wheel_time = CURRTIME;
+	sasl_wheel_timer = mowgli_timer_add(base_eventloop, "sasl_wheel_tick", sasl_wheel_tick, NULL, 1);
 
 	saslsvs = service_add("saslserv", saslserv);
 	add_bool_conf_item("HIDE_SERVER_NAMES", &saslsvs->conf_table, 0, &hide_server_names, false);
@@ -145,8 +175,9 @@ void _moddeinit(module_unload_intent_t intent)
 	hook_del_sasl_input(sasl_input);
 	hook_del_user_add(sasl_newuser);
 	hook_del_server_eob(sasl_server_eob);
+	hook_del_stats(sasl_stats);
 
-	mowgli_timer_destroy(base_eventloop, delete_stale_timer);
+	mowgli_timer_destroy(base_eventloop, sasl_wheel_timer);
 
 	del_conf_item("HIDE_SERVER_NAMES", &saslsvs->conf_table);
 
@@ -162,6 +193,8 @@ void _moddeinit(module_unload_intent_t intent)
 	{
 		destroy_session(n->data);
 	}
+
+	mowgli_patricia_destroy(sessions_by_uid, NULL, NULL);
 }
 
 /*
@@ -171,27 +204,53 @@ void _moddeinit(module_unload_intent_t intent)
 /* find an existing session by uid */
 sasl_session_t *find_session(const char *uid)
 {
-	sasl_session_t *p;
-	mowgli_node_t *n;
-
 	if (uid == NULL)
 		return NULL;
 
-	MOWGLI_ITER_FOREACH(n, sessions.head)
+	return mowgli_patricia_retrieve(sessions_by_uid, uid);
+}
+
+/* (re)schedule a session to expire SASL_SESSION_TIMEOUT seconds from now */
+static void sasl_session_touch(sasl_session_t *p)
+{
+	p->deadline = CURRTIME + SASL_SESSION_TIMEOUT;
+
+	/* a session that is already in the wheel is moved along when its
+	 * old slot comes up, see sasl_wheel_tick() */
+	if (p->wheel_slot < 0)
 	{
-		p = n->data;
-		if(p->uid != NULL && !strcmp(p->uid, uid))
-			return p;
+		p->wheel_slot = p->deadline % SASL_WHEEL_SLOTS;
+		mowgli_node_add(p, &p->wheel_node, &sasl_wheel[p->wheel_slot]);
 	}
+}
 
-	return NULL;
+/* count how a handshake ended, once per session */
+static void sasl_session_outcome(sasl_session_t *p, sasl_outcome_t outcome)
+{
+	struct timeval now;
+	unsigned int ms, i;
+
+	if (p->flags & ASASL_OUTCOME_SEEN)
+		return;
+	p->flags |= ASASL_OUTCOME_SEEN;
+
+	sasl_outcomes[outcome]++;
+
+	if (outcome != SASL_OUTCOME_SUCCESS && outcome != SASL_OUTCOME_FAILED)
+		return;
+
+	gettimeofday(&now, NULL);
+	ms = (now.tv_sec - p->started.tv_sec) * 1000 + (now.tv_usec - p->started.tv_usec) / 1000;
+
+	for (i = 0; i < SASL_LATENCY_BUCKETS - 1 && ms >= sasl_latency_bounds[i]; i++)
+		;
+	sasl_latency[i]++;
 }
 
 /* create a new session if it does not already exist */
 sasl_session_t *make_session(const char *uid, server_t *server)
 {
 	sasl_session_t *p = find_session(uid);
-	mowgli_node_t *n;
 
 	if(p)
 		return p;
@@ -200,8 +259,13 @@ sasl_session_t *make_session(const char *uid, server_t *server)
 	memset(p, 0, sizeof(sasl_session_t));
 	p->uid = strdup(uid);
 	p->server = server;
-	n = mowgli_node_create();
-	mowgli_node_add(p, n, &sessions);
+	p->wheel_slot = -1;
+	gettimeofday(&p->started, NULL);
+
+	mowgli_node_add(p, &p->node, &sessions);
+	mowgli_patricia_add(sessions_by_uid, p->uid, p);
+	sasl_session_touch(p);
+	sasl_sessions_started++;
 
 	return p;
 }
@@ -209,7 +273,6 @@ sasl_session_t *make_session(const char *uid, server_t *server)
 /* free a session and all its contents */
 void destroy_session(sasl_session_t *p)
 {
-	mowgli_node_t *n, *tn;
 	myuser_t *mu;
 
 	if (p->flags & ASASL_NEED_LOG && p->username != NULL)
@@ -219,14 +282,10 @@ void destroy_session(sasl_session_t *p)
 			sasl_logcommand(p, mu, CMDLOG_LOGIN, "LOGIN (session timed out)");
 	}
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
-	{
-		if(n->data == p)
-		{
-			mowgli_node_delete(n, &sessions);
-			mowgli_node_free(n);
-		}
-	}
+	mowgli_node_delete(&p->node, &sessions);
+	mowgli_patricia_delete(sessions_by_uid, p->uid);
+	if (p->wheel_slot >= 0)
+		mowgli_node_delete(&p->wheel_node, &sasl_wheel[p->wheel_slot]);
 
 	free(p->uid);
 	free(p->buf);
@@ -307,6 +366,15 @@ static void sasl_input(sasl_message_t *smsg)
 
 	case 'C':
 		/* (C)lient data */
+		if(p->flags & ASASL_VERIFYING)
+		{
+			/* nothing more is expected until we have answered */
+			sasl_session_outcome(p, SASL_OUTCOME_FAILED);
+			sasl_sts(p->uid, 'D', "F");
+			destroy_session(p);
+			return;
+		}
+
 		if(p->buf == NULL)
 		{
 			p->buf = (char *)malloc(len + 1);
@@ -317,6 +385,7 @@ static void sasl_input(sasl_message_t *smsg)
 		{
 			if(p->len + len + 1 > 8192) /* This is a little much... */
 			{
+				sasl_session_outcome(p, SASL_OUTCOME_FAILED);
 				sasl_sts(p->uid, 'D', "F");
 				destroy_session(p);
 				return;
@@ -344,6 +413,7 @@ static void sasl_input(sasl_message_t *smsg)
 
 	case 'D':
 		/* (D)one -- when we receive it, means client abort */
+		sasl_session_outcome(p, SASL_OUTCOME_ABORTED);
 		destroy_session(p);
 		return;
 	}
@@ -410,11 +480,10 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 {
 	int rc;
 	size_t tlen = 0;
-	char *cloak, *out = NULL;
+	char *out = NULL;
 	char temp[BUFSIZE];
 	char mech[61];
 	size_t out_len = 0;
-	metadata_t *md;
 
 	/* First piece of data in a session is the name of
 	 * the SASL mechanism that will be used.
@@ -423,6 +492,7 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	{
 		if(len > 60)
 		{
+			sasl_session_outcome(p, SASL_OUTCOME_FAILED);
 			sasl_sts(p->uid, 'D', "F");
 			destroy_session(p);
 			return;
@@ -435,6 +505,7 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 		{
 			sasl_sts(p->uid, 'M', mechlist_string);
 
+			sasl_session_outcome(p, SASL_OUTCOME_FAILED);
 			sasl_sts(p->uid, 'D', "F");
 			destroy_session(p);
 			return;
@@ -453,7 +524,36 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	}
 
 	/* Some progress has been made, reset timeout. */
-	p->flags &= ~ASASL_MARKED_FOR_DELETION;
+	sasl_session_touch(p);
+
+	/* the mechanism calls sasl_mech_complete() later on */
+	if(rc == ASASL_PENDING)
+	{
+		p->flags |= ASASL_VERIFYING;
+		free(out);
+		return;
+	}
+
+	sasl_packet_result(p, rc, out, out_len);
+}
+
+/* called by a mechanism once a step that returned ASASL_PENDING is done */
+static void sasl_mech_complete(sasl_session_t *p, int rc)
+{
+	return_if_fail(p->flags & ASASL_VERIFYING);
+
+	p->flags &= ~ASASL_VERIFYING;
+	sasl_session_touch(p);
+
+	sasl_packet_result(p, rc, NULL, 0);
+}
+
+/* answer the client according to the result of a mechanism step */
+static void sasl_packet_result(sasl_session_t *p, int rc, char *out, size_t out_len)
+{
+	char *cloak;
+	char temp[BUFSIZE];
+	metadata_t *md;
 
 	if(rc == ASASL_DONE)
 	{
@@ -467,11 +567,13 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 
 			if (!(mu->flags & MU_WAITAUTH))
 				svslogin_sts(p->uid, "*", "*", cloak, mu);
+			sasl_session_outcome(p, SASL_OUTCOME_SUCCESS);
 			sasl_sts(p->uid, 'D', "S");
 			/* Will destroy session on introduction of user to net. */
 		}
 		else
 		{
+			sasl_session_outcome(p, SASL_OUTCOME_FAILED);
 			sasl_sts(p->uid, 'D', "F");
 			destroy_session(p);
 		}
@@ -511,6 +613,7 @@ static void sasl_packet(sasl_session_t *p, char *buf, int len)
 	}
 
 	free(out);
+	sasl_session_outcome(p, SASL_OUTCOME_FAILED);
 	sasl_sts(p->uid, 'D', "F");
 	destroy_session(p);
 }
@@ -678,8 +781,7 @@ static myuser_t *login_user(sasl_session_t *p)
 	 */
 	if(ircd->flags & IRCD_SASL_USE_PUID)
 	{
-		target_mu->flags &= ~MU_NOBURSTLOGIN;
-		target_mu->flags |= MU_PENDINGLOGIN;
+		myuser_set_flags(target_mu, MU_PENDINGLOGIN, MU_NOBURSTLOGIN);
 	}
 
 	return target_mu;
@@ -726,29 +828,72 @@ static void sasl_newuser(hook_user_nick_t *data)
 	logcommand_user(saslsvs, u, CMDLOG_LOGIN, "LOGIN (%s)", mptr->name);
 }
 
-/* This function is run approximately once every 30 seconds.
- * It looks for flagged sessions, and deletes them, while
- * flagging all the others. This way stale sessions are deleted
- * after no more than 60 seconds.
+/* This function is run every second. It expires the sessions in the
+ * wheel slots for the seconds that have passed, and moves those that
+ * made progress since they were put there on to the slot for their new
+ * deadline.
  */
-static void delete_stale(void *vptr)
+static void sasl_wheel_tick(void *vptr)
 {
 	sasl_session_t *p;
 	mowgli_node_t *n, *tn;
+	mowgli_list_t due;
+	unsigned int slot;
 
-	MOWGLI_ITER_FOREACH_SAFE(n, tn, sessions.head)
+	/* after a long stall, every slot is due once */
+	if (CURRTIME - sasl_wheel_time > SASL_WHEEL_SLOTS)
+		sasl_wheel_time = CURRTIME - SASL_WHEEL_SLOTS;
+
+	while (sasl_wheel_time < CURRTIME)
 	{
-		p = n->data;
-		if(p->flags & ASASL_MARKED_FOR_DELETION)
+		sasl_wheel_time++;
+		slot = sasl_wheel_time % SASL_WHEEL_SLOTS;
+
+		/* take the slot over, sessions may be put back into it */
+		due = sasl_wheel[slot];
+		memset(&sasl_wheel[slot], 0, sizeof sasl_wheel[slot]);
+
+		MOWGLI_ITER_FOREACH_SAFE(n, tn, due.head)
 		{
-			mowgli_node_delete(n, &sessions);
+			p = n->data;
+			mowgli_node_delete(&p->wheel_node, &due);
+			p->wheel_slot = -1;
+
+			if (p->deadline > sasl_wheel_time)
+			{
+				p->wheel_slot = p->deadline % SASL_WHEEL_SLOTS;
+				mowgli_node_add(p, &p->wheel_node, &sasl_wheel[p->wheel_slot]);
+				continue;
+			}
+
+			sasl_session_outcome(p, SASL_OUTCOME_TIMEOUT);
 			destroy_session(p);
-			mowgli_node_free(n);
-		} else
-			p->flags |= ASASL_MARKED_FOR_DELETION;
+		}
 	}
 }
 
+static void sasl_stats(hook_stats_t *hdata)
+{
+	char buf[BUFSIZE];
+	size_t len = 0;
+	unsigned int i;
+
+	if (hdata->req != 'S' || !has_priv_user(hdata->u, PRIV_SERVER_AUSPEX))
+		return;
+
+	numeric_sts(me.me, 249, hdata->u, "S :sessions %zu live, %u started",
+			MOWGLI_LIST_LENGTH(&sessions), sasl_sessions_started);
+	numeric_sts(me.me, 249, hdata->u, "S :outcome  %u succeeded, %u failed, %u aborted, %u timed out",
+			sasl_outcomes[SASL_OUTCOME_SUCCESS], sasl_outcomes[SASL_OUTCOME_FAILED],
+			sasl_outcomes[SASL_OUTCOME_ABORTED], sasl_outcomes[SASL_OUTCOME_TIMEOUT]);
+
+	for (i = 0; i < SASL_LATENCY_BUCKETS - 1; i++)
+		len += snprintf(buf + len, sizeof buf - len, " <%ums:%u", sasl_latency_bounds[i], sasl_latency[i]);
+	snprintf(buf + len, sizeof buf - len, " >=%ums:%u", sasl_latency_bounds[i - 1], sasl_latency[i]);
+
+	numeric_sts(me.me, 249, hdata->u, "S :latency%s", buf);
+}
+
 static const char *sasl_get_source_name(sourceinfo_t *si)
 {
 	static char result[HOSTLEN+NICKLEN+10];
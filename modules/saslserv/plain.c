@@ -19,6 +19,7 @@ sasl_mech_register_func_t *regfuncs;
 static int mech_start(sasl_session_t *p, char **out, size_t *out_len);
 static int mech_step(sasl_session_t *p, char *message, size_t len, char **out, size_t *out_len);
 static void mech_finish(sasl_session_t *p);
+static void mech_verified(myuser_t *mu, bool verified, void *priv);
 sasl_mechanism_t mech = {"PLAIN", &mech_start, &mech_step, &mech_finish};
 
 void _modinit(module_t *m)
@@ -89,11 +90,26 @@ static int mech_step(sasl_session_t *p, char *message, size_t len, char **out, s
 
 	p->username = strdup(authc);
 	p->authzid = strdup(authz);
-	return verify_password(mu, pass) ? ASASL_DONE : ASASL_FAIL;
+
+	p->mechdata = verify_password_async(mu, pass, mech_verified, p);
+	explicit_bzero(pass, sizeof pass);
+
+	return ASASL_PENDING;
+}
+
+static void mech_verified(myuser_t *mu, bool verified, void *priv)
+{
+	sasl_session_t *p = priv;
+
+	p->mechdata = NULL;
+	regfuncs->mech_complete(p, verified ? ASASL_DONE : ASASL_FAIL);
 }
 
 static void mech_finish(sasl_session_t *p)
 {
+	if (p->mechdata != NULL)
+		verify_password_cancel(p->mechdata);
+	p->mechdata = NULL;
 }
 
 /* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
@@ -11,6 +11,7 @@
 #include "jsonrpclib.h"
 #include "datastream.h"
 #include "authcookie.h"
+#include "privs.h"
 
 DECLARE_MODULE_V1
 (
@@ -22,14 +23,30 @@ DECLARE_MODULE_V1
 static void handle_request(connection_t *cptr, void *requestbuf);
 
 mowgli_list_t *httpd_path_handlers;
+void (*httpd_reply_done)(connection_t *cptr);
 static mowgli_patricia_t *json_methods;
 
+/* logins waiting for their password to be checked */
+typedef struct {
+	connection_t *cptr;
+	char *sourceip;
+	char *id;
+	verify_request_t *req;
+	mowgli_node_t node;
+} jsonrpc_login_t;
+
+static mowgli_list_t pending_logins;
+
 static bool jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id);
+static void jsonrpc_login_free(jsonrpc_login_t *jl);
+static void jsonrpc_login_cancel(connection_t *cptr);
+static void jsonrpc_login_verified(myuser_t *mu, bool verified, void *priv);
 static bool jsonrpcmethod_logout(void *conn, mowgli_list_t *params, char *id);
 static bool jsonrpcmethod_command(void *conn, mowgli_list_t *params, char *id);
 static bool jsonrpcmethod_privset(void *conn, mowgli_list_t *params, char *id);
 static bool jsonrpcmethod_ison(void *conn, mowgli_list_t *params, char *id);
 static bool jsonrpcmethod_metadata(void *conn, mowgli_list_t *params, char *id);
+static bool jsonrpcmethod_profile(void *conn, mowgli_list_t *params, char *id);
 
 
 static void jsonrpc_command_fail(sourceinfo_t *si, cmd_faultcode_t code, const char *message);
@@ -56,6 +73,7 @@ static void handle_request(connection_t *cptr, void *requestbuf)
 void _modinit(module_t *m)
 {
 	MODULE_TRY_REQUEST_SYMBOL(m, httpd_path_handlers, "misc/httpd", "httpd_path_handlers");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_done, "misc/httpd", "httpd_reply_done");
 
 	handle_jsonrpc.path = "/jsonrpc";
 	mowgli_node_add(&handle_jsonrpc, mowgli_node_create(), httpd_path_handlers);
@@ -69,6 +87,7 @@ void _modinit(module_t *m)
 	jsonrpc_register_method("atheme.privset", jsonrpcmethod_privset);
 	jsonrpc_register_method("atheme.ison", jsonrpcmethod_ison);
 	jsonrpc_register_method("atheme.metadata", jsonrpcmethod_metadata);
+	jsonrpc_register_method("atheme.profile", jsonrpcmethod_profile);
 
 }
 
@@ -83,6 +102,20 @@ void _moddeinit(module_unload_intent_t intent)
 	jsonrpc_unregister_method("atheme.privset");
 	jsonrpc_unregister_method("atheme.ison");
 	jsonrpc_unregister_method("atheme.metadata");
+	jsonrpc_unregister_method("atheme.profile");
+
+	while (pending_logins.head != NULL)
+	{
+		jsonrpc_login_t *jl = pending_logins.head->data;
+		struct httpddata *hd = jl->cptr->userdata;
+
+		hd->reply_pending = false;
+		hd->cancel_reply = NULL;
+		connection_close_soon(jl->cptr);
+
+		verify_password_cancel(jl->req);
+		jsonrpc_login_free(jl);
+	}
 
 	if ((n = mowgli_node_find(&handle_jsonrpc, httpd_path_handlers)) != NULL)
 	{
@@ -125,7 +158,8 @@ jsonrpc_method_t get_json_method(const char *method_name) {
 static bool jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id)
 {
 	myuser_t *mu;
-	authcookie_t *ac;
+	jsonrpc_login_t *jl;
+	struct httpddata *hd;
 	char *sourceip, *accountname, *password;
 
 	size_t len = MOWGLI_LIST_LENGTH(params);
@@ -153,42 +187,96 @@ static bool jsonrpcmethod_login(void *conn, mowgli_list_t *params, char *id)
 		return false;
 	}
 
-	if (!verify_password(mu, password))
+	/* the reply is sent by jsonrpc_login_verified() */
+	jl = smalloc(sizeof(jsonrpc_login_t));
+	jl->cptr = conn;
+	jl->sourceip = sourceip != NULL ? sstrdup(sourceip) : NULL;
+	jl->id = sstrdup(id);
+	mowgli_node_add(jl, &jl->node, &pending_logins);
+
+	hd = jl->cptr->userdata;
+	hd->reply_pending = true;
+	hd->cancel_reply = jsonrpc_login_cancel;
+
+	jl->req = verify_password_async(mu, password, jsonrpc_login_verified, jl);
+
+	return true;
+}
+
+static void jsonrpc_login_free(jsonrpc_login_t *jl)
+{
+	mowgli_node_delete(&jl->node, &pending_logins);
+	free(jl->sourceip);
+	free(jl->id);
+	free(jl);
+}
+
+static void jsonrpc_login_cancel(connection_t *cptr)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, pending_logins.head)
+	{
+		jsonrpc_login_t *jl = n->data;
+
+		if (jl->cptr == cptr)
+		{
+			verify_password_cancel(jl->req);
+			jsonrpc_login_free(jl);
+			return;
+		}
+	}
+}
+
+static void jsonrpc_login_verified(myuser_t *mu, bool verified, void *priv)
+{
+	jsonrpc_login_t *jl = priv;
+	connection_t *cptr = jl->cptr;
+	struct httpddata *hd = cptr->userdata;
+	authcookie_t *ac;
+
+	hd->cancel_reply = NULL;
+
+	if (mu == NULL)
+		jsonrpc_failure_string(cptr, fault_nosuch_source, "The account is not registered.", jl->id);
+	else if (!verified)
 	{
 		sourceinfo_t *si;
 
-		logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
-		jsonrpc_failure_string(conn, fault_authfail, "The password is incorrect.", id);
+		logcommand_external(nicksvs.me, "jsonrpc", cptr, jl->sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
+		jsonrpc_failure_string(cptr, fault_authfail, "The password is incorrect.", jl->id);
 
 		si = sourceinfo_create();
 
 		jsonrpc_sourceinfo_t *jsi = (jsonrpc_sourceinfo_t *)si;
 
 		si->service = NULL;
-		si->sourcedesc = sourceip;
-		si->connection = conn;
+		si->sourcedesc = jl->sourceip;
+		si->connection = cptr;
 		si->v = &jsonrpc_vtable;
 		si->force_language = language_find("en");
 
 		jsi->base = si;
-		jsi->id = id;
+		jsi->id = jl->id;
 
 		bad_password(si, mu);
 
 		object_unref(si);
-
-		return false;
 	}
+	else
+	{
+		mu->lastlogin = CURRTIME;
 
-	mu->lastlogin = CURRTIME;
+		ac = authcookie_create(mu);
 
-	ac = authcookie_create(mu);
+		logcommand_external(nicksvs.me, "jsonrpc", cptr, jl->sourceip, mu, CMDLOG_LOGIN, "LOGIN");
 
-	logcommand_external(nicksvs.me, "jsonrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
+		jsonrpc_success_string(cptr, ac->ticket, jl->id);
+	}
 
-	jsonrpc_success_string(conn, ac->ticket, id);
+	jsonrpc_login_free(jl);
 
-	return true;
+	httpd_reply_done(cptr);
 }
 
 /*
@@ -682,6 +770,146 @@ static bool jsonrpcmethod_metadata(void *conn, mowgli_list_t *params, char *id)
 	return 0;
 }
 
+/*
+ * atheme.profile
+ *
+ * JSON inputs:
+ *       authcookie, account name, [hooks|commands|modules], [count]
+ *
+ * JSON outputs:
+ *       An array of the busiest hook handlers and commands (or modules),
+ *       busiest first, each an object with the following properties:
+ *       kind: string: "hook", "command" or "module"
+ *       name: string: hook or command name, absent for modules
+ *       module: string: module that added it
+ *       calls: number: calls counted
+ *       timed: number: calls sampled
+ *       total_us: number: estimated time spent in all calls
+ *       avg_us, p99_us, max_us: number: of the sampled calls
+ *
+ *       The account must have PRIV_SERVER_AUSPEX (general:auspex).
+ */
+
+static bool jsonrpcmethod_profile(void *conn, mowgli_list_t *params, char *id)
+{
+	profile_entry_t top[100];
+	unsigned int kinds = PROFILE_HOOK | PROFILE_COMMAND;
+	unsigned int count = 10, n, i;
+	bool by_module = false;
+	myuser_t *mu;
+	mowgli_node_t *node;
+
+	char *param, *accountname, *cookie, *what, *countstr;
+
+	size_t len = MOWGLI_LIST_LENGTH(params);
+	cookie = mowgli_node_nth_data(params, 0);
+	accountname = mowgli_node_nth_data(params, 1);
+	what = mowgli_node_nth_data(params, 2);
+	countstr = mowgli_node_nth_data(params, 3);
+
+	MOWGLI_LIST_FOREACH(node, params->head)
+	{
+		param = node->data;
+
+		if (*param == '\0' || strchr(param, '\r') || strchr(param, '\n'))
+		{
+			jsonrpc_failure_string(conn, fault_badparams, "Invalid parameters.", id);
+			return 0;
+		}
+	}
+
+	if (len < 2)
+	{
+		jsonrpc_failure_string(conn, fault_needmoreparams, "Insufficient parameters.", id);
+		return 0;
+	}
+
+	if ((mu = myuser_find(accountname)) == NULL)
+	{
+		jsonrpc_failure_string(conn, fault_nosuch_source, "Unknown user.", id);
+		return 0;
+	}
+
+	if (authcookie_validate(cookie, mu) == false)
+	{
+		jsonrpc_failure_string(conn, fault_badauthcookie, "Invalid authcookie for this account.", id);
+		return 0;
+	}
+
+	if (!has_priv_myuser(mu, PRIV_SERVER_AUSPEX))
+	{
+		jsonrpc_failure_string(conn, fault_noprivs, "You do not have sufficient privileges.", id);
+		return 0;
+	}
+
+	if (what != NULL)
+	{
+		if (!strcasecmp(what, "hooks"))
+			kinds = PROFILE_HOOK;
+		else if (!strcasecmp(what, "commands"))
+			kinds = PROFILE_COMMAND;
+		else if (!strcasecmp(what, "modules"))
+			by_module = true;
+		else if (strcasecmp(what, "all"))
+		{
+			jsonrpc_failure_string(conn, fault_badparams, "Invalid parameters.", id);
+			return 0;
+		}
+	}
+
+	if (countstr != NULL)
+	{
+		count = atoi(countstr);
+		if (count < 1 || count > sizeof top / sizeof top[0])
+		{
+			jsonrpc_failure_string(conn, fault_badparams, "Invalid parameters.", id);
+			return 0;
+		}
+	}
+
+	n = profile_top(kinds, by_module, top, count);
+
+	mowgli_json_t *resultobj = mowgli_json_create_array();
+	mowgli_list_t *entries = MOWGLI_JSON_ARRAY(resultobj);
+
+	for (i = 0; i < n; i++)
+	{
+		profile_entry_t *p = &top[i];
+		mowgli_json_t *entry = mowgli_json_create_object();
+		mowgli_patricia_t *patricia = MOWGLI_JSON_OBJECT(entry);
+
+		mowgli_patricia_add(patricia, "kind", mowgli_json_create_string(by_module ? "module" : p->kind == PROFILE_HOOK ? "hook" : "command"));
+		if (!by_module)
+			mowgli_patricia_add(patricia, "name", mowgli_json_create_string(p->name));
+		mowgli_patricia_add(patricia, "module", mowgli_json_create_string(p->module));
+		mowgli_patricia_add(patricia, "calls", mowgli_json_create_float(p->calls));
+		mowgli_patricia_add(patricia, "timed", mowgli_json_create_float(p->timed));
+		mowgli_patricia_add(patricia, "total_us", mowgli_json_create_float(profile_estimate_ns(p) / 1000));
+		mowgli_patricia_add(patricia, "avg_us", mowgli_json_create_float(p->timed ? p->total_ns / p->timed / 1000 : 0));
+		mowgli_patricia_add(patricia, "p99_us", mowgli_json_create_float(profile_percentile_us(p, 99)));
+		mowgli_patricia_add(patricia, "max_us", mowgli_json_create_float(p->max_ns / 1000));
+
+		mowgli_node_add(entry, mowgli_node_create(), entries);
+	}
+
+	mowgli_json_t *obj = mowgli_json_create_object();
+	mowgli_patricia_t *patricia = MOWGLI_JSON_OBJECT(obj);
+
+	mowgli_json_t *idobj = mowgli_json_create_string(id);
+
+	mowgli_patricia_add(patricia, "result", resultobj);
+	mowgli_patricia_add(patricia, "id", idobj);
+	mowgli_patricia_add(patricia, "error", mowgli_json_null);
+
+	mowgli_string_t *str = mowgli_string_create();
+
+	mowgli_json_serialize_to_string(obj, str, 0);
+
+	jsonrpc_send_data(conn, str->str);
+
+	return 0;
+}
+
 void jsonrpc_send_data(void *conn, char *str) {
 	struct httpddata *hd = ((connection_t *) conn)->userdata;
 
@@ -59,7 +59,6 @@ void irc_parse(char *line)
 			goto cleanup;
 
 		/* copy the original line so we know what we crashed on */
-		memset((char *)&coreLine, '\0', BUFSIZE);
 		mowgli_strlcpy(coreLine, line, BUFSIZE);
 
 		slog(LG_RAWDATA, "-> %s", line);
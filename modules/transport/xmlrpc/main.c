@@ -31,12 +31,26 @@ struct
 connection_t *current_cptr; /* XXX: Hack: src/xmlrpc.c requires us to do this */
 
 mowgli_list_t *httpd_path_handlers;
+void (*httpd_reply_done)(connection_t *cptr);
+
+/* logins waiting for their password to be checked */
+typedef struct {
+	connection_t *cptr;
+	char *sourceip;
+	verify_request_t *req;
+	mowgli_node_t node;
+} xmlrpc_login_t;
+
+static mowgli_list_t pending_logins;
 
 static void xmlrpc_command_fail(sourceinfo_t *si, cmd_faultcode_t code, const char *message);
 static void xmlrpc_command_success_nodata(sourceinfo_t *si, const char *message);
 static void xmlrpc_command_success_string(sourceinfo_t *si, const char *result, const char *message);
 
 static int xmlrpcmethod_login(void *conn, int parc, char *parv[]);
+static void xmlrpc_login_free(xmlrpc_login_t *xl);
+static void xmlrpc_login_cancel(connection_t *cptr);
+static void xmlrpc_login_verified(myuser_t *mu, bool verified, void *priv);
 static int xmlrpcmethod_logout(void *conn, int parc, char *parv[]);
 static int xmlrpcmethod_command(void *conn, int parc, char *parv[]);
 static int xmlrpcmethod_privset(void *conn, int parc, char *parv[]);
@@ -103,6 +117,7 @@ static void xmlrpc_config_ready(void *vptr)
 void _modinit(module_t *m)
 {
 	MODULE_TRY_REQUEST_SYMBOL(m, httpd_path_handlers, "misc/httpd", "httpd_path_handlers");
+	MODULE_TRY_REQUEST_SYMBOL(m, httpd_reply_done, "misc/httpd", "httpd_reply_done");
 
 	hook_add_event("config_ready");
 	hook_add_config_ready(xmlrpc_config_ready);
@@ -133,6 +148,19 @@ void _moddeinit(module_unload_intent_t intent)
 	xmlrpc_unregister_method("atheme.ison");
 	xmlrpc_unregister_method("atheme.metadata");
 
+	while (pending_logins.head != NULL)
+	{
+		xmlrpc_login_t *xl = pending_logins.head->data;
+		struct httpddata *hd = xl->cptr->userdata;
+
+		hd->reply_pending = false;
+		hd->cancel_reply = NULL;
+		connection_close_soon(xl->cptr);
+
+		verify_password_cancel(xl->req);
+		xmlrpc_login_free(xl);
+	}
+
 	if ((n = mowgli_node_find(&handle_xmlrpc, httpd_path_handlers)) != NULL)
 	{
 		mowgli_node_delete(n, httpd_path_handlers);
@@ -228,7 +256,8 @@ static void xmlrpc_command_success_string(sourceinfo_t *si, const char *result,
 static int xmlrpcmethod_login(void *conn, int parc, char *parv[])
 {
 	myuser_t *mu;
-	authcookie_t *ac;
+	xmlrpc_login_t *xl;
+	struct httpddata *hd;
 	const char *sourceip;
 
 	if (parc < 2)
@@ -252,36 +281,90 @@ static int xmlrpcmethod_login(void *conn, int parc, char *parv[])
 		return 0;
 	}
 
-	if (!verify_password(mu, parv[1]))
+	/* the reply is sent by xmlrpc_login_verified() */
+	xl = smalloc(sizeof(xmlrpc_login_t));
+	xl->cptr = conn;
+	xl->sourceip = sourceip != NULL ? sstrdup(sourceip) : NULL;
+	mowgli_node_add(xl, &xl->node, &pending_logins);
+
+	hd = xl->cptr->userdata;
+	hd->reply_pending = true;
+	hd->cancel_reply = xmlrpc_login_cancel;
+
+	xl->req = verify_password_async(mu, parv[1], xmlrpc_login_verified, xl);
+
+	return 0;
+}
+
+static void xmlrpc_login_free(xmlrpc_login_t *xl)
+{
+	mowgli_node_delete(&xl->node, &pending_logins);
+	free(xl->sourceip);
+	free(xl);
+}
+
+static void xmlrpc_login_cancel(connection_t *cptr)
+{
+	mowgli_node_t *n;
+
+	MOWGLI_ITER_FOREACH(n, pending_logins.head)
+	{
+		xmlrpc_login_t *xl = n->data;
+
+		if (xl->cptr == cptr)
+		{
+			verify_password_cancel(xl->req);
+			xmlrpc_login_free(xl);
+			return;
+		}
+	}
+}
+
+static void xmlrpc_login_verified(myuser_t *mu, bool verified, void *priv)
+{
+	xmlrpc_login_t *xl = priv;
+	connection_t *cptr = xl->cptr;
+	struct httpddata *hd = cptr->userdata;
+	authcookie_t *ac;
+
+	hd->cancel_reply = NULL;
+	current_cptr = cptr;
+
+	if (mu == NULL)
+		xmlrpc_generic_error(fault_nosuch_source, "The account is not registered.");
+	else if (!verified)
 	{
 		sourceinfo_t *si;
 
-		logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
+		logcommand_external(nicksvs.me, "xmlrpc", cptr, xl->sourceip, NULL, CMDLOG_LOGIN, "failed LOGIN to \2%s\2 (bad password)", entity(mu)->name);
 		xmlrpc_generic_error(fault_authfail, "The password is not valid for this account.");
 
 		si = sourceinfo_create();
 		si->service = NULL;
-		si->sourcedesc = parv[2] != NULL && *parv[2] ? parv[2] : NULL;
-		si->connection = conn;
+		si->sourcedesc = xl->sourceip;
+		si->connection = cptr;
 		si->v = &xmlrpc_vtable;
 		si->force_language = language_find("en");
 
 		bad_password(si, mu);
 
 		object_unref(si);
-
-		return 0;
 	}
+	else
+	{
+		mu->lastlogin = CURRTIME;
 
-	mu->lastlogin = CURRTIME;
+		ac = authcookie_create(mu);
 
-	ac = authcookie_create(mu);
+		logcommand_external(nicksvs.me, "xmlrpc", cptr, xl->sourceip, mu, CMDLOG_LOGIN, "LOGIN");
 
-	logcommand_external(nicksvs.me, "xmlrpc", conn, sourceip, mu, CMDLOG_LOGIN, "LOGIN");
+		xmlrpc_send_string(ac->ticket);
+	}
 
-	xmlrpc_send_string(ac->ticket);
+	current_cptr = NULL;
+	xmlrpc_login_free(xl);
 
-	return 0;
+	httpd_reply_done(cptr);
 }
 
 /*
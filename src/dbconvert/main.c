@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Converts databases between the OpenSEX and binary backends, so that a
+ * network can migrate to backend/binary and roll back again.
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+
+typedef bool (*bindb_convert_fn)(const char *from, const char *to);
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s --to-binary [services.db [services.bdb]]\n", argv0);
+	fprintf(stderr, "       %s --to-opensex [services.bdb [services.db]]\n", argv0);
+	fprintf(stderr, "\nFile names are relative to %s.\n", DATADIR);
+}
+
+int main(int argc, char *argv[])
+{
+	module_t *m;
+	bool ok;
+
+	if (argc < 2 || argc > 4)
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/dbconvert.log");
+	atheme_setup();
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	offline_mode = true;
+
+	m = module_load("backend/binary");
+	if (m == NULL)
+	{
+		slog(LG_ERROR, "dbconvert: cannot load backend/binary");
+		return EXIT_FAILURE;
+	}
+
+	if (!strcmp(argv[1], "--to-binary"))
+	{
+		const char *from = argc > 2 ? argv[2] : "services.db";
+		const char *to = argc > 3 ? argv[3] : "services.bdb";
+		bindb_convert_fn import = module_locate_symbol("backend/binary", "bindb_import_opensex");
+
+		slog(LG_INFO, "dbconvert: converting OpenSEX database %s to binary database %s", from, to);
+		ok = import != NULL && import(from, to);
+	}
+	else if (!strcmp(argv[1], "--to-opensex"))
+	{
+		const char *from = argc > 2 ? argv[2] : "services.bdb";
+		const char *to = argc > 3 ? argv[3] : "services.db";
+		bindb_convert_fn export = module_locate_symbol("backend/binary", "bindb_export_opensex");
+
+		slog(LG_INFO, "dbconvert: converting binary database %s to OpenSEX database %s", from, to);
+		ok = export != NULL && export(from, to);
+	}
+	else
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!ok)
+	{
+		slog(LG_ERROR, "dbconvert: conversion failed, see the log for details");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
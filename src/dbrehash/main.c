@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Rehashes account passwords offline, spreading the work over all cores:
+ * legacy hashes are wrapped in the default crypt scheme, or a list of
+ * credentials is checked and the matching passwords rehashed.
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+typedef struct {
+	myuser_t *mu;
+	char *account;			/* --verify */
+	char *password;			/* --verify */
+
+	char salt[PASSLEN];		/* from the default scheme, made up front */
+	char result[PASSLEN];		/* new hash, or empty */
+	const crypt_impl_t *matched;	/* --verify */
+	bool skipped;			/* --verify: needs the main thread */
+} rehash_job_t;
+
+typedef struct {
+	unsigned int hashes;
+	double secs;
+} rehash_worker_t;
+
+static rehash_job_t *jobs;
+static unsigned int njobs;
+static unsigned int next_job;
+static bool verify_mode;
+static const crypt_impl_t *target;
+
+static void print_usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s --wrap [options] [services.db]\n", argv0);
+	fprintf(stderr, "       %s --verify credentials [options] [services.db]\n", argv0);
+	fprintf(stderr, "\n");
+	fprintf(stderr, "--wrap wraps rawmd5 and rawsha1 hashes in the default crypt scheme, so\n");
+	fprintf(stderr, "they are replaced by a proper hash on the next login.\n");
+	fprintf(stderr, "--verify checks the \"account password\" lines of the credentials file\n");
+	fprintf(stderr, "and rehashes matching passwords that are not up to date.\n");
+	fprintf(stderr, "\n");
+	fprintf(stderr, "  -j threads   number of threads (default: one per core)\n");
+	fprintf(stderr, "  -m module    load another crypto module, e.g. crypto/rawmd5\n");
+	fprintf(stderr, "  -n           do not write the database back\n");
+	fprintf(stderr, "\nThe database name is relative to %s; crypto/pbkdf2v2 is the default scheme.\n", DATADIR);
+}
+
+static void handle_mdep(database_handle_t *db, const char *type)
+{
+	const char *modname = db_sread_word(db);
+
+	module_load(modname);
+}
+
+static double elapsed(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/* does the work of one job; may run in any thread */
+static bool rehash_job(rehash_job_t *job)
+{
+	const char *cstr;
+
+	if (!verify_mode)
+	{
+		cstr = target->wrap(job->mu->pass, job->salt, job->result, sizeof job->result);
+		return cstr != NULL;
+	}
+
+	if (!(job->mu->flags & MU_CRYPTPASS))
+	{
+		if (strcmp(job->mu->pass, job->password))
+			return false;
+		job->matched = target;
+	}
+	else
+	{
+		job->matched = crypt_verify_password_r(job->password, job->mu->pass, job->result, sizeof job->result, &job->skipped);
+		job->result[0] = '\0';
+
+		if (job->matched == NULL)
+			return true;
+
+		if (job->matched == target && (target->needs_param_upgrade == NULL || !target->needs_param_upgrade(job->mu->pass)))
+			return true;
+	}
+
+	if (target->crypt_r(job->password, job->salt, job->result, sizeof job->result) == NULL)
+		job->result[0] = '\0';
+
+	return true;
+}
+
+static void *rehash_worker(void *arg)
+{
+	rehash_worker_t *w = arg;
+	struct timeval start;
+	unsigned int i;
+
+	gettimeofday(&start, NULL);
+
+	while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < njobs)
+		if (rehash_job(&jobs[i]))
+			w->hashes++;
+
+	w->secs = elapsed(&start);
+
+	return NULL;
+}
+
+static bool read_credentials(const char *filename)
+{
+	char line[BUFSIZE * 2], *p;
+	unsigned int lineno = 0, size = 0;
+	FILE *f;
+
+	if ((f = fopen(filename, "r")) == NULL)
+	{
+		perror(filename);
+		return false;
+	}
+
+	while (fgets(line, sizeof line, f) != NULL)
+	{
+		lineno++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (*line == '\0' || *line == '#')
+			continue;
+
+		if ((p = strchr(line, ' ')) == NULL)
+		{
+			fprintf(stderr, "%s:%u: expected \"account password\"\n", filename, lineno);
+			continue;
+		}
+		*p++ = '\0';
+
+		if (njobs == size)
+		{
+			size = size ? size * 2 : 1024;
+			jobs = srealloc(jobs, size * sizeof(rehash_job_t));
+		}
+
+		memset(&jobs[njobs], 0, sizeof(rehash_job_t));
+		jobs[njobs].account = sstrdup(line);
+		jobs[njobs].password = sstrdup(p);
+		njobs++;
+
+		explicit_bzero(line, sizeof line);
+	}
+
+	fclose(f);
+
+	return true;
+}
+
+/* finds the accounts of the credentials, dropping unknown ones */
+static unsigned int resolve_credentials(void)
+{
+	unsigned int i, n, unknown = 0;
+
+	for (i = n = 0; i < njobs; i++)
+	{
+		if ((jobs[i].mu = myuser_find(jobs[i].account)) == NULL)
+		{
+			printf("%s: no such account\n", jobs[i].account);
+			unknown++;
+			free(jobs[i].account);
+			free(jobs[i].password);
+			continue;
+		}
+
+		jobs[n++] = jobs[i];
+	}
+
+	njobs = n;
+	return unknown;
+}
+
+/* collects the accounts with a hash the default scheme can wrap */
+static void collect_wrappable(void)
+{
+	myentity_iteration_state_t state;
+	myentity_t *mt;
+	unsigned int size = 0;
+
+	MYENTITY_FOREACH_T(mt, &state, ENT_USER)
+	{
+		myuser_t *mu = user(mt);
+
+		if (!(mu->flags & MU_CRYPTPASS))
+			continue;
+
+		if (njobs == size)
+		{
+			size = size ? size * 2 : 1024;
+			jobs = srealloc(jobs, size * sizeof(rehash_job_t));
+		}
+
+		memset(&jobs[njobs], 0, sizeof(rehash_job_t));
+		jobs[njobs].mu = mu;
+		njobs++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char *filename = "services.db";
+	const char *credentials = NULL;
+	const char *modules[16];
+	unsigned int nmodules = 0, nthreads = 0, hashes = 0, i;
+	unsigned int unknown = 0, matched = 0, rehashed = 0, bad = 0;
+	rehash_worker_t *workers;
+	struct timeval start;
+	bool save = true;
+	double secs, busy = 0;
+	module_t *m;
+	int c;
+
+	if (argc < 2)
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!strcmp(argv[1], "--verify") && argc > 2)
+	{
+		verify_mode = true;
+		credentials = argv[2];
+		c = 3;
+	}
+	else if (!strcmp(argv[1], "--wrap"))
+		c = 2;
+	else
+	{
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (; c < argc; c++)
+	{
+		if (!strcmp(argv[c], "-j") && c + 1 < argc)
+			nthreads = atoi(argv[++c]);
+		else if (!strcmp(argv[c], "-m") && c + 1 < argc && nmodules < sizeof modules / sizeof modules[0])
+			modules[nmodules++] = argv[++c];
+		else if (!strcmp(argv[c], "-n"))
+			save = false;
+		else if (argv[c][0] != '-' && c + 1 == argc)
+			filename = argv[c];
+		else
+		{
+			print_usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (nthreads == 0)
+	{
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+		nthreads = n > 0 ? n : 1;
+	}
+
+	/* read the credentials before atheme_bootstrap() changes directory */
+	if (verify_mode && !read_credentials(credentials))
+		return EXIT_FAILURE;
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/dbrehash.log");
+	atheme_setup();
+
+	runflags = RF_LIVE;
+	datadir = DATADIR;
+	strict_mode = false;
+	offline_mode = true;
+
+	/* the first crypto module loaded is the default scheme */
+	if (module_load("crypto/pbkdf2v2") == NULL)
+	{
+		slog(LG_ERROR, "dbrehash: cannot load crypto/pbkdf2v2");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < nmodules; i++)
+		if (module_load(modules[i]) == NULL)
+		{
+			slog(LG_ERROR, "dbrehash: cannot load %s", modules[i]);
+			return EXIT_FAILURE;
+		}
+
+	target = crypt_get_default_provider();
+	if (verify_mode ? target->crypt_r == NULL : target->wrap == NULL)
+	{
+		slog(LG_ERROR, "dbrehash: crypt scheme %s cannot be used from threads", target->id);
+		return EXIT_FAILURE;
+	}
+
+	m = module_load("backend/opensex");
+	if (m == NULL)
+	{
+		slog(LG_ERROR, "dbrehash: cannot load backend/opensex");
+		return EXIT_FAILURE;
+	}
+
+	db_unregister_type_handler("MDEP");
+	db_register_type_handler("MDEP", handle_mdep);
+
+	slog(LG_INFO, "dbrehash: loading %s", filename);
+
+	runflags &= ~RF_LIVE;
+	db_load(filename);
+	runflags |= RF_LIVE;
+
+	if (verify_mode)
+		unknown = resolve_credentials();
+	else
+		collect_wrappable();
+
+	/* salts come from the random number generator, which is not for threads */
+	for (i = 0; i < njobs; i++)
+		mowgli_strlcpy(jobs[i].salt, target->salt(), sizeof jobs[i].salt);
+
+	slog(LG_INFO, "dbrehash: %u accounts to check with %u threads", njobs, nthreads);
+
+	workers = scalloc(nthreads, sizeof(rehash_worker_t));
+	gettimeofday(&start, NULL);
+
+#ifdef HAVE_PTHREAD
+	{
+		pthread_t *threads = scalloc(nthreads, sizeof(pthread_t));
+
+		for (i = 0; i < nthreads; i++)
+			if (pthread_create(&threads[i], NULL, rehash_worker, &workers[i]) != 0)
+			{
+				slog(LG_ERROR, "dbrehash: cannot start thread %u, using %u", i + 1, i);
+				break;
+			}
+
+		nthreads = i;
+		for (i = 0; i < nthreads; i++)
+			pthread_join(threads[i], NULL);
+
+		if (nthreads == 0)
+		{
+			rehash_worker(&workers[0]);
+			nthreads = 1;
+		}
+
+		free(threads);
+	}
+#else
+	nthreads = 1;
+	rehash_worker(&workers[0]);
+#endif
+
+	secs = elapsed(&start);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		hashes += workers[i].hashes;
+		busy += workers[i].secs;
+		printf("thread %2u: %8u hashes in %7.3f s, %10.1f hashes/s\n", i + 1, workers[i].hashes, workers[i].secs,
+				workers[i].secs > 0 ? workers[i].hashes / workers[i].secs : 0.0);
+	}
+
+	printf("%u hashes in %.3f s with %u threads: %.1f hashes/s, %.1f hashes/s per core\n", hashes, secs, nthreads,
+			secs > 0 ? hashes / secs : 0.0, busy > 0 ? hashes / busy : 0.0);
+
+	/* schemes which cannot be used from threads are tried here */
+	for (i = 0; i < njobs; i++)
+	{
+		rehash_job_t *job = &jobs[i];
+
+		if (!verify_mode)
+		{
+			if (job->result[0] != '\0')
+			{
+				mowgli_strlcpy(job->mu->pass, job->result, PASSLEN);
+				rehashed++;
+			}
+			continue;
+		}
+
+		if (job->matched == NULL && job->skipped)
+		{
+			job->matched = crypt_verify_password(job->password, job->mu->pass);
+			if (job->matched != NULL)
+				target->crypt_r(job->password, job->salt, job->result, sizeof job->result);
+		}
+
+		if (job->matched == NULL)
+		{
+			printf("%s: bad password\n", job->account);
+			bad++;
+		}
+		else
+		{
+			matched++;
+			if (job->result[0] != '\0')
+			{
+				job->mu->flags |= MU_CRYPTPASS;
+				mowgli_strlcpy(job->mu->pass, job->result, PASSLEN);
+				rehashed++;
+			}
+		}
+
+		explicit_bzero(job->password, strlen(job->password));
+	}
+
+	if (verify_mode)
+		printf("%u matched, %u bad, %u unknown; %u rehashed\n", matched, bad, unknown, rehashed);
+	else
+		printf("%u of %u crypted passwords wrapped in %s\n", rehashed, njobs, target->id);
+
+	if (save && rehashed > 0)
+	{
+		slog(LG_INFO, "dbrehash: writing %s", filename);
+		db_save(filename, DB_SAVE_BLOCKING);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
@@ -46,6 +46,8 @@ int main(int argc, char *argv[])
 	printf("\n* * *\n\n");
 
 	printf("sizeof object_t: %zu B\n", sizeof(object_t));
+	printf("sizeof metadata_t: %zu B\n", sizeof(metadata_t));
+	printf("inline metadata: up to %u entries, %zu B\n", METADATA_INLINE_MAX, METADATA_INLINE_MAX * sizeof(metadata_t *));
 
 	printf("\n* * *\n\n");
 
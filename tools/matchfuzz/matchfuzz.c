@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Differential fuzzer for compiled masks.
+ */
+/*
+ * make matchfuzz
+ * ./matchfuzz [iterations] [seed]
+ *
+ * Builds random masks and names from a small alphabet that exercises case
+ * folding and every wildcard, compiles each mask with match_compile() and
+ * checks that match_pattern() agrees with match() under both casemappings.
+ * Long masks and names are mixed in so the iteration limit of match() is
+ * hit as well.
+ */
+
+#include "atheme.h"
+
+static const char alphabet[] = "aAbB[{]}\\|~^1.!@*?&#%";
+
+static char *random_mask(char *buf, size_t maxlen, bool wild)
+{
+	size_t len, i, nchars;
+
+	len = rand() % (rand() % 8 == 0 ? maxlen : 12);
+	nchars = wild ? sizeof alphabet - 1 : sizeof alphabet - 6;
+
+	for (i = 0; i < len; i++)
+		buf[i] = alphabet[rand() % nchars];
+	buf[len] = '\0';
+
+	return buf;
+}
+
+int main(int argc, char *argv[])
+{
+	char mask[BUFSIZE], name[BUFSIZE];
+	unsigned long iterations, i, failures = 0, matches = 0;
+	match_pattern_t *mp;
+	int j, mapping, expected, got;
+
+	iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	srand(argc > 2 ? atoi(argv[2]) : time(NULL));
+
+	for (i = 0; i < iterations; i++)
+	{
+		mapping = i % 2 ? MATCH_ASCII : MATCH_RFC1459;
+		set_match_mapping(mapping);
+
+		random_mask(mask, 300, true);
+		mp = match_compile(mask);
+
+		for (j = 0; j < 8; j++)
+		{
+			random_mask(name, 400, false);
+
+			/* a name built from the mask matches far more often */
+			if (j % 2 && strlen(mask) < sizeof name)
+			{
+				char *p;
+
+				mowgli_strlcpy(name, mask, sizeof name);
+				for (p = name; *p != '\0'; p++)
+					if (strchr("*?&#%", *p))
+						*p = alphabet[rand() % (sizeof alphabet - 6)];
+			}
+
+			/* and the mapping may change after compiling */
+			if (j == 4)
+				set_match_mapping(!mapping);
+
+			expected = match(mask, name);
+			got = match_pattern(mp, name);
+
+			if (expected == 0)
+				matches++;
+
+			if (expected != got)
+			{
+				printf("MISMATCH (%s): match(\"%s\", \"%s\") = %d, compiled = %d\n",
+						match_mapping == MATCH_ASCII ? "ascii" : "rfc1459",
+						mask, name, expected, got);
+				failures++;
+			}
+		}
+
+		match_pattern_free(mp);
+	}
+
+	printf("%lu masks, %lu comparisons, %lu matches, %lu mismatches\n",
+			iterations, iterations * 8, matches, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */
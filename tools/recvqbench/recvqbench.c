@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2026 Atheme Development Group
+ * Rights to this code are as documented in doc/LICENSE.
+ *
+ * Microbenchmark for splitting and tokenizing uplink lines.
+ */
+/*
+ * make createburst recvqbench
+ * ./createburst 500000 >burst.txt
+ * ./recvqbench burst.txt 5
+ *
+ * Feeds the burst through a socket into the recvq, once copying each line
+ * out with recvq_getline() and once reading it in place with
+ * recvq_getline_inplace(), and tokenizes every line the way the rfc1459
+ * transport does.
+ */
+
+#include "atheme.h"
+#include "libathemecore.h"
+#include "datastream.h"
+#include "pmodule.h"
+
+#include <sys/ioctl.h>
+
+static unsigned int lines;
+
+static void tokenize_line(char *line)
+{
+	char *parv[MAXPARC + 1];
+	char *message;
+
+	if (*line == ':' && (line = strchr(line, ' ')) != NULL)
+		line++;
+	if (line == NULL || (message = strchr(line, ' ')) == NULL)
+		return;
+
+	*message++ = '\0';
+
+	if (*message == ':')
+		parv[0] = message + 1;
+	else
+		tokenize(message, parv);
+}
+
+static void copy_handler(connection_t *cptr)
+{
+	char parsebuf[BUFSIZE + 1];
+	int count;
+
+	if ((count = recvq_getline(cptr, parsebuf, sizeof parsebuf - 1)) <= 0)
+		return;
+
+	if (parsebuf[count - 1] == '\n')
+		count--;
+	if (count > 0 && parsebuf[count - 1] == '\r')
+		count--;
+	parsebuf[count] = '\0';
+
+	tokenize_line(parsebuf);
+	lines++;
+}
+
+static void inplace_handler(connection_t *cptr)
+{
+	char *line;
+	int count;
+
+	if ((line = recvq_getline_inplace(cptr, BUFSIZE, &count)) == NULL)
+		return;
+
+	tokenize_line(line);
+	lines++;
+}
+
+static double run(const char *mode, const char *data, size_t len, unsigned int rounds,
+		unsigned int flags, void (*handler)(connection_t *))
+{
+	struct timeval start, end;
+	connection_t *cptr;
+	unsigned int i;
+	double secs;
+	int sv[2], pending;
+	size_t off;
+	ssize_t n;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+	{
+		perror("socketpair");
+		exit(EXIT_FAILURE);
+	}
+
+	fcntl(sv[1], F_SETFL, O_NONBLOCK);
+
+	cptr = connection_add(mode, sv[0], flags, recvq_put, NULL);
+	cptr->recvq_handler = handler;
+
+	lines = 0;
+	gettimeofday(&start, NULL);
+
+	for (i = 0; i < rounds; i++)
+	{
+		for (off = 0; off < len; off += n)
+		{
+			if ((n = write(sv[1], data + off, len - off)) < 0)
+			{
+				if (errno != EAGAIN)
+				{
+					perror("write");
+					exit(EXIT_FAILURE);
+				}
+				n = 0;
+			}
+
+			while (ioctl(sv[0], FIONREAD, &pending) == 0 && pending > 0)
+				recvq_put(cptr);
+		}
+	}
+
+	gettimeofday(&end, NULL);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+	printf("%-9s %10u lines in %7.3f s: %12.0f lines/s, %8.2f MB/s\n", mode, lines, secs,
+			lines / secs, (double) len * rounds / secs / 1048576.0);
+
+	close(sv[1]);
+	errno = 0;
+	connection_close(cptr);
+
+	return lines / secs;
+}
+
+int main(int argc, char *argv[])
+{
+	struct stat sb;
+	char *data;
+	unsigned int rounds;
+	double copy, inplace;
+	FILE *f;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s burstfile [rounds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	rounds = argc > 2 ? atoi(argv[2]) : 1;
+
+	/* read the burst before atheme_bootstrap() changes directory */
+	if ((f = fopen(argv[1], "rb")) == NULL || fstat(fileno(f), &sb) < 0)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	data = smalloc(sb.st_size);
+	if (fread(data, 1, sb.st_size, f) != (size_t) sb.st_size)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	fclose(f);
+
+	atheme_bootstrap();
+	atheme_init(argv[0], LOGDIR "/recvqbench.log");
+	atheme_setup();
+
+	runflags = RF_LIVE;
+
+	copy = run("copy", data, sb.st_size, rounds, 0, copy_handler);
+	inplace = run("in place", data, sb.st_size, rounds, CF_RECVQ_INPLACE, inplace_handler);
+
+	printf("in place is %.2fx the rate of copying\n", inplace / copy);
+
+	free(data);
+
+	return EXIT_SUCCESS;
+}
+
+/* vim:cinoptions=>s,e0,n0,f0,{0,}0,^0,=s,ps,t0,c3,+s,(2s,us,)20,*30,gs,hs
+ * vim:ts=8
+ * vim:sw=8
+ * vim:noexpandtab
+ */